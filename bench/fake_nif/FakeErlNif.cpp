@@ -0,0 +1,427 @@
+/**.......................................................................
+ * Implementation of the stand-in NIF API declared in erl_nif.h.
+ *
+ * Terms are 64-bit handles.  Atoms have the top bit set and index a
+ * process-wide intern table, so that atoms made in on_load (ATOM_OK
+ * etc.) remain valid in every environment.  All other terms index
+ * the store of the environment that made them, and are invalidated
+ * by enif_clear_env()/enif_free_env(), as in the BEAM.
+ */
+#include "erl_nif.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <limits.h>
+#include <string.h>
+
+#define ATOM_BIT ((ERL_NIF_TERM)1 << 63)
+
+enum TermType {
+    TERM_INTEGER,
+    TERM_DOUBLE,
+    TERM_NIL,
+    TERM_CONS,
+    TERM_TUPLE,
+    TERM_BINARY
+};
+
+struct Term {
+    TermType type_;
+
+    // Integers are stored as sign + magnitude, so that the full
+    // int64 and uint64 ranges can be represented
+
+    bool negative_;
+    uint64_t magnitude_;
+    double double_;
+
+    // Cons cells store {head, tail}; tuples their elements
+
+    std::vector<ERL_NIF_TERM> elements_;
+    std::vector<unsigned char> bytes_;
+
+    Term() : type_(TERM_NIL), negative_(false), magnitude_(0), double_(0.0) {};
+};
+
+struct enif_environment_t {
+    std::vector<Term> terms_;
+};
+
+static std::vector<std::string>        atomNames;
+static std::map<std::string, unsigned> atomIndex;
+
+//=======================================================================
+// Helpers
+//=======================================================================
+
+static bool isAtomTerm(ERL_NIF_TERM term)
+{
+    return (term & ATOM_BIT) != 0;
+}
+
+static Term* getTerm(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    if(isAtomTerm(term) || term >= env->terms_.size())
+        return 0;
+    return &env->terms_[term];
+}
+
+static ERL_NIF_TERM addTerm(ErlNifEnv* env, Term& term)
+{
+    env->terms_.push_back(term);
+    return env->terms_.size() - 1;
+}
+
+static Term* getInteger(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    Term* t = getTerm(env, term);
+    return (t && t->type_ == TERM_INTEGER) ? t : 0;
+}
+
+//=======================================================================
+// Environments
+//=======================================================================
+
+ErlNifEnv* enif_alloc_env(void)
+{
+    return new enif_environment_t();
+}
+
+void enif_free_env(ErlNifEnv* env)
+{
+    delete env;
+}
+
+void enif_clear_env(ErlNifEnv* env)
+{
+    env->terms_.clear();
+}
+
+//=======================================================================
+// Type checks
+//=======================================================================
+
+int enif_is_atom(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    return isAtomTerm(term) && (term & ~ATOM_BIT) < atomNames.size();
+}
+
+int enif_is_binary(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    Term* t = getTerm(env, term);
+    return t && t->type_ == TERM_BINARY;
+}
+
+int enif_is_list(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    Term* t = getTerm(env, term);
+    return t && (t->type_ == TERM_NIL || t->type_ == TERM_CONS);
+}
+
+int enif_is_number(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    Term* t = getTerm(env, term);
+    return t && (t->type_ == TERM_INTEGER || t->type_ == TERM_DOUBLE);
+}
+
+int enif_is_tuple(ErlNifEnv* env, ERL_NIF_TERM term)
+{
+    Term* t = getTerm(env, term);
+    return t && t->type_ == TERM_TUPLE;
+}
+
+//=======================================================================
+// Accessors
+//=======================================================================
+
+/**.......................................................................
+ * Like the real thing, returns the number of bytes written
+ * (including the terminator), or 0 if the atom doesn't fit in buf
+ */
+int enif_get_atom(ErlNifEnv* env, ERL_NIF_TERM term, char* buf, unsigned size, ErlNifCharEncoding encode)
+{
+    if(!enif_is_atom(env, term))
+        return 0;
+
+    const std::string& name = atomNames[term & ~ATOM_BIT];
+
+    if(name.size() + 1 > size)
+        return 0;
+
+    memcpy(buf, name.c_str(), name.size() + 1);
+    return name.size() + 1;
+}
+
+int enif_get_atom_length(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* len, ErlNifCharEncoding encode)
+{
+    if(!enif_is_atom(env, term))
+        return 0;
+
+    *len = atomNames[term & ~ATOM_BIT].size();
+    return 1;
+}
+
+int enif_get_double(ErlNifEnv* env, ERL_NIF_TERM term, double* dp)
+{
+    Term* t = getTerm(env, term);
+
+    if(!t || t->type_ != TERM_DOUBLE)
+        return 0;
+
+    *dp = t->double_;
+    return 1;
+}
+
+int enif_get_int(ErlNifEnv* env, ERL_NIF_TERM term, int* ip)
+{
+    Term* t = getInteger(env, term);
+
+    if(!t)
+        return 0;
+
+    if(t->negative_) {
+        if(t->magnitude_ > (uint64_t)INT_MAX + 1)
+            return 0;
+        *ip = (int)(-(int64_t)t->magnitude_);
+    } else {
+        if(t->magnitude_ > (uint64_t)INT_MAX)
+            return 0;
+        *ip = (int)t->magnitude_;
+    }
+
+    return 1;
+}
+
+int enif_get_int64(ErlNifEnv* env, ERL_NIF_TERM term, ErlNifSInt64* ip)
+{
+    Term* t = getInteger(env, term);
+
+    if(!t)
+        return 0;
+
+    if(t->negative_) {
+        if(t->magnitude_ > (uint64_t)INT64_MAX + 1)
+            return 0;
+        *ip = (ErlNifSInt64)(0 - t->magnitude_);
+    } else {
+        if(t->magnitude_ > (uint64_t)INT64_MAX)
+            return 0;
+        *ip = (ErlNifSInt64)t->magnitude_;
+    }
+
+    return 1;
+}
+
+int enif_get_uint(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* ip)
+{
+    Term* t = getInteger(env, term);
+
+    if(!t || (t->negative_ && t->magnitude_ != 0) || t->magnitude_ > UINT_MAX)
+        return 0;
+
+    *ip = (unsigned)t->magnitude_;
+    return 1;
+}
+
+int enif_get_uint64(ErlNifEnv* env, ERL_NIF_TERM term, ErlNifUInt64* ip)
+{
+    Term* t = getInteger(env, term);
+
+    if(!t || (t->negative_ && t->magnitude_ != 0))
+        return 0;
+
+    *ip = t->magnitude_;
+    return 1;
+}
+
+int enif_get_list_cell(ErlNifEnv* env, ERL_NIF_TERM term, ERL_NIF_TERM* head, ERL_NIF_TERM* tail)
+{
+    Term* t = getTerm(env, term);
+
+    if(!t || t->type_ != TERM_CONS)
+        return 0;
+
+    *head = t->elements_[0];
+    *tail = t->elements_[1];
+    return 1;
+}
+
+/**.......................................................................
+ * Returns false for improper lists, as the real thing does
+ */
+int enif_get_list_length(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* len)
+{
+    unsigned n = 0;
+    Term* t = getTerm(env, term);
+
+    while(t && t->type_ == TERM_CONS) {
+        n++;
+        t = getTerm(env, t->elements_[1]);
+    }
+
+    if(!t || t->type_ != TERM_NIL)
+        return 0;
+
+    *len = n;
+    return 1;
+}
+
+/**.......................................................................
+ * Returns the number of bytes written (including the terminator), 0
+ * if the list is not a latin1 string, or -size if the string was
+ * truncated to fit in buf
+ */
+int enif_get_string(ErlNifEnv* env, ERL_NIF_TERM list, char* buf, unsigned size, ErlNifCharEncoding encode)
+{
+    if(size == 0)
+        return 0;
+    
+    unsigned n = 0;
+    Term* t = getTerm(env, list);
+
+    while(t && t->type_ == TERM_CONS) {
+
+        Term* c = getInteger(env, t->elements_[0]);
+
+        if(!c || c->negative_ || c->magnitude_ > 255)
+            return 0;
+
+        if(n + 1 == size) {
+            buf[n] = '\0';
+            return -(int)size;
+        }
+
+        buf[n++] = (char)c->magnitude_;
+        t = getTerm(env, t->elements_[1]);
+    }
+
+    if(!t || t->type_ != TERM_NIL)
+        return 0;
+
+    buf[n] = '\0';
+    return n + 1;
+}
+
+int enif_get_tuple(ErlNifEnv* env, ERL_NIF_TERM tpl, int* arity, const ERL_NIF_TERM** array)
+{
+    Term* t = getTerm(env, tpl);
+
+    if(!t || t->type_ != TERM_TUPLE)
+        return 0;
+
+    *arity = t->elements_.size();
+    *array = t->elements_.empty() ? 0 : &t->elements_[0];
+    return 1;
+}
+
+int enif_inspect_binary(ErlNifEnv* env, ERL_NIF_TERM bin_term, ErlNifBinary* bin)
+{
+    Term* t = getTerm(env, bin_term);
+
+    if(!t || t->type_ != TERM_BINARY)
+        return 0;
+
+    // The BEAM never hands back a NULL data pointer, even for <<>>
+
+    static unsigned char empty = 0;
+    
+    bin->size = t->bytes_.size();
+    bin->data = t->bytes_.empty() ? &empty : &t->bytes_[0];
+    return 1;
+}
+
+//=======================================================================
+// Constructors
+//=======================================================================
+
+ERL_NIF_TERM enif_make_atom(ErlNifEnv* env, const char* name)
+{
+    std::map<std::string, unsigned>::iterator iter = atomIndex.find(name);
+
+    if(iter != atomIndex.end())
+        return ATOM_BIT | iter->second;
+
+    unsigned index = atomNames.size();
+    atomNames.push_back(name);
+    atomIndex[name] = index;
+
+    return ATOM_BIT | index;
+}
+
+ERL_NIF_TERM enif_make_string(ErlNifEnv* env, const char* string, ErlNifCharEncoding encode)
+{
+    size_t len = strlen(string);
+    std::vector<ERL_NIF_TERM> chars(len);
+
+    for(size_t i=0; i < len; i++)
+        chars[i] = enif_make_uint64(env, (unsigned char)string[i]);
+
+    return enif_make_list_from_array(env, chars.empty() ? 0 : &chars[0], len);
+}
+
+ERL_NIF_TERM enif_make_tuple2(ErlNifEnv* env, ERL_NIF_TERM e1, ERL_NIF_TERM e2)
+{
+    ERL_NIF_TERM arr[2] = {e1, e2};
+    return enif_make_tuple_from_array(env, arr, 2);
+}
+
+ERL_NIF_TERM enif_make_tuple_from_array(ErlNifEnv* env, const ERL_NIF_TERM arr[], unsigned cnt)
+{
+    Term t;
+    t.type_ = TERM_TUPLE;
+    t.elements_.assign(arr, arr + cnt);
+    return addTerm(env, t);
+}
+
+ERL_NIF_TERM enif_make_list_from_array(ErlNifEnv* env, const ERL_NIF_TERM arr[], unsigned cnt)
+{
+    Term nil;
+    nil.type_ = TERM_NIL;
+    ERL_NIF_TERM list = addTerm(env, nil);
+
+    for(unsigned i=cnt; i > 0; i--) {
+        Term cons;
+        cons.type_ = TERM_CONS;
+        cons.elements_.push_back(arr[i-1]);
+        cons.elements_.push_back(list);
+        list = addTerm(env, cons);
+    }
+
+    return list;
+}
+
+ERL_NIF_TERM enif_make_int64(ErlNifEnv* env, ErlNifSInt64 i)
+{
+    Term t;
+    t.type_      = TERM_INTEGER;
+    t.negative_  = (i < 0);
+    t.magnitude_ = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+    return addTerm(env, t);
+}
+
+ERL_NIF_TERM enif_make_uint64(ErlNifEnv* env, ErlNifUInt64 i)
+{
+    Term t;
+    t.type_      = TERM_INTEGER;
+    t.negative_  = false;
+    t.magnitude_ = i;
+    return addTerm(env, t);
+}
+
+ERL_NIF_TERM enif_make_double(ErlNifEnv* env, double d)
+{
+    Term t;
+    t.type_   = TERM_DOUBLE;
+    t.double_ = d;
+    return addTerm(env, t);
+}
+
+ERL_NIF_TERM enif_make_binary_from_data(ErlNifEnv* env, const unsigned char* data, size_t size)
+{
+    Term t;
+    t.type_ = TERM_BINARY;
+    t.bytes_.assign(data, data + size);
+    return addTerm(env, t);
+}
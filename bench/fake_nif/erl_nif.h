@@ -0,0 +1,124 @@
+// $Id: $
+
+#ifndef BENCH_FAKE_ERL_NIF_H
+#define BENCH_FAKE_ERL_NIF_H
+
+/**
+ * @file erl_nif.h
+ * 
+ * Tagged: Mon Oct 19 16:20:11 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * A minimal local stand-in for the Erlang NIF API, sufficient to
+ * compile and run c_src/ErlUtil.cc and c_src/profiler_nif.cc outside
+ * of a running BEAM (see bench/nifbench.cpp).
+ *
+ * Only the enif_* functions used by c_src/, plus the constructors
+ * the harness needs to build terms, are provided.  Signatures and
+ * return conventions follow the real erl_nif.h; terms are handles
+ * into a store owned by the environment (atoms are interned
+ * process-wide, as in the BEAM).
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t ERL_NIF_TERM;
+typedef int64_t  ErlNifSInt64;
+typedef uint64_t ErlNifUInt64;
+
+typedef struct enif_environment_t ErlNifEnv;
+
+typedef enum {
+    ERL_NIF_LATIN1 = 1
+} ErlNifCharEncoding;
+
+typedef struct {
+    size_t size;
+    unsigned char* data;
+} ErlNifBinary;
+
+typedef struct {
+    const char* name;
+    unsigned arity;
+    ERL_NIF_TERM (*fptr)(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]);
+    unsigned flags;
+} ErlNifFunc;
+
+typedef struct {
+    const char* name;
+    int num_of_funcs;
+    ErlNifFunc* funcs;
+    int  (*load)(ErlNifEnv*, void** priv_data, ERL_NIF_TERM load_info);
+    int  (*reload)(ErlNifEnv*, void** priv_data, ERL_NIF_TERM load_info);
+    int  (*upgrade)(ErlNifEnv*, void** priv_data, void** old_priv_data, ERL_NIF_TERM load_info);
+    void (*unload)(ErlNifEnv*, void* priv_data);
+} ErlNifEntry;
+
+#define ERL_NIF_INIT(NAME, FUNCS, LOAD, RELOAD, UPGRADE, UNLOAD)        \
+    ErlNifEntry* nif_init(void) {                                       \
+        static ErlNifEntry entry = {#NAME, sizeof(FUNCS)/sizeof(*FUNCS), \
+                                    FUNCS, LOAD, RELOAD, UPGRADE, UNLOAD}; \
+        return &entry;                                                  \
+    }
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    ErlNifEntry* nif_init(void);
+
+    //------------------------------------------------------------
+    // Environments
+    //------------------------------------------------------------
+
+    ErlNifEnv* enif_alloc_env(void);
+    void enif_free_env(ErlNifEnv* env);
+    void enif_clear_env(ErlNifEnv* env);
+
+    //------------------------------------------------------------
+    // Type checks
+    //------------------------------------------------------------
+
+    int enif_is_atom(ErlNifEnv* env, ERL_NIF_TERM term);
+    int enif_is_binary(ErlNifEnv* env, ERL_NIF_TERM term);
+    int enif_is_list(ErlNifEnv* env, ERL_NIF_TERM term);
+    int enif_is_number(ErlNifEnv* env, ERL_NIF_TERM term);
+    int enif_is_tuple(ErlNifEnv* env, ERL_NIF_TERM term);
+
+    //------------------------------------------------------------
+    // Accessors
+    //------------------------------------------------------------
+
+    int enif_get_atom(ErlNifEnv* env, ERL_NIF_TERM term, char* buf, unsigned size, ErlNifCharEncoding encode);
+    int enif_get_atom_length(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* len, ErlNifCharEncoding encode);
+    int enif_get_double(ErlNifEnv* env, ERL_NIF_TERM term, double* dp);
+    int enif_get_int(ErlNifEnv* env, ERL_NIF_TERM term, int* ip);
+    int enif_get_int64(ErlNifEnv* env, ERL_NIF_TERM term, ErlNifSInt64* ip);
+    int enif_get_uint(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* ip);
+    int enif_get_uint64(ErlNifEnv* env, ERL_NIF_TERM term, ErlNifUInt64* ip);
+    int enif_get_list_cell(ErlNifEnv* env, ERL_NIF_TERM term, ERL_NIF_TERM* head, ERL_NIF_TERM* tail);
+    int enif_get_list_length(ErlNifEnv* env, ERL_NIF_TERM term, unsigned* len);
+    int enif_get_string(ErlNifEnv* env, ERL_NIF_TERM list, char* buf, unsigned size, ErlNifCharEncoding encode);
+    int enif_get_tuple(ErlNifEnv* env, ERL_NIF_TERM tpl, int* arity, const ERL_NIF_TERM** array);
+    int enif_inspect_binary(ErlNifEnv* env, ERL_NIF_TERM bin_term, ErlNifBinary* bin);
+
+    //------------------------------------------------------------
+    // Constructors
+    //------------------------------------------------------------
+
+    ERL_NIF_TERM enif_make_atom(ErlNifEnv* env, const char* name);
+    ERL_NIF_TERM enif_make_string(ErlNifEnv* env, const char* string, ErlNifCharEncoding encode);
+    ERL_NIF_TERM enif_make_tuple2(ErlNifEnv* env, ERL_NIF_TERM e1, ERL_NIF_TERM e2);
+    ERL_NIF_TERM enif_make_tuple_from_array(ErlNifEnv* env, const ERL_NIF_TERM arr[], unsigned cnt);
+    ERL_NIF_TERM enif_make_list_from_array(ErlNifEnv* env, const ERL_NIF_TERM arr[], unsigned cnt);
+    ERL_NIF_TERM enif_make_int64(ErlNifEnv* env, ErlNifSInt64 i);
+    ERL_NIF_TERM enif_make_uint64(ErlNifEnv* env, ErlNifUInt64 i);
+    ERL_NIF_TERM enif_make_double(ErlNifEnv* env, double d);
+    ERL_NIF_TERM enif_make_binary_from_data(ErlNifEnv* env, const unsigned char* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // End #ifndef BENCH_FAKE_ERL_NIF_H
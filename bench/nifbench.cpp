@@ -0,0 +1,447 @@
+/**.......................................................................
+ * nifbench: exercises c_src/profiler_nif.cc and ErlUtil term decoding
+ * outside of the BEAM, against the stand-in enif_* functions in
+ * bench/fake_nif.
+ *
+ * Usage: nifbench [-n iterations] [-o file.json|-]
+ *        nifbench -f seed [-n iterations]
+ *
+ * In benchmark mode, each decode or dispatch path is timed
+ * separately and results are written as JSON (to
+ * bench_nif_output.json by default), in the same form as profbench:
+ *
+ *   {"name": "nif_startstop", "threads": 1, "ops": 200000,
+ *    "ns_per_op": 412.7, "mops_per_sec": 2.42}
+ *
+ * In fuzz mode (-f), random terms are fed to the ErlUtil decoders and
+ * to the NIF entry point.  Round-trippable terms (strings, atoms,
+ * binaries, integers) are checked for fidelity, and every NIF call is
+ * checked to return a well-formed term.  Commands that touch the
+ * filesystem (dump, prefix, shm_export, init_atomic_counters,
+ * add_ring_partition) are never generated.
+ */
+#include "erl_nif.h"
+
+#include "ErlUtil.h"
+#include "Profiler.h"
+#include "exceptionutils.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace nifutil;
+
+static int64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ErlNifEntry* entry = 0;
+static ErlNifEnv*   env   = 0;
+
+/**.......................................................................
+ * Call the profile/1 or profile/2 NIF through the function table, as
+ * the BEAM would
+ */
+static ERL_NIF_TERM callProfile(int argc, const ERL_NIF_TERM argv[])
+{
+    for(int i=0; i < entry->num_of_funcs; i++) {
+        if(entry->funcs[i].arity == (unsigned)argc)
+            return entry->funcs[i].fptr(env, argc, argv);
+    }
+
+    ThrowRuntimeError("No profile/" << argc << " in the NIF table");
+    return 0;
+}
+
+//=======================================================================
+// Benchmarks
+//=======================================================================
+
+struct Result {
+    std::string name_;
+    uint64_t ops_;
+    double nsPerOp_;
+};
+
+// Terms used by the benchmarks, rebuilt after every env clear
+
+struct BenchTerms {
+    ERL_NIF_TERM startTuple_;
+    ERL_NIF_TERM stopTuple_;
+    ERL_NIF_TERM startTuplePerThread_;
+    ERL_NIF_TERM stopTuplePerThread_;
+    ERL_NIF_TERM unknownTuple_;
+    ERL_NIF_TERM labelAtom_;
+    ERL_NIF_TERM labelString_;
+    ERL_NIF_TERM labelBinary_;
+    ERL_NIF_TERM atomTrue_;
+};
+
+static void makeBenchTerms(BenchTerms& t)
+{
+    const char* label = "leveldb_get_internal";
+    
+    t.labelAtom_   = enif_make_atom(env, label);
+    t.labelString_ = enif_make_string(env, label, ERL_NIF_LATIN1);
+    t.labelBinary_ = enif_make_binary_from_data(env, (const unsigned char*)label, strlen(label));
+    t.atomTrue_    = enif_make_atom(env, "true");
+
+    ERL_NIF_TERM start[3] = {enif_make_atom(env, "start"), t.labelAtom_, t.atomTrue_};
+    ERL_NIF_TERM stop[3]  = {enif_make_atom(env, "stop"),  t.labelAtom_, t.atomTrue_};
+    
+    t.startTuple_          = enif_make_tuple_from_array(env, start, 2);
+    t.stopTuple_           = enif_make_tuple_from_array(env, stop,  2);
+    t.startTuplePerThread_ = enif_make_tuple_from_array(env, start, 3);
+    t.stopTuplePerThread_  = enif_make_tuple_from_array(env, stop,  3);
+    t.unknownTuple_        = enif_make_tuple2(env, enif_make_atom(env, "unknown"), t.labelAtom_);
+}
+
+/**.......................................................................
+ * Time a single decode or dispatch path.  The env is cleared every
+ * 1024 iterations, since the NIF allocates a term per call
+ */
+#define BENCH(NAME, ITER, BODY)                                         \
+    {                                                                   \
+        BenchTerms t;                                                   \
+        enif_clear_env(env);                                            \
+        makeBenchTerms(t);                                              \
+        int64_t start = nowNs();                                        \
+        for(uint64_t i=0; i < ITER; i++) {                              \
+            BODY;                                                       \
+            if((i & 1023) == 1023) {                                    \
+                enif_clear_env(env);                                    \
+                makeBenchTerms(t);                                      \
+            }                                                           \
+        }                                                               \
+        Result r;                                                       \
+        r.name_    = NAME;                                              \
+        r.ops_     = ITER;                                              \
+        r.nsPerOp_ = (double)(nowNs() - start) / ITER;                  \
+        cerr << r.name_ << " ns/op=" << r.nsPerOp_ << endl;             \
+        results.push_back(r);                                           \
+    }
+
+static void runBenchmarks(std::vector<Result>& results, uint64_t iter)
+{
+    size_t sink = 0;
+
+    BENCH("decode_tuple_cells",    iter, sink += ErlUtil::getTupleCells(env, t.startTuplePerThread_).size());
+    BENCH("format_atom",           iter, sink += ErlUtil::formatTerm(env, t.labelAtom_).size());
+    BENCH("get_as_string_atom",    iter, sink += ErlUtil::getAsString(env, t.labelAtom_).size());
+    BENCH("get_as_string_list",    iter, sink += ErlUtil::getAsString(env, t.labelString_).size());
+    BENCH("get_as_string_binary",  iter, sink += ErlUtil::getAsString(env, t.labelBinary_).size());
+    BENCH("get_bool",              iter, sink += ErlUtil::getBool(env, t.atomTrue_));
+
+    // The full NIF path: table lookup, decode and dispatch
+
+    BENCH("nif_unknown_command",   iter, callProfile(1, &t.unknownTuple_));
+    BENCH("nif_startstop_global",  iter,
+          callProfile(1, &t.startTuple_); callProfile(1, &t.stopTuple_));
+    BENCH("nif_startstop_perthread", iter,
+          callProfile(1, &t.startTuplePerThread_); callProfile(1, &t.stopTuplePerThread_));
+
+    // The same start/stop pair called directly, for comparison
+
+    {
+        std::string startCmd("start"), stopCmd("stop"), label("leveldb_get_internal");
+        BENCH("direct_startstop_perthread", iter,
+              profiler::Profiler::profile(startCmd, label, true, false);
+              profiler::Profiler::profile(stopCmd,  label, true, false));
+    }
+
+    if(sink == 0)
+        cerr << "";
+}
+
+static void writeJson(std::ostream& os, std::vector<Result>& results)
+{
+    os << "{\"benchmarks\": [" << std::endl;
+    for(unsigned i=0; i < results.size(); i++) {
+        Result& r = results[i];
+        os << "  {\"name\": \"" << r.name_ << "\", \"threads\": 1"
+           << ", \"ops\": " << r.ops_ << ", \"ns_per_op\": " << r.nsPerOp_
+           << ", \"mops_per_sec\": " << (r.nsPerOp_ > 0 ? 1e3 / r.nsPerOp_ : 0) << "}"
+           << (i+1 < results.size() ? "," : "") << std::endl;
+    }
+    os << "]}" << std::endl;
+}
+
+//=======================================================================
+// Fuzzing
+//=======================================================================
+
+static const char* fuzzAtoms[] = {
+    "start", "stop", "noop", "cputime", "perfcounters", "debug",
+    "inc_atomic_counter", "true", "false", "ok", "", "x",
+    "a_rather_long_atom_name_that_is_still_a_valid_label"
+};
+
+#define N_FUZZ_ATOMS (sizeof(fuzzAtoms)/sizeof(*fuzzAtoms))
+
+static unsigned randInt(unsigned n)
+{
+    return n == 0 ? 0 : (unsigned)(rand() % n);
+}
+
+static uint64_t randUint64()
+{
+    uint64_t val = 0;
+    for(unsigned i=0; i < 4; i++)
+        val = (val << 16) | (rand() & 0xffff);
+
+    // Bias towards small values and type boundaries
+    
+    switch (randInt(4)) {
+    case 0:
+        return val & 0xff;
+    case 1:
+        return val & 0xffffffff;
+    case 2:
+        return ((uint64_t)1 << randInt(64)) + randInt(3) - 1;
+    default:
+        return val;
+    }
+}
+
+static std::string randBytes(bool printable)
+{
+    std::string str;
+    unsigned len = randInt(4) == 0 ? randInt(300) : randInt(20);
+    for(unsigned i=0; i < len; i++)
+        str += printable ? (char)(' ' + randInt(95)) : (char)randInt(256);
+    return str;
+}
+
+static ERL_NIF_TERM randTerm(unsigned depth)
+{
+    unsigned type = randInt(depth > 0 ? 9 : 6);
+    
+    switch (type) {
+    case 0:
+        return enif_make_atom(env, fuzzAtoms[randInt(N_FUZZ_ATOMS)]);
+    case 1:
+        return randInt(2) ? enif_make_uint64(env, randUint64()) : enif_make_int64(env, (int64_t)(0 - randUint64()));
+    case 2:
+        return enif_make_double(env, (double)randUint64() / (randInt(1000) + 1) * (randInt(2) ? 1 : -1));
+    case 3:
+        return enif_make_string(env, randBytes(true).c_str(), ERL_NIF_LATIN1);
+    case 4:
+        {
+            std::string bytes = randBytes(randInt(2));
+            return enif_make_binary_from_data(env, (const unsigned char*)bytes.c_str(), bytes.size());
+        }
+    case 5:
+        return enif_make_list_from_array(env, 0, 0);
+    default:
+        {
+            std::vector<ERL_NIF_TERM> elems(randInt(5));
+            for(unsigned i=0; i < elems.size(); i++)
+                elems[i] = randTerm(depth-1);
+            ERL_NIF_TERM* arr = elems.empty() ? 0 : &elems[0];
+            return type == 6 ? enif_make_list_from_array(env, arr, elems.size()) :
+                enif_make_tuple_from_array(env, arr, elems.size());
+        }
+    }
+}
+
+/**.......................................................................
+ * A command tuple: a known atom followed by 0-3 random arguments
+ */
+static ERL_NIF_TERM randCommand()
+{
+    std::vector<ERL_NIF_TERM> elems(randInt(4) + 1);
+    elems[0] = enif_make_atom(env, fuzzAtoms[randInt(N_FUZZ_ATOMS)]);
+    for(unsigned i=1; i < elems.size(); i++)
+        elems[i] = randInt(2) ? enif_make_atom(env, fuzzAtoms[randInt(N_FUZZ_ATOMS)]) : randTerm(2);
+    return enif_make_tuple_from_array(env, &elems[0], elems.size());
+}
+
+/**.......................................................................
+ * Return true if term is a valid NIF return value: a uint64, an atom,
+ * or {error, "message"}
+ */
+static bool isWellFormedReturn(ERL_NIF_TERM term)
+{
+    ErlNifUInt64 val;
+    if(enif_is_atom(env, term) || enif_get_uint64(env, term, &val))
+        return true;
+
+    int arity;
+    const ERL_NIF_TERM* array;
+    if(!enif_get_tuple(env, term, &arity, &array) || arity != 2)
+        return false;
+
+    return ErlUtil::isAtom(env, array[0]) && ErlUtil::getAtom(env, array[0]) == "error" &&
+        ErlUtil::isString(env, array[1]);
+}
+
+#define FUZZ_FAIL(msg)                                                  \
+    {                                                                   \
+        cerr << "Fuzz failure (seed " << seed << ", iteration " << i << "): " \
+             << msg << endl;                                            \
+        return 1;                                                       \
+    }
+
+static int runFuzz(unsigned seed, uint64_t iter)
+{
+    srand(seed);
+    uint64_t nErr = 0;
+
+    for(uint64_t i=0; i < iter; i++) {
+
+        if((i & 255) == 0)
+            enif_clear_env(env);
+
+        //------------------------------------------------------------
+        // Round trips through the decoders
+        //------------------------------------------------------------
+
+        std::string str = randBytes(true);
+        ERL_NIF_TERM strTerm = enif_make_string(env, str.c_str(), ERL_NIF_LATIN1);
+        ERL_NIF_TERM binTerm = enif_make_binary_from_data(env, (const unsigned char*)str.c_str(), str.size());
+
+        if(ErlUtil::getAsString(env, strTerm) != str)
+            FUZZ_FAIL("string '" << str << "' did not round-trip");
+
+        if(ErlUtil::getAsString(env, binTerm) != str)
+            FUZZ_FAIL("binary '" << str << "' did not round-trip");
+
+        if(str.size() > 0 && str.size() < 256) {
+            ERL_NIF_TERM atomTerm = enif_make_atom(env, str.c_str());
+            if(ErlUtil::getAsString(env, atomTerm) != str)
+                FUZZ_FAIL("atom '" << str << "' did not round-trip");
+        }
+
+        int64_t ival = (int64_t)randUint64();
+        if(ErlUtil::getValAsInt64(env, enif_make_int64(env, ival)) != ival)
+            FUZZ_FAIL("integer " << ival << " did not round-trip");
+
+        //------------------------------------------------------------
+        // Arbitrary terms through the decoders: errors must surface
+        // as exceptions, never crashes
+        //------------------------------------------------------------
+
+        ERL_NIF_TERM term = randTerm(3);
+
+        try {
+            ErlUtil::formatTerm(env, term);
+            ErlUtil::getAsString(env, term);
+        } catch(std::runtime_error& err) {
+            nErr++;
+        }
+
+        try {
+            ErlUtil::getTupleCells(env, term);
+        } catch(std::runtime_error& err) {
+            nErr++;
+        }
+
+        //------------------------------------------------------------
+        // And through the NIF itself
+        //------------------------------------------------------------
+
+        ERL_NIF_TERM argv[2];
+        argv[0] = randInt(4) == 0 ? term : randCommand();
+        argv[1] = randInt(2) ? enif_make_atom(env, fuzzAtoms[randInt(N_FUZZ_ATOMS)]) : randTerm(1);
+
+        ERL_NIF_TERM ret = callProfile(randInt(2) + 1, argv);
+        
+        if(!isWellFormedReturn(ret))
+            FUZZ_FAIL("NIF returned a malformed term for " << ErlUtil::formatTerm(env, argv[0]));
+    }
+
+    cerr << "Fuzzed " << iter << " iterations (seed " << seed << ", "
+         << nErr << " decode errors raised)" << endl;
+    
+    return 0;
+}
+
+//=======================================================================
+// Main
+//=======================================================================
+
+static void usage()
+{
+    cerr << "Usage: nifbench [-n iterations] [-o file.json|-]" << endl
+         << "       nifbench -f seed [-n iterations]" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t iter = 200000;
+    std::string outFile("bench_nif_output.json");
+    bool fuzz = false;
+    unsigned seed = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:o:f:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iter = strtoull(optarg, 0, 10);
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        case 'f':
+            fuzz = true;
+            seed = strtoul(optarg, 0, 10);
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+
+    try {
+
+        //------------------------------------------------------------
+        // Load the NIF as the BEAM would, with no load options
+        //------------------------------------------------------------
+
+        entry = nif_init();
+        env   = enif_alloc_env();
+
+        void* priv = 0;
+        if(entry->load && entry->load(env, &priv, enif_make_list_from_array(env, 0, 0)) != 0)
+            ThrowRuntimeError("NIF load failed");
+
+        int ret = 0;
+        
+        if(fuzz) {
+            ret = runFuzz(seed, iter);
+        } else {
+            std::vector<Result> results;
+            runBenchmarks(results, iter);
+
+            if(outFile == "-") {
+                writeJson(std::cout, results);
+            } else {
+                std::ofstream os(outFile.c_str());
+                writeJson(os, results);
+            }
+        }
+
+        if(entry->unload)
+            entry->unload(env, priv);
+        enif_free_env(env);
+
+        return ret;
+        
+    } catch(std::runtime_error& err) {
+        cerr << err.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,333 @@
+/**.......................................................................
+ * profbench: microbenchmarks for the profiler's own hot paths, run
+ * without Erlang.
+ *
+ * Usage: profbench [-t maxThreads] [-n iterations] [-o file.json]
+ *
+ * Results go to bench_output.json by default ('-o -' for stdout,
+ * though note that the profiler itself also writes to stdout).
+ * Each benchmark is run with 1, 2, 4, ... maxThreads threads (where it
+ * makes sense), and the results are written as JSON, one entry per
+ * benchmark and thread count:
+ *
+ *   {"name": "startstop_global", "threads": 4, "ops": 4000000,
+ *    "ns_per_op": 251.3, "mops_per_sec": 3.98}
+ *
+ * ns_per_op is wall time divided by the number of operations
+ * completed by each thread, so perfect scaling keeps it constant.
+ */
+#include "BufferedAtomicCounter.h"
+#include "Profiler.h"
+#include "exceptionutils.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace profiler;
+
+#define N_LABELS 10000
+
+static int64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//=======================================================================
+// Benchmark bodies.  Each runs 'iter' operations on the calling
+// thread
+//=======================================================================
+
+struct BenchArgs {
+    unsigned threadIndex_;
+    uint64_t iter_;
+    pthread_barrier_t* barrier_;
+    int64_t startNs_;
+    int64_t endNs_;
+};
+
+typedef void (*BenchFn)(BenchArgs& args);
+
+static std::vector<std::string> labels;
+static BufferedAtomicCounter atomicCounter(100, 1000);
+static BufferedAtomicCounter atomicMax(100, 1000, BufferedAtomicCounter::KIND_MAX);
+
+static void startStopGlobal(BenchArgs& args)
+{
+    std::string label("bench_global");
+    for(uint64_t i=0; i < args.iter_; i++) {
+        Profiler::profile("start", label, false, true);
+        Profiler::profile("stop",  label, false, true);
+    }
+}
+
+static void startStopPerThread(BenchArgs& args)
+{
+    std::string label("bench_perthread");
+    for(uint64_t i=0; i < args.iter_; i++) {
+        Profiler::profile("start", label, true, true);
+        Profiler::profile("stop",  label, true, true);
+    }
+}
+
+static void labelLookup(BenchArgs& args)
+{
+    // Stride through the labels so successive lookups don't hit
+    // the same part of the map
+    
+    unsigned index = args.threadIndex_;
+    for(uint64_t i=0; i < args.iter_; i++) {
+        index = (index + 7919) % labels.size();
+        Profiler::profile("start", labels[index], true, true);
+        Profiler::profile("stop",  labels[index], true, true);
+    }
+}
+
+static void atomicIncrement(BenchArgs& args)
+{
+    uint64_t us = Profiler::getCurrentMicroSeconds();
+    for(uint64_t i=0; i < args.iter_; i++)
+        atomicCounter.increment(us + (i & 0xffff));
+}
+
+static void atomicAddMax(BenchArgs& args)
+{
+    uint64_t us = Profiler::getCurrentMicroSeconds();
+    for(uint64_t i=0; i < args.iter_; i++)
+        atomicMax.add(us + (i & 0xffff), i);
+}
+
+static void atomicIncrementProfiler(BenchArgs& args)
+{
+    std::string tag("bench");
+    for(uint64_t i=0; i < args.iter_; i++)
+        Profiler::incrementAtomicCounter(1, tag);
+}
+
+static void getTime(BenchArgs& args)
+{
+    int64_t sum = 0;
+    for(uint64_t i=0; i < args.iter_; i++)
+        sum += Profiler::getCurrentMicroSeconds();
+    if(sum == 0)
+        cerr << "";
+}
+
+//=======================================================================
+// Driver
+//=======================================================================
+
+struct ThreadArgs {
+    BenchFn fn_;
+    BenchArgs args_;
+};
+
+static void* runThread(void* arg)
+{
+    ThreadArgs* threadArgs = (ThreadArgs*)arg;
+    pthread_barrier_wait(threadArgs->args_.barrier_);
+
+    // Each thread times itself, since on a loaded (or single-cpu)
+    // host the main thread may not run again until the workers are
+    // done
+    
+    threadArgs->args_.startNs_ = nowNs();
+    threadArgs->fn_(threadArgs->args_);
+    threadArgs->args_.endNs_ = nowNs();
+    
+    return 0;
+}
+
+struct Result {
+    std::string name_;
+    unsigned threads_;
+    uint64_t ops_;
+    double nsPerOp_;
+};
+
+/**.......................................................................
+ * Run fn on nThread threads, iter operations each, and return the
+ * wall time (from the first thread starting to the last finishing)
+ * per operation per thread
+ */
+static Result runBench(std::string name, BenchFn fn, unsigned nThread, uint64_t iter)
+{
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, 0, nThread + 1);
+
+    std::vector<pthread_t> threads(nThread);
+    std::vector<ThreadArgs> args(nThread);
+
+    for(unsigned i=0; i < nThread; i++) {
+        args[i].fn_                = fn;
+        args[i].args_.threadIndex_ = i;
+        args[i].args_.iter_        = iter;
+        args[i].args_.barrier_     = &barrier;
+        if(pthread_create(&threads[i], 0, &runThread, &args[i]) != 0)
+            ThrowRuntimeError("Unable to create benchmark thread");
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    for(unsigned i=0; i < nThread; i++)
+        pthread_join(threads[i], 0);
+
+    pthread_barrier_destroy(&barrier);
+
+    int64_t start = args[0].args_.startNs_;
+    int64_t end   = args[0].args_.endNs_;
+    for(unsigned i=1; i < nThread; i++) {
+        start = std::min(start, args[i].args_.startNs_);
+        end   = std::max(end,   args[i].args_.endNs_);
+    }
+    int64_t elapsed = end - start;
+
+    Result result;
+    result.name_    = name;
+    result.threads_ = nThread;
+    result.ops_     = iter * nThread;
+    result.nsPerOp_ = (double)elapsed / iter;
+
+    cerr << name << " threads=" << nThread << " ns/op=" << result.nsPerOp_ << endl;
+    
+    return result;
+}
+
+static Result runDump(unsigned nRep)
+{
+    std::ostringstream os;
+    os << "/tmp/profbench_" << getpid() << "_profile.txt";
+
+    int64_t start = nowNs();
+    for(unsigned i=0; i < nRep; i++)
+        Profiler::profile("dump", os.str(), false, true);
+    int64_t elapsed = nowNs() - start;
+
+    unlink(os.str().c_str());
+
+    Result result;
+    result.name_    = "dump_10k_labels";
+    result.threads_ = 1;
+    result.ops_     = nRep;
+    result.nsPerOp_ = (double)elapsed / nRep;
+
+    cerr << result.name_ << " ms/op=" << result.nsPerOp_ / 1e6 << endl;
+
+    return result;
+}
+
+static void writeJson(std::ostream& os, std::vector<Result>& results)
+{
+    os << "{\"benchmarks\": [" << std::endl;
+    for(unsigned i=0; i < results.size(); i++) {
+        Result& r = results[i];
+        os << "  {\"name\": \"" << r.name_ << "\", \"threads\": " << r.threads_
+           << ", \"ops\": " << r.ops_ << ", \"ns_per_op\": " << r.nsPerOp_
+           << ", \"mops_per_sec\": " << (r.nsPerOp_ > 0 ? 1e3 * r.threads_ / r.nsPerOp_ : 0) << "}"
+           << (i+1 < results.size() ? "," : "") << std::endl;
+    }
+    os << "]}" << std::endl;
+}
+
+static void usage()
+{
+    cerr << "Usage: profbench [-t maxThreads] [-n iterations] [-o file.json|-]" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t iter = 200000;
+    std::string outFile("bench_output.json");
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:n:o:")) != -1) {
+        switch (opt) {
+        case 't':
+            maxThreads = atoi(optarg);
+            break;
+        case 'n':
+            iter = strtoull(optarg, 0, 10);
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+
+    try {
+        std::vector<Result> results;
+        std::vector<unsigned> threadCounts;
+
+        for(unsigned n=1; n < maxThreads; n *= 2)
+            threadCounts.push_back(n);
+        threadCounts.push_back(maxThreads > 0 ? maxThreads : 1);
+
+        //------------------------------------------------------------
+        // Atomic counters need a partition and an initialized timer;
+        // the timer's output is discarded
+        //------------------------------------------------------------
+
+        std::map<std::string, std::string> tags;
+        tags["bench"] = "bench";
+        Profiler::addRingPartition(1, "./data/leveldb/0 bench");
+        Profiler::initializeAtomicCounters(tags, 100, 1000, "/dev/null");
+
+        results.push_back(runBench("clock", getTime, 1, iter));
+        
+        for(unsigned i=0; i < threadCounts.size(); i++) {
+            results.push_back(runBench("startstop_global",    startStopGlobal,         threadCounts[i], iter));
+            results.push_back(runBench("startstop_perthread", startStopPerThread,      threadCounts[i], iter));
+            results.push_back(runBench("atomic_increment",    atomicIncrement,         threadCounts[i], iter));
+            results.push_back(runBench("atomic_add_max",      atomicAddMax,            threadCounts[i], iter));
+            results.push_back(runBench("atomic_increment_profiler", atomicIncrementProfiler, threadCounts[i], iter));
+        }
+
+        //------------------------------------------------------------
+        // Label lookup and dump, with N_LABELS labels present
+        //------------------------------------------------------------
+
+        Profiler::limits(N_LABELS, 1024);
+
+        for(unsigned i=0; i < N_LABELS; i++) {
+            std::ostringstream os;
+            os << "label_" << i;
+            labels.push_back(os.str());
+        }
+
+        for(unsigned i=0; i < threadCounts.size(); i++)
+            results.push_back(runBench("label_lookup_10k", labelLookup, threadCounts[i], iter));
+
+        results.push_back(runDump(10));
+
+        if(outFile == "-") {
+            writeJson(std::cout, results);
+        } else {
+            std::ofstream os(outFile.c_str());
+            writeJson(os, results);
+        }
+        
+    } catch(std::runtime_error& err) {
+        cerr << err.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1439 @@
+/**.......................................................................
+ * proftest: functional tests of the profiler, run without Erlang.
+ *
+ * Usage: proftest [name ...]
+ *
+ * Each test runs in a child process of its own, since the profiler is
+ * a process-wide singleton, and ends with exit() so that the
+ * profiler's exit-time work (the final dump) is exercised too.  A
+ * test passes if its child exits with status 0.  Each child gets an
+ * empty scratch directory as its output prefix, removed afterwards.
+ * With names, only those tests are run.
+ */
+#include "AllocTracker.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
+#include "ShmLayout.h"
+#include "exceptionutils.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace profiler;
+
+//=======================================================================
+// Helpers
+//=======================================================================
+
+// The scratch directory of the running test
+
+static std::string testDir;
+
+#define CHECK(COND, MSG)                                                \
+    {                                                                   \
+        if(!(COND)) {                                                   \
+            cerr << "  check failed at line " << __LINE__ << ": " << #COND \
+                 << ": " << MSG << endl;                                \
+            _exit(1);                                                   \
+        }                                                               \
+    }
+
+typedef std::map<std::string, int64_t> Row;
+
+/**.......................................................................
+ * Read a CSV report into rows keyed by "label 0xthread"
+ */
+static std::map<std::string, Row> readCsv(std::string fileName)
+{
+    std::map<std::string, Row> rows;
+    std::ifstream in(fileName.c_str());
+    std::string line;
+    std::vector<std::string> header;
+
+    while(std::getline(in, line)) {
+
+        std::vector<std::string> cols;
+        std::string col;
+        bool quoted = false;
+
+        for(unsigned i=0; i < line.size(); i++) {
+            char c = line[i];
+            if(c == '"') {
+                if(quoted && i+1 < line.size() && line[i+1] == '"')
+                    col += line[++i];
+                else
+                    quoted = !quoted;
+            } else if(c == ',' && !quoted) {
+                cols.push_back(col);
+                col.clear();
+            } else {
+                col += c;
+            }
+        }
+        cols.push_back(col);
+
+        if(header.empty()) {
+            header = cols;
+            continue;
+        }
+
+        Row& row = rows[cols[0] + " " + cols[1]];
+        for(unsigned i=2; i < cols.size() && i < header.size(); i++)
+            row[header[i]] = strtoll(cols[i].c_str(), 0, 10);
+    }
+
+    return rows;
+}
+
+/**.......................................................................
+ * Dump a CSV report to the scratch directory and read it back
+ */
+static std::map<std::string, Row> dumpCsv(std::string name)
+{
+    std::string fileName = testDir + "/" + name + ".csv";
+    Profiler::reportFormat("csv");
+    Profiler::profile("dump", fileName, false, true);
+    return readCsv(fileName);
+}
+
+static std::vector<std::string> readLines(std::string fileName)
+{
+    std::vector<std::string> lines;
+    std::ifstream in(fileName.c_str());
+    std::string line;
+    while(std::getline(in, line))
+        lines.push_back(line);
+    return lines;
+}
+
+static std::vector<std::string> split(const std::string& line)
+{
+    std::vector<std::string> toks;
+    std::istringstream is(line);
+    std::string tok;
+    while(is >> tok)
+        toks.push_back(tok);
+    return toks;
+}
+
+/**.......................................................................
+ * Return the names of files in the scratch directory ending in suffix
+ */
+static std::vector<std::string> findFiles(std::string suffix)
+{
+    std::vector<std::string> names;
+    DIR* dir = opendir(testDir.c_str());
+    if(dir == 0)
+        return names;
+
+    struct dirent* entry = 0;
+    while((entry = readdir(dir)) != 0) {
+        std::string name(entry->d_name);
+        if(name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+            names.push_back(name);
+    }
+
+    closedir(dir);
+    return names;
+}
+
+static void busyUsec(int64_t usec)
+{
+    int64_t end = Profiler::getCurrentMicroSeconds() + usec;
+    while(Profiler::getCurrentMicroSeconds() < end)
+        ;
+}
+
+//=======================================================================
+// Tests
+//=======================================================================
+
+//-----------------------------------------------------------------------
+// CPU time: lock contention must not make off-cpu time negative
+//-----------------------------------------------------------------------
+
+static void* cpuTimeWorker(void* arg)
+{
+    std::string label("cpu.worker");
+    for(unsigned i=0; i < 2000; i++) {
+        Profiler::profile("start", label, true, true);
+        busyUsec(5);
+        Profiler::profile("stop", label, true, true);
+    }
+    return 0;
+}
+
+static void testCpuTime()
+{
+    Profiler::cpuTime(true);
+
+    pthread_t threads[8];
+    for(unsigned i=0; i < 8; i++)
+        pthread_create(&threads[i], 0, cpuTimeWorker, 0);
+    for(unsigned i=0; i < 8; i++)
+        pthread_join(threads[i], 0);
+
+    std::map<std::string, Row> rows = dumpCsv("cputime");
+
+    unsigned nRow = 0;
+    for(std::map<std::string, Row>::iterator iter=rows.begin(); iter != rows.end(); iter++) {
+        if(iter->first.find("cpu.worker") != 0)
+            continue;
+        nRow++;
+        CHECK(iter->second["usec"] > 0, iter->first);
+        CHECK(iter->second["cpuusec"] > 0, iter->first);
+        CHECK(iter->second["offcpuusec"] >= 0, iter->first << " offcpuusec = " << iter->second["offcpuusec"]);
+    }
+
+    CHECK(nRow == 8, "found " << nRow << " per-thread counters");
+}
+
+//-----------------------------------------------------------------------
+// Hardware counters: either unavailable, and then absent (or 0), or
+// counting.  Availability is decided once, whichever thread asks
+// first
+//-----------------------------------------------------------------------
+
+static void* perfWorker(void* arg)
+{
+    *(bool*)arg = PerfCounters::isAvailable();
+
+    std::string label("perf.worker");
+    volatile uint64_t sum = 0;
+
+    for(unsigned i=0; i < 100; i++) {
+        Profiler::profile("start", label, true, true);
+        for(unsigned j=0; j < 10000; j++)
+            sum += j;
+        Profiler::profile("stop", label, true, true);
+    }
+    return 0;
+}
+
+static void testPerfCounters()
+{
+    Profiler::perfCounters(true);
+
+    pthread_t threads[4];
+    bool available[4];
+    for(unsigned i=0; i < 4; i++)
+        pthread_create(&threads[i], 0, perfWorker, &available[i]);
+    for(unsigned i=0; i < 4; i++)
+        pthread_join(threads[i], 0);
+
+    for(unsigned i=1; i < 4; i++)
+        CHECK(available[i] == available[0], "threads disagree about availability");
+
+    std::map<std::string, Row> rows = dumpCsv("perf");
+
+    for(std::map<std::string, Row>::iterator iter=rows.begin(); iter != rows.end(); iter++) {
+        if(iter->first.find("perf.worker") != 0)
+            continue;
+        if(available[0]) {
+            CHECK(iter->second["cycles"] > 0, iter->first);
+            CHECK(iter->second["instructions"] > 0, iter->first);
+        } else {
+            CHECK(iter->second["cycles"] == 0, iter->first);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------
+// Multiplexing: the counts of a region are scaled by the enabled and
+// running times of that region alone, so a change in the ratio over
+// the thread's lifetime can't inflate (or wrap) a short region
+//-----------------------------------------------------------------------
+
+static PerfCounters::Sample perfSample(uint64_t value, uint64_t enabledNs, uint64_t runningNs)
+{
+    PerfCounters::Sample sample;
+    sample.valid_     = true;
+    sample.enabledNs_ = enabledNs;
+    sample.runningNs_ = runningNs;
+    for(unsigned i=0; i < PerfCounters::N_EVENT; i++)
+        sample.values_[i] = value;
+    return sample;
+}
+
+static void testPerfScaling()
+{
+    uint64_t deltas[PerfCounters::N_EVENT];
+
+    // A billion events before the region, which counted 1000 over
+    // half the time it was enabled
+
+    PerfCounters::Sample start = perfSample(1000000000, 1000000, 1000000);
+    PerfCounters::Sample stop  = perfSample(1000001000, 1000100, 1000050);
+    CHECK(PerfCounters::delta(start, stop, deltas), "valid samples rejected");
+    CHECK(deltas[PerfCounters::EVENT_CYCLES] == 2000, "scaled to " << deltas[PerfCounters::EVENT_CYCLES]);
+
+    // The ratio falling over the region must not make it negative
+
+    start = perfSample(1000000000, 1000000, 500000);
+    stop  = perfSample(1000001000, 1000100, 500100);
+    CHECK(PerfCounters::delta(start, stop, deltas), "valid samples rejected");
+    CHECK(deltas[PerfCounters::EVENT_INSTRUCTIONS] == 1000, "scaled to " << deltas[PerfCounters::EVENT_INSTRUCTIONS]);
+
+    // Not running at all in the region counts nothing
+
+    stop = perfSample(1000000000, 1000100, 500000);
+    CHECK(PerfCounters::delta(start, stop, deltas) && deltas[0] == 0, "unscheduled region counted " << deltas[0]);
+
+    stop.valid_ = false;
+    deltas[0] = 7;
+    CHECK(!PerfCounters::delta(start, stop, deltas) && deltas[0] == 7, "invalid sample accepted");
+}
+
+//-----------------------------------------------------------------------
+// Allocation tracking: posix_memalign() rejects invalid alignments,
+// as POSIX requires, and counts the allocations it makes
+//-----------------------------------------------------------------------
+
+static void testAllocTrack()
+{
+    Profiler::allocTrack(true);
+
+    size_t badAlignments[] = {0, 3, sizeof(void*) / 2, 3 * sizeof(void*), 1000};
+
+    for(unsigned i=0; i < sizeof(badAlignments)/sizeof(*badAlignments); i++) {
+        void* ptr = &ptr;
+        int ret = posix_memalign(&ptr, badAlignments[i], 64);
+        CHECK(ret == EINVAL, "alignment " << badAlignments[i] << " returned " << ret);
+        CHECK(ptr == &ptr, "alignment " << badAlignments[i] << " set the pointer");
+    }
+
+    std::string label("alloc.aligned");
+    void* ptrs[10];
+
+    Profiler::profile("start", label, true, true);
+    for(unsigned i=0; i < 10; i++) {
+        CHECK(posix_memalign(&ptrs[i], 256, 1000) == 0, "alignment 256 failed");
+        CHECK(((uintptr_t)ptrs[i] & 255) == 0, "misaligned pointer " << ptrs[i]);
+    }
+    Profiler::profile("stop", label, true, true);
+
+    for(unsigned i=0; i < 10; i++)
+        free(ptrs[i]);
+
+    // A realloc that fails frees nothing
+
+    std::string failLabel("alloc.realloc");
+    void* volatile block = malloc(64);
+
+    Profiler::profile("start", failLabel, true, true);
+    void* volatile huge = realloc(block, (size_t)-1 / 2);
+    Profiler::profile("stop", failLabel, true, true);
+
+    CHECK(huge == 0, "realloc of half the address space succeeded");
+    free(block);
+
+    std::map<std::string, Row> rows = dumpCsv("alloc");
+
+    CHECK(AllocTracker::isActive(), "the allocation hooks are not linked in");
+
+    bool found = false;
+    for(std::map<std::string, Row>::iterator iter=rows.begin(); iter != rows.end(); iter++) {
+        if(iter->first.find("alloc.aligned") != 0)
+            continue;
+        found = true;
+        CHECK(iter->second["allocs"] >= 10, iter->first << " allocs = " << iter->second["allocs"]);
+        CHECK(iter->second["allocbytes"] >= 10000, iter->first << " allocbytes = " << iter->second["allocbytes"]);
+    }
+
+    CHECK(found, "no alloc.aligned counter");
+
+    found = false;
+    for(std::map<std::string, Row>::iterator iter=rows.begin(); iter != rows.end(); iter++) {
+        if(iter->first.find("alloc.realloc") != 0)
+            continue;
+        found = true;
+        CHECK(iter->second["frees"] == 0, iter->first << " frees = " << iter->second["frees"]);
+        CHECK(iter->second["allocs"] == 0, iter->first << " allocs = " << iter->second["allocs"]);
+    }
+
+    CHECK(found, "no alloc.realloc counter");
+}
+
+//-----------------------------------------------------------------------
+// Atomic counters with uneven partitions.  Partitions are ordered by
+// id: p50 and p300 are added after the counters are initialized, so
+// they have no tags and no bins, and must neither be ranked nor shift
+// the bins of p100 and p200.  Bins are 10 ms, and intervals 100 ms
+//-----------------------------------------------------------------------
+
+static std::string atomicFile;
+
+static void initUnevenPartitions(unsigned topK, bool skipCold)
+{
+    atomicFile = testDir + "/atomic.txt";
+
+    Profiler::addRingPartition(100, "./data/leveldb/p100");
+    Profiler::addRingPartition(200, "./data/leveldb/p200");
+
+    std::map<std::string, std::string> nameMap;
+    nameMap["a"] = "count";
+    nameMap["b"] = "count";
+    Profiler::initializeAtomicCounters(nameMap, 10, 10000, atomicFile);
+
+    Profiler::addRingPartition(50,  "./data/leveldb/p50");
+    Profiler::addRingPartition(300, "./data/leveldb/p300");
+
+    Profiler::atomicTopK(topK, skipCold);
+
+    // Count in one interval, and wait for it to be written
+
+    for(unsigned i=0; i < 5; i++)
+        Profiler::incrementAtomicCounter(100, "a");
+    for(unsigned i=0; i < 1000; i++)
+        Profiler::incrementAtomicCounter(200, "b");
+    for(unsigned i=0; i < 7; i++)
+        Profiler::incrementAtomicCounter(300, "b");
+
+    usleep(350000);
+}
+
+/**.......................................................................
+ * Sum the counts credited to each partition index by the 'top' lines
+ * of a tag
+ */
+static std::map<unsigned, uint64_t> readTop(std::string tag)
+{
+    std::map<unsigned, uint64_t> top;
+    std::vector<std::string> lines = readLines(atomicFile);
+
+    for(unsigned iLine=0; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        if(toks.size() < 3 || toks[0] != "top" || toks[2] != tag + ":")
+            continue;
+        for(unsigned i=3; i < toks.size(); i++) {
+            unsigned iPart = strtoul(toks[i].c_str(), 0, 10);
+            top[iPart] += strtoull(toks[i].substr(toks[i].find(':') + 1).c_str(), 0, 10);
+        }
+    }
+
+    return top;
+}
+
+static void testAtomicTopK()
+{
+    initUnevenPartitions(2, false);
+
+    std::vector<std::string> lines = readLines(atomicFile);
+    CHECK(lines.size() > 2 && lines[0] == "partitions: p50 p100 p200 p300 ", "header: " << lines[0]);
+
+    std::map<unsigned, uint64_t> topA = readTop("a");
+    std::map<unsigned, uint64_t> topB = readTop("b");
+
+    CHECK(topA.size() == 1 && topA[1] == 5, "a credited to " << topA.size() << " partitions");
+    CHECK(topB.size() == 1 && topB[2] == 1000, "b credited to " << topB.size() << " partitions");
+}
+
+//-----------------------------------------------------------------------
+// The same, writing bins only for hot partitions: only p200's bins
+// (the 1000 increments of b) and p100's (the 5 of a) may be written
+//-----------------------------------------------------------------------
+
+static void testAtomicSkipCold()
+{
+    initUnevenPartitions(1, true);
+
+    std::vector<std::string> lines = readLines(atomicFile);
+    uint64_t totalA = 0, totalB = 0;
+    bool sawHot = false;
+
+    for(unsigned iLine=0; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        if(toks.empty())
+            continue;
+
+        // hot timestamp: part part ...
+        
+        if(toks[0] == "hot") {
+            for(unsigned i=2; i < toks.size(); i++) {
+                CHECK(toks[i] == "1" || toks[i] == "2", "cold partition " << toks[i] << " marked hot");
+                sawHot = true;
+            }
+            continue;
+        }
+
+        // timestamp: bins, 2 tags x 10 bins for each hot partition,
+        // following a hot line listing them in order
+        
+        if(isdigit(toks[0][0]) && toks[0][toks[0].size()-1] == ':' && iLine > 0) {
+            std::vector<std::string> hot = split(lines[iLine-1]);
+            CHECK(hot.size() >= 2 && hot[0] == "hot", "bins without a hot line");
+            CHECK(toks.size() - 1 == (hot.size() - 2) * 20, "wrote " << toks.size() - 1 << " bins for "
+                  << hot.size() - 2 << " hot partitions");
+
+            for(unsigned iHot=0; iHot + 2 < hot.size(); iHot++) {
+                for(unsigned iBin=0; iBin < 20; iBin++) {
+                    uint64_t val = strtoull(toks[1 + iHot * 20 + iBin].c_str(), 0, 10);
+                    bool tagA = iBin < 10;
+                    if(hot[iHot + 2] == "1") {
+                        totalA += tagA ? val : 0;
+                        CHECK(tagA || val == 0, "p100 counted b");
+                    } else {
+                        totalB += tagA ? 0 : val;
+                        CHECK(!tagA || val == 0, "p200 counted a");
+                    }
+                }
+            }
+        }
+    }
+
+    CHECK(sawHot, "no hot partitions written");
+    CHECK(totalA == 5,    "p100 a = " << totalA);
+    CHECK(totalB == 1000, "p200 b = " << totalB);
+}
+
+//-----------------------------------------------------------------------
+// Sparse output: each interval's runs must decode to exactly the
+// number of values it declares, with the counts in the bins of the
+// partitions that have them.  With skip-cold, the values are those of
+// the hot partitions listed before it
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Decode a "sparse timestamp nValues: gap:v,v gap:v ..." line
+ */
+static std::vector<uint64_t> decodeSparse(std::vector<std::string>& toks)
+{
+    CHECK(toks.size() >= 3 && toks[2][toks[2].size()-1] == ':', "malformed sparse line");
+    
+    std::vector<uint64_t> vals(strtoul(toks[2].c_str(), 0, 10), 0);
+    unsigned iVal = 0;
+
+    for(unsigned iTok=3; iTok < toks.size(); iTok++) {
+        std::string& run = toks[iTok];
+        size_t colon = run.find(':');
+        CHECK(colon != std::string::npos, "run without a gap: " << run);
+
+        iVal += strtoul(run.c_str(), 0, 10);
+
+        std::istringstream is(run.substr(colon + 1));
+        std::string val;
+        while(std::getline(is, val, ',')) {
+            CHECK(iVal < vals.size(), "run past the " << vals.size() << " values declared");
+            vals[iVal++] = strtoull(val.c_str(), 0, 10);
+            CHECK(vals[iVal-1] != 0, "zero written in a run: " << run);
+        }
+    }
+
+    return vals;
+}
+
+static void testAtomicSparse()
+{
+    Profiler::atomicFormat("sparse");
+    initUnevenPartitions(0, false);
+
+    bool threw = false;
+    try {
+        Profiler::atomicFormat("compressed");
+    } catch(std::exception&) {
+        threw = true;
+    }
+    CHECK(threw, "unknown atomic format accepted");
+
+    std::vector<std::string> lines = readLines(atomicFile);
+    uint64_t totals[4] = {0, 0, 0, 0};
+    unsigned nSparse = 0;
+
+    for(unsigned iLine=0; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        CHECK(toks.empty() || !isdigit(toks[0][0]), "dense line in sparse mode: " << lines[iLine]);
+        
+        if(toks.empty() || toks[0] != "sparse")
+            continue;
+
+        // p100 and p200 only, 2 tags x 10 bins each
+        
+        std::vector<uint64_t> vals = decodeSparse(toks);
+        CHECK(vals.size() == 40, vals.size() << " values in an interval");
+        for(unsigned i=0; i < vals.size(); i++)
+            totals[i / 10] += vals[i];
+        nSparse++;
+    }
+
+    CHECK(nSparse > 0, "no sparse lines");
+    CHECK(totals[0] == 5 && totals[1] == 0 && totals[2] == 0 && totals[3] == 1000,
+          "totals " << totals[0] << " " << totals[1] << " " << totals[2] << " " << totals[3]);
+}
+
+static void testAtomicSparseSkipCold()
+{
+    Profiler::atomicFormat("sparse");
+    initUnevenPartitions(1, true);
+
+    std::vector<std::string> lines = readLines(atomicFile);
+    uint64_t totalA = 0, totalB = 0;
+
+    for(unsigned iLine=1; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        if(toks.empty() || toks[0] != "sparse")
+            continue;
+
+        std::vector<std::string> hot = split(lines[iLine-1]);
+        CHECK(hot.size() >= 2 && hot[0] == "hot", "sparse bins without a hot line");
+
+        std::vector<uint64_t> vals = decodeSparse(toks);
+        CHECK(vals.size() == (hot.size() - 2) * 20, vals.size() << " values for " << hot.size() - 2 << " hot partitions");
+
+        for(unsigned iHot=0; iHot + 2 < hot.size(); iHot++) {
+            for(unsigned iBin=0; iBin < 20; iBin++) {
+                uint64_t val = vals[iHot * 20 + iBin];
+                if(hot[iHot + 2] == "1")
+                    totalA += iBin < 10 ? val : 0;
+                else if(hot[iHot + 2] == "2")
+                    totalB += iBin < 10 ? 0 : val;
+                else
+                    CHECK(false, "cold partition " << hot[iHot + 2] << " marked hot");
+            }
+        }
+    }
+
+    CHECK(totalA == 5,    "p100 a = " << totalA);
+    CHECK(totalB == 1000, "p200 b = " << totalB);
+}
+
+//-----------------------------------------------------------------------
+// Only count and sum tags are ranked: the totals of min, max and
+// gauge bins mean nothing
+//-----------------------------------------------------------------------
+
+static void testAtomicTopKKinds()
+{
+    atomicFile = testDir + "/atomic.txt";
+
+    Profiler::addRingPartition(1, "./data/leveldb/p1");
+    Profiler::addRingPartition(2, "./data/leveldb/p2");
+
+    std::map<std::string, std::string> nameMap;
+    nameMap["bytes"] = "sum";
+    nameMap["depth"] = "gauge";
+    nameMap["puts"]  = "count";
+    nameMap["worst"] = "max";
+    nameMap["best"]  = "min";
+    Profiler::initializeAtomicCounters(nameMap, 10, 10000, atomicFile);
+    Profiler::atomicTopK(2, false);
+
+    for(unsigned i=0; i < 10; i++) {
+        Profiler::incrementAtomicCounter(1, "puts");
+        Profiler::addAtomicCounter(2, "bytes", 100);
+        Profiler::addAtomicCounter(1, "depth", 1000);
+        Profiler::addAtomicCounter(2, "worst", 1000);
+        Profiler::addAtomicCounter(1, "best", 1000);
+    }
+
+    usleep(350000);
+
+    CHECK(readTop("bytes").size() == 1 && readTop("bytes")[1] == 1000, "bytes not ranked by sum");
+    CHECK(readTop("puts").size()  == 1 && readTop("puts")[0]  == 10,   "puts not ranked by count");
+
+    std::vector<std::string> lines = readLines(atomicFile);
+    for(unsigned iLine=0; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        CHECK(toks.size() < 3 || toks[0] != "top" || (toks[2] != "depth:" && toks[2] != "worst:" && toks[2] != "best:"),
+              "ranked a non-additive tag: " << lines[iLine]);
+    }
+}
+
+//-----------------------------------------------------------------------
+// The running top K names the partitions it ranked, even after a
+// partition that sorts before them is added, shifting their indices
+//-----------------------------------------------------------------------
+
+static void testAtomicTopKNames()
+{
+    initUnevenPartitions(2, false);
+
+    Profiler::addRingPartition(10, "./data/leveldb/p10");
+
+    std::string debugFile = testDir + "/debug.txt";
+    CHECK(freopen(debugFile.c_str(), "w", stdout), "unable to redirect stdout");
+    Profiler::profile("debug", false, true);
+    std::cout.flush();
+
+    std::vector<std::string> lines = readLines(debugFile);
+    std::string topA, topB;
+    for(unsigned iLine=0; iLine < lines.size(); iLine++) {
+        std::vector<std::string> toks = split(lines[iLine]);
+        if(toks.size() == 2 && toks[0] == "a:")
+            topA = toks[1];
+        if(toks.size() == 2 && toks[0] == "b:")
+            topB = toks[1];
+    }
+
+    CHECK(topA == "p100=5",    "a: " << topA);
+    CHECK(topB == "p200=1000", "b: " << topB);
+}
+
+//-----------------------------------------------------------------------
+// Shared-memory export of atomic counters: partitions added after the
+// counters were initialized have no bins, so only p100 and p200 may
+// be published, each name lined up with its own values
+//-----------------------------------------------------------------------
+
+struct ShmAtomic {
+    ShmHeader header_;
+    std::vector<std::string> names_;
+    std::vector<uint64_t> values_;
+};
+
+/**.......................................................................
+ * Copy the atomic counter section of a mapped segment, retrying while
+ * the writer is mid-update
+ */
+static bool readShmAtomic(unsigned char* base, ShmAtomic& atomic)
+{
+    ShmHeader* header = (ShmHeader*)base;
+
+    for(unsigned iTry=0; iTry < 100; iTry++) {
+        uint32_t seq = header->atomicSeq_;
+        __sync_synchronize();
+
+        if(seq % 2 == 0) {
+            atomic.header_ = *header;
+
+            unsigned nNames  = atomic.header_.nPartitions_ + atomic.header_.nTags_;
+            uint64_t nValues = (uint64_t)atomic.header_.nPartitions_ * atomic.header_.nTags_ * atomic.header_.nBins_;
+
+            atomic.names_.clear();
+            for(unsigned i=0; i < nNames && i < atomic.header_.maxNames_; i++)
+                atomic.names_.push_back(std::string((char*)(base + atomic.header_.namesOffset_ + i * PROFILER_SHM_NAME_LEN)));
+
+            uint64_t* values = (uint64_t*)(base + atomic.header_.atomicOffset_);
+            atomic.values_.assign(values, values + (nValues < atomic.header_.maxAtomicValues_ ? nValues : 0));
+
+            __sync_synchronize();
+            if(header->atomicSeq_ == seq)
+                return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+static void testShmExport()
+{
+    std::ostringstream os;
+    os << "/proftest_shm_" << getpid();
+    std::string shmName = os.str();
+
+    Profiler::addRingPartition(100, "./data/leveldb/p100");
+    Profiler::addRingPartition(200, "./data/leveldb/p200");
+
+    std::map<std::string, std::string> nameMap;
+    nameMap["a"] = "count";
+    nameMap["b"] = "count";
+    Profiler::initializeAtomicCounters(nameMap, 10, 10000, testDir + "/atomic.txt");
+
+    Profiler::addRingPartition(50,  "./data/leveldb/p50");
+    Profiler::addRingPartition(300, "./data/leveldb/p300");
+
+    Profiler::profile("shm_export", shmName, false, true);
+
+    int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+    CHECK(fd >= 0, "unable to open " << shmName << ": " << strerror(errno));
+
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0 && (st.st_mode & 0777) == 0600, "segment mode " << std::oct << (st.st_mode & 0777));
+
+    unsigned char* base = (unsigned char*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(base != MAP_FAILED, "unable to map " << shmName);
+
+    for(unsigned i=0; i < 5; i++)
+        Profiler::incrementAtomicCounter(100, "a");
+    for(unsigned i=0; i < 1000; i++)
+        Profiler::incrementAtomicCounter(200, "b");
+    for(unsigned i=0; i < 7; i++)
+        Profiler::incrementAtomicCounter(300, "b");
+
+    // Intervals are dumped every 100 ms, so poll often enough to see
+    // each one, in case the counts straddle two of them
+
+    ShmAtomic atomic;
+    uint64_t lastTimestamp = 0;
+    uint64_t sums[2][2] = {{0, 0}, {0, 0}};
+
+    for(unsigned iPoll=0; iPoll < 200; iPoll++) {
+        usleep(2000);
+        CHECK(readShmAtomic(base, atomic), "atomic section never consistent");
+
+        ShmHeader& header = atomic.header_;
+        if(header.timestampUs_ == lastTimestamp)
+            continue;
+        lastTimestamp = header.timestampUs_;
+
+        CHECK(header.nPartitions_ == 2 && header.nTags_ == 2 && header.nBins_ == 10,
+              "published " << header.nPartitions_ << " partitions x " << header.nTags_ << " tags x " << header.nBins_ << " bins");
+        CHECK(header.truncated_ == 0, "truncated");
+        CHECK(atomic.names_[0] == "p100" && atomic.names_[1] == "p200", "partitions " << atomic.names_[0] << " " << atomic.names_[1]);
+        CHECK(atomic.names_[2] == "a" && atomic.names_[3] == "b", "tags " << atomic.names_[2] << " " << atomic.names_[3]);
+
+        // Sum each partition's bins of each tag
+
+        for(unsigned iPart=0; iPart < 2; iPart++)
+            for(unsigned iTag=0; iTag < 2; iTag++)
+                for(unsigned iBin=0; iBin < header.nBins_; iBin++)
+                    sums[iPart][iTag] += atomic.values_[(iPart * 2 + iTag) * header.nBins_ + iBin];
+    }
+
+    Profiler::profile("shm_export", "", false, true);
+
+    CHECK(sums[0][0] == 5 && sums[0][1] == 0, "p100 a = " << sums[0][0] << " b = " << sums[0][1]);
+    CHECK(sums[1][0] == 0 && sums[1][1] == 1000, "p200 a = " << sums[1][0] << " b = " << sums[1][1]);
+}
+
+//-----------------------------------------------------------------------
+// Counter arena: global-only labels allocate one row of each block,
+// not a row for every thread slot (16 x 16 counters was ~17 MB for
+// 4096 labels)
+//-----------------------------------------------------------------------
+
+static size_t residentBytes()
+{
+    std::ifstream in("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    in >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void testArenaMemory()
+{
+    std::vector<std::string> labels(4000);
+    for(unsigned i=0; i < labels.size(); i++) {
+        std::ostringstream os;
+        os << "arena." << i;
+        labels[i] = os.str();
+    }
+
+    size_t before = residentBytes();
+    CHECK(before > 0, "unable to read /proc/self/statm");
+
+    for(unsigned i=0; i < labels.size(); i++) {
+        Profiler::profile("start", labels[i], false, true);
+        Profiler::profile("stop",  labels[i], false, true);
+    }
+
+    size_t grown = residentBytes() - before;
+    CHECK(grown < 6 * 1024 * 1024, "4000 global labels grew the heap by " << grown << " bytes");
+
+    std::map<std::string, Row> rows = dumpCsv("arena");
+    CHECK(rows.size() == labels.size() && rows.count("arena.3999 0x0") == 1, "reported " << rows.size() << " counters");
+}
+
+//-----------------------------------------------------------------------
+// Exit-time report: a prefix that doesn't exist makes the final dump
+// fail, which must not abort the process from the destructor.  An
+// explicit dump to the same prefix still reports the error
+//-----------------------------------------------------------------------
+
+static void testExitDump()
+{
+    std::string label("exit.dump");
+    Profiler::profile("start", label, true, true);
+    Profiler::profile("stop",  label, true, true);
+
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+
+    bool threw = false;
+    try {
+        Profiler::profile("dump", testDir + "/missing/profile.txt", false, true);
+    } catch(std::exception&) {
+        threw = true;
+    }
+
+    CHECK(threw, "dump to a missing directory succeeded");
+
+    // Leave an interval open, so the report has warnings to write
+
+    Profiler::profile("start", label, true, true);
+}
+
+//-----------------------------------------------------------------------
+// Checkpoints: failures to write (here, a missing prefix) are logged
+// on the checkpoint thread, which keeps going, and checkpoints resume
+// once the prefix is usable.  The checkpointer is still running, and
+// failing, when the process exits
+//-----------------------------------------------------------------------
+
+static void testCheckpoint()
+{
+    std::string label("checkpoint.work");
+    Profiler::profile("start", label, true, true);
+    Profiler::profile("stop",  label, true, true);
+
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+    Profiler::checkpoint(20, false);
+    usleep(100000);
+
+    CHECK(findFiles("_profile.txt").empty(), "checkpoint written to the wrong directory");
+
+    Profiler::profile("prefix", testDir, false, true);
+    usleep(100000);
+
+    std::vector<std::string> files = findFiles("_profile.txt");
+    CHECK(files.size() == 1, files.size() << " checkpoint files after the prefix was fixed");
+
+    std::vector<std::string> lines = readLines(testDir + "/" + files[0]);
+    bool found = false;
+    for(unsigned i=0; i < lines.size(); i++)
+        found = found || lines[i].find("checkpoint.work") != std::string::npos;
+    CHECK(found, "checkpoint.work not in " << files[0]);
+
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+    usleep(50000);
+}
+
+//-----------------------------------------------------------------------
+// On-signal checkpoints: SIGTERM writes a checkpoint and then kills
+// the process as it would have.  With a prefix that can't be written,
+// the process must still die of the signal, not hang or abort
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Run a process that checkpoints on signal and kills itself with
+ * SIGTERM, returning its wait status
+ */
+static int checkpointAndTerminate(std::string prefix)
+{
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        std::string label("checkpoint.signal");
+        Profiler::profile("start", label, true, true);
+        Profiler::profile("stop",  label, true, true);
+
+        Profiler::profile("prefix", prefix, false, true);
+        Profiler::checkpoint(0, true);
+
+        kill(getpid(), SIGTERM);
+        usleep(5000000);
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+static void testCheckpointSignal()
+{
+    int status = checkpointAndTerminate(testDir);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM, "not killed by SIGTERM: status " << status);
+
+    std::vector<std::string> files = findFiles("_profile.txt");
+    CHECK(files.size() == 1, files.size() << " checkpoint files after SIGTERM");
+
+    std::vector<std::string> lines = readLines(testDir + "/" + files[0]);
+    bool found = false;
+    for(unsigned i=0; i < lines.size(); i++)
+        found = found || lines[i].find("checkpoint.signal") != std::string::npos;
+    CHECK(found, "checkpoint.signal not in " << files[0]);
+
+    status = checkpointAndTerminate(testDir + "/missing");
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM, "not killed by SIGTERM: status " << status);
+}
+
+//-----------------------------------------------------------------------
+// Sessions: an expired session writes <name>_session, and a session
+// still running at exit, whose report can't be written, must not
+// abort the process from the destructor
+//-----------------------------------------------------------------------
+
+static void testSession()
+{
+    std::string label("session.work");
+    Profiler::SessionOptions opts;
+
+    Profiler::sessionStart("short", 50, opts);
+    Profiler::profile("start", label, true, true);
+    Profiler::profile("stop",  label, true, true);
+    usleep(200000);
+
+    std::vector<std::string> lines = readLines(testDir + "/short_session.txt");
+    bool found = false;
+    for(unsigned i=0; i < lines.size(); i++)
+        found = found || lines[i].find("session.work") != std::string::npos;
+    CHECK(found, "session.work not in short_session.txt");
+
+    bool threw = false;
+    try {
+        Profiler::sessionStart("short/name", 50, opts);
+    } catch(std::exception&) {
+        threw = true;
+    }
+    CHECK(threw, "a session name with a path separator was accepted");
+
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+    Profiler::sessionStart("long", 60000, opts);
+}
+
+//-----------------------------------------------------------------------
+// A group enabled by a session, nested in a disabled one, is created
+// by the session, and must be off again once it ends
+//-----------------------------------------------------------------------
+
+static void testSessionGroups()
+{
+    std::string label("a.b.x");
+    Profiler::SessionOptions opts;
+    opts.groups_.push_back("a.b.*");
+
+    Profiler::enableGroup("a.*", false);
+
+    Profiler::sessionStart("groups", 60000, opts);
+    Profiler::profile("start", label, false, true);
+    Profiler::profile("stop",  label, false, true);
+    Profiler::sessionStop();
+
+    // Only the (short) interval timed during the session may count
+
+    Profiler::profile("start", label, false, true);
+    Profiler::profile("start", "c.x", false, true);
+    usleep(20000);
+    Profiler::profile("stop",  label, false, true);
+    Profiler::profile("stop",  "c.x", false, true);
+
+    std::map<std::string, Row> rows = dumpCsv("groups");
+
+    CHECK(rows.count("a.b.x 0x0") == 1,       "a.b.x not recorded during the session");
+    CHECK(rows["a.b.x 0x0"]["usec"] < 20000,  "a.b.x usec = " << rows["a.b.x 0x0"]["usec"]);
+    CHECK(rows["c.x 0x0"]["usec"] >= 20000,   "c.x usec = " << rows["c.x 0x0"]["usec"]);
+}
+
+//-----------------------------------------------------------------------
+// Epochs: an interval open at a reset is folded into the closed
+// epoch when it stops.  If writing the epoch file fails, the fold
+// must survive for the next dump to write
+//-----------------------------------------------------------------------
+
+static Row readEpochRow(unsigned epoch, std::string key)
+{
+    std::ostringstream suffix;
+    suffix << "_epoch" << epoch << ".csv";
+
+    std::vector<std::string> files = findFiles(suffix.str());
+    CHECK(files.size() == 1, files.size() << " files ending in " << suffix.str());
+
+    std::map<std::string, Row> rows = readCsv(testDir + "/" + files[0]);
+    CHECK(rows.count(key) == 1, key << " not in " << files[0]);
+    return rows[key];
+}
+
+static void testEpochRetry()
+{
+    std::string label("epoch.late");
+    Profiler::reportFormat("csv");
+
+    Profiler::profile("start", label, false, true);
+    CHECK(Profiler::reset() == 1, "first reset is not epoch 1");
+    CHECK(readEpochRow(0, "epoch.late 0x0")["open"] == 1, "open interval not flagged");
+
+    // The late stop dirties epoch 0, which can't be written here
+
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+    usleep(1000);
+    Profiler::profile("stop", label, false, true);
+
+    bool threw = false;
+    try {
+        Profiler::profile("dump", testDir + "/profile.csv", false, true);
+    } catch(std::exception&) {
+        threw = true;
+    }
+    CHECK(threw, "epoch write to a missing directory succeeded");
+
+    Profiler::profile("prefix", testDir, false, true);
+    Profiler::profile("dump", testDir + "/profile.csv", false, true);
+
+    Row row = readEpochRow(0, "epoch.late 0x0");
+    CHECK(row["open"] == 0 && row["usec"] >= 1000, "late stop lost: open = " << row["open"] << ", usec = " << row["usec"]);
+
+    // Exit with epoch 1's late stop unwritable
+
+    Profiler::profile("start", label, false, true);
+    Profiler::reset();
+    Profiler::profile("prefix", testDir + "/missing", false, true);
+    Profiler::profile("stop", label, false, true);
+}
+
+//-----------------------------------------------------------------------
+// Resets: a second reset must write the late stops folded into the
+// previous closed epoch before replacing it, and concurrent resets
+// must each leave an epoch file behind
+//-----------------------------------------------------------------------
+
+#define RESET_THREADS 4
+#define RESETS_PER_THREAD 50
+
+static void* resetWorker(void* arg)
+{
+    std::string label("reset.worker");
+    for(unsigned i=0; i < RESETS_PER_THREAD; i++) {
+        Profiler::profile("start", label, true, true);
+        Profiler::reset();
+        Profiler::profile("stop", label, true, true);
+    }
+    return 0;
+}
+
+static void testEpochResets()
+{
+    std::string label("epoch.late");
+    Profiler::reportFormat("csv");
+    
+    Profiler::profile("start", label, false, true);
+    Profiler::reset();
+    usleep(1000);
+    Profiler::profile("stop", label, false, true);
+    Profiler::reset();
+
+    Row row = readEpochRow(0, "epoch.late 0x0");
+    CHECK(row["open"] == 0 && row["usec"] >= 1000, "late stop lost: open = " << row["open"] << ", usec = " << row["usec"]);
+
+    pthread_t threads[RESET_THREADS];
+    for(unsigned i=0; i < RESET_THREADS; i++)
+        pthread_create(&threads[i], 0, resetWorker, 0);
+    for(unsigned i=0; i < RESET_THREADS; i++)
+        pthread_join(threads[i], 0);
+
+    unsigned lastEpoch = Profiler::reset();
+    CHECK(lastEpoch == 3 + RESET_THREADS * RESETS_PER_THREAD, "last epoch " << lastEpoch);
+
+    for(unsigned epoch=0; epoch < lastEpoch; epoch++) {
+        std::ostringstream suffix;
+        suffix << "_epoch" << epoch << ".csv";
+        CHECK(findFiles(suffix.str()).size() == 1, "no file for epoch " << epoch);
+    }
+}
+
+//-----------------------------------------------------------------------
+// Scrape endpoint: the unix socket is owner-only even with a
+// permissive umask, bad addresses are rejected without disturbing
+// files in the way, and both sockets answer requests
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Send a request to a connected socket, and return the whole reply
+ */
+static std::string request(int fd, std::string req)
+{
+    std::string reply;
+    if(write(fd, req.c_str(), req.size()) != (ssize_t)req.size()) {
+        close(fd);
+        return reply;
+    }
+
+    char buf[4096];
+    ssize_t nRead;
+    while((nRead = read(fd, buf, sizeof(buf))) > 0)
+        reply.append(buf, nRead);
+
+    close(fd);
+    return reply;
+}
+
+static std::string requestUnix(std::string path, std::string req)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "unable to connect to " << path);
+    return request(fd, req);
+}
+
+static std::string requestTcp(unsigned port, std::string req)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0, "unable to connect to port " << port);
+    return request(fd, req);
+}
+
+static bool scrapeThrows(std::string address)
+{
+    try {
+        Profiler::scrape(address);
+    } catch(std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+static void testScrape()
+{
+    std::string label("scrape.work");
+    Profiler::profile("start", label, false, true);
+    Profiler::profile("stop",  label, false, true);
+
+    CHECK(scrapeThrows("udp:80"),      "udp address accepted");
+    CHECK(scrapeThrows("tcp:"),        "empty port accepted");
+    CHECK(scrapeThrows("tcp:70000"),   "port 70000 accepted");
+    CHECK(scrapeThrows("unix:"),       "empty path accepted");
+    CHECK(scrapeThrows("unix:" + std::string(200, 'x')), "overlong path accepted");
+
+    // A regular file in the way is left alone, and the bind fails
+
+    std::string plain = testDir + "/plain";
+    {
+        std::ofstream out(plain.c_str());
+        out << "keep" << endl;
+    }
+    CHECK(scrapeThrows("unix:" + plain), "bound over a regular file");
+    CHECK(readLines(plain).size() == 1 && readLines(plain)[0] == "keep", "regular file disturbed");
+
+    std::string path = testDir + "/scrape.sock";
+
+    mode_t savedMask = umask(0);
+    CHECK(Profiler::scrape("unix:" + path) == 0, "unix socket has a port");
+    umask(savedMask);
+
+    struct stat st;
+    CHECK(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode), "no socket at " << path);
+    CHECK((st.st_mode & 0777) == 0600, "socket mode is 0" << std::oct << (st.st_mode & 0777));
+
+    std::string reply = requestUnix(path, "csv\n");
+    CHECK(reply.find("\"scrape.work\",0x0,") != std::string::npos, "unix reply: " << reply);
+
+    CHECK(requestUnix(path, "nosuchformat\n").find("error: ") == 0, "bad format not reported");
+
+    unsigned port = Profiler::scrape("tcp:0");
+    CHECK(port != 0, "tcp:0 bound no port");
+    CHECK(lstat(path.c_str(), &st) != 0, "unix socket left behind after a restart");
+
+    reply = requestTcp(port, "GET /csv HTTP/1.0\r\n\r\n");
+    CHECK(reply.find("HTTP/1.0 200 OK") == 0 && reply.find("\"scrape.work\",0x0,") != std::string::npos, "tcp reply: " << reply);
+
+    CHECK(requestTcp(port, "GET /nosuchpath HTTP/1.0\r\n\r\n").find("HTTP/1.0 404") == 0, "bad path not a 404");
+
+    Profiler::scrape("");
+}
+
+//-----------------------------------------------------------------------
+// Async spans: a span begun before a reset is credited to the closed
+// epoch when it ends; one that spans two resets goes to the epoch it
+// ends in.  A token ended twice is ignored, and the pool is bounded
+//-----------------------------------------------------------------------
+
+static void testSpans()
+{
+    Profiler::reportFormat("csv");
+
+    uint64_t late = Profiler::spanBegin("span.late");
+    uint64_t older = Profiler::spanBegin("span.older");
+    CHECK(late != 0 && older != 0, "spanBegin returned 0");
+
+    usleep(20000);
+    Profiler::reset();
+    usleep(1000);
+
+    Profiler::spanEnd(late);
+    Profiler::spanEnd(late);
+
+    std::map<std::string, Row> rows = dumpCsv("epoch1");
+    CHECK(rows["span.late 0x0"]["usec"] == 0, "late span credited to the new epoch");
+
+    Row row = readEpochRow(0, "span.late 0x0");
+    CHECK(row["usec"] >= 21000, "late span not in epoch 0: usec = " << row["usec"]);
+
+    Profiler::reset();
+    Profiler::spanEnd(older);
+
+    rows = dumpCsv("epoch2");
+    CHECK(rows["span.older 0x0"]["usec"] >= 21000, "span across two resets not in epoch 2");
+    CHECK(readEpochRow(0, "span.older 0x0")["usec"] == 0, "span across two resets in epoch 0");
+    CHECK(readCsv(testDir + "/epoch2.csv")["span.late 0x0"]["usec"] == 0, "late span ended twice");
+
+    std::vector<uint64_t> tokens;
+    uint64_t token;
+    while((token = Profiler::spanBegin("span.many")) != 0 && tokens.size() < 100000)
+        tokens.push_back(token);
+
+    CHECK(token == 0 && tokens.size() == 16384, tokens.size() << " spans opened");
+
+    for(unsigned i=0; i < tokens.size(); i++)
+        Profiler::spanEnd(tokens[i]);
+
+    CHECK(Profiler::spanBegin("span.many") != 0, "pool not refilled");
+}
+
+//-----------------------------------------------------------------------
+// Overlap counters: intervals overlap freely, busy time is their
+// union in wall-clock time (sleeping counts), and a stop with nothing
+// open is an error rather than a negative count
+//-----------------------------------------------------------------------
+
+static void testOverlap()
+{
+    std::string label("overlap.request");
+    Profiler::overlap(label);
+
+    for(unsigned i=0; i < 3; i++)
+        Profiler::profile("start", label, false, true);
+    usleep(20000);
+    for(unsigned i=0; i < 3; i++)
+        Profiler::profile("stop", label, false, true);
+
+    Profiler::profile("stop", label, false, true);
+    Profiler::profile("start", label, false, true);
+
+    std::map<std::string, Row> rows = dumpCsv("overlap");
+    Row& row = rows["overlap.request 0x0"];
+
+    CHECK(row["count"] == 3,          "count = " << row["count"]);
+    CHECK(row["active"] == 1,         "active = " << row["active"]);
+    CHECK(row["peakactive"] == 3,     "peakactive = " << row["peakactive"]);
+    CHECK(row["uninitiated"] == 1,    "uninitiated = " << row["uninitiated"]);
+    CHECK(row["busyusec"] >= 20000,   "busyusec = " << row["busyusec"]);
+    CHECK(row["usec"] >= 3 * 20000,   "usec = " << row["usec"]);
+    CHECK(row["usec"] >= row["busyusec"], "usec " << row["usec"] << " < busyusec " << row["busyusec"]);
+}
+
+//=======================================================================
+// Driver
+//=======================================================================
+
+struct Test {
+    const char* name_;
+    void (*fn_)();
+};
+
+static Test tests[] = {
+    {"cputime",          testCpuTime},
+    {"perfcounters",     testPerfCounters},
+    {"perfscaling",      testPerfScaling},
+    {"alloctrack",       testAllocTrack},
+    {"atomictopk",       testAtomicTopK},
+    {"atomicskipcold",   testAtomicSkipCold},
+    {"atomicsparse",     testAtomicSparse},
+    {"atomicsparsecold", testAtomicSparseSkipCold},
+    {"atomickinds",      testAtomicTopKKinds},
+    {"atomictopknames",  testAtomicTopKNames},
+    {"shmexport",        testShmExport},
+    {"arenamemory",      testArenaMemory},
+    {"exitdump",         testExitDump},
+    {"checkpoint",       testCheckpoint},
+    {"checkpointsignal", testCheckpointSignal},
+    {"session",          testSession},
+    {"sessiongroups",    testSessionGroups},
+    {"epochretry",       testEpochRetry},
+    {"epochresets",      testEpochResets},
+    {"scrape",           testScrape},
+    {"spans",            testSpans},
+    {"overlap",          testOverlap},
+};
+
+#define N_TESTS (sizeof(tests)/sizeof(*tests))
+
+/**.......................................................................
+ * Run one test in a child process, in a fresh scratch directory
+ */
+static bool runTest(Test& test)
+{
+    char dirName[] = "/tmp/proftestXXXXXX";
+    if(mkdtemp(dirName) == 0) {
+        cerr << test.name_ << ": unable to create a scratch directory" << endl;
+        return false;
+    }
+
+    cout.flush();
+    cerr.flush();
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+
+        // The profiler's own messages would drown the results
+
+        if(!freopen("/dev/null", "w", stdout))
+            _exit(1);
+
+        testDir = dirName;
+        Profiler::profile("prefix", testDir, false, true);
+
+        try {
+            test.fn_();
+        } catch(std::exception& err) {
+            cerr << "  unexpected exception: " << err.what() << endl;
+            _exit(1);
+        }
+
+        exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    std::string rm = std::string("rm -rf ") + dirName;
+    if(system(rm.c_str()) != 0)
+        cerr << "Unable to remove " << dirName << endl;
+
+    bool passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    cerr << (passed ? "pass " : "FAIL ") << test.name_;
+    if(WIFSIGNALED(status))
+        cerr << " (signal " << WTERMSIG(status) << ")";
+    cerr << endl;
+
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned nRun = 0, nFail = 0;
+
+    for(unsigned i=0; i < N_TESTS; i++) {
+
+        bool selected = (argc == 1);
+        for(int iArg=1; iArg < argc; iArg++)
+            if(strcmp(argv[iArg], tests[i].name_) == 0)
+                selected = true;
+
+        if(!selected)
+            continue;
+
+        nRun++;
+        if(!runTest(tests[i]))
+            nFail++;
+    }
+
+    cerr << nRun - nFail << " of " << nRun << " tests passed" << endl;
+
+    // Skip the exit-time dump of this process's (unused) profiler
+
+    _exit(nFail == 0 ? 0 : 1);
+}
@@ -61,6 +61,16 @@ using namespace nifutil;
 
 namespace profiler {
 
+    /**.......................................................................
+     * Throw if a command tuple doesn't have at least nMin elements,
+     * rather than indexing past the end of it
+     */
+    static void checkCells(std::vector<ERL_NIF_TERM>& cells, unsigned nMin, std::string atom)
+    {
+        if(cells.size() < nMin)
+            ThrowRuntimeError("The " << atom << " command requires " << nMin-1 << " argument(s)");
+    }
+
     ERL_NIF_TERM profile(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     {
         try {
@@ -70,6 +80,10 @@ namespace profiler {
                 always = ErlUtil::getBool(env, argv[1]);
             
             std::vector<ERL_NIF_TERM> cells = ErlUtil::getTupleCells(env, argv[0]);
+
+            if(cells.size() == 0)
+                ThrowRuntimeError("Empty command tuple");
+            
             std::string atom  = ErlUtil::formatTerm(env, cells[0]);
 
             //------------------------------------------------------------
@@ -77,11 +91,91 @@ namespace profiler {
             //------------------------------------------------------------
 
             if(atom == "noop") {
+                checkCells(cells, 2, atom);
                 Profiler::noop(ErlUtil::getBool(env, cells[1]));
                 return profiler::ATOM_OK;
             }
 
+            //------------------------------------------------------------
+            // Async spans, which can end on a different thread from
+            // the one they began on: {span_begin, Label} returns a
+            // token, and {span_end, Token} ends the span
+            //------------------------------------------------------------
+
+            if(atom == "span_begin") {
+                checkCells(cells, 2, atom);
+                return enif_make_uint64(env, Profiler::spanBegin(ErlUtil::getAsString(env, cells[1])));
+            }
+
+            if(atom == "span_end") {
+                checkCells(cells, 2, atom);
+                Profiler::spanEnd(ErlUtil::getValAsUint64(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Start a new epoch of counters: {reset}.  Returns the
+            // new epoch number
+            //------------------------------------------------------------
+
+            if(atom == "reset")
+                return enif_make_uint64(env, Profiler::reset());
+
+            //------------------------------------------------------------
+            // Turn counters on or off by label prefix:
+            // {enable_group, "compaction.*"}, {disable_group, "*"}
+            //------------------------------------------------------------
+
+            if(atom == "enable_group" || atom == "disable_group") {
+                checkCells(cells, 2, atom);
+                Profiler::enableGroup(ErlUtil::getAsString(env, cells[1]), atom == "enable_group");
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Let a label's shared counter take overlapping
+            // intervals: {overlap, "request"}
+            //------------------------------------------------------------
+
+            if(atom == "overlap") {
+                checkCells(cells, 2, atom);
+                Profiler::overlap(ErlUtil::getAsString(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Sample per-thread CPU time and context switches on
+            // start/stop
+            //------------------------------------------------------------
+
+            if(atom == "cputime") {
+                checkCells(cells, 2, atom);
+                Profiler::cpuTime(ErlUtil::getBool(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Read per-thread hardware counters on start/stop
+            //------------------------------------------------------------
+
+            if(atom == "perfcounters") {
+                checkCells(cells, 2, atom);
+                Profiler::perfCounters(ErlUtil::getBool(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Attribute per-thread allocations to running counters
+            //------------------------------------------------------------
+
+            if(atom == "alloctrack") {
+                checkCells(cells, 2, atom);
+                Profiler::allocTrack(ErlUtil::getBool(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
             if(atom == "init_atomic_counters") {
+                checkCells(cells, 2, atom);
 
                 if(ErlUtil::isTuple(env, cells[1])) {
 
@@ -96,9 +190,21 @@ namespace profiler {
 
                         std::map<std::string, std::string> nameMap;
                         
+                        // Each tag is either "name" (a count) or
+                        // {"name", Kind}, with Kind one of count,
+                        // sum, min, max, gauge or hist
+                        
                         for(unsigned i=0; i < list.size(); i++) {
-                            std::string name = ErlUtil::getString(env, list[i]);
-                            nameMap[name] = name;
+                            if(ErlUtil::isTuple(env, list[i])) {
+                                std::vector<ERL_NIF_TERM> tag = ErlUtil::getTupleCells(env, list[i]);
+                                BufferedAtomicCounter::Kind kind;
+                                std::string kindStr = tag.size() == 2 ? ErlUtil::getAsString(env, tag[1]) : "";
+                                if(kindStr != "hist" && !BufferedAtomicCounter::kindFromString(kindStr, kind))
+                                    ThrowRuntimeError("Tags must be Name or {Name, count | sum | min | max | gauge | hist}");
+                                nameMap[ErlUtil::getAsString(env, tag[0])] = kindStr;
+                            } else {
+                                nameMap[ErlUtil::getString(env, list[i])] = "count";
+                            }
                         }
 
                         Profiler::initializeAtomicCounters(nameMap, bufferSize, minorIntervalMs, outputFile);
@@ -111,14 +217,214 @@ namespace profiler {
                 return profiler::ATOM_ERROR;
             }
 
+            //------------------------------------------------------------
+            // Counter families over arbitrary dimensions:
+            //
+            //   {add_counter_family, Name, [{Dim, Size} | {Dim, [Label]}], File}
+            //   {add_counter_family, Name, Dims, File, Kind}
+            //
+            // returns an integer id, used as
+            //
+            //   {inc_counter_family, Id, {I1, I2, ...}}
+            //   {add_to_counter_family, Id, {I1, I2, ...}, Value}
+            //------------------------------------------------------------
+
+            if(atom == "add_counter_family") {
+                checkCells(cells, 4, atom);
+                
+                std::string name = ErlUtil::getAsString(env, cells[1]);
+                std::vector<ERL_NIF_TERM> dimTerms = ErlUtil::getListCells(env, cells[2]);
+                std::vector<CounterFamily::Dimension> dims(dimTerms.size());
+
+                for(unsigned i=0; i < dimTerms.size(); i++) {
+                    std::vector<ERL_NIF_TERM> dim = ErlUtil::getTupleCells(env, dimTerms[i]);
+
+                    if(dim.size() != 2)
+                        ThrowRuntimeError("Dimensions must be specified as {Name, Size} or {Name, [Label]}");
+
+                    dims[i].name_ = ErlUtil::getAsString(env, dim[0]);
+                    
+                    if(ErlUtil::isList(env, dim[1]) && !ErlUtil::isString(env, dim[1])) {
+                        std::vector<ERL_NIF_TERM> labels = ErlUtil::getListCells(env, dim[1]);
+                        for(unsigned j=0; j < labels.size(); j++)
+                            dims[i].labels_.push_back(ErlUtil::getAsString(env, labels[j]));
+                        dims[i].size_ = labels.size();
+                    } else {
+                        dims[i].size_ = ErlUtil::getValAsUint32(env, dim[1]);
+                    }
+                }
+
+                BufferedAtomicCounter::Kind kind = BufferedAtomicCounter::KIND_COUNT;
+                if(cells.size() > 4 && !BufferedAtomicCounter::kindFromString(ErlUtil::getAsString(env, cells[4]), kind))
+                    ThrowRuntimeError("Kind must be one of count, sum, min, max or gauge");
+                
+                unsigned id = Profiler::addCounterFamily(name, dims, ErlUtil::getAsString(env, cells[3]), kind);
+                return enif_make_uint64(env, id);
+            }
+
+            if(atom == "inc_counter_family" || atom == "add_to_counter_family") {
+                checkCells(cells, atom == "inc_counter_family" ? 3 : 4, atom);
+                
+                unsigned id = ErlUtil::getValAsUint32(env, cells[1]);
+                std::vector<ERL_NIF_TERM> indexTerms = ErlUtil::isTuple(env, cells[2]) ?
+                    ErlUtil::getTupleCells(env, cells[2]) : ErlUtil::getListCells(env, cells[2]);
+
+                if(indexTerms.size() > MAX_FAMILY_DIMS)
+                    ThrowRuntimeError("Too many indices for a counter family (max " << MAX_FAMILY_DIMS << ")");
+                
+                unsigned indices[MAX_FAMILY_DIMS];
+                for(unsigned i=0; i < indexTerms.size(); i++)
+                    indices[i] = ErlUtil::getValAsUint32(env, indexTerms[i]);
+
+                if(atom == "inc_counter_family")
+                    Profiler::incrementCounterFamily(id, indices, indexTerms.size());
+                else
+                    Profiler::addToCounterFamily(id, indices, indexTerms.size(),
+                                                 ErlUtil::getValAsUint64(env, cells[3]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Report the K heaviest partitions per tag in the atomic
+            // counter output: {atomic_topk, K} or {atomic_topk, K,
+            // SkipCold}
+            //------------------------------------------------------------
+
+            if(atom == "atomic_topk") {
+                checkCells(cells, 2, atom);
+                unsigned k = ErlUtil::getValAsUint32(env, cells[1]);
+                bool skipCold = cells.size() > 2 ? ErlUtil::getBool(env, cells[2]) : false;
+                Profiler::atomicTopK(k, skipCold);
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Select dense or sparse encoding of the atomic counter
+            // output: {atomic_format, dense | sparse}
+            //------------------------------------------------------------
+
+            if(atom == "atomic_format") {
+                checkCells(cells, 2, atom);
+                Profiler::atomicFormat(ErlUtil::getAsString(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Cap the number of distinct labels and per-thread
+            // counter threads: {limits, MaxLabels, MaxThreads}
+            //------------------------------------------------------------
+
+            if(atom == "limits") {
+                checkCells(cells, 3, atom);
+                Profiler::limits(ErlUtil::getValAsUint32(env, cells[1]), ErlUtil::getValAsUint32(env, cells[2]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Select the format of dumped files: {format, text | json
+            // | csv | prometheus}
+            //------------------------------------------------------------
+
+            if(atom == "format") {
+                checkCells(cells, 2, atom);
+                Profiler::reportFormat(ErlUtil::getAsString(env, cells[1]));
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Serve snapshots on a local socket: {scrape, "unix:/path"}
+            // or {scrape, "tcp:Port"}, or {scrape, ""} to stop.
+            // Returns the bound TCP port
+            //------------------------------------------------------------
+
+            if(atom == "scrape") {
+                checkCells(cells, 2, atom);
+                unsigned port = Profiler::scrape(ErlUtil::getAsString(env, cells[1]));
+                return enif_make_uint64(env, port);
+            }
+
+            //------------------------------------------------------------
+            // Periodically rewrite the report file, and optionally on
+            // SIGTERM/SIGABRT: {checkpoint, IntervalMs} or
+            // {checkpoint, IntervalMs, OnSignal}.  {checkpoint, 0}
+            // stops
+            //------------------------------------------------------------
+
+            if(atom == "checkpoint") {
+                checkCells(cells, 2, atom);
+                unsigned intervalMs = ErlUtil::getValAsUint32(env, cells[1]);
+                bool onSignal = cells.size() > 2 ? ErlUtil::getBool(env, cells[2]) : false;
+                Profiler::checkpoint(intervalMs, onSignal);
+                return profiler::ATOM_OK;
+            }
+
+            //------------------------------------------------------------
+            // Timed profiling session: {session_start, Name,
+            // DurationMs, Opts}, where Opts is a list of cputime,
+            // perfcounters, alloctrack and {enable_group, Pattern}.
+            // {session_stop} ends the session early
+            //------------------------------------------------------------
+
+            if(atom == "session_start") {
+                checkCells(cells, 4, atom);
+
+                Profiler::SessionOptions opts;
+                std::vector<ERL_NIF_TERM> optTerms = ErlUtil::getListCells(env, cells[3]);
+
+                for(unsigned i=0; i < optTerms.size(); i++) {
+                    if(ErlUtil::isTuple(env, optTerms[i])) {
+                        std::vector<ERL_NIF_TERM> opt = ErlUtil::getTupleCells(env, optTerms[i]);
+                        if(opt.size() != 2 || ErlUtil::getAsString(env, opt[0]) != "enable_group")
+                            ThrowRuntimeError("Unrecognized session option: " << ErlUtil::formatTerm(env, optTerms[i]));
+                        opts.groups_.push_back(ErlUtil::getAsString(env, opt[1]));
+                        continue;
+                    }
+
+                    std::string opt = ErlUtil::getAsString(env, optTerms[i]);
+
+                    if(opt == "cputime")
+                        opts.cpuTime_ = true;
+                    else if(opt == "perfcounters")
+                        opts.perfCounters_ = true;
+                    else if(opt == "alloctrack")
+                        opts.allocTrack_ = true;
+                    else
+                        ThrowRuntimeError("Unrecognized session option: " << opt);
+                }
+
+                Profiler::sessionStart(ErlUtil::getAsString(env, cells[1]),
+                                       ErlUtil::getValAsUint32(env, cells[2]), opts);
+                return profiler::ATOM_OK;
+            }
+
+            if(atom == "session_stop") {
+                Profiler::sessionStop();
+                return profiler::ATOM_OK;
+            }
+
             if(atom == "inc_atomic_counter") {
+                checkCells(cells, 3, atom);
                 uint64_t partPtr = ErlUtil::getValAsUint64(env, cells[1]);
                 std::string counterName = ErlUtil::getAsString(env, cells[2]);
                 Profiler::incrementAtomicCounter(partPtr, counterName);
                 return profiler::ATOM_OK;
             }
 
+            //------------------------------------------------------------
+            // Accumulate a value into an atomic counter:
+            // {add_atomic_counter, PartPtr, Tag, Value}
+            //------------------------------------------------------------
+
+            if(atom == "add_atomic_counter") {
+                checkCells(cells, 4, atom);
+                uint64_t partPtr = ErlUtil::getValAsUint64(env, cells[1]);
+                std::string counterName = ErlUtil::getAsString(env, cells[2]);
+                Profiler::addAtomicCounter(partPtr, counterName, ErlUtil::getValAsUint64(env, cells[3]));
+                return profiler::ATOM_OK;
+            }
+
             if(atom == "add_ring_partition") {
+                checkCells(cells, 3, atom);
                 uint64_t partPtr = ErlUtil::getValAsUint64(env, cells[1]);
                 std::string leveldbFile = ErlUtil::getAsString(env, cells[2]);
                 COUT("partPTr = " << partPtr << " file = " << leveldbFile);
@@ -131,7 +437,7 @@ namespace profiler {
             //------------------------------------------------------------
 
             if(atom == "debug") {
-                Profiler::profile("debug");
+                Profiler::profile("debug", false, false);
                 return profiler::ATOM_OK;
             }
 
@@ -140,6 +446,7 @@ namespace profiler {
             //------------------------------------------------------------
 
             if(atom == "start" || atom == "stop") {
+                checkCells(cells, 2, atom);
                 std::string label = ErlUtil::getAsString(env, cells[1]);
                 
                 bool perThread = false;
@@ -152,13 +459,14 @@ namespace profiler {
             }
 
             //------------------------------------------------------------
-            // dump counters out to disk, or set the prefix dir for output
+            // dump counters out to disk, set the prefix dir for output,
+            // or export counters to a named shared-memory segment
             //------------------------------------------------------------
 
-            if(atom == "dump" || atom == "prefix") {
+            if(atom == "dump" || atom == "prefix" || atom == "shm_export") {
                 if(cells.size() != 2)
                     ThrowRuntimeError("You must specify a path with the " << atom << " argument");
-                Profiler::profile(atom, ErlUtil::getAsString(env, cells[1]), true);
+                Profiler::profile(atom, ErlUtil::getAsString(env, cells[1]), false, true);
                 return profiler::ATOM_OK;
             }
 
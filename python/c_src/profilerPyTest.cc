@@ -1,24 +1,26 @@
 /**.......................................................................
- * Python file for reading from GCP archive data files.
+ * Python bindings for the profiler.
+ *
+ * Besides the generic profile() entry point, the module provides
+ * Label objects, which keep their label so that start() and stop()
+ * neither convert nor copy it, and apply(), which applies a batch of
+ * caller-timed events from an int64 buffer (such as a numpy array)
+ * without copying it and without holding the GIL.  atomicBins()
+ * returns a read-only view of the live time-resolved atomic counter
+ * bins, which numpy.asarray() wraps without copying.
  */
 #include <Python.h>
-#include <iostream>  
-#include <vector>  
-#include <map>  
+#include <iostream>
+#include <vector>
+#include <map>
 
 #include "PyParser.h"
-#if 0
 #include "Profiler.h"
-#endif
 #include "exceptionutils.h"
 
-//#if DIR_HAVE_NUMPY
-//#include "arrayobject.h"
-//#endif
-
 using namespace std;
 using namespace gcp::python;
-//using namespace profiler;
+using namespace profiler;
 
 /**.......................................................................
  * Entry point from the Python environment
@@ -34,7 +36,8 @@ static PyObject* profile(PyObject* self, PyObject* args)
     if(argc == 2)
       always = PyParser::getBoolVal(PyParser::getArrayItem(args, 1));
 
-    PyParser cells(PyParser::getArrayItem(args, 0));
+    PyObject* cellObj = PyParser::getArrayItem(args, 0);
+    PyParser cells(cellObj);
     std::string atom  = cells.getString((unsigned)0);
 
     //------------------------------------------------------------
@@ -42,7 +45,7 @@ static PyObject* profile(PyObject* self, PyObject* args)
     //------------------------------------------------------------
 
     if(atom == "noop") {
-//      Profiler::noop(cells.getBoolVal((unsigned)1));
+      Profiler::noop(cells.getBoolVal((unsigned)1));
       return Py_BuildValue("s", "ok");
     }
 
@@ -51,8 +54,8 @@ static PyObject* profile(PyObject* self, PyObject* args)
     //------------------------------------------------------------
 
     if(atom == "debug") {
-//        Profiler::profileChar("debug", "", false, false);
-        return Py_BuildValue("s", "ok");
+      Profiler::profileChar("debug", "", false, always);
+      return Py_BuildValue("s", "ok");
     }
 
     //------------------------------------------------------------
@@ -61,24 +64,129 @@ static PyObject* profile(PyObject* self, PyObject* args)
 
     if(atom == "start" || atom == "stop") {
       std::string label  = cells.getString((unsigned)1);
-                
+
       bool perThread = false;
       if(cells.getSize() > 2)
         perThread = cells.getBoolVal((unsigned)2);
-      
-//      uint64_t count = Profiler::profileChar(atom.c_str(), label.c_str(), perThread, always);
-      uint64_t count = 1;
+
+      uint64_t count = Profiler::profileChar(atom.c_str(), label.c_str(), perThread, always);
       return PyLong_FromUnsignedLongLong(count);
     }
 
     //------------------------------------------------------------
-    // dump counters out to disk, or set the prefix dir for output
+    // dump counters out to disk, or set the prefix dir for output.
+    // Dumps write a file, so other Python threads can run meanwhile
     //------------------------------------------------------------
 
     if(atom == "dump" || atom == "prefix") {
       if(cells.getSize() != 2)
         ThrowRuntimeError("You must specify a path with the " << atom << " argument");
-//      Profiler::profileChar(atom.c_str(), cells.getString((unsigned)1).c_str(), false, true);
+
+      std::string path = cells.getString((unsigned)1);
+      std::string error;
+
+      Py_BEGIN_ALLOW_THREADS
+      try {
+        Profiler::profile(atom, path, false, true);
+      } catch(std::exception& err) {
+        error = err.what();
+      }
+      Py_END_ALLOW_THREADS
+
+      if(!error.empty())
+        ThrowRuntimeError(error);
+
+      return Py_BuildValue("s", "ok");
+    }
+
+    //------------------------------------------------------------
+    // Let a label take overlapping intervals
+    //------------------------------------------------------------
+
+    if(atom == "overlap") {
+      if(cells.getSize() != 2)
+        ThrowRuntimeError("You must specify a label with the " << atom << " argument");
+      Profiler::overlap(cells.getString((unsigned)1));
+      return Py_BuildValue("s", "ok");
+    }
+
+    //------------------------------------------------------------
+    // Start a new epoch of counters
+    //------------------------------------------------------------
+
+    if(atom == "reset") {
+      unsigned epoch = 0;
+      std::string error;
+
+      Py_BEGIN_ALLOW_THREADS
+      try {
+        epoch = Profiler::reset();
+      } catch(std::exception& err) {
+        error = err.what();
+      }
+      Py_END_ALLOW_THREADS
+
+      if(!error.empty())
+        ThrowRuntimeError(error);
+
+      return PyLong_FromUnsignedLong(epoch);
+    }
+
+    //------------------------------------------------------------
+    // Time-resolved atomic counters: register a partition (by an
+    // integer id, and a file containing ./data/leveldb/), then
+    // initialize the tags, each a name (a count) or a (name, kind)
+    // tuple, with the number of bins and the bin width (usec)
+    //------------------------------------------------------------
+
+    if(atom == "add_ring_partition") {
+      if(cells.getSize() != 3)
+        ThrowRuntimeError("Usage: profile(('" << atom << "', id, file))");
+      Profiler::addRingPartition(PyLong_AsUnsignedLongLong(PyParser::getArrayItem(cellObj, 1)),
+                                 cells.getString((unsigned)2));
+      return Py_BuildValue("s", "ok");
+    }
+
+    if(atom == "init_atomic_counters") {
+      if(cells.getSize() != 5)
+        ThrowRuntimeError("Usage: profile(('" << atom << "', tags, bufferSize, intervalUs, file))");
+
+      PyObject* tags = PyParser::getArrayItem(cellObj, 1);
+      std::map<std::string, std::string> nameMap;
+
+      for(unsigned i=0; i < PyParser::getSize(tags); i++) {
+        PyObject* tag = PyParser::getArrayItem(tags, i);
+        if(PyParser::isTuple(tag)) {
+          BufferedAtomicCounter::Kind kind;
+          std::string kindStr = PyParser::getSize(tag) == 2 ? PyParser::getString(tag, 1) : "";
+          if(kindStr != "hist" && !BufferedAtomicCounter::kindFromString(kindStr, kind))
+            ThrowRuntimeError("Tags must be name or (name, count | sum | min | max | gauge | hist)");
+          nameMap[PyParser::getString(tag, 0)] = kindStr;
+        } else {
+          nameMap[PyParser::getString(tags, i)] = "count";
+        }
+      }
+
+      Profiler::initializeAtomicCounters(nameMap,
+                                         PyLong_AsUnsignedLong(PyParser::getArrayItem(cellObj, 2)),
+                                         PyLong_AsUnsignedLongLong(PyParser::getArrayItem(cellObj, 3)),
+                                         cells.getString((unsigned)4));
+      return Py_BuildValue("s", "ok");
+    }
+
+    if(atom == "increment_atomic_counter" || atom == "add_atomic_counter") {
+      bool add = atom == "add_atomic_counter";
+      if(cells.getSize() != (add ? 4 : 3))
+        ThrowRuntimeError("Usage: profile(('" << atom << "', id, tag" << (add ? ", value))" : "))"));
+
+      uint64_t partPtr = PyLong_AsUnsignedLongLong(PyParser::getArrayItem(cellObj, 1));
+      std::string tag  = cells.getString((unsigned)2);
+
+      if(add)
+        Profiler::addAtomicCounter(partPtr, tag, PyLong_AsUnsignedLongLong(PyParser::getArrayItem(cellObj, 3)));
+      else
+        Profiler::incrementAtomicCounter(partPtr, tag);
+
       return Py_BuildValue("s", "ok");
     }
 
@@ -87,23 +195,319 @@ static PyObject* profile(PyObject* self, PyObject* args)
   } catch(std::runtime_error& err) {
 
     return Py_BuildValue("s", err.what());
-        
+
   } catch(...) {
     return Py_BuildValue("s", "Caught unhandled exception");
   }
 }
 
+//=======================================================================
+// Label objects
+//=======================================================================
+
+//------------------------------------------------------------
+// A label, converted to a std::string once, when the object is
+// created.  start() and stop() pass that string by reference, hold
+// the GIL throughout (the profiler lock is held for less time than
+// it would take to release and reacquire it) and return None, so
+// they allocate nothing
+//------------------------------------------------------------
+
+typedef struct {
+  PyObject_HEAD
+  std::string* label_;
+  bool perThread_;
+  bool always_;
+  unsigned slot_;
+} LabelObject;
+
+static PyObject* Label_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+  LabelObject* self = (LabelObject*)type->tp_alloc(type, 0);
+
+  if(self) {
+    self->label_     = 0;
+    self->perThread_ = false;
+    self->always_    = false;
+    self->slot_      = 0;
+  }
+
+  return (PyObject*)self;
+}
+
+static int Label_init(LabelObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"name", "perThread", "always", NULL};
+
+  const char* name = 0;
+  int perThread = 0;
+  int always    = 0;
+
+  if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|pp", (char**)kwlist, &name, &perThread, &always))
+    return -1;
+
+  try {
+    delete self->label_;
+    self->label_     = new std::string(name);
+    self->perThread_ = perThread;
+    self->always_    = always;
+    self->slot_      = Profiler::labelSlot(*self->label_);
+  } catch(std::exception& err) {
+    PyErr_SetString(PyExc_RuntimeError, err.what());
+    return -1;
+  }
+
+  return 0;
+}
+
+static bool checkInitialized(LabelObject* self)
+{
+  if(self->label_ == 0) {
+    PyErr_SetString(PyExc_RuntimeError, "Label was not initialized");
+    return false;
+  }
+
+  return true;
+}
+
+static void Label_dealloc(LabelObject* self)
+{
+  delete self->label_;
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Label_start(LabelObject* self, PyObject* unused)
+{
+  if(!checkInitialized(self))
+    return NULL;
+
+  try {
+    Profiler::start(*self->label_, self->perThread_, self->always_);
+  } catch(std::exception& err) {
+    PyErr_SetString(PyExc_RuntimeError, err.what());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject* Label_stop(LabelObject* self, PyObject* unused)
+{
+  if(!checkInitialized(self))
+    return NULL;
+
+  try {
+    Profiler::stop(*self->label_, self->perThread_, self->always_);
+  } catch(std::exception& err) {
+    PyErr_SetString(PyExc_RuntimeError, err.what());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject* Label_enter(LabelObject* self, PyObject* unused)
+{
+  if(Label_start(self, unused) == NULL)
+    return NULL;
+
+  Py_INCREF(self);
+  return (PyObject*)self;
+}
+
+/**.......................................................................
+ * Stop the counter whether or not the block raised, and let any
+ * exception propagate
+ */
+static PyObject* Label_exit(LabelObject* self, PyObject* args)
+{
+  if(Label_stop(self, NULL) == NULL)
+    return NULL;
+
+  Py_RETURN_FALSE;
+}
+
+static PyObject* Label_getName(LabelObject* self, void* closure)
+{
+  if(!checkInitialized(self))
+    return NULL;
+
+  return PyUnicode_FromStringAndSize(self->label_->data(), self->label_->size());
+}
+
+static PyObject* Label_getSlot(LabelObject* self, void* closure)
+{
+  return PyLong_FromUnsignedLong(self->slot_);
+}
+
+static PyMethodDef Label_methods[] = {
+  {"start",     (PyCFunction)Label_start, METH_NOARGS,  "Start the counter"},
+  {"stop",      (PyCFunction)Label_stop,  METH_NOARGS,  "Stop the counter"},
+  {"__enter__", (PyCFunction)Label_enter, METH_NOARGS,  "Start the counter on entering a with block"},
+  {"__exit__",  (PyCFunction)Label_exit,  METH_VARARGS, "Stop the counter on leaving a with block"},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Label_getset[] = {
+  {(char*)"name", (getter)Label_getName, NULL, (char*)"The label", NULL},
+  {(char*)"id",   (getter)Label_getSlot, NULL, (char*)"The label's slot, for events passed to apply()", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject LabelType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "pyProfiler.Label",
+};
+
+//=======================================================================
+// Module functions
+//=======================================================================
+
+/**.......................................................................
+ * Apply a batch of events from a C-contiguous buffer of int64, of
+ * shape (n, 3) or (3n,): (label id, 0 to start or 1 to stop, usec).
+ * The buffer is read in place, with the GIL released
+ */
+static PyObject* applyBatch(PyObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"events", "perThread", "always", NULL};
+
+  PyObject* obj = 0;
+  int perThread = 0;
+  int always    = 0;
+
+  if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|pp", (char**)kwlist, &obj, &perThread, &always))
+    return NULL;
+
+  Py_buffer view;
+  if(PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+    return NULL;
+
+  // Accept the native 64-bit integer formats ('l' is 64 bits on
+  // LP64 platforms, and is what numpy.int64 exports there)
+
+  const char* format = view.format ? view.format : "B";
+  if(*format == '@' || *format == '=' || *format == '<')
+    format++;
+
+  bool intFormat = (format[0] == 'q' || format[0] == 'l') && format[1] == '\0';
+
+  if(!intFormat || view.itemsize != 8) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_TypeError, "Events must be a buffer of int64");
+    return NULL;
+  }
+
+  Py_ssize_t nVal = view.len / view.itemsize;
+
+  if(nVal % 3 != 0 || (view.ndim == 2 && view.shape[1] != 3) || view.ndim > 2) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "Events must be (label id, 0 or 1, usec) triples, of shape (n, 3) or (3n,)");
+    return NULL;
+  }
+
+  std::string error;
+
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    Profiler::applyEvents((const int64_t*)view.buf, nVal / 3, perThread, always);
+  } catch(std::exception& err) {
+    error = err.what();
+  }
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&view);
+
+  if(!error.empty()) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+/**.......................................................................
+ * The profiler's clock, in microseconds, for timing events
+ */
+static PyObject* currentMicroSeconds(PyObject* self, PyObject* args)
+{
+  return PyLong_FromLongLong(Profiler::getCurrentMicroSeconds());
+}
+
+/**.......................................................................
+ * Describe the live atomic counter bins, or return None if the atomic
+ * counters haven't been initialized.  "bins" is a read-only memoryview
+ * of uint64, shape (2, partitions, tags, bins), over the counters
+ * themselves: it is never copied, and reading it later sees the
+ * current counts.  The matrix lives until exit, so the view can be
+ * kept
+ */
+static PyObject* atomicBins(PyObject* self, PyObject* args)
+{
+  Profiler::AtomicBins info;
+
+  if(!Profiler::atomicBins(info))
+    Py_RETURN_NONE;
+
+  Py_ssize_t len = (Py_ssize_t)2 * info.nPartition_ * info.nTag_ * info.nBin_ * sizeof(uint64_t);
+
+  // A zero-length view of anything will do when there is nothing to
+  // count (bins_ is then 0)
+
+  static char empty[sizeof(uint64_t)];
+  PyObject* raw = PyMemoryView_FromMemory(info.bins_ ? (char*)info.bins_ : empty, len, PyBUF_READ);
+  if(raw == NULL)
+    return NULL;
+
+  PyObject* bins = PyObject_CallMethod(raw, "cast", "s(IIII)", "Q", 2U, info.nPartition_, info.nTag_, info.nBin_);
+  Py_DECREF(raw);
+  if(bins == NULL)
+    return NULL;
+
+  PyObject* partitions = PyList_New(info.nPartition_);
+  PyObject* files      = PyList_New(info.nPartition_);
+  PyObject* tags       = PyList_New(info.nTag_);
+  PyObject* kinds      = PyList_New(info.nTag_);
+
+  for(unsigned iPart=0; iPart < info.nPartition_; iPart++) {
+    PyList_SET_ITEM(partitions, iPart, PyLong_FromUnsignedLongLong(info.partitions_[iPart]));
+    PyList_SET_ITEM(files, iPart, PyUnicode_FromString(info.partitionFiles_[iPart].c_str()));
+  }
+
+  for(unsigned iTag=0; iTag < info.nTag_; iTag++) {
+    PyList_SET_ITEM(tags,  iTag, PyUnicode_FromString(info.tags_[iTag].c_str()));
+    PyList_SET_ITEM(kinds, iTag, PyUnicode_FromString(info.kinds_[iTag].c_str()));
+  }
+
+  return Py_BuildValue("{s:N,s:N,s:N,s:N,s:N,s:K,s:K}",
+                       "bins",       bins,
+                       "partitions", partitions,
+                       "files",      files,
+                       "tags",       tags,
+                       "kinds",      kinds,
+                       "minorUs",    (unsigned long long)info.minorIntervalUs_,
+                       "majorUs",    (unsigned long long)info.majorIntervalUs_);
+}
+
 static PyObject* listFunctions(PyObject* self, PyObject* args)
 {
   COUT(std::endl << "Functions available from this module:" << std::endl);
   COUT("     profile");
+  COUT("     Label(name, perThread=False, always=False)");
+  COUT("     apply(events, perThread=False, always=False)");
+  COUT("     now");
+  COUT("     atomicBins");
   COUT("");
   return Py_BuildValue("s", "ok");
 }
 
 static PyMethodDef pyProfiler_methods[] = {
-  {"list",    listFunctions, METH_VARARGS, "Call pyProfiler.list() for a list of functions available from this module."},
-  {"profile", profile,       METH_VARARGS, " \n  main profiler method\n"},
+  {"list",    listFunctions,       METH_VARARGS, "Call pyProfiler.list() for a list of functions available from this module."},
+  {"profile", profile,             METH_VARARGS, " \n  main profiler method\n"},
+  {"apply",   (PyCFunction)(void(*)(void))applyBatch, METH_VARARGS | METH_KEYWORDS,
+   " \n  apply(events, perThread=False, always=False): apply (label id, 0/1, usec) int64 event triples\n"},
+  {"now",     currentMicroSeconds, METH_NOARGS,  " \n  the profiler clock, in microseconds\n"},
+  {"atomicBins", atomicBins,       METH_NOARGS,  " \n  a read-only view of the live atomic counter bins\n"},
   {NULL, NULL, 0, NULL}
 };
 
@@ -115,14 +519,31 @@ static struct PyModuleDef pyProfiler_modDef = {
     pyProfiler_methods
 };
 
-//PyMODINIT_FUNC
-//initpyProfiler(void)
-//{
-//  (void) Py_InitModule("pyProfiler", pyProfiler_methods);
-//}
-
 PyMODINIT_FUNC
 PyInit_pyProfiler(void)
 {
-    return PyModule_Create(&pyProfiler_modDef);
+  LabelType.tp_basicsize = sizeof(LabelObject);
+  LabelType.tp_flags     = Py_TPFLAGS_DEFAULT;
+  LabelType.tp_doc       = "Label(name, perThread=False, always=False): a profiler counter label";
+  LabelType.tp_new       = Label_new;
+  LabelType.tp_init      = (initproc)Label_init;
+  LabelType.tp_dealloc   = (destructor)Label_dealloc;
+  LabelType.tp_methods   = Label_methods;
+  LabelType.tp_getset    = Label_getset;
+
+  if(PyType_Ready(&LabelType) < 0)
+    return NULL;
+
+  PyObject* module = PyModule_Create(&pyProfiler_modDef);
+  if(module == NULL)
+    return NULL;
+
+  Py_INCREF(&LabelType);
+  if(PyModule_AddObject(module, "Label", (PyObject*)&LabelType) < 0) {
+    Py_DECREF(&LabelType);
+    Py_DECREF(module);
+    return NULL;
+  }
+
+  return module;
 }
@@ -0,0 +1,55 @@
+"""
+Python helpers for the pyProfiler extension module.
+
+    import profiler
+
+    req = profiler.Label("request")
+    with req:
+        handle()
+
+    @profiler.timed("parse")
+    def parse(buf):
+        ...
+
+Label objects start and stop a counter without converting or copying
+the label; create them once and keep them.  profiler.apply() takes a
+batch of (label id, 0 to start or 1 to stop, usec) int64 events, such
+as a numpy array of shape (n, 3), timed with profiler.now().
+
+profiler.atomicBins() describes the live time-resolved atomic
+counters; numpy.asarray(info["bins"]) is a read-only array over the
+counters themselves, indexed [buffer, partition, tag, bin].
+"""
+
+import functools
+
+from pyProfiler import Label, apply, atomicBins, now, profile
+
+
+def timed(label, perThread=False, always=False):
+    """
+    Decorator that times each call of a function under label.
+    """
+
+    counter = Label(label, perThread, always)
+
+    def decorate(func):
+        @functools.wraps(func)
+        def wrapper(*args, **kwargs):
+            with counter:
+                return func(*args, **kwargs)
+        return wrapper
+
+    return decorate
+
+
+def currentBin(info, usec=None):
+    """
+    The (buffer, bin) indices of info["bins"] being incremented at
+    usec (by default, now), for info as returned by atomicBins().
+    """
+
+    if usec is None:
+        usec = now()
+
+    return (usec // info["majorUs"]) % 2, (usec % info["majorUs"]) // info["minorUs"]
@@ -0,0 +1,124 @@
+"""
+Tests of the pyProfiler extension's live atomic counter view.
+
+    cd python; make test
+
+The view is a plain memoryview, so numpy is not needed.  Output (the
+atomic counter file, and the report written at exit) goes to the
+directory holding the extension, which make clean removes.
+"""
+
+import os
+import time
+import unittest
+
+import profiler
+import pyProfiler
+
+OUTDIR = os.path.dirname(os.path.abspath(pyProfiler.__file__))
+
+MIN_EMPTY = 2**64 - 1
+
+
+def waitForFreshInterval(info):
+    """
+    Wait until at least half of the current major interval remains,
+    so that counts made now are still in the live buffer when read.
+    """
+
+    while profiler.currentBin(info)[1] >= info["bins"].shape[3] // 2:
+        time.sleep(info["minorUs"] / 1e6 / 4)
+
+
+class AtomicBinsTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        profiler.profile(("prefix", OUTDIR))
+
+        cls.before = profiler.atomicBins()
+
+        profiler.profile(("add_ring_partition", 100, "./data/leveldb/p100"))
+        profiler.profile(("add_ring_partition", 200, "./data/leveldb/p200"))
+
+        # 10 bins of 100 ms
+
+        ret = profiler.profile(("init_atomic_counters",
+                                ["puts", ("bytes", "sum"), ("lo", "min"), ("lat", "hist")],
+                                10, 100000, os.path.join(OUTDIR, "atomic_test.txt")))
+        assert ret == "ok", ret
+
+        # Added after the counters were initialized, so not in the view
+
+        profiler.profile(("add_ring_partition", 300, "./data/leveldb/p300"))
+
+        cls.info = profiler.atomicBins()
+
+    def index(self, tag):
+        return self.info["tags"].index(tag)
+
+    def test_none_before_init(self):
+        self.assertIsNone(self.before)
+
+    def test_layout(self):
+        info = self.info
+        self.assertEqual(info["partitions"], [100, 200])
+        self.assertEqual(info["files"], ["p100", "p200"])
+        self.assertEqual(sorted(info["tags"]), ["bytes", "lo", "puts"])
+        self.assertEqual(info["kinds"][self.index("bytes")], "sum")
+        self.assertEqual(info["kinds"][self.index("lo")], "min")
+        self.assertEqual(info["kinds"][self.index("puts")], "count")
+        self.assertEqual(info["minorUs"], 100000)
+        self.assertEqual(info["majorUs"], 1000000)
+        self.assertEqual(info["bins"].shape, (2, 2, 3, 10))
+        self.assertEqual(info["bins"].format, "Q")
+
+    def test_read_only(self):
+        bins = self.info["bins"]
+        with self.assertRaises(TypeError):
+            bins[0, 0, 0, 0] = 1
+
+    def test_live_counts(self):
+        info = self.info
+        bins = info["bins"]
+        puts, nbytes, lo = self.index("puts"), self.index("bytes"), self.index("lo")
+
+        waitForFreshInterval(info)
+        buf, first = profiler.currentBin(info)
+
+        for i in range(7):
+            profiler.profile(("increment_atomic_counter", 200, "puts"))
+        profiler.profile(("add_atomic_counter", 100, "bytes", 5))
+        profiler.profile(("add_atomic_counter", 100, "bytes", 6))
+        profiler.profile(("add_atomic_counter", 100, "lo", 9))
+        profiler.profile(("add_atomic_counter", 100, "lo", 4))
+        profiler.profile(("increment_atomic_counter", 300, "puts"))
+
+        last = profiler.currentBin(info)[1]
+        counted = range(first, last + 1)
+
+        # The view taken at setup shows the new counts without being
+        # fetched again
+
+        self.assertEqual(sum(bins[buf, 1, puts, b] for b in counted), 7)
+        self.assertEqual(sum(bins[buf, 0, puts, b] for b in counted), 0)
+        self.assertEqual(sum(bins[buf, 0, nbytes, b] for b in counted), 11)
+        self.assertEqual(min(bins[buf, 0, lo, b] for b in counted), 4)
+        self.assertEqual(bins[buf, 1, lo, first], MIN_EMPTY)
+
+    def test_current_bin(self):
+        info = self.info
+        major, minor = info["majorUs"], info["minorUs"]
+        self.assertEqual(profiler.currentBin(info, 0), (0, 0))
+        self.assertEqual(profiler.currentBin(info, major + 3 * minor + 1), (1, 3))
+        self.assertEqual(profiler.currentBin(info, 2 * major - 1), (1, 9))
+
+    def test_bad_commands(self):
+        self.assertTrue(profiler.profile(("init_atomic_counters", ["puts"])).startswith("Usage"))
+        self.assertTrue(profiler.profile(("add_atomic_counter", 100, "bytes")).startswith("Usage"))
+        self.assertTrue(profiler.profile(("init_atomic_counters", [("x", "median")], 10, 100000,
+                                          os.path.join(OUTDIR, "bad.txt"))).startswith("Tags must be"))
+
+
+if __name__ == "__main__":
+    unittest.main()
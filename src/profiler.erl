@@ -98,6 +98,53 @@
 %%        profiling calls can still be manually made by using the
 %%        profile/2 interface, with the second argument set to true.
 %%
+%%    {reset}
+%%
+%%        Start a new epoch: write the counters accumulated so far to
+%%        <prefix>/<instance>_epochN.txt and count from zero.  Returns
+%%        the new epoch number.  Intervals open at the reset are
+%%        added to the epoch they started in when they stop.
+%%
+%%    {overlap, Label}
+%%
+%%        Let the shared counter for Label take any number of
+%%        overlapping intervals, and report the number active, the
+%%        peak, and the busy time (union of intervals) as active,
+%%        peakactive and busyusec rows.  Declare before first use.
+%%
+%%    {span_begin, Label}
+%%
+%%        Begin an async span, returning a token that {span_end,
+%%        Token} ends from any process or thread.  The elapsed time
+%%        is added to the shared counter for Label.  Returns 0 if
+%%        too many spans are open.
+%%
+%%    {enable_group, Pattern} | {disable_group, Pattern}
+%%
+%%        Turn start/stop counters on or off by label prefix, e.g.
+%%        "compaction.*", or "*" for all labels.  Groups nest, so
+%%        "compaction.level0.*" can be set apart from "compaction.*".
+%%        Unlike noop, this also applies to profile/2 calls.
+%%
+%%    {cputime, true | false}
+%%
+%%        If true, also sample per-thread CPU time and context
+%%        switches on start/stop, and report cpuusec, offcpuusec,
+%%        vcsw and ivcsw rows in the profiler output.
+%%
+%%    {perfcounters, true | false}
+%%
+%%        If true, also read per-thread hardware counters (cycles,
+%%        instructions, LLC misses, branch misses) on start/stop.
+%%        Degrades to a no-op if perf events are not available.
+%%
+%%    {alloctrack, true | false}
+%%
+%%        If true, attribute per-thread heap allocations to running
+%%        counters, and report allocs, allocbytes and frees rows.
+%%        Requires a build with -DPROFILER_ALLOC_HOOKS, with the
+%%        library preloaded.
+%%
 %%    {prefix, 'some/path'} 
 %%
 %%        Set the directory prefix for profiler output files.  On
@@ -105,6 +152,79 @@
 %%        single file called pid'_profiler.txt', where pid is the
 %%        process id.
 %%
+%%    {shm_export, "/name"}
+%%
+%%        Publish live counter values to the named POSIX
+%%        shared-memory segment, for out-of-process readers such as
+%%        tools/bin/profshm.  An empty name stops the export.
+%%
+%%    {add_atomic_counter, PartPtr, Tag, Value}
+%%
+%%        Accumulate Value into the current bin of an atomic counter
+%%        tag initialized as {Tag, sum | min | max | gauge}, or
+%%        record it in the log2 histogram of a {Tag, hist} tag.
+%%
+%%    {add_counter_family, Name, [{Dim, Size} | {Dim, [Label]}], File}
+%%
+%%        Declare a family of time-resolved counters over the given
+%%        dimensions, written to File each major interval.  Returns
+%%        an integer id.  Atomic counters must be initialized first.
+%%
+%%    {inc_counter_family, Id, {I1, I2, ...}}
+%%
+%%        Increment the family cell at the given (0-based) indices.
+%%
+%%    {add_to_counter_family, Id, {I1, I2, ...}, Value}
+%%
+%%        Accumulate Value into the cell, for families declared with
+%%        a fifth Kind element (sum | min | max | gauge).
+%%
+%%    {atomic_topk, K} | {atomic_topk, K, true | false}
+%%
+%%        Write the K heaviest partitions per tag to the atomic
+%%        counter file each interval.  If the third element is
+%%        true, bins are only written for those partitions.  K = 0
+%%        turns this off.
+%%
+%%    {atomic_format, dense | sparse}
+%%
+%%        Write every bin of each interval to the atomic counter
+%%        file (dense, the default), or only the runs of non-zero
+%%        bins (sparse).
+%%
+%%    {limits, MaxLabels, MaxThreads}
+%%
+%%        Cap the number of distinct counter labels and of threads
+%%        with per-thread counters.  Labels beyond the cap are
+%%        counted under '(overflow)', and threads beyond it under
+%%        the shared 0x0 counter of their label.
+%%
+%%    {format, text | json | csv | prometheus | binary}
+%%
+%%        Select the format of files written by {dump, ...} and at
+%%        exit.
+%%
+%%    {scrape, "unix:/path" | "tcp:Port" | ""}
+%%
+%%        Serve counters from a profiler thread on a Unix socket or
+%%        loopback TCP port (HTTP GET /, /json, /csv, /metrics or
+%%        /binary, or a format name on a line).  Returns the bound
+%%        port.  An empty address stops the endpoint.
+%%
+%%    {checkpoint, IntervalMs} | {checkpoint, IntervalMs, OnSignal}
+%%
+%%        Rewrite the file written at exit every IntervalMs, and
+%%        also on SIGTERM/SIGABRT if OnSignal is true.  The file is
+%%        replaced atomically.  {checkpoint, 0} stops.
+%%
+%%    {session_start, Name, DurationMs, Opts}
+%%
+%%        Profile for DurationMs with profiling on and the options
+%%        in Opts (cputime, perfcounters, alloctrack, {enable_group,
+%%        Pattern}), then write what was counted in that time to
+%%        <prefix>/Name_session.txt and restore the previous
+%%        settings.  {session_stop} ends the session early.
+%%
 %%    {dump, 'myfile'}  
 %%
 %%        Manually dump profiler stats to the file 'myfile'
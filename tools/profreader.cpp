@@ -0,0 +1,1129 @@
+/**.......................................................................
+ * profreader: read and analyze profiler output files.
+ *
+ * Usage:
+ *
+ *   profreader [options] file            Summarize a profile or atomic counter file
+ *   profreader [options] -d file1 file2  Compare two runs
+ *
+ * Options:
+ *
+ *   -n N        Number of hot partitions to list (default 10)
+ *   -i usec     Major interval of an atomic counter file, if it can't
+ *               be inferred from consecutive timestamps
+ *
+ * The file type is detected from its contents: profile files (written
+ * by {dump, File} or at exit) start with 'totalcount', and atomic
+ * counter files (written by init_atomic_counters) with 'partitions:'.
+ * Counter family files (add_counter_family), which start with
+ * 'family:', are read as atomic counter files with one 'partition'
+ * per cell and the family name as the only tag.
+ * The 'top' and 'hot' lines written by {atomic_topk, ...} and the
+ * 'sparse' intervals written by {atomic_format, sparse} are
+ * understood; partitions skipped as cold count as zero.  Histogram
+ * tags ('hist' lines) are merged across partitions and bins, and the
+ * partition/bin combinations with the highest p99 are listed.
+
+ *
+ * Files are streamed a token at a time, so memory use depends only on
+ * the number of labels/threads or partitions/tags, not on the length
+ * of the file.
+ */
+#include "exceptionutils.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+//=======================================================================
+// A buffered whitespace tokenizer over a FILE*.  Tokens that start
+// with a single quote extend to the next closing quote, so that
+// quoted labels may contain whitespace
+//=======================================================================
+
+class TokenReader {
+public:
+
+    TokenReader(std::string fileName) {
+        fileName_ = fileName;
+        fp_ = fopen(fileName.c_str(), "rb");
+        if(!fp_)
+            ThrowSysError("Unable to open " << fileName);
+        buf_.resize(1024*1024);
+        pos_ = len_ = 0;
+        atEol_ = false;
+    }
+
+    ~TokenReader() {
+        if(fp_)
+            fclose(fp_);
+    }
+
+    // Read the next token into tok.  Returns false at end of file.
+    // atEol() is true if the token was the last on its line
+    
+    bool next(std::string& tok) {
+        tok.clear();
+        int c;
+
+        // Skip whitespace
+
+        do {
+            c = get();
+            if(c < 0)
+                return false;
+        } while(isspace(c));
+
+        bool quoted = (c == '\'');
+        tok.push_back(c);
+
+        while((c = get()) >= 0) {
+            if(quoted) {
+                tok.push_back(c);
+                if(c == '\'' && tok.size() > 1)
+                    quoted = false;
+            } else if(isspace(c)) {
+                break;
+            } else {
+                tok.push_back(c);
+            }
+        }
+
+        // Peek past trailing blanks to see if the line ends here
+        
+        while(c == ' ' || c == '\t' || c == '\r')
+            c = get();
+
+        atEol_ = (c == '\n' || c < 0);
+
+        if(c >= 0 && !isspace(c))
+            unget();
+        
+        return true;
+    }
+
+    bool atEol() {
+        return atEol_;
+    }
+
+    const std::string& fileName() {
+        return fileName_;
+    }
+    
+private:
+
+    int get() {
+        if(pos_ == len_) {
+            len_ = fread(&buf_[0], 1, buf_.size(), fp_);
+            pos_ = 0;
+            if(len_ == 0)
+                return -1;
+        }
+        return (unsigned char)buf_[pos_++];
+    }
+
+    void unget() {
+        pos_--;
+    }
+    
+    std::string fileName_;
+    FILE* fp_;
+    std::vector<char> buf_;
+    size_t pos_;
+    size_t len_;
+    bool atEol_;
+};
+
+static uint64_t toUint(const std::string& tok)
+{
+    return strtoull(tok.c_str(), 0, 10);
+}
+
+static std::string stripColon(const std::string& tok)
+{
+    if(!tok.empty() && tok[tok.size()-1] == ':')
+        return tok.substr(0, tok.size()-1);
+    return tok;
+}
+
+//=======================================================================
+// A fixed-size log-linear histogram, used to estimate percentiles in
+// constant memory.  Values below 4 are exact; above that, each power
+// of two is split into 4 sub-buckets (< 25% relative error)
+//=======================================================================
+
+#define HIST_NBUCKET 256
+
+struct Histogram {
+    uint64_t counts_[HIST_NBUCKET];
+    uint64_t n_;
+    uint64_t max_;
+
+    Histogram() {
+        memset(counts_, 0, sizeof(counts_));
+        n_   = 0;
+        max_ = 0;
+    }
+
+    static unsigned bucket(uint64_t val) {
+        if(val < 4)
+            return val;
+        unsigned e = 63 - __builtin_clzll(val);
+        unsigned sub = (val >> (e-2)) & 3;
+        return 4 * (e-1) + sub;
+    }
+
+    static uint64_t bucketUpper(unsigned bucket) {
+        if(bucket < 4)
+            return bucket;
+        unsigned e = bucket/4 + 1;
+        unsigned sub = bucket % 4;
+        return ((uint64_t)(4 + sub + 1) << (e-2)) - 1;
+    }
+
+    void add(uint64_t val) {
+        counts_[bucket(val)]++;
+        n_++;
+        if(val > max_)
+            max_ = val;
+    }
+
+    uint64_t percentile(double pct) {
+        if(n_ == 0)
+            return 0;
+        uint64_t target = (uint64_t)(pct / 100 * n_);
+        if(target >= n_)
+            target = n_ - 1;
+        uint64_t sum = 0;
+        for(unsigned i=0; i < HIST_NBUCKET; i++) {
+            sum += counts_[i];
+            if(sum > target)
+                return std::min(bucketUpper(i), max_);
+        }
+        return max_;
+    }
+};
+
+//=======================================================================
+// Profile files
+//=======================================================================
+
+struct LabelStats {
+    std::map<std::string, int64_t> rows_;
+};
+
+struct ProfileSummary {
+    uint64_t totalCount_;
+    std::vector<std::string> labels_;
+    std::vector<std::string> rowNames_;
+    std::map<std::string, LabelStats> stats_;
+    unsigned nWarnings_;
+    uint64_t rejectedLabels_;
+    uint64_t rejectedThreads_;
+    
+    ProfileSummary() {
+        totalCount_      = 0;
+        nWarnings_       = 0;
+        rejectedLabels_  = 0;
+        rejectedThreads_ = 0;
+    }
+};
+
+/**.......................................................................
+ * Sum each row type (count, usec, cpuusec, ...) over threads, per
+ * label.  Ratio rows (ipc etc.) are recomputed from their
+ * constituents rather than summed
+ */
+static void readProfile(TokenReader& reader, ProfileSummary& summary)
+{
+    std::string tok;
+
+    while(reader.next(tok)) {
+
+        if(tok == "totalcount") {
+            reader.next(tok);
+            summary.totalCount_ = toUint(tok);
+
+        } else if(tok == "rejected") {
+
+            // Lookups redirected by the profiler's label and thread
+            // limits
+            
+            if(reader.next(tok))
+                summary.rejectedLabels_ = toUint(tok);
+            if(reader.next(tok))
+                summary.rejectedThreads_ = toUint(tok);
+
+        } else if(tok == "label") {
+            while(!reader.atEol() && reader.next(tok)) {
+                if(tok.size() > 1 && tok[0] == '\'')
+                    tok = tok.substr(1, tok.size()-2);
+                summary.labels_.push_back(tok);
+            }
+            
+        } else if(tok == "WARNING:") {
+            summary.nWarnings_++;
+            while(!reader.atEol() && reader.next(tok))
+                ;
+            
+        } else {
+
+            // A row: name threadId value value ...
+            
+            std::string row = tok;
+            bool ratio = (row == "ipc" || row == "llcmpki" || row == "brmpki");
+
+            if(!ratio && std::find(summary.rowNames_.begin(), summary.rowNames_.end(), row) == summary.rowNames_.end())
+                summary.rowNames_.push_back(row);
+
+            if(reader.atEol() || !reader.next(tok))
+                continue;
+
+            for(unsigned i=0; !reader.atEol() && reader.next(tok); i++) {
+                if(!ratio && i < summary.labels_.size())
+                    summary.stats_[summary.labels_[i]].rows_[row] += strtoll(tok.c_str(), 0, 10);
+            }
+        }
+    }
+}
+
+static void printProfile(ProfileSummary& summary)
+{
+    cout << "totalcount " << summary.totalCount_ << " labels " << summary.labels_.size()
+         << " warnings " << summary.nWarnings_ << endl;
+
+    if(summary.rejectedLabels_ > 0 || summary.rejectedThreads_ > 0)
+        cout << "rejected by limits: " << summary.rejectedLabels_ << " label and "
+             << summary.rejectedThreads_ << " thread lookups (see '(overflow)')" << endl;
+
+    cout << setw(32) << left << "label" << right;
+    for(unsigned i=0; i < summary.rowNames_.size(); i++)
+        cout << setw(14) << summary.rowNames_[i];
+    cout << endl;
+
+    for(unsigned iLabel=0; iLabel < summary.labels_.size(); iLabel++) {
+        LabelStats& stats = summary.stats_[summary.labels_[iLabel]];
+        cout << setw(32) << left << summary.labels_[iLabel] << right;
+        for(unsigned i=0; i < summary.rowNames_.size(); i++)
+            cout << setw(14) << stats.rows_[summary.rowNames_[i]];
+        cout << endl;
+    }
+}
+
+static void diffProfile(ProfileSummary& a, ProfileSummary& b)
+{
+    std::vector<std::string> labels = a.labels_;
+    for(unsigned i=0; i < b.labels_.size(); i++)
+        if(a.stats_.find(b.labels_[i]) == a.stats_.end())
+            labels.push_back(b.labels_[i]);
+
+    cout << setw(32) << left << "label" << right
+         << setw(14) << "usec A" << setw(14) << "usec B" << setw(14) << "delta" << setw(10) << "ratio" << endl;
+
+    for(unsigned i=0; i < labels.size(); i++) {
+        int64_t usecA = a.stats_[labels[i]].rows_["usec"];
+        int64_t usecB = b.stats_[labels[i]].rows_["usec"];
+        cout << setw(32) << left << labels[i] << right
+             << setw(14) << usecA << setw(14) << usecB << setw(14) << (usecB - usecA);
+        if(usecA > 0)
+            cout << setw(10) << fixed << setprecision(3) << (double)usecB / usecA;
+        else
+            cout << setw(10) << "-";
+        cout << endl;
+    }
+}
+
+//=======================================================================
+// Atomic counter files
+//=======================================================================
+
+//-----------------------------------------------------------------------
+// Histogram tags: 32 log2 buckets per partition per bin, as written
+// by util/BufferedHistogram.  Bucket 0 holds zeros, and bucket i > 0
+// values in [2^(i-1), 2^i)
+//-----------------------------------------------------------------------
+
+#define LOG2_NBUCKET 32
+
+static uint64_t log2BucketUpper(unsigned bucket)
+{
+    return bucket == 0 ? 0 : ((uint64_t)1 << bucket) - 1;
+}
+
+/**.......................................................................
+ * Return the upper bound of the bucket containing the p'th percentile
+ */
+static uint64_t log2Percentile(const uint64_t* counts, double p)
+{
+    uint64_t n = 0;
+    for(unsigned i=0; i < LOG2_NBUCKET; i++)
+        n += counts[i];
+
+    if(n == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(p / 100 * n);
+    uint64_t sum = 0;
+    for(unsigned i=0; i < LOG2_NBUCKET; i++) {
+        sum += counts[i];
+        if(sum > target)
+            return log2BucketUpper(i);
+    }
+    return log2BucketUpper(LOG2_NBUCKET-1);
+}
+
+// One partition x bin of one interval, ranked by p99
+
+struct HistSpike {
+    uint64_t p99_;
+    uint64_t count_;
+    uint64_t timestamp_;
+    unsigned part_;
+    unsigned bin_;
+
+    bool operator<(const HistSpike& spike) const {
+        return p99_ > spike.p99_ || (p99_ == spike.p99_ && count_ > spike.count_);
+    }
+};
+
+struct HistTagSummary {
+    std::string name_;
+    std::vector<uint64_t> merged_;      // LOG2_NBUCKET
+    std::vector<uint64_t> partMerged_;  // nPart x LOG2_NBUCKET
+    std::vector<HistSpike> spikes_;     // the worst p99s seen
+};
+
+struct AtomicSummary {
+    std::vector<std::string> partitions_;
+    std::vector<std::string> tags_;
+
+    // Per-tag kinds (count, sum, min, max, gauge), if the file has a
+    // 'kinds:' line.  Totals and rates are only meaningful for count
+    // and sum
+    
+    std::vector<std::string> kinds_;
+    unsigned nBins_;
+    uint64_t nIntervals_;
+    uint64_t firstTimestamp_;
+    uint64_t lastTimestamp_;
+    uint64_t majorIntervalUs_;
+
+    // Per partition x tag totals, and the distribution of per-bin
+    // counts summed over partitions, per tag
+    
+    std::vector<uint64_t> totals_;
+    std::vector<Histogram> tagBinHists_;
+    std::vector<Histogram> partTagBinHists_;
+
+    // Number of intervals in which each partition x tag appeared in
+    // a 'top' line, and the number of 'top' lines per tag
+    
+    std::vector<uint64_t> topHits_;
+    std::vector<uint64_t> nTopIntervals_;
+
+    std::vector<HistTagSummary> hists_;
+    unsigned nTopSpikes_;
+
+    AtomicSummary() {
+        nBins_           = 0;
+        nIntervals_      = 0;
+        firstTimestamp_  = 0;
+        lastTimestamp_   = 0;
+        majorIntervalUs_ = 0;
+        nTopSpikes_      = 10;
+    }
+
+    unsigned index(unsigned iPart, unsigned iTag) {
+        return iPart * tags_.size() + iTag;
+    }
+
+    double seconds() {
+        return (double)nIntervals_ * majorIntervalUs_ / 1e6;
+    }
+
+    bool isAdditive(unsigned iTag) {
+        return iTag >= kinds_.size() || kinds_[iTag] == "count" || kinds_[iTag] == "sum";
+    }
+};
+
+/**.......................................................................
+ * Process one interval's values (ordered by partition, then tag,
+ * then bin)
+ */
+static void addInterval(AtomicSummary& summary, std::vector<uint64_t>& values)
+{
+    unsigned nPart = summary.partitions_.size();
+    unsigned nTag  = summary.tags_.size();
+
+    // A file with only histogram tags has empty intervals
+    
+    if(nTag == 0 && values.empty()) {
+        summary.nIntervals_++;
+        return;
+    }
+    
+    if(nPart == 0 || nTag == 0 || values.size() % (nPart * nTag) != 0)
+        ThrowRuntimeError("Interval has " << values.size() << " values, which is not a multiple of "
+                          << nPart << " partitions x " << nTag << " tags");
+
+    unsigned nBins = values.size() / (nPart * nTag);
+
+    if(summary.nBins_ == 0) {
+        summary.nBins_ = nBins;
+        summary.totals_.resize(nPart * nTag);
+        summary.tagBinHists_.resize(nTag);
+        summary.partTagBinHists_.resize(nPart * nTag);
+    } else if(nBins != summary.nBins_) {
+        ThrowRuntimeError("Inconsistent number of bins: " << nBins << " vs " << summary.nBins_);
+    }
+    
+    // Per-bin values are combined across partitions by summing them,
+    // except for min tags (the smallest non-zero value is taken) and
+    // max/gauge tags (the largest)
+    
+    for(unsigned iTag=0; iTag < nTag; iTag++) {
+        bool additive = summary.isAdditive(iTag);
+        bool isMin    = iTag < summary.kinds_.size() && summary.kinds_[iTag] == "min";
+        for(unsigned iBin=0; iBin < nBins; iBin++) {
+            uint64_t binSum = 0;
+            for(unsigned iPart=0; iPart < nPart; iPart++) {
+                uint64_t val = values[(iPart * nTag + iTag) * nBins + iBin];
+                summary.totals_[summary.index(iPart, iTag)] += val;
+                summary.partTagBinHists_[summary.index(iPart, iTag)].add(val);
+                if(additive)
+                    binSum += val;
+                else if(isMin)
+                    binSum = (binSum == 0 || (val > 0 && val < binSum)) ? val : binSum;
+                else
+                    binSum = std::max(binSum, val);
+            }
+            summary.tagBinHists_[iTag].add(binSum);
+        }
+    }
+
+    summary.nIntervals_++;
+}
+
+static void addTimestamp(AtomicSummary& summary, uint64_t timestamp)
+{
+    if(summary.nIntervals_ == 0) {
+        summary.firstTimestamp_ = timestamp;
+    } else if(timestamp > summary.lastTimestamp_) {
+        uint64_t delta = timestamp - summary.lastTimestamp_;
+        if(summary.majorIntervalUs_ == 0 || delta < summary.majorIntervalUs_)
+            summary.majorIntervalUs_ = delta;
+    }
+    summary.lastTimestamp_ = timestamp;
+}
+
+/**.......................................................................
+ * Name each cell of a counter family from its 'dims:' header, e.g.
+ * "op=get,client=3", last dimension varying fastest
+ */
+static void readFamilyDims(TokenReader& reader, std::vector<std::string>& cells)
+{
+    std::string tok;
+    cells.assign(1, "");
+
+    while(!reader.atEol() && reader.next(tok)) {
+
+        size_t eq = tok.find('=');
+        if(eq == std::string::npos)
+            ThrowRuntimeError("Malformed dimension '" << tok << "'");
+
+        std::string dimName = tok.substr(0, eq);
+        std::string spec    = tok.substr(eq+1);
+        std::vector<std::string> labels;
+
+        // Either a size, or a comma-separated list of labels
+        
+        if(spec.find_first_not_of("0123456789") == std::string::npos) {
+            unsigned size = strtoul(spec.c_str(), 0, 10);
+            for(unsigned i=0; i < size; i++) {
+                std::ostringstream os;
+                os << i;
+                labels.push_back(os.str());
+            }
+        } else {
+            size_t start = 0, comma;
+            while((comma = spec.find(',', start)) != std::string::npos) {
+                labels.push_back(spec.substr(start, comma - start));
+                start = comma + 1;
+            }
+            labels.push_back(spec.substr(start));
+        }
+
+        std::vector<std::string> next;
+        for(unsigned i=0; i < cells.size(); i++) {
+            for(unsigned j=0; j < labels.size(); j++)
+                next.push_back(cells[i] + (cells[i].empty() ? "" : ",") + dimName + "=" + labels[j]);
+        }
+        cells.swap(next);
+    }
+}
+
+/**.......................................................................
+ * Expand an interval written only for the partitions in hot to the
+ * full partition x tag x bin layout, with zeros for the rest
+ */
+static void expandHot(AtomicSummary& summary, std::vector<unsigned>& hot, std::vector<uint64_t>& values)
+{
+    unsigned nPart = summary.partitions_.size();
+    unsigned nTag  = summary.tags_.size();
+    unsigned nBins = summary.nBins_;
+
+    if(hot.size() > 0) {
+        if(nTag == 0 || values.size() % (hot.size() * nTag) != 0)
+            ThrowRuntimeError("Interval has " << values.size() << " values, which is not a multiple of "
+                              << hot.size() << " hot partitions x " << nTag << " tags");
+        nBins = values.size() / (hot.size() * nTag);
+    }
+
+    std::vector<uint64_t> full((size_t)nPart * nTag * nBins, 0);
+    unsigned nPerPart = nTag * nBins;
+    
+    for(unsigned i=0; i < hot.size(); i++) {
+        if(hot[i] >= nPart)
+            ThrowRuntimeError("Hot partition index " << hot[i] << " out of range");
+        std::copy(values.begin() + i * nPerPart, values.begin() + (i+1) * nPerPart,
+                  full.begin() + hot[i] * nPerPart);
+    }
+
+    values.swap(full);
+}
+
+/**.......................................................................
+ * Parse the runs of a sparse interval (gap:v,v gap:v ...) into a
+ * zero-filled vector of nValues
+ */
+static void readSparse(TokenReader& reader, uint64_t nValues, std::vector<uint64_t>& values)
+{
+    std::string tok;
+    values.assign(nValues, 0);
+    uint64_t pos = 0;
+
+    while(!reader.atEol() && reader.next(tok)) {
+
+        const char* ptr = tok.c_str();
+        char* end = 0;
+
+        pos += strtoull(ptr, &end, 10);
+        if(*end != ':')
+            ThrowRuntimeError("Malformed sparse run '" << tok << "'");
+
+        do {
+            ptr = end + 1;
+            if(pos >= nValues)
+                ThrowRuntimeError("Sparse run '" << tok << "' overruns " << nValues << " values");
+            values[pos++] = strtoull(ptr, &end, 10);
+        } while(*end == ',');
+    }
+}
+
+/**.......................................................................
+ * Add an interval, expanding it first if it was preceded by a 'hot'
+ * line
+ */
+static void finishInterval(AtomicSummary& summary, uint64_t timestamp, std::vector<uint64_t>& values,
+                           std::vector<unsigned>& hot, bool& haveHot)
+{
+    addTimestamp(summary, timestamp);
+
+    if(haveHot) {
+        haveHot = false;
+
+        // An interval with no hot partitions carries no information
+        // about the number of bins, so can't be expanded until the
+        // first full interval is seen
+                
+        if(hot.empty() && summary.nBins_ == 0) {
+            summary.nIntervals_++;
+            return;
+        }
+                
+        expandHot(summary, hot, values);
+    }
+            
+    addInterval(summary, values);
+}
+
+/**.......................................................................
+ * Merge one interval of a histogram tag (partition x bin x bucket)
+ * into its summary, keeping the nTopSpikes_ worst per-bin p99s
+ */
+static void addHistInterval(AtomicSummary& summary, HistTagSummary& hist, uint64_t timestamp,
+                            std::vector<uint64_t>& values)
+{
+    unsigned nPart = summary.partitions_.size();
+
+    if(nPart == 0 || values.size() % (nPart * LOG2_NBUCKET) != 0)
+        ThrowRuntimeError("Histogram " << hist.name_ << " has " << values.size()
+                          << " values, which is not a multiple of " << nPart
+                          << " partitions x " << LOG2_NBUCKET << " buckets");
+
+    unsigned nBins = values.size() / (nPart * LOG2_NBUCKET);
+
+    // Counters and histograms share a bin size, but a file may have
+    // only histograms
+
+    if(summary.tags_.empty())
+        summary.nBins_ = nBins;
+    
+    hist.merged_.resize(LOG2_NBUCKET);
+    hist.partMerged_.resize(nPart * LOG2_NBUCKET);
+    
+    for(unsigned iPart=0; iPart < nPart; iPart++) {
+        for(unsigned iBin=0; iBin < nBins; iBin++) {
+
+            const uint64_t* counts = &values[(iPart * nBins + iBin) * LOG2_NBUCKET];
+            uint64_t n = 0;
+            
+            for(unsigned i=0; i < LOG2_NBUCKET; i++) {
+                hist.merged_[i] += counts[i];
+                hist.partMerged_[iPart * LOG2_NBUCKET + i] += counts[i];
+                n += counts[i];
+            }
+
+            if(n == 0)
+                continue;
+
+            HistSpike spike;
+            spike.p99_       = log2Percentile(counts, 99);
+            spike.count_     = n;
+            spike.timestamp_ = timestamp;
+            spike.part_      = iPart;
+            spike.bin_       = iBin;
+
+            // Keep the list bounded: replace the least bad entry if
+            // this one is worse
+            
+            if(hist.spikes_.size() < summary.nTopSpikes_) {
+                hist.spikes_.push_back(spike);
+            } else if(!hist.spikes_.empty()) {
+                std::vector<HistSpike>::iterator least = std::max_element(hist.spikes_.begin(), hist.spikes_.end());
+                if(spike < *least)
+                    *least = spike;
+            }
+        }
+    }
+}
+
+static void readAtomic(TokenReader& reader, AtomicSummary& summary, uint64_t majorIntervalUs)
+{
+    std::string tok;
+    std::vector<uint64_t> values;
+    std::vector<unsigned> hot;
+    bool haveHot = false;
+    
+    while(reader.next(tok)) {
+
+        if(tok == "partitions:") {
+            summary.partitions_.clear();
+            while(!reader.atEol() && reader.next(tok))
+                summary.partitions_.push_back(tok);
+
+        } else if(tok == "tags:") {
+            summary.tags_.clear();
+            while(!reader.atEol() && reader.next(tok))
+                summary.tags_.push_back(tok);
+
+        } else if(tok == "hists:") {
+            summary.hists_.clear();
+            while(!reader.atEol() && reader.next(tok)) {
+                HistTagSummary hist;
+                hist.name_ = tok;
+                summary.hists_.push_back(hist);
+            }
+
+        } else if(tok == "hist") {
+
+            // hist timestamp tag nValues: gap:v,v gap:v ...
+
+            std::string tag;
+            reader.next(tok);
+            uint64_t timestamp = toUint(tok);
+            reader.next(tag);
+            reader.next(tok);
+            readSparse(reader, toUint(stripColon(tok)), values);
+
+            unsigned iHist=0;
+            while(iHist < summary.hists_.size() && summary.hists_[iHist].name_ != tag)
+                iHist++;
+
+            if(iHist == summary.hists_.size())
+                ThrowRuntimeError("Unknown histogram tag '" << tag << "'");
+
+            addHistInterval(summary, summary.hists_[iHist], timestamp, values);
+            
+        } else if(tok == "kinds:") {
+            summary.kinds_.clear();
+            while(!reader.atEol() && reader.next(tok))
+                summary.kinds_.push_back(tok);
+
+        } else if(tok == "family:") {
+            reader.next(tok);
+            summary.tags_.assign(1, tok);
+
+        } else if(tok == "dims:") {
+            readFamilyDims(reader, summary.partitions_);
+
+        } else if(tok == "top") {
+
+            // top timestamp tag: part:count part:count ...
+
+            std::string tag;
+            reader.next(tok);
+            reader.next(tag);
+            tag = stripColon(tag);
+
+            unsigned nPart = summary.partitions_.size();
+            unsigned nTag  = summary.tags_.size();
+            unsigned iTag  = std::find(summary.tags_.begin(), summary.tags_.end(), tag) - summary.tags_.begin();
+
+            if(iTag == nTag)
+                ThrowRuntimeError("Unknown tag '" << tag << "' in top line");
+
+            summary.topHits_.resize(nPart * nTag);
+            summary.nTopIntervals_.resize(nTag);
+            summary.nTopIntervals_[iTag]++;
+
+            while(!reader.atEol() && reader.next(tok)) {
+                unsigned iPart = strtoul(tok.c_str(), 0, 10);
+                if(iPart < nPart)
+                    summary.topHits_[summary.index(iPart, iTag)]++;
+            }
+
+        } else if(tok == "hot") {
+
+            // hot timestamp: part part ...
+
+            reader.next(tok);
+            hot.clear();
+            haveHot = true;
+            while(!reader.atEol() && reader.next(tok))
+                hot.push_back(toUint(tok));
+
+        } else if(tok == "sparse") {
+
+            // sparse timestamp nValues: gap:v,v gap:v ...
+
+            reader.next(tok);
+            uint64_t timestamp = toUint(tok);
+            reader.next(tok);
+            readSparse(reader, toUint(stripColon(tok)), values);
+
+            finishInterval(summary, timestamp, values, hot, haveHot);
+            
+        } else if(!tok.empty() && tok[tok.size()-1] == ':') {
+
+            // timestamp: v v v ...
+
+            uint64_t timestamp = toUint(stripColon(tok));
+            
+            values.clear();
+            while(!reader.atEol() && reader.next(tok))
+                values.push_back(toUint(tok));
+
+            finishInterval(summary, timestamp, values, hot, haveHot);
+            
+        } else {
+            ThrowRuntimeError("Unrecognized token '" << tok << "' in " << reader.fileName());
+        }
+    }
+
+    if(majorIntervalUs > 0)
+        summary.majorIntervalUs_ = majorIntervalUs;
+}
+
+struct PartitionRank {
+    unsigned part_;
+    uint64_t total_;
+
+    bool operator<(const PartitionRank& rank) const {
+        return total_ > rank.total_;
+    }
+};
+
+static void printAtomicHists(AtomicSummary& summary, unsigned nTop)
+{
+    double binUs = summary.nBins_ > 0 ? (double)summary.majorIntervalUs_ / summary.nBins_ : 0;
+    
+    for(unsigned iHist=0; iHist < summary.hists_.size(); iHist++) {
+
+        HistTagSummary& hist = summary.hists_[iHist];
+
+        if(hist.merged_.empty())
+            continue;
+        
+        uint64_t n = 0;
+        for(unsigned i=0; i < LOG2_NBUCKET; i++)
+            n += hist.merged_[i];
+        
+        cout << endl << "histogram " << hist.name_ << ": n " << n
+             << " p50 <= " << log2Percentile(&hist.merged_[0], 50)
+             << " p90 <= " << log2Percentile(&hist.merged_[0], 90)
+             << " p99 <= " << log2Percentile(&hist.merged_[0], 99) << endl;
+
+        std::sort(hist.spikes_.begin(), hist.spikes_.end());
+        unsigned nSpike = std::min(nTop, (unsigned)hist.spikes_.size());
+        
+        cout << "highest p99 per partition and bin:" << endl
+             << setw(4) << "" << " " << setw(48) << left << "partition" << right
+             << setw(20) << "time (us)" << setw(10) << "n" << setw(14) << "p99 <=" << endl;
+
+        for(unsigned i=0; i < nSpike; i++) {
+            HistSpike& spike = hist.spikes_[i];
+            cout << setw(4) << i+1 << " " << setw(48) << left << summary.partitions_[spike.part_] << right
+                 << setw(20) << (uint64_t)(spike.timestamp_ + spike.bin_ * binUs)
+                 << setw(10) << spike.count_ << setw(14) << spike.p99_ << endl;
+        }
+    }
+}
+
+static void printAtomic(AtomicSummary& summary, unsigned nTop)
+{
+    unsigned nPart = summary.partitions_.size();
+    unsigned nTag  = summary.tags_.size();
+    double sec     = summary.seconds();
+    double binSec  = summary.nBins_ > 0 ? (double)summary.majorIntervalUs_ / summary.nBins_ / 1e6 : 0;
+
+    cout << "partitions " << nPart << " tags " << nTag << " bins " << summary.nBins_
+         << " intervals " << summary.nIntervals_ << " major interval " << summary.majorIntervalUs_ << " us" << endl;
+
+    if(summary.majorIntervalUs_ == 0)
+        cout << "(major interval unknown: rates not computed; use -i)" << endl;
+    
+    //------------------------------------------------------------
+    // Per-tag totals, rates and per-bin percentiles
+    //------------------------------------------------------------
+
+    cout << endl << setw(20) << left << "tag" << right << setw(14) << "total" << setw(14) << "rate/s"
+         << setw(10) << "p50/bin" << setw(10) << "p90/bin" << setw(10) << "p99/bin" << setw(10) << "max/bin" << endl;
+
+    for(unsigned iTag=0; iTag < nTag; iTag++) {
+        uint64_t total = 0;
+        for(unsigned iPart=0; iPart < nPart; iPart++)
+            total += summary.totals_[summary.index(iPart, iTag)];
+
+        Histogram& hist = summary.tagBinHists_[iTag];
+        std::string name = summary.tags_[iTag];
+        if(iTag < summary.kinds_.size() && summary.kinds_[iTag] != "count")
+            name += "(" + summary.kinds_[iTag] + ")";
+        
+        cout << setw(20) << left << name << right;
+        if(summary.isAdditive(iTag))
+            cout << setw(14) << total << setw(14) << fixed << setprecision(1) << (sec > 0 ? total / sec : 0);
+        else
+            cout << setw(14) << "-" << setw(14) << "-";
+        cout << setw(10) << hist.percentile(50) << setw(10) << hist.percentile(90)
+             << setw(10) << hist.percentile(99) << setw(10) << hist.max_ << endl;
+    }
+
+    if(binSec > 0)
+        cout << "(bin width " << binSec * 1e3 << " ms)" << endl;
+    
+    //------------------------------------------------------------
+    // Top-N partitions, per tag
+    //------------------------------------------------------------
+
+    for(unsigned iTag=0; iTag < nTag; iTag++) {
+
+        std::vector<PartitionRank> ranks(nPart);
+        for(unsigned iPart=0; iPart < nPart; iPart++) {
+            ranks[iPart].part_  = iPart;
+            ranks[iPart].total_ = summary.totals_[summary.index(iPart, iTag)];
+        }
+
+        unsigned n = std::min(nTop, nPart);
+        std::partial_sort(ranks.begin(), ranks.begin() + n, ranks.end());
+
+        cout << endl << "top " << n << " partitions for tag " << summary.tags_[iTag] << ":" << endl;
+
+        for(unsigned i=0; i < n; i++) {
+            unsigned iPart = ranks[i].part_;
+            Histogram& hist = summary.partTagBinHists_[summary.index(iPart, iTag)];
+            cout << setw(4) << i+1 << " " << setw(48) << left << summary.partitions_[iPart] << right
+                 << setw(14) << ranks[i].total_
+                 << setw(14) << fixed << setprecision(1) << (sec > 0 ? ranks[i].total_ / sec : 0)
+                 << setw(10) << hist.percentile(99) << setw(10) << hist.max_ << endl;
+        }
+    }
+
+    //------------------------------------------------------------
+    // Partitions most often in the per-interval top K, if the file
+    // has 'top' lines
+    //------------------------------------------------------------
+
+    for(unsigned iTag=0; iTag < summary.nTopIntervals_.size(); iTag++) {
+
+        if(summary.nTopIntervals_[iTag] == 0)
+            continue;
+        
+        std::vector<PartitionRank> ranks(nPart);
+        for(unsigned iPart=0; iPart < nPart; iPart++) {
+            ranks[iPart].part_  = iPart;
+            ranks[iPart].total_ = summary.topHits_[summary.index(iPart, iTag)];
+        }
+
+        unsigned n = std::min(nTop, nPart);
+        std::partial_sort(ranks.begin(), ranks.begin() + n, ranks.end());
+
+        cout << endl << "partitions most often in the interval top K for tag " << summary.tags_[iTag]
+             << " (of " << summary.nTopIntervals_[iTag] << " intervals):" << endl;
+
+        for(unsigned i=0; i < n && ranks[i].total_ > 0; i++) {
+            cout << setw(4) << i+1 << " " << setw(48) << left << summary.partitions_[ranks[i].part_] << right
+                 << setw(14) << ranks[i].total_ << endl;
+        }
+    }
+
+    printAtomicHists(summary, nTop);
+}
+
+static void diffAtomic(AtomicSummary& a, AtomicSummary& b)
+{
+    double secA = a.seconds();
+    double secB = b.seconds();
+
+    cout << setw(48) << left << "partition" << setw(20) << "tag" << right
+         << setw(14) << "rate/s A" << setw(14) << "rate/s B" << setw(10) << "ratio" << endl;
+
+    std::map<std::string, unsigned> partIndexB, tagIndexB;
+    for(unsigned i=0; i < b.partitions_.size(); i++)
+        partIndexB[b.partitions_[i]] = i;
+    for(unsigned i=0; i < b.tags_.size(); i++)
+        tagIndexB[b.tags_[i]] = i;
+
+    for(unsigned iPart=0; iPart < a.partitions_.size(); iPart++) {
+        for(unsigned iTag=0; iTag < a.tags_.size(); iTag++) {
+            double rateA = secA > 0 ? a.totals_[a.index(iPart, iTag)] / secA : 0;
+            double rateB = 0;
+            if(partIndexB.count(a.partitions_[iPart]) && tagIndexB.count(a.tags_[iTag]) && secB > 0)
+                rateB = b.totals_[b.index(partIndexB[a.partitions_[iPart]], tagIndexB[a.tags_[iTag]])] / secB;
+
+            cout << setw(48) << left << a.partitions_[iPart] << setw(20) << a.tags_[iTag] << right
+                 << setw(14) << fixed << setprecision(1) << rateA << setw(14) << rateB;
+            if(rateA > 0)
+                cout << setw(10) << setprecision(3) << rateB / rateA;
+            else
+                cout << setw(10) << "-";
+            cout << endl;
+        }
+    }
+}
+
+//=======================================================================
+// Main
+//=======================================================================
+
+enum FileType {
+    FILE_PROFILE,
+    FILE_ATOMIC
+};
+
+static FileType detectType(std::string fileName)
+{
+    TokenReader reader(fileName);
+    std::string tok;
+
+    if(reader.next(tok)) {
+        if(tok == "totalcount")
+            return FILE_PROFILE;
+        if(tok == "partitions:" || tok == "family:")
+            return FILE_ATOMIC;
+    }
+
+    ThrowRuntimeError("Can't determine the type of " << fileName);
+    return FILE_PROFILE;
+}
+
+static void usage()
+{
+    cerr << "Usage: profreader [-n N] [-i usec] file" << endl
+         << "       profreader [-i usec] -d file1 file2" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned nTop = 10;
+    uint64_t majorIntervalUs = 0;
+    bool diff = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:i:d")) != -1) {
+        switch (opt) {
+        case 'n':
+            nTop = atoi(optarg);
+            break;
+        case 'i':
+            majorIntervalUs = strtoull(optarg, 0, 10);
+            break;
+        case 'd':
+            diff = true;
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if(argc - optind != (diff ? 2 : 1))
+        usage();
+
+    try {
+
+        FileType type = detectType(argv[optind]);
+
+        if(diff && detectType(argv[optind+1]) != type)
+            ThrowRuntimeError("Can't compare files of different types");
+        
+        if(type == FILE_PROFILE) {
+
+            ProfileSummary a, b;
+            TokenReader readerA(argv[optind]);
+            readProfile(readerA, a);
+
+            if(diff) {
+                TokenReader readerB(argv[optind+1]);
+                readProfile(readerB, b);
+                diffProfile(a, b);
+            } else {
+                printProfile(a);
+            }
+            
+        } else {
+
+            AtomicSummary a, b;
+            TokenReader readerA(argv[optind]);
+            a.nTopSpikes_ = nTop;
+            readAtomic(readerA, a, majorIntervalUs);
+
+            if(diff) {
+                TokenReader readerB(argv[optind+1]);
+                readAtomic(readerB, b, majorIntervalUs);
+                diffAtomic(a, b);
+            } else {
+                printAtomic(a, nTop);
+            }
+        }
+        
+    } catch(std::runtime_error& err) {
+        cerr << err.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
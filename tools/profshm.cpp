@@ -0,0 +1,218 @@
+/**.......................................................................
+ * profshm: attach to a profiler shared-memory export (see
+ * util/ShmLayout.h) and print the live counter values.
+ *
+ * Usage: profshm [-a] [-w seconds] name
+ *
+ *   -a          Also print the most recent interval of time-resolved
+ *               atomic counters
+ *   -w seconds  Re-read and print every 'seconds' seconds
+ */
+#include "ShmLayout.h"
+#include "exceptionutils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace profiler;
+
+/**.......................................................................
+ * Map the named segment read-only, and validate its header
+ */
+static const unsigned char* attach(std::string name, size_t& size)
+{
+    if(name.empty() || name[0] != '/')
+        name = "/" + name;
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        ThrowSysError("Unable to open shared-memory segment " << name);
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        close(fd);
+        ThrowRuntimeError("Segment " << name << " is too small to be a profiler export");
+    }
+
+    size = st.st_size;
+    void* base = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED)
+        ThrowSysError("Unable to map shared-memory segment " << name);
+
+    const ShmHeader* header = (const ShmHeader*)base;
+
+    if(header->magic_ != PROFILER_SHM_MAGIC)
+        ThrowRuntimeError("Segment " << name << " is not a profiler export (or is still being initialized)");
+
+    if(header->version_ != PROFILER_SHM_VERSION)
+        ThrowRuntimeError("Segment " << name << " has layout version " << header->version_
+                          << ", but this tool reads version " << PROFILER_SHM_VERSION);
+
+    if(header->size_ > size)
+        ThrowRuntimeError("Segment " << name << " is truncated");
+    
+    return (const unsigned char*)base;
+}
+
+/**.......................................................................
+ * Take a consistent copy of one counter slot
+ */
+static void readCounter(const ShmCounter* src, ShmCounter& dest)
+{
+    uint32_t seq1, seq2;
+
+    do {
+        seq1 = src->seq_;
+        __sync_synchronize();
+        memcpy(&dest, (const void*)src, sizeof(ShmCounter));
+        __sync_synchronize();
+        seq2 = src->seq_;
+    } while((seq1 & 1) || seq1 != seq2);
+}
+
+static void printCounters(const unsigned char* base)
+{
+    const ShmHeader*  header   = (const ShmHeader*)base;
+    const ShmCounter* counters = (const ShmCounter*)(base + header->countersOffset_);
+    unsigned nCounters = header->nCounters_;
+    __sync_synchronize();
+
+    cout << "pid " << header->pid_ << " counters " << nCounters << endl;
+    cout << setw(32) << left << "label" << " " << setw(18) << "thread" << right
+         << setw(12) << "count" << setw(14) << "usec" << setw(14) << "cpuusec"
+         << setw(12) << "allocs" << setw(14) << "allocbytes" << setw(8) << "errors" << endl;
+
+    for(unsigned i=0; i < nCounters; i++) {
+        ShmCounter counter;
+        readCounter(&counters[i], counter);
+
+        cout << setw(32) << left << counter.label_ << " "
+             << "0x" << setw(16) << hex << counter.threadId_ << dec << right
+             << setw(12) << counter.counts_ << setw(14) << counter.usec_ << setw(14) << counter.cpuUsec_
+             << setw(12) << counter.allocs_ << setw(14) << counter.allocBytes_
+             << setw(8) << (counter.errorCountUninitiated_ + counter.errorCountUnterminated_) << endl;
+    }
+}
+
+static void printAtomic(const unsigned char* base)
+{
+    const ShmHeader* header = (const ShmHeader*)base;
+    const char*      names  = (const char*)(base + header->namesOffset_);
+    const uint64_t*  values = (const uint64_t*)(base + header->atomicOffset_);
+
+    ShmHeader copy;
+    std::vector<std::string> nameVec;
+    std::vector<uint64_t> valueVec;
+    uint32_t seq1, seq2;
+    
+    do {
+        seq1 = header->atomicSeq_;
+        __sync_synchronize();
+
+        memcpy(&copy, (const void*)header, sizeof(ShmHeader));
+
+        unsigned nNames = copy.nPartitions_ + copy.nTags_;
+        if(nNames > copy.maxNames_)
+            nNames = 0;
+
+        nameVec.resize(nNames);
+        for(unsigned i=0; i < nNames; i++)
+            nameVec[i] = std::string(names + i * PROFILER_SHM_NAME_LEN,
+                                     strnlen(names + i * PROFILER_SHM_NAME_LEN, PROFILER_SHM_NAME_LEN));
+
+        uint64_t nValues = (uint64_t)copy.nPartitions_ * copy.nTags_ * copy.nBins_;
+        if(nValues > copy.maxAtomicValues_)
+            nValues = 0;
+
+        valueVec.resize(nValues);
+        if(nValues > 0)
+            memcpy(&valueVec[0], values, nValues * sizeof(uint64_t));
+
+        __sync_synchronize();
+        seq2 = header->atomicSeq_;
+    } while((seq1 & 1) || seq1 != seq2);
+
+    if(copy.nPartitions_ == 0) {
+        cout << "no atomic counters published" << endl;
+        return;
+    }
+
+    cout << "timestamp " << copy.timestampUs_ << " interval " << copy.intervalUs_ << " us"
+         << (copy.truncated_ ? " (truncated)" : "") << endl;
+
+    uint64_t index = 0;
+    for(unsigned iPart=0; iPart < copy.nPartitions_; iPart++) {
+        for(unsigned iTag=0; iTag < copy.nTags_; iTag++) {
+            cout << nameVec[iPart] << " " << nameVec[copy.nPartitions_ + iTag] << ": ";
+            for(unsigned iBin=0; iBin < copy.nBins_; iBin++)
+                cout << valueVec[index++] << " ";
+            cout << endl;
+        }
+    }
+}
+
+static void usage()
+{
+    cerr << "Usage: profshm [-a] [-w seconds] name" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    bool atomic = false;
+    double watchSec = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "aw:")) != -1) {
+        switch (opt) {
+        case 'a':
+            atomic = true;
+            break;
+        case 'w':
+            watchSec = atof(optarg);
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if(optind != argc-1)
+        usage();
+
+    try {
+        size_t size = 0;
+        const unsigned char* base = attach(argv[optind], size);
+
+        do {
+            printCounters(base);
+            if(atomic)
+                printAtomic(base);
+
+            if(watchSec > 0) {
+                cout << endl;
+                usleep((useconds_t)(watchSec * 1e6));
+            }
+        } while(watchSec > 0);
+
+        munmap((void*)base, size);
+        
+    } catch(std::runtime_error& err) {
+        cerr << err.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
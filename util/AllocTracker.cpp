@@ -0,0 +1,217 @@
+#include "stdafx.h"
+#include "AllocTracker.h"
+
+#if PROFILER_HAVE_ALLOC_HOOKS
+#include <new>
+#include <errno.h>
+#include <stdlib.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+volatile bool AllocTracker::active_ = false;
+
+#if PROFILER_HAVE_ALLOC_HOOKS
+
+//------------------------------------------------------------
+// The per-thread counts.  initial-exec TLS is used so that touching
+// these from inside malloc can never itself call malloc (as the
+// general-dynamic model may, via __tls_get_addr)
+//------------------------------------------------------------
+
+struct AllocCounts {
+    uint64_t allocs_;
+    uint64_t bytes_;
+    uint64_t frees_;
+};
+
+static __thread AllocCounts threadCounts __attribute__((tls_model("initial-exec")));
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t n, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void  __libc_free(void* ptr);
+}
+
+#endif
+
+//=======================================================================
+// AllocTracker::Sample
+//=======================================================================
+
+AllocTracker::Sample::Sample()
+{
+    valid_  = false;
+    allocs_ = 0;
+    bytes_  = 0;
+    frees_  = 0;
+}
+
+//=======================================================================
+// AllocTracker
+//=======================================================================
+
+bool AllocTracker::read(Sample& sample)
+{
+#if PROFILER_HAVE_ALLOC_HOOKS
+    sample.valid_  = active_;
+    sample.allocs_ = threadCounts.allocs_;
+    sample.bytes_  = threadCounts.bytes_;
+    sample.frees_  = threadCounts.frees_;
+#else
+    sample.valid_  = false;
+#endif
+    return sample.valid_;
+}
+
+bool AllocTracker::isActive()
+{
+    return active_;
+}
+
+void AllocTracker::recordAlloc(size_t bytes)
+{
+#if PROFILER_HAVE_ALLOC_HOOKS
+    threadCounts.allocs_++;
+    threadCounts.bytes_ += bytes;
+
+    if(!active_)
+        active_ = true;
+#endif
+}
+
+void AllocTracker::recordFree()
+{
+#if PROFILER_HAVE_ALLOC_HOOKS
+    threadCounts.frees_++;
+#endif
+}
+
+#if PROFILER_HAVE_ALLOC_HOOKS
+
+//=======================================================================
+// The interposed allocators
+//=======================================================================
+
+extern "C" {
+
+    PROFILER_API void* malloc(size_t size)
+    {
+        void* ptr = __libc_malloc(size);
+        if(ptr)
+            AllocTracker::recordAlloc(size);
+        return ptr;
+    }
+
+    PROFILER_API void* calloc(size_t n, size_t size)
+    {
+        void* ptr = __libc_calloc(n, size);
+        if(ptr)
+            AllocTracker::recordAlloc(n * size);
+        return ptr;
+    }
+
+    // A realloc is counted as a new allocation of the full size, and
+    // a free of the old block, if any.  A realloc that fails leaves
+    // the old block allocated, so only a successful one (or a size
+    // of 0, which frees it) counts the free
+    
+    PROFILER_API void* realloc(void* ptr, size_t size)
+    {
+        void* newPtr = __libc_realloc(ptr, size);
+
+        if(ptr && (newPtr || size == 0))
+            AllocTracker::recordFree();
+        
+        if(newPtr)
+            AllocTracker::recordAlloc(size);
+        
+        return newPtr;
+    }
+
+    PROFILER_API void* memalign(size_t alignment, size_t size)
+    {
+        void* ptr = __libc_memalign(alignment, size);
+        if(ptr)
+            AllocTracker::recordAlloc(size);
+        return ptr;
+    }
+
+    PROFILER_API void* aligned_alloc(size_t alignment, size_t size)
+    {
+        return memalign(alignment, size);
+    }
+
+    // POSIX requires the alignment to be a power of two multiple of
+    // sizeof(void*), which memalign() doesn't check
+    
+    PROFILER_API int posix_memalign(void** memptr, size_t alignment, size_t size)
+    {
+        if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void*) != 0)
+            return EINVAL;
+
+        void* ptr = memalign(alignment, size);
+
+        if(!ptr)
+            return ENOMEM;
+
+        *memptr = ptr;
+        return 0;
+    }
+
+    PROFILER_API void free(void* ptr)
+    {
+        if(ptr)
+            AllocTracker::recordFree();
+        __libc_free(ptr);
+    }
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = malloc(size);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+    return malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+    return malloc(size);
+}
+
+void operator delete(void* ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) throw()
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) throw()
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) throw()
+{
+    free(ptr);
+}
+
+#endif
@@ -0,0 +1,76 @@
+// $Id: $
+
+#ifndef PROFILER_ALLOCTRACKER_H
+#define PROFILER_ALLOCTRACKER_H
+
+/**
+ * @file AllocTracker.h
+ * 
+ * Tagged: Mon Oct 19 11:02:17 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "export.h"
+
+//------------------------------------------------------------
+// Allocation hooks are only compiled in on request, and only with
+// glibc, where the underlying __libc_* allocators are exported.
+// Build with -DPROFILER_ALLOC_HOOKS, and LD_PRELOAD the resulting
+// library so that its malloc/free take precedence over libc's
+//------------------------------------------------------------
+
+#if defined(PROFILER_ALLOC_HOOKS) && defined(__GLIBC__)
+#define PROFILER_HAVE_ALLOC_HOOKS 1
+#else
+#define PROFILER_HAVE_ALLOC_HOOKS 0
+#endif
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Per-thread allocation counts, maintained by the interposed
+    // malloc/free/operator new/operator delete
+    //------------------------------------------------------------
+    
+    class AllocTracker {
+    public:
+
+        struct Sample {
+            bool valid_;
+            uint64_t allocs_;
+            uint64_t bytes_;
+            uint64_t frees_;
+
+            PROFILER_API Sample();
+        };
+
+        // Read the allocation counts for the calling thread.
+        // Returns false (and marks the sample invalid) if the hooks
+        // are not compiled in, or have never been called
+
+        PROFILER_API static bool read(Sample& sample);
+
+        // True if the hooks are compiled in and have intercepted at
+        // least one allocation
+
+        PROFILER_API static bool isActive();
+
+        static void recordAlloc(size_t bytes);
+        static void recordFree();
+        
+    private:
+
+        static volatile bool active_;
+        
+    }; // End class AllocTracker
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_ALLOCTRACKER_H
@@ -8,27 +8,88 @@ using namespace std;
 
 using namespace profiler;
 
+// The initial (empty) value of a MIN bin
+
+#define MIN_EMPTY (~(uint64_t)0)
+
 //=======================================================================
 // BufferedAtomicCounter::AtomicCounter
 //=======================================================================
 
 BufferedAtomicCounter::AtomicCounter::AtomicCounter()
 {
-#ifdef __APPLE__
     counts_ = 0;
+}
+
+void BufferedAtomicCounter::AtomicCounter::increment()
+{
+    add(1);
+}
+
+void BufferedAtomicCounter::AtomicCounter::add(uint64_t value)
+{
+#ifdef __APPLE__
+    OSAtomicAdd64(value, &counts_);
+#elif defined _WIN32
+    InterlockedAdd64(&counts_, value);
 #else
-    counts_ = 0;
+    __sync_fetch_and_add(&counts_, value);
 #endif
 }
 
-void BufferedAtomicCounter::AtomicCounter::increment()
+/**.......................................................................
+ * Compare-and-swap until value is no longer less than the bin (or
+ * greater than, for max())
+ */
+void BufferedAtomicCounter::AtomicCounter::min(uint64_t value)
 {
+    uint64_t curr = counts_;
+    
+    while(value < curr) {
 #ifdef __APPLE__
-    OSAtomicIncrement32(&counts_);
+        if(OSAtomicCompareAndSwap64(curr, value, &counts_))
+            break;
 #elif defined _WIN32
-    InterlockedAdd(&counts_, 1);
+        if(InterlockedCompareExchange64(&counts_, value, curr) == (LONGLONG)curr)
+            break;
 #else
-    __sync_fetch_and_add(&counts_, 1);
+        if(__sync_bool_compare_and_swap(&counts_, curr, value))
+            break;
+#endif
+        curr = counts_;
+    }
+}
+
+void BufferedAtomicCounter::AtomicCounter::max(uint64_t value)
+{
+    uint64_t curr = counts_;
+    
+    while(value > curr) {
+#ifdef __APPLE__
+        if(OSAtomicCompareAndSwap64(curr, value, &counts_))
+            break;
+#elif defined _WIN32
+        if(InterlockedCompareExchange64(&counts_, value, curr) == (LONGLONG)curr)
+            break;
+#else
+        if(__sync_bool_compare_and_swap(&counts_, curr, value))
+            break;
+#endif
+        curr = counts_;
+    }
+}
+
+void BufferedAtomicCounter::AtomicCounter::set(uint64_t value)
+{
+#ifdef __APPLE__
+    int64_t curr;
+    do {
+        curr = counts_;
+    } while(!OSAtomicCompareAndSwap64(curr, value, &counts_));
+#elif defined _WIN32
+    InterlockedExchange64(&counts_, value);
+#else
+    __sync_lock_test_and_set(&counts_, value);
 #endif
 }
 
@@ -36,6 +97,45 @@ void BufferedAtomicCounter::AtomicCounter::increment()
 // BufferedAtomicCounter
 //=======================================================================
 
+bool BufferedAtomicCounter::kindFromString(std::string str, Kind& kind)
+{
+    if(str == "count")
+        kind = KIND_COUNT;
+    else if(str == "sum")
+        kind = KIND_SUM;
+    else if(str == "min")
+        kind = KIND_MIN;
+    else if(str == "max")
+        kind = KIND_MAX;
+    else if(str == "gauge")
+        kind = KIND_GAUGE;
+    else
+        return false;
+
+    return true;
+}
+
+std::string BufferedAtomicCounter::kindToString(Kind kind)
+{
+    switch (kind) {
+    case KIND_SUM:
+        return "sum";
+    case KIND_MIN:
+        return "min";
+    case KIND_MAX:
+        return "max";
+    case KIND_GAUGE:
+        return "gauge";
+    default:
+        return "count";
+    }
+}
+
+bool BufferedAtomicCounter::isAdditive(Kind kind)
+{
+    return kind == KIND_COUNT || kind == KIND_SUM;
+}
+
 /**.......................................................................
  * Constructor.
  */
@@ -44,17 +144,42 @@ BufferedAtomicCounter::BufferedAtomicCounter()
     setTo(0, 0);
 }
 
-BufferedAtomicCounter::BufferedAtomicCounter(unsigned int bufferSize, uint64_t intervalMs)
+BufferedAtomicCounter::BufferedAtomicCounter(unsigned int bufferSize, uint64_t intervalMs, Kind kind)
 {
-    setTo(bufferSize, intervalMs);
+    setTo(bufferSize, intervalMs, kind);
 }
 
-void BufferedAtomicCounter::setTo(unsigned int bufferSize, uint64_t intervalMs)
+void BufferedAtomicCounter::setTo(unsigned int bufferSize, uint64_t intervalMs, Kind kind)
 {
+    kind_        = kind;
+    bufferSize_  = bufferSize;
+    external_[0] = 0;
+    external_[1] = 0;
+    
     counters_.resize(2);
     counters_[0].resize(bufferSize);
     counters_[1].resize(bufferSize);
 
+    resetBins(buffer(0));
+    resetBins(buffer(1));
+    
+    minorIntervalMs_ = intervalMs;
+    majorIntervalMs_ = intervalMs * bufferSize;
+}
+
+void BufferedAtomicCounter::setTo(unsigned int bufferSize, uint64_t intervalMs, Kind kind,
+                                  AtomicCounter* buffer0, AtomicCounter* buffer1)
+{
+    kind_        = kind;
+    bufferSize_  = bufferSize;
+    external_[0] = buffer0;
+    external_[1] = buffer1;
+
+    counters_.clear();
+    
+    resetBins(buffer(0));
+    resetBins(buffer(1));
+    
     minorIntervalMs_ = intervalMs;
     majorIntervalMs_ = intervalMs * bufferSize;
 }
@@ -64,17 +189,22 @@ void BufferedAtomicCounter::setTo(unsigned int bufferSize, uint64_t intervalMs)
  */
 BufferedAtomicCounter::~BufferedAtomicCounter() {}
 
+BufferedAtomicCounter::Kind BufferedAtomicCounter::kind()
+{
+    return kind_;
+}
+
 /**.......................................................................
- * Increment the right counter for the current time
+ * Return the bin for the current time, or NULL if not initialized
  */
-void BufferedAtomicCounter::increment(uint64_t currentMicroSeconds)
+BufferedAtomicCounter::AtomicCounter* BufferedAtomicCounter::currentBin(uint64_t currentMicroSeconds)
 {
     //------------------------------------------------------------
     // Do nothing if not initialized
     //------------------------------------------------------------
     
     if(majorIntervalMs_ == 0)
-        return;
+        return 0;
     
     //------------------------------------------------------------
     // Which buffer are we currently incrementing? (Are we in an even
@@ -89,36 +219,101 @@ void BufferedAtomicCounter::increment(uint64_t currentMicroSeconds)
 
     unsigned int minorInd = (currentMicroSeconds % majorIntervalMs_) / minorIntervalMs_;
 
-    COUT("Current MS = " << currentMicroSeconds << " major = " << majorIntervalMs_ << " majorInd = " << majorInd << " minorInd = " << minorInd);
+    return buffer(majorInd) + minorInd;
+}
 
+/**.......................................................................
+ * Return the first bin of one of the two buffers
+ */
+BufferedAtomicCounter::AtomicCounter* BufferedAtomicCounter::buffer(unsigned int majorInd)
+{
+    if(external_[majorInd])
+        return external_[majorInd];
 
-    //------------------------------------------------------------
-    // Increment the appropriate counter
-    //------------------------------------------------------------
-    
-    counters_[majorInd][minorInd].increment();
+    return bufferSize_ > 0 ? &counters_[majorInd][0] : 0;
+}
+
+/**.......................................................................
+ * Increment the right counter for the current time
+ */
+void BufferedAtomicCounter::increment(uint64_t currentMicroSeconds)
+{
+    AtomicCounter* bin = currentBin(currentMicroSeconds);
+
+    if(bin)
+        bin->increment();
+}
+
+/**.......................................................................
+ * Accumulate value into the right counter for the current time
+ */
+void BufferedAtomicCounter::add(uint64_t currentMicroSeconds, uint64_t value)
+{
+    AtomicCounter* bin = currentBin(currentMicroSeconds);
+
+    if(!bin)
+        return;
+
+    switch (kind_) {
+    case KIND_MIN:
+        bin->min(value);
+        break;
+    case KIND_MAX:
+        bin->max(value);
+        break;
+    case KIND_GAUGE:
+        bin->set(value);
+        break;
+    default:
+        bin->add(value);
+        break;
+    }
 }
 
 std::string BufferedAtomicCounter::dump(uint64_t currentMicroSeconds)
+{
+    std::ostringstream os;
+    std::vector<uint64_t> bins;
+
+    drain(currentMicroSeconds, bins);
+    
+    for(unsigned i=0; i < bins.size(); i++)
+        os << bins[i] << " ";
+
+    return os.str();
+}
+
+void BufferedAtomicCounter::drain(uint64_t currentMicroSeconds, std::vector<uint64_t>& bins)
 {
     //------------------------------------------------------------
     // Which buffer are we currently dumping? (Are we in an even
     // or odd major interval since an absolute second boundary?)
     //------------------------------------------------------------
 
-    std::ostringstream os;
-    
     unsigned int majorInd = (currentMicroSeconds / majorIntervalMs_ + 1) % 2;
-    std::vector<AtomicCounter>& vec = counters_[majorInd];
-    for(unsigned i=0; i < vec.size(); i++) {
-        os << vec[i].counts_ << " ";
-
-        // And zero the counter
-        
-        vec[i].counts_ = 0;
+    AtomicCounter* vec = buffer(majorInd);
+    for(unsigned i=0; i < bufferSize_; i++) {
+        uint64_t val = vec[i].counts_;
+        bins.push_back((kind_ == KIND_MIN && val == MIN_EMPTY) ? 0 : val);
     }
 
-    return os.str();
+    // And reset the counters
+        
+    resetBins(vec);
 }
 
+/**.......................................................................
+ * Set bins to their empty value
+ */
+void BufferedAtomicCounter::resetBins(AtomicCounter* bins)
+{
+    uint64_t empty = kind_ == KIND_MIN ? MIN_EMPTY : 0;
     
+    for(unsigned i=0; i < bufferSize_; i++)
+        bins[i].counts_ = empty;
+}
+
+unsigned int BufferedAtomicCounter::bufferSize()
+{
+    return bufferSize_;
+}
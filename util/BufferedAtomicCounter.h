@@ -32,36 +32,87 @@ namespace profiler {
     public:
 
         //------------------------------------------------------------
-        // A struct for managing a single 32-bit atomic counter
+        // What each bin accumulates: a count of events (the
+        // default), a sum of values, the minimum or maximum value,
+        // or the last value set (a gauge).  Bins of a MIN counter in
+        // which nothing was recorded are reported as 0
+        //------------------------------------------------------------
+
+        enum Kind {
+            KIND_COUNT,
+            KIND_SUM,
+            KIND_MIN,
+            KIND_MAX,
+            KIND_GAUGE
+        };
+
+        // Convert to/from the names used in the NIF and output
+        // files (count, sum, min, max, gauge).  kindFromString
+        // returns false for anything else
+        
+        PROFILER_API static bool kindFromString(std::string str, Kind& kind);
+        PROFILER_API static std::string kindToString(Kind kind);
+
+        // True for the kinds whose bins add up to a meaningful total
+        // (count and sum)
+
+        PROFILER_API static bool isAdditive(Kind kind);
+        
+        //------------------------------------------------------------
+        // A struct for managing a single 64-bit atomic counter
         //------------------------------------------------------------
     
         struct PROFILER_API AtomicCounter {
 #ifdef __APPLE__
-            int counts_;
+            volatile int64_t counts_;
 #elif defined _WIN32
 
 #ifdef PROFILER_EXPORTS
-            volatile LONG counts_;
+            volatile LONGLONG counts_;
 #else
-            uint32_t counts_;
+            uint64_t counts_;
 #endif
 
 #else
-            uint32_t counts_;
+            uint64_t counts_;
 #endif
             AtomicCounter();
             void increment();
+            void add(uint64_t value);
+            void min(uint64_t value);
+            void max(uint64_t value);
+            void set(uint64_t value);
         };
 
         /**
          * Constructor.
          */
         PROFILER_API BufferedAtomicCounter();
-        PROFILER_API BufferedAtomicCounter(unsigned int bufferSize, uint64_t intervalMs);
+        PROFILER_API BufferedAtomicCounter(unsigned int bufferSize, uint64_t intervalMs, Kind kind=KIND_COUNT);
 
-        PROFILER_API void setTo(unsigned int bufferSize, uint64_t intervalMs);
+        PROFILER_API void setTo(unsigned int bufferSize, uint64_t intervalMs, Kind kind=KIND_COUNT);
+
+        // As above, but keep the two buffers of bufferSize bins in
+        // storage owned by the caller, which must outlive this
+        // counter.  Lets the profiler lay the bins of all counters
+        // out as one matrix, for zero-copy readers
+        
+        PROFILER_API void setTo(unsigned int bufferSize, uint64_t intervalMs, Kind kind,
+                                AtomicCounter* buffer0, AtomicCounter* buffer1);
         PROFILER_API void increment(uint64_t currentMicroSeconds);
+
+        // Accumulate value into the current bin according to kind()
+        // (for KIND_COUNT, this adds value to the count)
+        
+        PROFILER_API void add(uint64_t currentMicroSeconds, uint64_t value);
+        PROFILER_API Kind kind();
         PROFILER_API std::string dump(uint64_t currentMicroSeconds);
+
+        // Append the counts for the major interval that is not
+        // currently being incremented to bins, and zero them
+        
+        PROFILER_API void drain(uint64_t currentMicroSeconds, std::vector<uint64_t>& bins);
+        PROFILER_API unsigned int bufferSize();
     
         /**
          * Destructor.
@@ -70,10 +121,20 @@ namespace profiler {
 
     private:
 
+        Kind kind_;
         uint64_t minorIntervalMs_;
         uint64_t majorIntervalMs_;
-    
+
+        AtomicCounter* currentBin(uint64_t currentMicroSeconds);
+        AtomicCounter* buffer(unsigned int majorInd);
+        void resetBins(AtomicCounter* bins);
+
+        // The bins, in counters_ unless external_ points to storage
+        // owned by someone else (copies of this object then share it)
+        
+        unsigned int bufferSize_;
         std::vector<std::vector<AtomicCounter> > counters_;
+        AtomicCounter* external_[2];
     
     }; // End class BufferedAtomicCounter
 
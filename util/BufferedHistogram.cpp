@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "BufferedHistogram.h"
+
+using namespace std;
+
+using namespace profiler;
+
+#define HIST_MAX_COUNT 0xffff
+
+/**.......................................................................
+ * Constructor.
+ */
+BufferedHistogram::BufferedHistogram()
+{
+    setTo(0, 0);
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+BufferedHistogram::~BufferedHistogram() {}
+
+void BufferedHistogram::setTo(unsigned int bufferSize, uint64_t intervalUs)
+{
+    bufferSize_      = bufferSize;
+    minorIntervalUs_ = intervalUs;
+    majorIntervalUs_ = intervalUs * bufferSize;
+
+    buckets_[0].assign(bufferSize * HIST_N_BUCKET, 0);
+    buckets_[1].assign(bufferSize * HIST_N_BUCKET, 0);
+}
+
+unsigned int BufferedHistogram::bufferSize()
+{
+    return bufferSize_;
+}
+
+/**.......................................................................
+ * Return the log2 bucket for value: 0 for 0, else 1 + floor(log2(value)),
+ * capped at the last bucket
+ */
+unsigned BufferedHistogram::bucketOf(uint64_t value)
+{
+    if(value == 0)
+        return 0;
+    
+#ifdef __GNUC__
+    unsigned bucket = 64 - __builtin_clzll(value);
+#else
+    unsigned bucket = 0;
+    while(value != 0) {
+        value >>= 1;
+        bucket++;
+    }
+#endif
+    
+    return bucket < HIST_N_BUCKET ? bucket : HIST_N_BUCKET-1;
+}
+
+void BufferedHistogram::record(uint64_t currentMicroSeconds, uint64_t value)
+{
+    if(majorIntervalUs_ == 0)
+        return;
+
+    //------------------------------------------------------------
+    // Pick the major and minor interval as BufferedAtomicCounter
+    // does
+    //------------------------------------------------------------
+
+    unsigned int majorInd = (currentMicroSeconds / majorIntervalUs_) % 2;
+    unsigned int minorInd = (currentMicroSeconds % majorIntervalUs_) / minorIntervalUs_;
+
+#if defined _WIN32 && defined PROFILER_EXPORTS
+    volatile SHORT* count = &buckets_[majorInd][minorInd * HIST_N_BUCKET + bucketOf(value)];
+    SHORT curr = *count;
+    while((uint16_t)curr != HIST_MAX_COUNT) {
+        SHORT prev = InterlockedCompareExchange16(count, curr + 1, curr);
+        if(prev == curr)
+            break;
+        curr = prev;
+    }
+#else
+    volatile uint16_t* count = &buckets_[majorInd][minorInd * HIST_N_BUCKET + bucketOf(value)];
+    uint16_t curr = *count;
+    while(curr != HIST_MAX_COUNT) {
+        if(__sync_bool_compare_and_swap(count, curr, (uint16_t)(curr + 1)))
+            break;
+        curr = *count;
+    }
+#endif
+}
+
+void BufferedHistogram::drain(uint64_t currentMicroSeconds, std::vector<uint64_t>& buckets)
+{
+    if(majorIntervalUs_ == 0)
+        return;
+    
+    unsigned int majorInd = (currentMicroSeconds / majorIntervalUs_ + 1) % 2;
+
+    for(unsigned i=0; i < buckets_[majorInd].size(); i++) {
+        buckets.push_back((uint16_t)buckets_[majorInd][i]);
+        buckets_[majorInd][i] = 0;
+    }
+}
@@ -0,0 +1,91 @@
+// $Id: $
+
+#ifndef PROFILER_BUFFEREDHISTOGRAM_H
+#define PROFILER_BUFFEREDHISTOGRAM_H
+
+/**
+ * @file BufferedHistogram.h
+ * 
+ * Tagged: Tue Oct 20 14:40:18 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <vector>
+#include <inttypes.h>
+
+#include "export.h"
+
+#ifdef PROFILER_EXPORTS
+#include <windows.h>
+#endif
+
+// Buckets per histogram.  Bucket 0 holds zeros, and bucket i > 0
+// values in [2^(i-1), 2^i), with the last bucket open-ended
+
+#define HIST_N_BUCKET 32
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // The histogram analog of BufferedAtomicCounter: for each minor
+    // interval (bin) of the current and previous major interval, a
+    // fixed-size log2-bucketed histogram of 16-bit counts.
+    //
+    // Recording is a lock-free compare-and-swap on one bucket, which
+    // saturates at 65535 rather than wrapping.  Since buckets are
+    // fixed, histograms can be merged (across partitions, bins or
+    // intervals) by adding bucket counts
+    //------------------------------------------------------------
+
+    class BufferedHistogram {
+    public:
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API BufferedHistogram();
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~BufferedHistogram();
+
+        PROFILER_API void setTo(unsigned int bufferSize, uint64_t intervalUs);
+
+        // Record value in the current bin
+        
+        PROFILER_API void record(uint64_t currentMicroSeconds, uint64_t value);
+
+        // Append the buckets of each bin of the major interval that
+        // is not currently being recorded (bufferSize x
+        // HIST_N_BUCKET values) to buckets, and zero them
+        
+        PROFILER_API void drain(uint64_t currentMicroSeconds, std::vector<uint64_t>& buckets);
+
+        PROFILER_API unsigned int bufferSize();
+        
+        PROFILER_API static unsigned bucketOf(uint64_t value);
+
+    private:
+
+        uint64_t minorIntervalUs_;
+        uint64_t majorIntervalUs_;
+        unsigned int bufferSize_;
+
+        // Two major intervals of bufferSize_ x HIST_N_BUCKET counts
+        
+#if defined _WIN32 && defined PROFILER_EXPORTS
+        std::vector<SHORT> buckets_[2];
+#else
+        std::vector<uint16_t> buckets_[2];
+#endif
+        
+    }; // End class BufferedHistogram
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_BUFFEREDHISTOGRAM_H
@@ -0,0 +1,338 @@
+#include "stdafx.h"
+#include "Checkpointer.h"
+
+#include "exceptionutils.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// How long a signal handler waits for the checkpoint before passing
+// the signal on
+
+#define CHECKPOINTER_SIGNAL_TIMEOUT_MS 5000
+
+// Bytes written to the wake pipe
+
+#define CHECKPOINTER_WAKE_STOP   'q'
+#define CHECKPOINTER_WAKE_SIGNAL 's'
+
+using namespace std;
+
+using namespace profiler;
+
+#ifndef _WIN32
+
+Checkpointer* volatile Checkpointer::signalOwner_ = 0;
+struct sigaction       Checkpointer::oldTermAction_;
+struct sigaction       Checkpointer::oldAbrtAction_;
+
+namespace {
+
+    /**.......................................................................
+     * Don't leak profiler pipes into ports spawned by the emulator
+     */
+    void setCloseOnExec(int fd)
+    {
+        int flags = fcntl(fd, F_GETFD);
+        if(flags >= 0)
+            fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+
+    void setNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL);
+        if(flags >= 0)
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+#endif
+
+/**.......................................................................
+ * Constructor.
+ */
+Checkpointer::Checkpointer()
+{
+    intervalUs_   = 0;
+    onSignal_     = false;
+    checkpointFn_ = 0;
+    arg_          = 0;
+    wakeFds_[0]   = -1;
+    wakeFds_[1]   = -1;
+    doneFds_[0]   = -1;
+    doneFds_[1]   = -1;
+    running_      = false;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+Checkpointer::~Checkpointer()
+{
+    stop();
+}
+
+/**.......................................................................
+ * Start the checkpoint thread, stopping any previous one first
+ */
+void Checkpointer::start(uint64_t intervalUs, bool onSignal, CheckpointFn checkpointFn, void* arg)
+{
+#ifdef _WIN32
+    ThrowRuntimeError("Checkpoints are not supported on this platform");
+#else
+    stop();
+
+    if(onSignal && signalOwner_ != 0)
+        ThrowRuntimeError("Signals are already handled by another checkpointer");
+
+    intervalUs_   = intervalUs;
+    onSignal_     = onSignal;
+    checkpointFn_ = checkpointFn;
+    arg_          = arg;
+
+    if(pipe(wakeFds_) != 0 || pipe(doneFds_) != 0) {
+        int err = errno;
+        closeFds();
+        ThrowRuntimeError("Unable to create checkpoint pipes: " << strerror(err));
+    }
+
+    for(unsigned i=0; i < 2; i++) {
+        setCloseOnExec(wakeFds_[i]);
+        setCloseOnExec(doneFds_[i]);
+    }
+
+    // The handler must never block writing a wake-up, or find a
+    // stale acknowledgement from an earlier signal
+
+    setNonBlocking(wakeFds_[1]);
+    setNonBlocking(doneFds_[0]);
+
+    if(pthread_create(&threadId_, NULL, &run, this) != 0) {
+        closeFds();
+        ThrowRuntimeError("Unable to create checkpoint thread");
+    }
+
+    running_ = true;
+
+    if(onSignal_)
+        installHandlers();
+#endif
+}
+
+/**.......................................................................
+ * Stop checkpointing: restore the previous signal handlers, then
+ * wake the thread and wait for it to finish any checkpoint in
+ * progress
+ */
+void Checkpointer::stop()
+{
+#ifndef _WIN32
+    if(!running_)
+        return;
+
+    if(onSignal_)
+        removeHandlers();
+
+    char c = CHECKPOINTER_WAKE_STOP;
+    while(write(wakeFds_[1], &c, 1) < 0 && errno == EINTR)
+        ;
+
+    pthread_join(threadId_, NULL);
+
+    closeFds();
+
+    intervalUs_ = 0;
+    onSignal_   = false;
+    running_    = false;
+#endif
+}
+
+bool Checkpointer::isRunning()
+{
+    return running_;
+}
+
+uint64_t Checkpointer::intervalUs()
+{
+    return intervalUs_;
+}
+
+bool Checkpointer::onSignal()
+{
+    return onSignal_;
+}
+
+/**.......................................................................
+ * Route SIGTERM and SIGABRT through handleSignal()
+ */
+void Checkpointer::installHandlers()
+{
+#ifndef _WIN32
+    signalOwner_ = this;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_sigaction = &handleSignal;
+    action.sa_flags     = SA_SIGINFO | SA_RESTART;
+
+    sigaction(SIGTERM, &action, &oldTermAction_);
+    sigaction(SIGABRT, &action, &oldAbrtAction_);
+#endif
+}
+
+/**.......................................................................
+ * Put back the handlers that were installed before ours, unless
+ * someone has replaced ours in the meantime
+ */
+void Checkpointer::removeHandlers()
+{
+#ifndef _WIN32
+    struct sigaction current;
+
+    if(sigaction(SIGTERM, NULL, &current) == 0 && current.sa_sigaction == &handleSignal)
+        sigaction(SIGTERM, &oldTermAction_, NULL);
+
+    if(sigaction(SIGABRT, NULL, &current) == 0 && current.sa_sigaction == &handleSignal)
+        sigaction(SIGABRT, &oldAbrtAction_, NULL);
+
+    signalOwner_ = 0;
+#endif
+}
+
+/**.......................................................................
+ * Close the wake and done pipes
+ */
+void Checkpointer::closeFds()
+{
+#ifndef _WIN32
+    for(unsigned i=0; i < 2; i++) {
+        if(wakeFds_[i] >= 0)
+            close(wakeFds_[i]);
+        if(doneFds_[i] >= 0)
+            close(doneFds_[i]);
+    }
+#endif
+
+    wakeFds_[0] = -1;
+    wakeFds_[1] = -1;
+    doneFds_[0] = -1;
+    doneFds_[1] = -1;
+}
+
+#ifndef _WIN32
+
+/**.......................................................................
+ * The checkpoint thread: checkpoint every interval, or when woken by
+ * the signal handler, until woken by stop()
+ */
+void* Checkpointer::run(void* arg)
+{
+    Checkpointer* cp = (Checkpointer*)arg;
+
+    // Leave the signals we handle to other threads, so that the
+    // handler never waits on the thread it is running in
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGABRT);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while(true) {
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(cp->wakeFds_[0], &fds);
+
+        struct timeval timeout;
+        timeout.tv_sec  = cp->intervalUs_ / 1000000;
+        timeout.tv_usec = cp->intervalUs_ % 1000000;
+
+        int nReady = select(cp->wakeFds_[0]+1, &fds, NULL, NULL, cp->intervalUs_ > 0 ? &timeout : NULL);
+
+        if(nReady < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        char c = 0;
+        if(nReady > 0 && read(cp->wakeFds_[0], &c, 1) != 1)
+            continue;
+
+        if(c == CHECKPOINTER_WAKE_STOP)
+            break;
+
+        try {
+            cp->checkpointFn_(cp->arg_);
+        } catch(...) {
+        }
+
+        if(c == CHECKPOINTER_WAKE_SIGNAL) {
+            while(write(cp->doneFds_[1], &c, 1) < 0 && errno == EINTR)
+                ;
+        }
+    }
+
+    return 0;
+}
+
+/**.......................................................................
+ * Handler for SIGTERM and SIGABRT.  Only async-signal-safe calls are
+ * made here: the checkpoint itself is written by the checkpoint
+ * thread
+ */
+void Checkpointer::handleSignal(int sig, siginfo_t* info, void* context)
+{
+    int savedErrno = errno;
+
+    Checkpointer* cp = signalOwner_;
+
+    if(cp != 0 && !pthread_equal(pthread_self(), cp->threadId_)) {
+        char c;
+        while(read(cp->doneFds_[0], &c, 1) == 1)
+            ;
+
+        c = CHECKPOINTER_WAKE_SIGNAL;
+        if(write(cp->wakeFds_[1], &c, 1) == 1) {
+            struct pollfd pfd;
+            pfd.fd      = cp->doneFds_[0];
+            pfd.events  = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, 1, CHECKPOINTER_SIGNAL_TIMEOUT_MS);
+        }
+    }
+
+    //------------------------------------------------------------
+    // Now pass the signal on.  The default action is taken by
+    // restoring it and raising the signal again, which is delivered
+    // as soon as this handler returns
+    //------------------------------------------------------------
+
+    struct sigaction* old = (sig == SIGTERM) ? &oldTermAction_ : &oldAbrtAction_;
+
+    errno = savedErrno;
+
+    if(old->sa_flags & SA_SIGINFO) {
+        old->sa_sigaction(sig, info, context);
+    } else if(old->sa_handler == SIG_IGN) {
+        return;
+    } else if(old->sa_handler == SIG_DFL) {
+        sigaction(sig, old, NULL);
+        raise(sig);
+    } else {
+        old->sa_handler(sig);
+    }
+}
+
+#endif
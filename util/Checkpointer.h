@@ -0,0 +1,103 @@
+// $Id: $
+
+#ifndef PROFILER_CHECKPOINTER_H
+#define PROFILER_CHECKPOINTER_H
+
+/**
+ * @file Checkpointer.h
+ *
+ * Tagged: Mon Oct 19 21:36:40 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <inttypes.h>
+
+#include "export.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Calls a checkpoint function from a thread of its own, every
+    // interval and, optionally, when the process receives SIGTERM
+    // or SIGABRT.
+    //
+    // The signal handler does no work itself: it wakes the thread
+    // through a pipe, waits (for at most
+    // CHECKPOINTER_SIGNAL_TIMEOUT_MS) for the checkpoint to be
+    // written, and then passes the signal on to whatever handler
+    // was installed before, or to the default action.  Only one
+    // Checkpointer can handle signals at a time
+    //------------------------------------------------------------
+
+    class Checkpointer {
+    public:
+
+        typedef void (*CheckpointFn)(void* arg);
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API Checkpointer();
+
+        /**
+         * Destructor.  Stops the thread if it is running
+         */
+        PROFILER_API virtual ~Checkpointer();
+
+        // Start checkpointing every intervalUs (0 for signals only),
+        // replacing any previous settings
+
+        PROFILER_API void start(uint64_t intervalUs, bool onSignal, CheckpointFn checkpointFn, void* arg);
+        PROFILER_API void stop();
+        PROFILER_API bool isRunning();
+
+        PROFILER_API uint64_t intervalUs();
+        PROFILER_API bool onSignal();
+
+    private:
+
+        uint64_t intervalUs_;
+        bool onSignal_;
+
+        CheckpointFn checkpointFn_;
+        void* arg_;
+
+        int wakeFds_[2];
+        int doneFds_[2];
+        bool running_;
+
+#ifndef _WIN32
+        pthread_t threadId_;
+
+        static void* run(void* arg);
+
+        //------------------------------------------------------------
+        // State for the signal handler, which can only reach the
+        // handling Checkpointer through statics
+        //------------------------------------------------------------
+
+        static Checkpointer* volatile signalOwner_;
+        static struct sigaction oldTermAction_;
+        static struct sigaction oldAbrtAction_;
+
+        static void handleSignal(int sig, siginfo_t* info, void* context);
+#endif
+
+        void installHandlers();
+        void removeHandlers();
+        void closeFds();
+
+    }; // End class Checkpointer
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_CHECKPOINTER_H
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "CounterFamily.h"
+#include "exceptionutils.h"
+
+#include <sstream>
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Names and labels are written space- and comma-separated, so can't
+ * contain either (or '=')
+ */
+static void checkName(std::string name, std::string what)
+{
+    if(name.empty() || name.find_first_of(" \t\n,=") != std::string::npos)
+        ThrowRuntimeError("Invalid " << what << " '" << name << "': must be non-empty, "
+                          "with no whitespace, ',' or '='");
+}
+
+/**.......................................................................
+ * Constructor.
+ */
+CounterFamily::CounterFamily(std::string name, std::vector<Dimension>& dims,
+                             unsigned int bufferSize, uint64_t intervalUs,
+                             std::string outputFile, BufferedAtomicCounter::Kind kind)
+{
+    checkName(name, "counter family name");
+    
+    if(dims.size() == 0 || dims.size() > MAX_FAMILY_DIMS)
+        ThrowRuntimeError("Counter family " << name << " has " << dims.size()
+                          << " dimensions (must be 1-" << MAX_FAMILY_DIMS << ")");
+    
+    uint64_t nCell = 1;
+    for(unsigned i=0; i < dims.size(); i++) {
+
+        checkName(dims[i].name_, "dimension name");
+        for(unsigned j=0; j < dims[i].labels_.size(); j++)
+            checkName(dims[i].labels_[j], "dimension label");
+        
+        if(dims[i].size_ == 0)
+            ThrowRuntimeError("Dimension " << dims[i].name_ << " of counter family " << name << " is empty");
+
+        if(!dims[i].labels_.empty() && dims[i].labels_.size() != dims[i].size_)
+            ThrowRuntimeError("Dimension " << dims[i].name_ << " has " << dims[i].labels_.size()
+                              << " labels but size " << dims[i].size_);
+        
+        nCell *= dims[i].size_;
+        
+        if(nCell > MAX_FAMILY_CELLS)
+            ThrowRuntimeError("Counter family " << name << " has more than " << MAX_FAMILY_CELLS << " cells");
+    }
+
+    name_       = name;
+    outputFile_ = outputFile;
+    firstDump_  = true;
+    dims_       = dims;
+
+    cells_.resize(nCell);
+    for(unsigned i=0; i < cells_.size(); i++)
+        cells_[i].setTo(bufferSize, intervalUs, kind);
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+CounterFamily::~CounterFamily() {}
+
+/**.......................................................................
+ * Return the cell at indices, or NULL if they don't match the schema
+ */
+BufferedAtomicCounter* CounterFamily::getCell(const unsigned* indices, unsigned nIndex)
+{
+    if(nIndex != dims_.size())
+        return 0;
+
+    unsigned cell = 0;
+    for(unsigned i=0; i < nIndex; i++) {
+        if(indices[i] >= dims_[i].size_)
+            return 0;
+        cell = cell * dims_[i].size_ + indices[i];
+    }
+
+    return &cells_[cell];
+}
+
+bool CounterFamily::increment(const unsigned* indices, unsigned nIndex, uint64_t currentUs)
+{
+    BufferedAtomicCounter* cell = getCell(indices, nIndex);
+
+    if(!cell)
+        return false;
+    
+    cell->increment(currentUs);
+    return true;
+}
+
+bool CounterFamily::add(const unsigned* indices, unsigned nIndex, uint64_t currentUs, uint64_t value)
+{
+    BufferedAtomicCounter* cell = getCell(indices, nIndex);
+
+    if(!cell)
+        return false;
+    
+    cell->add(currentUs, value);
+    return true;
+}
+
+void CounterFamily::drain(uint64_t currentUs, std::vector<uint64_t>& bins)
+{
+    for(unsigned i=0; i < cells_.size(); i++)
+        cells_[i].drain(currentUs, bins);
+}
+
+std::string CounterFamily::header()
+{
+    std::ostringstream os;
+
+    os << "family: " << name_ << std::endl << "dims: ";
+
+    for(unsigned i=0; i < dims_.size(); i++) {
+        os << dims_[i].name_ << "=";
+        if(dims_[i].labels_.empty()) {
+            os << dims_[i].size_;
+        } else {
+            for(unsigned j=0; j < dims_[i].labels_.size(); j++)
+                os << dims_[i].labels_[j] << (j+1 < dims_[i].labels_.size() ? "," : "");
+        }
+        os << " ";
+    }
+    os << std::endl;
+
+    if(cells_[0].kind() != BufferedAtomicCounter::KIND_COUNT)
+        os << "kinds: " << BufferedAtomicCounter::kindToString(cells_[0].kind()) << std::endl;
+    
+    return os.str();
+}
+
+unsigned CounterFamily::nCells()
+{
+    return cells_.size();
+}
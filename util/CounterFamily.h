@@ -0,0 +1,105 @@
+// $Id: $
+
+#ifndef PROFILER_COUNTERFAMILY_H
+#define PROFILER_COUNTERFAMILY_H
+
+/**
+ * @file CounterFamily.h
+ * 
+ * Tagged: Tue Oct 20 09:14:52 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include "BufferedAtomicCounter.h"
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "export.h"
+
+// Limits on the number and shape of families
+
+#define MAX_COUNTER_FAMILIES 64
+#define MAX_FAMILY_DIMS      8
+#define MAX_FAMILY_CELLS     65536
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // A family of time-resolved counters over an arbitrary set of
+    // dimensions (e.g. operation x client), declared once with a
+    // fixed size per dimension.  Each combination of dimension
+    // indices is a cell with its own BufferedAtomicCounter, so that
+    // incrementing is an index computation plus an atomic add.
+    //
+    // Cells are ordered with the last dimension varying fastest
+    //------------------------------------------------------------
+
+    class CounterFamily {
+    public:
+
+        struct Dimension {
+            std::string name_;
+            unsigned size_;
+
+            // Optional names for each index, written to the output
+            // header
+            
+            std::vector<std::string> labels_;
+        };
+        
+        /**
+         * Constructor.
+         */
+        PROFILER_API CounterFamily(std::string name, std::vector<Dimension>& dims,
+                                   unsigned int bufferSize, uint64_t intervalUs,
+                                   std::string outputFile,
+                                   BufferedAtomicCounter::Kind kind=BufferedAtomicCounter::KIND_COUNT);
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~CounterFamily();
+
+        // Increment the cell at indices[0..nIndex).  Returns false
+        // (and does nothing) if the indices don't match the schema
+        
+        PROFILER_API bool increment(const unsigned* indices, unsigned nIndex, uint64_t currentUs);
+
+        // Accumulate value into the cell, according to the family's
+        // kind
+        
+        PROFILER_API bool add(const unsigned* indices, unsigned nIndex, uint64_t currentUs, uint64_t value);
+
+        // Append the bins of all cells, in cell order, to bins
+        
+        PROFILER_API void drain(uint64_t currentUs, std::vector<uint64_t>& bins);
+
+        // The file header: "family: name", "dims: d1=n d2=a,b,c",
+        // and "kinds: kind" if the family is not a plain count
+        
+        PROFILER_API std::string header();
+
+        PROFILER_API unsigned nCells();
+        
+        std::string name_;
+        std::string outputFile_;
+        bool firstDump_;
+        
+    private:
+
+        std::vector<Dimension> dims_;
+        std::vector<BufferedAtomicCounter> cells_;
+
+        BufferedAtomicCounter* getCell(const unsigned* indices, unsigned nIndex);
+        
+    }; // End class CounterFamily
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_COUNTERFAMILY_H
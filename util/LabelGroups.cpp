@@ -0,0 +1,192 @@
+#include "stdafx.h"
+#include "LabelGroups.h"
+
+#include "exceptionutils.h"
+
+#ifdef __APPLE__
+#include <libkern/OSAtomic.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.
+ */
+LabelGroups::LabelGroups()
+{
+    nGroups_ = 1;
+    enabled_ = ~(uint64_t)0;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+LabelGroups::~LabelGroups() {}
+
+/**.......................................................................
+ * Return the group of a label: the named group with the longest
+ * prefix of the label, or 0 if there is none
+ */
+unsigned LabelGroups::groupOf(const std::string& label)
+{
+    unsigned nGroups = nGroups_;
+    unsigned group = 0;
+    size_t longest = 0;
+
+    for(unsigned iGroup=1; iGroup < nGroups; iGroup++) {
+        const std::string& prefix = prefixes_[iGroup];
+        if(prefix.size() > longest && label.compare(0, prefix.size(), prefix) == 0) {
+            group   = iGroup;
+            longest = prefix.size();
+        }
+    }
+
+    return group;
+}
+
+/**.......................................................................
+ * Enable or disable the groups matching a pattern
+ */
+void LabelGroups::enable(std::string pattern, bool enable)
+{
+    if(pattern == "*") {
+        setEnabled(enable ? ~(uint64_t)0 : 0);
+        return;
+    }
+
+    std::string prefix = pattern;
+    if(!prefix.empty() && prefix[prefix.size()-1] == '*')
+        prefix.erase(prefix.size()-1);
+
+    if(prefix.empty())
+        ThrowRuntimeError("Invalid label group pattern: '" << pattern << "'");
+
+    //------------------------------------------------------------
+    // Create the group if necessary, starting in the state of the
+    // group it is nested in.  The prefix is made visible before the
+    // count that covers it
+    //------------------------------------------------------------
+
+    unsigned nGroups = nGroups_;
+    unsigned iGroup = 1;
+    for(; iGroup < nGroups; iGroup++)
+        if(prefixes_[iGroup] == prefix)
+            break;
+
+    uint64_t enabled = enabled_;
+
+    if(iGroup == nGroups) {
+
+        if(nGroups == LABEL_GROUPS_MAX)
+            ThrowRuntimeError("Too many label groups (max " << LABEL_GROUPS_MAX-1 << ")");
+
+        uint64_t bit = (uint64_t)1 << nGroups;
+        if((enabled >> groupOf(prefix)) & 1)
+            enabled |= bit;
+        else
+            enabled &= ~bit;
+        setEnabled(enabled);
+
+        prefixes_[nGroups] = prefix;
+
+#ifdef __APPLE__
+        OSMemoryBarrier();
+#elif defined _WIN32
+        MemoryBarrier();
+#else
+        __sync_synchronize();
+#endif
+        nGroups_ = nGroups + 1;
+    }
+
+    //------------------------------------------------------------
+    // Now set or clear this group and every group nested in it
+    //------------------------------------------------------------
+
+    uint64_t mask = 0;
+    nGroups = nGroups_;
+    for(unsigned jGroup=1; jGroup < nGroups; jGroup++)
+        if(prefixes_[jGroup].compare(0, prefix.size(), prefix) == 0)
+            mask |= (uint64_t)1 << jGroup;
+
+    setEnabled(enable ? (enabled | mask) : (enabled & ~mask));
+}
+
+uint64_t LabelGroups::enabledBits()
+{
+    return enabled_;
+}
+
+unsigned LabelGroups::groupCount()
+{
+    return nGroups_;
+}
+
+/**.......................................................................
+ * Restore saved enable bits.  Bits of groups created since they were
+ * saved are meaningless, so each such group takes the state of the
+ * saved group with the longest prefix of its own (or group 0)
+ */
+void LabelGroups::restoreEnabledBits(uint64_t enabled, unsigned groupCount)
+{
+    unsigned nGroups = nGroups_;
+
+    for(unsigned iGroup=groupCount; iGroup < nGroups; iGroup++) {
+        const std::string& prefix = prefixes_[iGroup];
+        unsigned parent = 0;
+        size_t longest = 0;
+
+        for(unsigned jGroup=1; jGroup < groupCount; jGroup++) {
+            const std::string& parentPrefix = prefixes_[jGroup];
+            if(parentPrefix.size() > longest && parentPrefix.size() < prefix.size() &&
+               prefix.compare(0, parentPrefix.size(), parentPrefix) == 0) {
+                parent  = jGroup;
+                longest = parentPrefix.size();
+            }
+        }
+
+        uint64_t bit = (uint64_t)1 << iGroup;
+        if((enabled >> parent) & 1)
+            enabled |= bit;
+        else
+            enabled &= ~bit;
+    }
+
+    setEnabled(enabled);
+}
+
+/**.......................................................................
+ * Format the groups and their state
+ */
+void LabelGroups::format(std::ostringstream& os)
+{
+    uint64_t enabled = enabled_;
+
+    os << "* " << ((enabled & 1) ? "on" : "off");
+
+    for(unsigned iGroup=1; iGroup < nGroups_; iGroup++)
+        os << ", " << prefixes_[iGroup] << " " << (((enabled >> iGroup) & 1) ? "on" : "off");
+}
+
+/**.......................................................................
+ * Publish a new set of enable bits
+ */
+void LabelGroups::setEnabled(uint64_t enabled)
+{
+#ifdef __APPLE__
+    int64_t curr;
+    do {
+        curr = enabled_;
+    } while(!OSAtomicCompareAndSwap64(curr, enabled, (volatile int64_t*)&enabled_));
+#elif defined _WIN32
+    InterlockedExchange64((volatile LONGLONG*)&enabled_, enabled);
+#else
+    __sync_lock_test_and_set(&enabled_, enabled);
+#endif
+}
@@ -0,0 +1,110 @@
+// $Id: $
+
+#ifndef PROFILER_LABELGROUPS_H
+#define PROFILER_LABELGROUPS_H
+
+/**
+ * @file LabelGroups.h
+ *
+ * Tagged: Mon Oct 19 22:14:08 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+#include <sstream>
+#include <inttypes.h>
+
+#include "export.h"
+
+// Groups are bits of a 64-bit word; group 0 holds every label that
+// matches no named group
+
+#define LABEL_GROUPS_MAX 64
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Runtime enabling and disabling of counters by label prefix.
+    //
+    // A group is named by a label prefix ("compaction." for the
+    // pattern "compaction.*"), and a label belongs to the group
+    // with the longest prefix that matches it, so groups nest:
+    // "compaction.*" can be off while "compaction.level0.*" is on.
+    // Enabling or disabling a pattern applies to its group and to
+    // every group nested inside it.
+    //
+    // The enable bits of all groups are kept in one word, which
+    // isEnabled() reads with a single load.  When every group is on
+    // (the default) or every group is off, that load and one branch
+    // are the whole cost; otherwise the label is matched against the
+    // (at most LABEL_GROUPS_MAX) group prefixes.
+    //
+    // Groups are only ever added, and each prefix is written before
+    // the count that covers it is published, so isEnabled() needs no
+    // lock.  enable() must be serialized by the caller
+    //------------------------------------------------------------
+
+    class LabelGroups {
+    public:
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API LabelGroups();
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~LabelGroups();
+
+        // Enable or disable the groups matching a pattern: "*" for
+        // all of them, or a prefix with an optional trailing "*".
+        // Creates the group if it doesn't exist yet
+
+        PROFILER_API void enable(std::string pattern, bool enable);
+
+        inline bool isEnabled(const std::string& label) {
+            uint64_t enabled = enabled_;
+
+            if(enabled == ~(uint64_t)0)
+                return true;
+
+            if(enabled == 0)
+                return false;
+
+            return (enabled >> groupOf(label)) & 1;
+        }
+
+        PROFILER_API unsigned groupOf(const std::string& label);
+
+        // Save and restore the enable bits of all groups.  Groups
+        // created since the bits were saved (those at and above
+        // groupCount) take the restored state of the group they
+        // are nested in
+
+        PROFILER_API uint64_t enabledBits();
+        PROFILER_API unsigned groupCount();
+        PROFILER_API void restoreEnabledBits(uint64_t enabled, unsigned groupCount);
+
+        // Format the named groups and their state, e.g.
+        // "* off, compaction. on"
+
+        PROFILER_API void format(std::ostringstream& os);
+
+    private:
+
+        std::string prefixes_[LABEL_GROUPS_MAX];
+        volatile unsigned nGroups_;
+        volatile uint64_t enabled_;
+
+        void setEnabled(uint64_t enabled);
+
+    }; // End class LabelGroups
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_LABELGROUPS_H
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "OneShotTimer.h"
+
+#include "exceptionutils.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.
+ */
+OneShotTimer::OneShotTimer()
+{
+    delayUs_    = 0;
+    expireFn_   = 0;
+    arg_        = 0;
+    wakeFds_[0] = -1;
+    wakeFds_[1] = -1;
+    running_    = false;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+OneShotTimer::~OneShotTimer()
+{
+    cancel();
+}
+
+/**.......................................................................
+ * Start the timer thread
+ */
+void OneShotTimer::start(uint64_t delayUs, ExpireFn expireFn, void* arg)
+{
+#ifdef _WIN32
+    ThrowRuntimeError("Timed sessions are not supported on this platform");
+#else
+    cancel();
+
+    delayUs_  = delayUs;
+    expireFn_ = expireFn;
+    arg_      = arg;
+
+    if(pipe(wakeFds_) != 0) {
+        int err = errno;
+        closeFds();
+        ThrowRuntimeError("Unable to create timer wake pipe: " << strerror(err));
+    }
+
+    for(unsigned i=0; i < 2; i++) {
+        int flags = fcntl(wakeFds_[i], F_GETFD);
+        if(flags >= 0)
+            fcntl(wakeFds_[i], F_SETFD, flags | FD_CLOEXEC);
+    }
+
+    if(pthread_create(&threadId_, NULL, &run, this) != 0) {
+        closeFds();
+        ThrowRuntimeError("Unable to create timer thread");
+    }
+
+    running_ = true;
+#endif
+}
+
+/**.......................................................................
+ * Wake the thread if it is still waiting, and wait for it to exit.
+ * This also reaps a thread that has already fired
+ */
+void OneShotTimer::cancel()
+{
+#ifndef _WIN32
+    if(!running_)
+        return;
+
+    char c = 0;
+    while(write(wakeFds_[1], &c, 1) < 0 && errno == EINTR)
+        ;
+
+    pthread_join(threadId_, NULL);
+
+    closeFds();
+
+    running_ = false;
+#endif
+}
+
+void OneShotTimer::closeFds()
+{
+#ifndef _WIN32
+    for(unsigned i=0; i < 2; i++)
+        if(wakeFds_[i] >= 0)
+            close(wakeFds_[i]);
+#endif
+
+    wakeFds_[0] = -1;
+    wakeFds_[1] = -1;
+}
+
+#ifndef _WIN32
+
+/**.......................................................................
+ * The timer thread: wait out the delay, and call the function unless
+ * woken by cancel() first
+ */
+void* OneShotTimer::run(void* arg)
+{
+    OneShotTimer* timer = (OneShotTimer*)arg;
+
+    struct timeval timeout;
+    timeout.tv_sec  = timer->delayUs_ / 1000000;
+    timeout.tv_usec = timer->delayUs_ % 1000000;
+
+    int nReady;
+
+    do {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(timer->wakeFds_[0], &fds);
+
+        nReady = select(timer->wakeFds_[0]+1, &fds, NULL, NULL, &timeout);
+
+    } while(nReady < 0 && errno == EINTR);
+
+    if(nReady == 0) {
+        try {
+            timer->expireFn_(timer->arg_);
+        } catch(...) {
+        }
+    }
+
+    return 0;
+}
+
+#endif
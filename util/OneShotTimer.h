@@ -0,0 +1,77 @@
+// $Id: $
+
+#ifndef PROFILER_ONESHOTTIMER_H
+#define PROFILER_ONESHOTTIMER_H
+
+/**
+ * @file OneShotTimer.h
+ *
+ * Tagged: Mon Oct 19 22:51:26 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <inttypes.h>
+
+#include "export.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Calls a function once, from a thread of its own, after a
+    // delay, unless cancelled first.
+    //
+    // cancel() waits for the thread to exit, including a call in
+    // progress, so it must not be called from the function itself,
+    // nor with a lock the function takes
+    //------------------------------------------------------------
+
+    class OneShotTimer {
+    public:
+
+        typedef void (*ExpireFn)(void* arg);
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API OneShotTimer();
+
+        /**
+         * Destructor.  Cancels the timer if it is still pending
+         */
+        PROFILER_API virtual ~OneShotTimer();
+
+        // Start the timer, cancelling any previous one first
+
+        PROFILER_API void start(uint64_t delayUs, ExpireFn expireFn, void* arg);
+        PROFILER_API void cancel();
+
+    private:
+
+        uint64_t delayUs_;
+        ExpireFn expireFn_;
+        void* arg_;
+
+        int wakeFds_[2];
+        bool running_;
+
+#ifndef _WIN32
+        pthread_t threadId_;
+
+        static void* run(void* arg);
+#endif
+
+        void closeFds();
+
+    }; // End class OneShotTimer
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_ONESHOTTIMER_H
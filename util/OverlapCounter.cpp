@@ -0,0 +1,241 @@
+#include "stdafx.h"
+#include "OverlapCounter.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+// Attempts read() makes at a consistent view before settling for the
+// last one, so that a reader can't be starved by constant updates
+
+#define OVERLAP_READ_MAX_TRIES 100000
+
+// Added to seq_ to end an update: one fewer writer in progress, one
+// more update completed
+
+#define OVERLAP_SEQ_DONE (((uint64_t)1 << 32) - 1)
+
+//=======================================================================
+// OverlapCounter::Values
+//=======================================================================
+
+OverlapCounter::Values::Values()
+{
+    active_      = 0;
+    peakActive_  = 0;
+    completed_   = 0;
+    latencyUsec_ = 0;
+    busyUsec_    = 0;
+    unmatched_   = 0;
+}
+
+int64_t OverlapCounter::Values::getField(ProfileSnapshot::Field field)
+{
+    switch (field) {
+    case ProfileSnapshot::FIELD_COUNTS:
+        return completed_;
+        break;
+    case ProfileSnapshot::FIELD_USEC:
+        return latencyUsec_;
+        break;
+    case ProfileSnapshot::FIELD_ACTIVE:
+        return active_;
+        break;
+    case ProfileSnapshot::FIELD_PEAK_ACTIVE:
+        return peakActive_;
+        break;
+    case ProfileSnapshot::FIELD_BUSY_USEC:
+        return busyUsec_;
+        break;
+    default:
+        return 0;
+        break;
+    }
+}
+
+//=======================================================================
+// OverlapCounter
+//=======================================================================
+
+/**.......................................................................
+ * Constructor.
+ */
+OverlapCounter::OverlapCounter()
+{
+    labelSlot_  = 0;
+    seq_        = 0;
+    active_     = 0;
+    peakActive_ = 0;
+    completed_  = 0;
+    unmatched_  = 0;
+    latency_    = 0;
+    busy_       = 0;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+OverlapCounter::~OverlapCounter() {}
+
+/**.......................................................................
+ * Start an interval.  If it is the only one active, it also starts a
+ * busy period
+ */
+void OverlapCounter::start(int64_t usec)
+{
+    addU64(&seq_, 1);
+
+    int64_t prev = active_;
+    while(!cas64(&active_, prev, prev + 1))
+        prev = active_;
+
+    addU64(&latency_, -(uint64_t)usec);
+
+    if(prev == 0)
+        addU64(&busy_, -(uint64_t)usec);
+
+    addU64(&seq_, OVERLAP_SEQ_DONE);
+
+    // The peak doesn't have to agree with the other values, so it
+    // is updated outside the sequence
+
+    int64_t peak = peakActive_;
+    while(prev + 1 > peak && !cas64(&peakActive_, peak, prev + 1))
+        peak = peakActive_;
+}
+
+/**.......................................................................
+ * Stop an interval.  If it was the last one active, it also ends the
+ * busy period
+ */
+bool OverlapCounter::stop(int64_t usec)
+{
+    addU64(&seq_, 1);
+
+    int64_t prev = active_;
+
+    do {
+        if(prev <= 0) {
+            addU64(&seq_, OVERLAP_SEQ_DONE);
+            add64(&unmatched_, 1);
+            return false;
+        }
+
+        if(cas64(&active_, prev, prev - 1))
+            break;
+
+        prev = active_;
+
+    } while(true);
+
+    addU64(&latency_, (uint64_t)usec);
+
+    if(prev == 1)
+        addU64(&busy_, (uint64_t)usec);
+
+    add64(&completed_, 1);
+
+    addU64(&seq_, OVERLAP_SEQ_DONE);
+
+    return true;
+}
+
+/**.......................................................................
+ * Read the values accumulated since the last rebase()
+ */
+void OverlapCounter::read(int64_t usec, Values& vals)
+{
+    readRaw(usec, vals);
+
+    vals.completed_   -= base_.completed_;
+    vals.latencyUsec_ -= base_.latencyUsec_;
+    vals.busyUsec_    -= base_.busyUsec_;
+    vals.unmatched_   -= base_.unmatched_;
+}
+
+void OverlapCounter::rebase(int64_t usec)
+{
+    readRaw(usec, base_);
+
+    int64_t peak = peakActive_;
+    while(!cas64(&peakActive_, peak, base_.active_))
+        peak = peakActive_;
+}
+
+/**.......................................................................
+ * Read a consistent set of values: the sequence must show no update
+ * in progress, and be unchanged after the values are read.  Open
+ * intervals (and an open busy period) count up to usec
+ */
+void OverlapCounter::readRaw(int64_t usec, Values& vals)
+{
+    int64_t active;
+    int64_t completed;
+    uint64_t latency;
+    uint64_t busy;
+
+    for(unsigned iTry=0; ; iTry++) {
+
+        uint64_t seq = seq_;
+        barrier();
+
+        active    = active_;
+        completed = completed_;
+        latency   = latency_;
+        busy      = busy_;
+
+        barrier();
+
+        if(((seq & 0xFFFFFFFF) == 0 && seq == seq_) || iTry + 1 == OVERLAP_READ_MAX_TRIES)
+            break;
+    }
+
+    vals.active_      = active;
+    vals.peakActive_  = peakActive_;
+    vals.completed_   = completed;
+    vals.latencyUsec_ = (int64_t)(latency + (uint64_t)(active * usec));
+    vals.busyUsec_    = (int64_t)(busy + (active > 0 ? (uint64_t)usec : 0));
+    vals.unmatched_   = unmatched_;
+}
+
+void OverlapCounter::add64(volatile int64_t* ptr, int64_t val)
+{
+#ifdef __APPLE__
+    OSAtomicAdd64Barrier(val, ptr);
+#elif defined _WIN32
+    InterlockedExchangeAdd64((volatile LONGLONG*)ptr, val);
+#else
+    __sync_fetch_and_add(ptr, val);
+#endif
+}
+
+void OverlapCounter::addU64(volatile uint64_t* ptr, uint64_t val)
+{
+    add64((volatile int64_t*)ptr, (int64_t)val);
+}
+
+bool OverlapCounter::cas64(volatile int64_t* ptr, int64_t oldVal, int64_t newVal)
+{
+#ifdef __APPLE__
+    return OSAtomicCompareAndSwap64Barrier(oldVal, newVal, ptr);
+#elif defined _WIN32
+    return InterlockedCompareExchange64((volatile LONGLONG*)ptr, newVal, oldVal) == oldVal;
+#else
+    return __sync_bool_compare_and_swap(ptr, oldVal, newVal);
+#endif
+}
+
+void OverlapCounter::barrier()
+{
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
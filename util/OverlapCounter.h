@@ -0,0 +1,137 @@
+// $Id: $
+
+#ifndef PROFILER_OVERLAPCOUNTER_H
+#define PROFILER_OVERLAPCOUNTER_H
+
+/**
+ * @file OverlapCounter.h
+ *
+ * Tagged: Tue Oct 20 00:31:47 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#ifdef __APPLE__
+#include <libkern/OSAtomic.h>
+#endif
+
+#include <string>
+#include <inttypes.h>
+
+#include "export.h"
+#include "ProfileSnapshot.h"
+
+#define MAX_OVERLAP_COUNTERS 64
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // A counter that accepts any number of overlapping intervals,
+    // for operations (requests, say) that run concurrently under
+    // one label.
+    //
+    // Stops are not matched to starts, and nothing is stored per
+    // interval: start() subtracts its time from a running sum and
+    // stop() adds its time, so that the sum, plus the current time
+    // for each interval still open, is the total latency of every
+    // interval.  The busy time (the union of the intervals) is
+    // kept the same way, from the times at which the number of
+    // active intervals leaves and returns to 0.  Both are wall-clock
+    // times: an interval is occupied from its start to its stop,
+    // whether or not anything is running on a CPU in between, so
+    // busy time includes preemption, blocking and sleeping.
+    //
+    // Updates are lock-free.  The active count, latency and busy
+    // sums only make sense together, so each update is bracketed
+    // by a sequence word (writers in progress in the low half,
+    // updates completed in the high half), and read() retries
+    // until it sees no update in progress and none completed
+    // while it read
+    //------------------------------------------------------------
+
+    class OverlapCounter {
+    public:
+
+        // Values accumulated since the last rebase()
+
+        struct Values {
+            int64_t active_;
+            int64_t peakActive_;
+            int64_t completed_;
+            int64_t latencyUsec_;
+            int64_t busyUsec_;
+            int64_t unmatched_;
+
+            Values();
+
+            // The value reported for a snapshot field: completed
+            // intervals as the count, their latency as the usec, and
+            // the concurrency fields.  0 for any other field
+
+            int64_t getField(ProfileSnapshot::Field field);
+        };
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API OverlapCounter();
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~OverlapCounter();
+
+        PROFILER_API void start(int64_t usec);
+
+        // Returns false (and counts it) if no interval is active
+
+        PROFILER_API bool stop(int64_t usec);
+
+        // Read the values as of usec, relative to the last rebase().
+        // Not safe against a concurrent rebase()
+
+        PROFILER_API void read(int64_t usec, Values& vals);
+
+        // Start accumulating from zero, as of usec.  The peak is
+        // reset to the number of intervals still active
+
+        PROFILER_API void rebase(int64_t usec);
+
+        // The label this counts, and its slot in the profiler
+
+        std::string label_;
+        unsigned labelSlot_;
+
+    private:
+
+        volatile uint64_t seq_;
+
+        volatile int64_t active_;
+        volatile int64_t peakActive_;
+        volatile int64_t completed_;
+        volatile int64_t unmatched_;
+
+        // Sums of stop times minus start times, and of busy-period
+        // end times minus start times.  Only differences are
+        // meaningful, so these are left to wrap
+
+        volatile uint64_t latency_;
+        volatile uint64_t busy_;
+
+        Values base_;
+
+        void readRaw(int64_t usec, Values& vals);
+
+        static void add64(volatile int64_t* ptr, int64_t val);
+        static void addU64(volatile uint64_t* ptr, uint64_t val);
+        static bool cas64(volatile int64_t* ptr, int64_t oldVal, int64_t newVal);
+        static void barrier();
+
+    }; // End class OverlapCounter
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_OVERLAPCOUNTER_H
@@ -0,0 +1,284 @@
+#include "stdafx.h"
+#include "PerfCounters.h"
+
+#if defined(__linux__)
+#define HAVE_PERF_EVENTS 1
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#else
+#define HAVE_PERF_EVENTS 0
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+// Written only by initialize(), under pthread_once(), which orders
+// the write before any read made after pthread_once() returns
+
+bool PerfCounters::available_ = false;
+
+//=======================================================================
+// PerfCounters::Sample
+//=======================================================================
+
+PerfCounters::Sample::Sample()
+{
+    valid_     = false;
+    enabledNs_ = 0;
+    runningNs_ = 0;
+    for(unsigned i=0; i < N_EVENT; i++)
+        values_[i] = 0;
+}
+
+/**.......................................................................
+ * Scale the counts between two samples by the time the group was
+ * enabled over the time it was running between them.  Counters are
+ * only ever read by their own thread, so neither count nor time can
+ * go backwards between two valid samples; guard against it anyway
+ * rather than wrap
+ */
+bool PerfCounters::delta(const Sample& start, const Sample& stop, uint64_t deltas[N_EVENT])
+{
+    if(!start.valid_ || !stop.valid_)
+        return false;
+
+    uint64_t enabled = stop.enabledNs_ > start.enabledNs_ ? stop.enabledNs_ - start.enabledNs_ : 0;
+    uint64_t running = stop.runningNs_ > start.runningNs_ ? stop.runningNs_ - start.runningNs_ : 0;
+
+    for(unsigned i=0; i < N_EVENT; i++) {
+        uint64_t value = stop.values_[i] > start.values_[i] ? stop.values_[i] - start.values_[i] : 0;
+
+        if(running == 0)
+            value = 0;
+        else if(running < enabled)
+            value = (uint64_t)((double)value * enabled / running);
+
+        deltas[i] = value;
+    }
+
+    return true;
+}
+
+#if HAVE_PERF_EVENTS
+
+//=======================================================================
+// Linux implementation
+//=======================================================================
+
+static pthread_key_t  groupKey;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+//------------------------------------------------------------
+// The event group for a single thread.  Events that couldn't be
+// opened (for example LLC misses inside some VMs) have fd = -1 and
+// are reported as 0.  A group read() returns the number of values,
+// the times the group was enabled and running, and then the values,
+// in the order in which members were added to the group
+//------------------------------------------------------------
+
+struct PerfCounters::ThreadGroup {
+    bool open_;
+    int leaderFd_;
+    int fds_[N_EVENT];
+    unsigned nOpen_;
+    unsigned readIndex_[N_EVENT];
+
+    ThreadGroup() {
+        open_     = false;
+        leaderFd_ = -1;
+        nOpen_    = 0;
+        for(unsigned i=0; i < N_EVENT; i++) {
+            fds_[i]       = -1;
+            readIndex_[i] = 0;
+        }
+    }
+};
+
+static int openEvent(uint32_t type, uint64_t config, int groupFd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = (groupFd == -1) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // pid = 0, cpu = -1: count this thread, on whatever cpu it runs
+    
+    return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/**.......................................................................
+ * Create the thread-group key, and find out whether counters can be
+ * opened at all, by opening (and closing) a cycles counter
+ */
+void PerfCounters::initialize()
+{
+    pthread_key_create(&groupKey, &deleteThreadGroup);
+
+    int fd = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+
+    if(fd >= 0) {
+        close(fd);
+        available_ = true;
+    }
+}
+
+void PerfCounters::deleteThreadGroup(void* arg)
+{
+    ThreadGroup* group = (ThreadGroup*)arg;
+
+    for(unsigned i=0; i < N_EVENT; i++) {
+        if(group->fds_[i] >= 0)
+            close(group->fds_[i]);
+    }
+    
+    delete group;
+}
+
+/**.......................................................................
+ * Return the event group for the calling thread, opening it if this
+ * is the first time this thread has asked for it
+ */
+PerfCounters::ThreadGroup* PerfCounters::getThreadGroup()
+{
+    ThreadGroup* group = (ThreadGroup*)pthread_getspecific(groupKey);
+
+    if(group)
+        return group;
+
+    group = new ThreadGroup();
+    pthread_setspecific(groupKey, group);
+
+    //------------------------------------------------------------
+    // Cycles is the group leader.  If we can't open it (out of file
+    // descriptors, say), this thread goes without
+    //------------------------------------------------------------
+    
+    group->leaderFd_ = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+
+    if(group->leaderFd_ < 0)
+        return group;
+
+    group->fds_[EVENT_CYCLES]       = group->leaderFd_;
+    group->readIndex_[EVENT_CYCLES] = group->nOpen_++;
+    
+    static const uint64_t configs[N_EVENT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for(unsigned i=EVENT_CYCLES+1; i < N_EVENT; i++) {
+        group->fds_[i] = openEvent(PERF_TYPE_HARDWARE, configs[i], group->leaderFd_);
+        if(group->fds_[i] >= 0)
+            group->readIndex_[i] = group->nOpen_++;
+    }
+
+    ioctl(group->leaderFd_, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(group->leaderFd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    group->open_ = true;
+    
+    return group;
+}
+
+bool PerfCounters::read(Sample& sample)
+{
+    sample.valid_ = false;
+
+    pthread_once(&initOnce, &initialize);
+
+    if(!available_)
+        return false;
+
+    ThreadGroup* group = getThreadGroup();
+
+    if(!group->open_)
+        return false;
+
+    // Group read format is { nr, time_enabled, time_running,
+    // values[nr] }
+    
+    uint64_t buf[N_EVENT + 3];
+    ssize_t expected = (group->nOpen_ + 3) * sizeof(uint64_t);
+    
+    if(::read(group->leaderFd_, buf, sizeof(buf)) != expected)
+        return false;
+
+    // Raw counts: multiplexing is corrected for by delta(), over
+    // the interval between two samples
+    
+    sample.enabledNs_ = buf[1];
+    sample.runningNs_ = buf[2];
+    
+    for(unsigned i=0; i < N_EVENT; i++)
+        sample.values_[i] = group->fds_[i] >= 0 ? buf[3 + group->readIndex_[i]] : 0;
+
+    sample.valid_ = true;
+    
+    return true;
+}
+
+#else
+
+//=======================================================================
+// Stub implementation for platforms without perf events
+//=======================================================================
+
+struct PerfCounters::ThreadGroup {};
+
+void PerfCounters::initialize() {}
+void PerfCounters::deleteThreadGroup(void* arg) {}
+
+PerfCounters::ThreadGroup* PerfCounters::getThreadGroup()
+{
+    return 0;
+}
+
+bool PerfCounters::read(Sample& sample)
+{
+    sample.valid_ = false;
+    return false;
+}
+
+#endif
+
+bool PerfCounters::isAvailable()
+{
+#if HAVE_PERF_EVENTS
+    pthread_once(&initOnce, &initialize);
+#endif
+    return available_;
+}
+
+const char* PerfCounters::eventName(unsigned event)
+{
+    switch (event) {
+    case EVENT_CYCLES:
+        return "cycles";
+        break;
+    case EVENT_INSTRUCTIONS:
+        return "instructions";
+        break;
+    case EVENT_LLC_MISSES:
+        return "llcmisses";
+        break;
+    case EVENT_BRANCH_MISSES:
+        return "branchmisses";
+        break;
+    default:
+        return "unknown";
+        break;
+    }
+}
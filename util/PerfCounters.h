@@ -0,0 +1,93 @@
+// $Id: $
+
+#ifndef PROFILER_PERFCOUNTERS_H
+#define PROFILER_PERFCOUNTERS_H
+
+/**
+ * @file PerfCounters.h
+ * 
+ * Tagged: Mon Oct 19 09:12:40 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <inttypes.h>
+
+#include "export.h"
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Per-thread hardware performance counters.  On Linux, each
+    // thread lazily opens a perf_event_open() group on first use,
+    // which is read with a single read() call thereafter.  On other
+    // platforms, or if the events can't be opened (no PMU, a
+    // restrictive perf_event_paranoid, etc.), samples are simply
+    // marked invalid.  When the PMU is shared, the kernel
+    // multiplexes the events.  Samples keep the raw counts, with the
+    // times the group was enabled and running, and delta() scales
+    // the counts between two samples by the enabled over the running
+    // time between them.  Scaling each sample's lifetime counts
+    // instead would multiply any change in that ratio by the whole
+    // history of the thread
+    //------------------------------------------------------------
+    
+    class PerfCounters {
+    public:
+
+        enum Event {
+            EVENT_CYCLES,
+            EVENT_INSTRUCTIONS,
+            EVENT_LLC_MISSES,
+            EVENT_BRANCH_MISSES,
+            N_EVENT
+        };
+
+        struct Sample {
+            bool valid_;
+            uint64_t values_[N_EVENT];
+            uint64_t enabledNs_;
+            uint64_t runningNs_;
+
+            PROFILER_API Sample();
+        };
+
+        // Read the current counter values for the calling thread.
+        // Returns false (and marks the sample invalid) if counters
+        // are not available
+
+        PROFILER_API static bool read(Sample& sample);
+
+        // The counts between two samples of the same thread, scaled
+        // for multiplexing.  Returns false (leaving deltas alone) if
+        // either sample is invalid.  Events that didn't run between
+        // the samples count 0
+
+        PROFILER_API static bool delta(const Sample& start, const Sample& stop, uint64_t deltas[N_EVENT]);
+
+        // Returns false if counters cannot be opened in this
+        // process.  This is decided once, by the first caller of
+        // read() or isAvailable()
+
+        PROFILER_API static bool isAvailable();
+
+        PROFILER_API static const char* eventName(unsigned event);
+        
+    private:
+
+        struct ThreadGroup;
+
+        static ThreadGroup* getThreadGroup();
+        static void deleteThreadGroup(void* arg);
+        static void initialize();
+        
+        static bool available_;
+        
+    }; // End class PerfCounters
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_PERFCOUNTERS_H
@@ -0,0 +1,456 @@
+#include "stdafx.h"
+#include "ProfileSnapshot.h"
+#include "ReportWriter.h"
+
+#include <map>
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.
+ */
+ProfileSnapshot::ProfileSnapshot()
+{
+    clear();
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+ProfileSnapshot::~ProfileSnapshot() {}
+
+void ProfileSnapshot::clear()
+{
+    epoch_           = 0;
+    totalCount_      = 0;
+    rejectedLabels_  = 0;
+    rejectedThreads_ = 0;
+    cpuSampled_      = false;
+    perfSampled_     = false;
+    allocSampled_    = false;
+    overlapSampled_  = false;
+
+    labels_.clear();
+    threadIds_.clear();
+    fields_.clear();
+    cells_.clear();
+    values_.clear();
+    warnings_.clear();
+
+    for(unsigned iField=0; iField < N_FIELD; iField++)
+        fieldSlots_[iField] = -1;
+}
+
+/**.......................................................................
+ * Clear the snapshot, and select the fields to copy: the count and
+ * elapsed usec always, and the optional quantities if sampled (or,
+ * for overlap counters, if any label counts overlapping intervals)
+ */
+void ProfileSnapshot::initialize(bool cpuSampled, bool perfSampled, bool allocSampled,
+                                 bool overlapSampled)
+{
+    clear();
+
+    cpuSampled_     = cpuSampled;
+    perfSampled_    = perfSampled;
+    allocSampled_   = allocSampled;
+    overlapSampled_ = overlapSampled;
+
+    for(unsigned iField=0; iField < N_FIELD; iField++) {
+
+        Field field = (Field)iField;
+        bool copy = true;
+        
+        switch (field) {
+        case FIELD_CPU_USEC:
+        case FIELD_OFFCPU_USEC:
+        case FIELD_VOL_CTX_SWITCHES:
+        case FIELD_INVOL_CTX_SWITCHES:
+            copy = cpuSampled;
+            break;
+        case FIELD_CYCLES:
+        case FIELD_INSTRUCTIONS:
+        case FIELD_LLC_MISSES:
+        case FIELD_BRANCH_MISSES:
+            copy = perfSampled;
+            break;
+        case FIELD_ALLOCS:
+        case FIELD_ALLOC_BYTES:
+        case FIELD_FREES:
+            copy = allocSampled;
+            break;
+        case FIELD_ACTIVE:
+        case FIELD_PEAK_ACTIVE:
+        case FIELD_BUSY_USEC:
+            copy = overlapSampled;
+            break;
+        default:
+            break;
+        }
+
+        if(copy) {
+            fieldSlots_[iField] = fields_.size();
+            fields_.push_back(field);
+        }
+    }
+}
+
+/**.......................................................................
+ * Subtract a baseline snapshot.  Label and thread slots are only
+ * ever appended, so a slot means the same counter in both snapshots
+ */
+void ProfileSnapshot::subtract(ProfileSnapshot& baseline)
+{
+    totalCount_      -= baseline.totalCount_      < totalCount_      ? baseline.totalCount_      : totalCount_;
+    rejectedLabels_  -= baseline.rejectedLabels_  < rejectedLabels_  ? baseline.rejectedLabels_  : rejectedLabels_;
+    rejectedThreads_ -= baseline.rejectedThreads_ < rejectedThreads_ ? baseline.rejectedThreads_ : rejectedThreads_;
+
+    //------------------------------------------------------------
+    // Index the baseline by (label, thread)
+    //------------------------------------------------------------
+
+    std::map<std::pair<unsigned, unsigned>, unsigned> baseCells;
+    for(unsigned iCell=0; iCell < baseline.cells_.size(); iCell++)
+        baseCells[std::make_pair(baseline.cells_[iCell].label_, baseline.cells_[iCell].thread_)] = iCell;
+
+    std::map<std::pair<unsigned, unsigned>, unsigned> baseWarnings;
+    for(unsigned iWarning=0; iWarning < baseline.warnings_.size(); iWarning++)
+        baseWarnings[std::make_pair(baseline.warnings_[iWarning].label_, baseline.warnings_[iWarning].thread_)] = iWarning;
+
+    //------------------------------------------------------------
+    // Subtract cell by cell, compacting in place
+    //------------------------------------------------------------
+
+    unsigned nField = fields_.size();
+    unsigned nKept = 0;
+
+    for(unsigned iCell=0; iCell < cells_.size(); iCell++) {
+
+        std::map<std::pair<unsigned, unsigned>, unsigned>::iterator base =
+            baseCells.find(std::make_pair(cells_[iCell].label_, cells_[iCell].thread_));
+
+        bool changed = false;
+
+        for(unsigned iField=0; iField < nField; iField++) {
+            int64_t val = values_[iCell * nField + iField];
+            if(base != baseCells.end() && !isGauge(fields_[iField]))
+                val -= baseline.value(base->second, fields_[iField]);
+            values_[nKept * nField + iField] = val;
+            changed = changed || val != 0;
+        }
+
+        if(changed)
+            cells_[nKept++] = cells_[iCell];
+    }
+
+    cells_.resize(nKept);
+    values_.resize(nKept * nField);
+
+    nKept = 0;
+
+    for(unsigned iWarning=0; iWarning < warnings_.size(); iWarning++) {
+
+        Warning warning = warnings_[iWarning];
+
+        std::map<std::pair<unsigned, unsigned>, unsigned>::iterator base =
+            baseWarnings.find(std::make_pair(warning.label_, warning.thread_));
+
+        if(base != baseWarnings.end()) {
+            warning.errorCountUninitiated_  -= baseline.warnings_[base->second].errorCountUninitiated_;
+            warning.errorCountUnterminated_ -= baseline.warnings_[base->second].errorCountUnterminated_;
+        }
+
+        if(warning.errorCountUninitiated_ > 0 || warning.errorCountUnterminated_ > 0 || warning.unterminated_)
+            warnings_[nKept++] = warning;
+    }
+
+    warnings_.resize(nKept);
+}
+
+/**.......................................................................
+ * Return the row name of a field
+ */
+const char* ProfileSnapshot::fieldName(Field field)
+{
+    switch (field) {
+    case FIELD_COUNTS:
+        return "count";
+        break;
+    case FIELD_USEC:
+        return "usec";
+        break;
+    case FIELD_CPU_USEC:
+        return "cpuusec";
+        break;
+    case FIELD_OFFCPU_USEC:
+        return "offcpuusec";
+        break;
+    case FIELD_VOL_CTX_SWITCHES:
+        return "vcsw";
+        break;
+    case FIELD_INVOL_CTX_SWITCHES:
+        return "ivcsw";
+        break;
+    case FIELD_CYCLES:
+        return "cycles";
+        break;
+    case FIELD_INSTRUCTIONS:
+        return "instructions";
+        break;
+    case FIELD_LLC_MISSES:
+        return "llcmisses";
+        break;
+    case FIELD_BRANCH_MISSES:
+        return "branchmisses";
+        break;
+    case FIELD_ALLOCS:
+        return "allocs";
+        break;
+    case FIELD_ALLOC_BYTES:
+        return "allocbytes";
+        break;
+    case FIELD_FREES:
+        return "frees";
+        break;
+    case FIELD_ACTIVE:
+        return "active";
+        break;
+    case FIELD_PEAK_ACTIVE:
+        return "peakactive";
+        break;
+    case FIELD_BUSY_USEC:
+        return "busyusec";
+        break;
+    default:
+        return "unknown";
+        break;
+    }
+}
+
+bool ProfileSnapshot::isGauge(Field field)
+{
+    return field == FIELD_ACTIVE || field == FIELD_PEAK_ACTIVE;
+}
+
+/**.......................................................................
+ * Write the snapshot in the profile file layout
+ */
+void ProfileSnapshot::writeText(ReportWriter& writer, bool term)
+{
+    //------------------------------------------------------------
+    // Write the total count at the top of the file, and the number
+    // of lookups rejected by the cardinality limits, if any
+    //------------------------------------------------------------
+
+    writeRowHead(writer, term, "totalcount");
+    writer.writeUint(totalCount_);
+    writer.write('\n');
+
+    if(rejectedLabels_ > 0 || rejectedThreads_ > 0) {
+        writeRowHead(writer, term, "rejected");
+        writer.writeUint(rejectedLabels_);
+        writer.write(' ');
+        writer.writeUint(rejectedThreads_);
+        writer.write('\n');
+    }
+
+    //------------------------------------------------------------
+    // Write the list of labels
+    //------------------------------------------------------------
+
+    writeRowHead(writer, term, "label");
+
+    for(unsigned iLabel=0; iLabel < labels_.size(); iLabel++) {
+        writer.write('\'');
+        writer.write(labels_[iLabel]);
+        writer.write("' ", 2);
+    }
+
+    writeRowTail(writer, term);
+
+    //------------------------------------------------------------
+    // Now the count and elapsed usec for each thread and label,
+    // followed by whichever optional quantities were sampled.  For
+    // hardware counters, these are followed by the derived
+    // instructions per cycle and misses per 1000 instructions, and
+    // last come the concurrency rows of overlap counters
+    //------------------------------------------------------------
+
+    writeFieldRows(writer, term, FIELD_COUNTS);
+    writeFieldRows(writer, term, FIELD_USEC);
+
+    if(cpuSampled_) {
+        writeFieldRows(writer, term, FIELD_CPU_USEC);
+        writeFieldRows(writer, term, FIELD_OFFCPU_USEC);
+        writeFieldRows(writer, term, FIELD_VOL_CTX_SWITCHES);
+        writeFieldRows(writer, term, FIELD_INVOL_CTX_SWITCHES);
+    }
+
+    if(perfSampled_) {
+        writeFieldRows(writer, term, FIELD_CYCLES);
+        writeFieldRows(writer, term, FIELD_INSTRUCTIONS);
+        writeFieldRows(writer, term, FIELD_LLC_MISSES);
+        writeFieldRows(writer, term, FIELD_BRANCH_MISSES);
+        writeRatioRows(writer, term, "ipc",     FIELD_INSTRUCTIONS,  FIELD_CYCLES,       1.0);
+        writeRatioRows(writer, term, "llcmpki", FIELD_LLC_MISSES,    FIELD_INSTRUCTIONS, 1000.0);
+        writeRatioRows(writer, term, "brmpki",  FIELD_BRANCH_MISSES, FIELD_INSTRUCTIONS, 1000.0);
+    }
+
+    if(allocSampled_) {
+        writeFieldRows(writer, term, FIELD_ALLOCS);
+        writeFieldRows(writer, term, FIELD_ALLOC_BYTES);
+        writeFieldRows(writer, term, FIELD_FREES);
+    }
+
+    if(overlapSampled_) {
+        writeFieldRows(writer, term, FIELD_ACTIVE);
+        writeFieldRows(writer, term, FIELD_PEAK_ACTIVE);
+        writeFieldRows(writer, term, FIELD_BUSY_USEC);
+    }
+
+    //------------------------------------------------------------
+    // Finally, write out any errors, with a blank line after each
+    // thread
+    //------------------------------------------------------------
+
+    unsigned iWarning = 0;
+
+    for(unsigned iThread=0; iThread < threadIds_.size(); iThread++) {
+
+        for(; iWarning < warnings_.size() && warnings_[iWarning].thread_ == iThread; iWarning++) {
+            Warning& warning = warnings_[iWarning];
+
+            if(warning.errorCountUninitiated_ > 0) {
+                writer.write("WARNING: thread 0x");
+                writer.writeHex(threadIds_[iThread]);
+                writer.write(" attempted ");
+                writer.writeUint(warning.errorCountUninitiated_);
+                writer.write(warning.errorCountUninitiated_ > 1 ? " terminations" : " termination");
+                writer.write(" of counter '");
+                writer.write(labels_[warning.label_]);
+                writer.write("' without initiation");
+                writeRowTail(writer, term);
+            }
+
+            if(warning.errorCountUnterminated_ > 0) {
+                writer.write("WARNING: thread 0x");
+                writer.writeHex(threadIds_[iThread]);
+                writer.write(" attempted ");
+                writer.writeUint(warning.errorCountUnterminated_);
+                writer.write(warning.errorCountUnterminated_ > 1 ? " initiations" : " initiation");
+                writer.write(" of counter '");
+                writer.write(labels_[warning.label_]);
+                writer.write("' without termination");
+                writeRowTail(writer, term);
+            }
+
+            if(warning.unterminated_) {
+                writer.write("WARNING: thread 0x");
+                writer.writeHex(threadIds_[iThread]);
+                writer.write(" left counter '");
+                writer.write(labels_[warning.label_]);
+                writer.write("' unterminated");
+                writeRowTail(writer, term);
+            }
+        }
+
+        writeRowTail(writer, term);
+    }
+}
+
+/**.......................................................................
+ * Write one row per thread of the requested field, for each label.
+ * Cells are ordered by thread and then label, so a single cursor
+ * walks them in step with the grid, and labels a thread never used
+ * are written as 0
+ */
+void ProfileSnapshot::writeFieldRows(ReportWriter& writer, bool term, Field field)
+{
+    unsigned iCell = 0;
+
+    for(unsigned iThread=0; iThread < threadIds_.size(); iThread++) {
+
+        writeRowHead(writer, term, fieldName(field), iThread);
+
+        for(unsigned iLabel=0; iLabel < labels_.size(); iLabel++) {
+            if(iCell < cells_.size() && cells_[iCell].thread_ == iThread && cells_[iCell].label_ == iLabel) {
+                writer.writeInt(value(iCell, field));
+                iCell++;
+            } else {
+                writer.write('0');
+            }
+            writer.write(' ');
+        }
+
+        writeRowTail(writer, term);
+    }
+}
+
+/**.......................................................................
+ * Write one row per thread of the ratio of two fields, for each label
+ */
+void ProfileSnapshot::writeRatioRows(ReportWriter& writer, bool term, const char* name,
+                                     Field num, Field den, double scale)
+{
+    unsigned iCell = 0;
+
+    for(unsigned iThread=0; iThread < threadIds_.size(); iThread++) {
+
+        writeRowHead(writer, term, name, iThread);
+
+        for(unsigned iLabel=0; iLabel < labels_.size(); iLabel++) {
+
+            int64_t denVal = 0;
+            int64_t numVal = 0;
+
+            if(iCell < cells_.size() && cells_[iCell].thread_ == iThread && cells_[iCell].label_ == iLabel) {
+                denVal = value(iCell, den);
+                numVal = value(iCell, num);
+                iCell++;
+            }
+
+            if(denVal == 0)
+                writer.write('0');
+            else
+                writer.writeFixed((scale * numVal) / denVal, 3);
+
+            writer.write(' ');
+        }
+
+        writeRowTail(writer, term);
+    }
+}
+
+/**.......................................................................
+ * Start a row with its name
+ */
+void ProfileSnapshot::writeRowHead(ReportWriter& writer, bool term, const char* name)
+{
+    if(term)
+        writer.write('\r');
+
+    writer.write(name);
+    writer.write(' ');
+}
+
+/**.......................................................................
+ * Start a per-thread row with its name and the thread id
+ */
+void ProfileSnapshot::writeRowHead(ReportWriter& writer, bool term, const char* name, unsigned iThread)
+{
+    writeRowHead(writer, term, name);
+
+    writer.write("0x", 2);
+    writer.writeHex(threadIds_[iThread]);
+    writer.write(' ');
+}
+
+void ProfileSnapshot::writeRowTail(ReportWriter& writer, bool term)
+{
+    writer.write('\n');
+
+    if(term)
+        writer.write('\r');
+}
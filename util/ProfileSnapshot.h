@@ -0,0 +1,166 @@
+// $Id: $
+
+#ifndef PROFILER_PROFILESNAPSHOT_H
+#define PROFILER_PROFILESNAPSHOT_H
+
+/**
+ * @file ProfileSnapshot.h
+ *
+ * Tagged: Mon Oct 19 19:20:41 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "export.h"
+
+namespace profiler {
+
+    class ReportWriter;
+
+    //------------------------------------------------------------
+    // A copy of the start/stop counters, taken under the profiler
+    // lock so that reports can be formatted without holding it.
+    // Only counters that have been used are copied, in order of
+    // thread slot and then label slot, so a report can walk the
+    // thread x label grid with a single cursor
+    //------------------------------------------------------------
+
+    class ProfileSnapshot {
+    public:
+
+        // Reported quantities, in row order
+
+        enum Field {
+            FIELD_COUNTS,
+            FIELD_USEC,
+            FIELD_CPU_USEC,
+            FIELD_OFFCPU_USEC,
+            FIELD_VOL_CTX_SWITCHES,
+            FIELD_INVOL_CTX_SWITCHES,
+            FIELD_CYCLES,
+            FIELD_INSTRUCTIONS,
+            FIELD_LLC_MISSES,
+            FIELD_BRANCH_MISSES,
+            FIELD_ALLOCS,
+            FIELD_ALLOC_BYTES,
+            FIELD_FREES,
+            FIELD_ACTIVE,
+            FIELD_PEAK_ACTIVE,
+            FIELD_BUSY_USEC,
+            N_FIELD
+        };
+
+        // A used counter: its label and thread slots
+
+        struct Cell {
+            unsigned label_;
+            unsigned thread_;
+        };
+
+        // A counter with start/stop errors
+
+        struct Warning {
+            unsigned label_;
+            unsigned thread_;
+            unsigned errorCountUninitiated_;
+            unsigned errorCountUnterminated_;
+            bool unterminated_;
+        };
+
+        // The epoch the counters belong to (see Profiler::reset())
+
+        unsigned epoch_;
+
+        uint64_t totalCount_;
+        uint64_t rejectedLabels_;
+        uint64_t rejectedThreads_;
+
+        bool cpuSampled_;
+        bool perfSampled_;
+        bool allocSampled_;
+        bool overlapSampled_;
+
+        std::vector<std::string> labels_;
+        std::vector<uint64_t> threadIds_;
+
+        // Cells and warnings are ordered by thread slot, then label
+        // slot.  Only the fields that will be reported are copied:
+        // fields_ lists them, and values_ holds fields_.size() values
+        // per cell
+
+        std::vector<Field> fields_;
+        std::vector<Cell> cells_;
+        std::vector<int64_t> values_;
+        std::vector<Warning> warnings_;
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API ProfileSnapshot();
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~ProfileSnapshot();
+
+        PROFILER_API void clear();
+
+        // Clear the snapshot and select the fields to copy, according
+        // to which optional quantities have been sampled
+
+        PROFILER_API void initialize(bool cpuSampled, bool perfSampled, bool allocSampled,
+                                     bool overlapSampled=false);
+
+        // Subtract an earlier snapshot of the same profiler, leaving
+        // what accumulated in between.  Cells and warnings that did
+        // not change are dropped; labels and threads are kept.
+        // Gauges (see isGauge()) are left as they are
+
+        PROFILER_API void subtract(ProfileSnapshot& baseline);
+
+        // The value of a field for a cell (0 if not copied)
+
+        inline int64_t value(unsigned iCell, Field field) {
+            return fieldSlots_[field] < 0 ? 0 : values_[iCell * fields_.size() + fieldSlots_[field]];
+        }
+
+        // Write the snapshot in the profile file layout (totalcount,
+        // label, then one row per thread for each quantity).  If
+        // term is true, rows are delimited with carriage returns for
+        // display on a raw terminal
+
+        PROFILER_API void writeText(ReportWriter& writer, bool term);
+
+        PROFILER_API static const char* fieldName(Field field);
+
+        // True for the current number and peak of active overlapping
+        // intervals, which are levels rather than accumulated sums
+
+        PROFILER_API static bool isGauge(Field field);
+
+    private:
+
+        // Index of each field in fields_, or -1
+
+        int fieldSlots_[N_FIELD];
+
+        void writeFieldRows(ReportWriter& writer, bool term, Field field);
+        void writeRatioRows(ReportWriter& writer, bool term, const char* name,
+                            Field num, Field den, double scale);
+        void writeRowHead(ReportWriter& writer, bool term, const char* name);
+        void writeRowHead(ReportWriter& writer, bool term, const char* name, unsigned iThread);
+        void writeRowTail(ReportWriter& writer, bool term);
+
+    }; // End class ProfileSnapshot
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_PROFILESNAPSHOT_H
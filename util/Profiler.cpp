@@ -1,11 +1,27 @@
 #include "stdafx.h"
 
 #include "Profiler.h"
+#include "AllocTracker.h"
+#include "Checkpointer.h"
+#include "LabelGroups.h"
+#include "OneShotTimer.h"
+#include "OverlapCounter.h"
+#include "PerfCounters.h"
+#include "ProfileSnapshot.h"
 #include "ProfString.h"
+#include "ReportFormat.h"
+#include "ReportWriter.h"
+#include "ScrapeServer.h"
+#include "ShmExport.h"
+#include "SpanPool.h"
+#include "SparseFormat.h"
+#include "TopK.h"
 
 #include "exceptionutils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <iomanip>
 #include <sstream>
 #include <fstream>
 #include <signal.h>
@@ -18,6 +34,7 @@
 
 #include <windows.h>
 #include <Winsock2.h>
+#include <io.h>
 
 // API for CreateThread is different for v120 vs v141
 
@@ -38,7 +55,12 @@ typedef DWORD thread_id;
 
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 #define VER PTHREAD
 #define THREAD_START(fn) void* (fn)(void *arg)
@@ -56,6 +78,11 @@ typedef pthread_t thread_id;
 //-----------------------------------------------------------------------
 
 
+// Dimensions of a block of counter storage (labels x threads)
+
+#define ARENA_BLOCK_LABELS  16
+#define ARENA_BLOCK_THREADS 16
+
 namespace profiler {
     class ProfilerImpl {
 
@@ -63,6 +90,27 @@ namespace profiler {
             STATE_TRIGGERED,
             STATE_DONE
         };
+
+        //------------------------------------------------------------
+        // A snapshot of the resource usage of the calling thread.
+        // This is sampled at counter start/stop only when CPU-time,
+        // hardware-counter or allocation profiling is enabled
+        //------------------------------------------------------------
+
+        struct ThreadUsage {
+            thread_id threadId_;
+
+            bool hasCpu_;
+            int64_t cpuUsec_;
+            int64_t wallUsec_;
+            int64_t volCtxSwitches_;
+            int64_t involCtxSwitches_;
+
+            PerfCounters::Sample perf_;
+            AllocTracker::Sample alloc_;
+            
+            ThreadUsage();
+        };
         
         struct Counter {
             int64_t currentCounts_;
@@ -76,8 +124,43 @@ namespace profiler {
             unsigned errorCountUninitiated_;
             unsigned errorCountUnterminated_;
 
-            void start(int64_t usec, unsigned count);
-            void stop(int64_t usec, unsigned count);
+            // Resource usage, accumulated only for intervals that
+            // started and stopped on the same thread.  hasUsage_ is
+            // true if the current interval was started with a usage
+            // sample
+
+            bool hasUsage_;
+            ThreadUsage currentUsage_;
+            int64_t deltaOffCpuUsec_;
+            int64_t deltaCpuUsec_;
+            int64_t deltaVolCtxSwitches_;
+            int64_t deltaInvolCtxSwitches_;
+            uint64_t deltaPerf_[PerfCounters::N_EVENT];
+            uint64_t deltaAllocs_;
+            uint64_t deltaAllocBytes_;
+            uint64_t deltaFrees_;
+
+            // Slot in the shared-memory export, or -1 if none
+
+            int shmIndex_;
+
+            // True once this arena slot has been handed out by
+            // getCounter()
+
+            bool used_;
+
+            // The epoch that the accumulated values belong to, and
+            // the epoch in which the current interval started (see
+            // reset())
+
+            unsigned epoch_;
+            unsigned startEpoch_;
+            
+            void start(int64_t usec, unsigned count, unsigned epoch, ThreadUsage* usage=0);
+            void stop(int64_t usec, unsigned count, ThreadUsage* usage=0);
+            void addInterval(int64_t usec, unsigned count);
+            void clearDeltas();
+            int64_t getField(ProfileSnapshot::Field field);
             
             Counter();
         };
@@ -85,7 +168,29 @@ namespace profiler {
     public: 
         
         static void noop(bool makeNoop);
+        static unsigned reset();
+        static void enableGroup(std::string pattern, bool enable);
+        static void overlap(std::string label);
+        static unsigned startCounter(std::string& label, bool perThread, bool always);
+        static void stopCounter(std::string& label, bool perThread, bool always);
+        static unsigned labelSlot(std::string label);
+        static void applyEvents(const int64_t* events, unsigned nEvent, bool perThread, bool always);
+        static void cpuTime(bool enable);
+        static void perfCounters(bool enable);
+        static void allocTrack(bool enable);
+        static void atomicTopK(unsigned k, bool skipCold);
+        static void atomicFormat(std::string format);
+        static void limits(unsigned maxLabels, unsigned maxThreads);
+        static void reportFormat(std::string format);
+        static unsigned scrape(std::string address);
+        static void scrapeSnapshot(ProfileSnapshot& snap, void* arg);
+        static void checkpoint(unsigned intervalMs, bool onSignal);
+        static void writeCheckpoint(void* arg);
+        static void sessionStart(std::string name, unsigned durationMs, Profiler::SessionOptions& opts);
+        static void sessionStop();
+        static void expireSession(void* arg);
         static int64_t getCurrentMicroSeconds();
+        static void getThreadUsage(ThreadUsage& usage);
         static ProfilerImpl* get();
 
         static unsigned profile(std::string command, bool perThread=false, bool always=false);
@@ -103,19 +208,56 @@ namespace profiler {
                                              std::string fileName);
 
         static void incrementAtomicCounter(uint64_t partPtr, std::string counterName);
+        static void addAtomicCounter(uint64_t partPtr, std::string counterName, uint64_t value);
+        static bool atomicBins(Profiler::AtomicBins& bins);
+
+        static unsigned addCounterFamily(std::string name, std::vector<CounterFamily::Dimension>& dims,
+                                         std::string fileName, BufferedAtomicCounter::Kind kind);
+        static void incrementCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex);
+        static void addToCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex, uint64_t value);
 
         unsigned start(std::string& label, bool perThread);
         void stop(std::string& label, bool perThread);
+
+        static uint64_t spanBegin(std::string label);
+        static void spanEnd(uint64_t token);
         
         std::string formatStats(bool crTerminated);
+        void snapshot(ProfileSnapshot& snap);
+        void snapshotLocked(ProfileSnapshot& snap);
+        void foldLateStop(Counter& counter, unsigned iLabel, unsigned iThread);
+        bool foldLateSpan(unsigned iLabel, unsigned iThread, unsigned startEpoch, int64_t usec, unsigned count);
+        void writeClosedEpoch();
+        void writeEpoch(ProfileSnapshot& snap);
         void dump(std::string fileName);
+        void writeReport(std::string fileName);
+        void writeReport(std::string fileName, ProfileSnapshot& snap);
+        void endSession();
+        std::string reportFileName(std::string name);
         void setPrefix(std::string fileName);
         void debug();
         
         Counter& getCounter(std::string& label, bool perThread);
+        Counter& getCounter(unsigned iLabel, unsigned iThread);
+        unsigned getLabelSlot(std::string& label);
+        unsigned getThreadSlot(thread_id id);
+        Counter* findCounter(unsigned iLabel, unsigned iThread);
+
+        void exportToShm(std::string name);
+        void publishCounter(Counter& counter, const std::string& label, thread_id id);
         
         void startAtomicCounterTimer();
+        void stopAtomicCounterTimer();
         void dumpAtomicCounters();
+        void dumpCounterFamilies();
+        void writeAtomicHistograms(std::fstream& outfile, uint64_t timestamp, RingPartition& tagged);
+        void writeAtomicTopK(std::fstream& outfile, uint64_t timestamp, std::vector<uint64_t>& bins,
+                             std::vector<uint64_t>& partKeys,
+                             std::vector<unsigned>& partOffsets, std::vector<unsigned>& partTags,
+                             RingPartition& tagged, unsigned nBins,
+                             unsigned topK, std::vector<bool>& hot);
+        void formatAtomicTopK(std::ostringstream& os);
+        void formatLimits(std::ostringstream& os);
 
 #ifndef _MSC_FULL_VER
         static THREAD_START(runAtomicCounterTimer);
@@ -130,32 +272,245 @@ namespace profiler {
     private:
         
         ProfilerImpl();
-        std::vector<thread_id> getThreadIds();
-        std::map<std::string, std::map<thread_id, Counter> > countMap_;
         thread_id atomicCounterTimerId_;
+
+        // Written to by stopAtomicCounterTimer() to wake the timer
+        // thread so that it exits
+
+        int atomicCounterWakeFds_[2];
+
+        //------------------------------------------------------------
+        // Counter storage.  Labels and threads are assigned slots in
+        // order of first use, and the counter for (label, thread) is
+        // element [iThread % ARENA_BLOCK_THREADS][iLabel %
+        // ARENA_BLOCK_LABELS] of block [iLabel / ARENA_BLOCK_LABELS]
+        // [iThread / ARENA_BLOCK_THREADS].  Blocks, and each thread's
+        // row of ARENA_BLOCK_LABELS counters within a block, are
+        // allocated the first time one of their counters is used and
+        // never move, so lookups after warm-up don't allocate, and
+        // reports (which are written a thread at a time) walk
+        // contiguous memory.  Allocating rows separately keeps
+        // global-only labels, which use a single row, from paying
+        // for the other ARENA_BLOCK_THREADS-1
+        //------------------------------------------------------------
+
+        struct CounterBlock {
+            Counter* counters_[ARENA_BLOCK_THREADS];
+
+            CounterBlock() {
+                for(unsigned i=0; i < ARENA_BLOCK_THREADS; i++)
+                    counters_[i] = 0;
+            }
+
+            ~CounterBlock() {
+                for(unsigned i=0; i < ARENA_BLOCK_THREADS; i++)
+                    delete[] counters_[i];
+            }
+
+        private:
+            CounterBlock(const CounterBlock&);
+            CounterBlock& operator=(const CounterBlock&);
+        };
+
+        std::vector<std::string> labels_;
+        std::map<std::string, unsigned> labelSlots_;
+        std::vector<thread_id> threadIds_;
+        std::map<thread_id, unsigned> threadSlots_;
+        std::vector<std::vector<CounterBlock*> > blocks_;
+
+        //------------------------------------------------------------
+        // Cardinality limits.  Labels beyond maxLabels_ (or longer
+        // than PROFILER_MAX_LABEL_LENGTH) are counted under
+        // PROFILER_OVERFLOW_LABEL, and per-thread counters from
+        // threads beyond maxThreads_ are folded into the shared (0x0)
+        // counter of their label
+        //------------------------------------------------------------
+
+        unsigned maxLabels_;
+        unsigned maxThreads_;
+
+        uint64_t rejectedLabels_;
+        uint64_t rejectedThreads_;
+        std::vector<std::string> rejectedSamples_;
         
         //------------------------------------------------------------
         // Members for normal counters
         //------------------------------------------------------------
         
         unsigned nAccessed_;
+        bool cpuSampled_;
+        bool perfSampled_;
+        bool allocSampled_;
         
         Mutex mutex_;
         unsigned counter_;
         std::string prefix_;
+
+        // Runtime enable bits by label prefix, checked before the
+        // lock is taken.  Changed only with mutex_ held
+
+        LabelGroups groups_;
+
+        //------------------------------------------------------------
+        // Async spans.  Open spans live in a lock-free pool, so any
+        // thread can end one; their durations are added to the
+        // shared (0x0) counter of their label.  The pool is
+        // allocated, under mutex_, by the first spanBegin()
+        //------------------------------------------------------------
+
+        SpanPool* volatile spans_;
+        uint64_t spanOverflows_;
+        uint64_t spanInvalidEnds_;
+
+        //------------------------------------------------------------
+        // Overlap counters: shared (0x0) counters that accept
+        // overlapping intervals, updated without mutex_.  Like the
+        // counter families, they are never removed, and each slot
+        // is filled before nOverlaps_ covers it, so start() and
+        // stop() can search them without locking.  labelOverlaps_
+        // maps a label slot to its overlap counter (or -1), for
+        // snapshots
+        //------------------------------------------------------------
+
+        OverlapCounter* overlaps_[MAX_OVERLAP_COUNTERS];
+        volatile unsigned nOverlaps_;
+        std::vector<int> labelOverlaps_;
+
+        OverlapCounter* findOverlap(const std::string& label);
+
+        //------------------------------------------------------------
+        // Epochs.  reset() closes the current epoch by copying the
+        // counters into closedEpoch_, and starts a new one.  Counters
+        // are cleared lazily, the next time they are used (or
+        // skipped by snapshots until then), and an interval that
+        // started before the reset is added to closedEpoch_ when it
+        // stops.  closedEpoch_ is written out with the next dump,
+        // checkpoint or reset.  resetMutex_ serializes resets,
+        // including their writes, so that one reset can't replace a
+        // closed epoch that another hasn't written yet
+        //------------------------------------------------------------
+
+        unsigned epoch_;
+        unsigned epochBaseCount_;
+
+        Mutex resetMutex_;
+        ProfileSnapshot closedEpoch_;
+        std::map<std::pair<unsigned, unsigned>, unsigned> closedCells_;
+        bool closedEpochDirty_;
+
+        // Format of dumped files (see ReportFormat.h)
+
+        ReportFormat::Format reportFormat_;
         
         //------------------------------------------------------------
         // Members for time-resolved atomic counting
         //------------------------------------------------------------
         
         std::map<uint64_t, RingPartition> atomicCounterMap_;
+
+        // The bins of every (partition, tag) counter, laid out as one
+        // [buffer][partition][tag][bin] matrix when the counters are
+        // initialized (see Profiler::AtomicBins), and never resized
+        // afterwards.  Partitions added later keep their own bins,
+        // and are not in the matrix
+
+        std::vector<BufferedAtomicCounter::AtomicCounter> atomicBins_;
+        std::vector<uint64_t> atomicBinPartitions_;
+        std::vector<std::string> atomicBinTags_;
+        std::vector<std::string> atomicBinKinds_;
         
         uint64_t majorIntervalUs_;
+        uint64_t minorIntervalUs_;
+        unsigned int atomicBufferSize_;
         std::string atomicCounterOutput_;
         bool firstDump_;
+
+        // Counter families, indexed by the id returned when they are
+        // added.  Families are never removed, and slots are filled
+        // before nFamilies_ is incremented, so increments can index
+        // this array without locking
+        
+        CounterFamily* families_[MAX_COUNTER_FAMILIES];
+        volatile unsigned nFamilies_;
+
+        // Heaviest partitions per tag: K, whether to write bins only
+        // for partitions in some tag's per-interval top K, and the
+        // running (space-saving) top K per tag since the last change
+        // of K.  The running top K is keyed by partition (the key of
+        // atomicCounterMap_), not its index, since partitions added
+        // later shift the indices
+
+        unsigned atomicTopK_;
+        bool atomicSkipCold_;
+        std::vector<TopK> cumulativeTopK_;
+
+        // If true, write only the runs of non-zero bins (see
+        // SparseFormat.h)
+
+        bool atomicSparse_;
+
+        //------------------------------------------------------------
+        // Live export of counters to shared memory
+        //------------------------------------------------------------
+
+        ShmExport shm_;
+
+        //------------------------------------------------------------
+        // Scrape endpoint.  This has its own lock, since stopping it
+        // waits for a request in progress, which may be waiting for
+        // mutex_ to take a snapshot
+        //------------------------------------------------------------
+
+        Mutex scrapeMutex_;
+        ScrapeServer scrape_;
+
+        //------------------------------------------------------------
+        // Periodic and on-signal checkpoints of the report file.
+        // Like the scrape endpoint, this has its own lock, since
+        // stopping waits for a checkpoint that may need mutex_
+        //------------------------------------------------------------
+
+        Mutex checkpointMutex_;
+        Checkpointer checkpoints_;
+
+        // True while checkpoints are failing, so that a bad prefix
+        // is logged once rather than every interval.  Only the
+        // checkpoint thread touches it
+
+        bool checkpointFailing_;
+
+        //------------------------------------------------------------
+        // Timed profiling session.  Counters are not reset: the
+        // session result is the difference between a snapshot taken
+        // at the start and one taken at the end, so the start/stop
+        // path is unchanged.  sessionMutex_ guards the session state.
+        // sessionTimerMutex_ serializes starting and stopping
+        // sessions, and is never taken by the timer thread, which
+        // may be ending the session when its timer is cancelled
+        //------------------------------------------------------------
+
+        Mutex sessionTimerMutex_;
+        Mutex sessionMutex_;
+        OneShotTimer sessionTimer_;
+        bool sessionActive_;
+        std::string sessionName_;
+        int64_t sessionEndUs_;
+        ProfileSnapshot sessionBaseline_;
+
+        // Settings to restore when the session ends
+
+        bool savedNoop_;
+        bool savedCpuTime_;
+        bool savedPerfCounters_;
+        bool savedAllocTrack_;
+        uint64_t savedGroups_;
+        unsigned savedGroupCount_;
         
         static ProfilerImpl instance_;
         static bool noop_;
+        static bool cpuTime_;
+        static bool perfCounters_;
+        static bool allocTrack_;
         
     };
 };
@@ -163,8 +518,29 @@ namespace profiler {
 using namespace profiler;
 using namespace std;
 
+// Default cardinality limits for start/stop counters, and the label
+// that counts everything rejected by them
+
+#define PROFILER_DEFAULT_MAX_LABELS  4096
+#define PROFILER_DEFAULT_MAX_THREADS 1024
+#define PROFILER_MAX_LABEL_LENGTH    256
+#define PROFILER_MAX_REJECTED_SAMPLES 8
+#define PROFILER_OVERFLOW_LABEL      "(overflow)"
+
+// Most async spans that can be open at once
+
+#define PROFILER_MAX_OPEN_SPANS      16384
+
+// Capacity of the shared-memory export
+
+#define SHM_MAX_COUNTERS      4096
+#define SHM_MAX_ATOMIC_VALUES (1024*1024)
+
 ProfilerImpl ProfilerImpl::instance_;
 bool         ProfilerImpl::noop_ = false;
+bool         ProfilerImpl::cpuTime_ = false;
+bool         ProfilerImpl::perfCounters_ = false;
+bool         ProfilerImpl::allocTrack_ = false;
 
 
 //=======================================================================
@@ -177,10 +553,36 @@ bool         ProfilerImpl::noop_ = false;
 ProfilerImpl::ProfilerImpl() 
 {
     nAccessed_            = 0;
+    cpuSampled_           = false;
+    perfSampled_          = false;
+    allocSampled_         = false;
     counter_              = 0;
     atomicCounterTimerId_ = 0;
+    atomicCounterWakeFds_[0] = -1;
+    atomicCounterWakeFds_[1] = -1;
     majorIntervalUs_      = 0;
+    minorIntervalUs_      = 0;
+    atomicBufferSize_     = 0;
+    nFamilies_            = 0;
     firstDump_            = true;
+    atomicTopK_           = 0;
+    atomicSkipCold_       = false;
+    atomicSparse_         = false;
+    maxLabels_            = PROFILER_DEFAULT_MAX_LABELS;
+    maxThreads_           = PROFILER_DEFAULT_MAX_THREADS;
+    rejectedLabels_       = 0;
+    rejectedThreads_      = 0;
+    reportFormat_         = ReportFormat::FORMAT_TEXT;
+    sessionActive_        = false;
+    spans_                = 0;
+    nOverlaps_            = 0;
+    spanOverflows_        = 0;
+    spanInvalidEnds_      = 0;
+    epoch_                = 0;
+    epochBaseCount_       = 0;
+    closedEpochDirty_     = false;
+    sessionEndUs_         = 0;
+    checkpointFailing_    = false;
     
     setPrefix("/tmp/");
 }
@@ -190,25 +592,181 @@ ProfilerImpl::ProfilerImpl()
  */
 ProfilerImpl::~ProfilerImpl() 
 {
-#ifndef _WIN32
-    std::ostringstream os;
-    os << prefix_ << "/" << this << "_profile.txt";
-    dump(os.str());
+    sessionTimer_.cancel();
 
-    if(atomicCounterTimerId_ != 0) {
-        pthread_kill(atomicCounterTimerId_, SIGKILL);
+    try {
+        endSession();
+    } catch(std::exception& err) {
+        COUT("Unable to write the session report: " << err.what());
     }
-#else
-    std::ostringstream os;
-    os << prefix_ << "\\" << this << "_profile.txt";
-    dump(os.str());
-#endif
+    
+    checkpoints_.stop();
+    scrape_.stop();
+    stopAtomicCounterTimer();
+
+    // Nothing may escape a destructor run at exit: a prefix that is
+    // missing or unwritable costs the report, not the process.  The
+    // closed epoch and the report are guarded separately, so that
+    // one failing doesn't lose the other
+
+    std::string fileName = reportFileName("profile");
+    COUT("Dumping to file: " << fileName);
+
+    try {
+        writeClosedEpoch();
+    } catch(std::exception& err) {
+        COUT("Unable to write the closed epoch: " << err.what());
+    }
+
+    try {
+        writeReport(fileName);
+    } catch(std::exception& err) {
+        COUT("Unable to write the exit-time report: " << err.what());
+    }
+
+    for(unsigned iBlock=0; iBlock < blocks_.size(); iBlock++)
+        for(unsigned jBlock=0; jBlock < blocks_[iBlock].size(); jBlock++)
+            delete blocks_[iBlock][jBlock];
+
+    delete spans_;
+
+    for(unsigned i=0; i < nOverlaps_; i++)
+        delete overlaps_[i];
 }
 
+/**.......................................................................
+ * Return the counter for a label and thread, creating it if
+ * necessary.  Labels and threads that would exceed the configured
+ * limits are redirected to the overflow label and the shared 0x0
+ * thread respectively, so that a caller generating unique labels
+ * (request ids, say) can't grow storage without bound.  Called with
+ * mutex_ held
+ */
 ProfilerImpl::Counter& ProfilerImpl::getCounter(std::string& label, bool perThread)
 {
-    thread_id id = perThread ? thread_self() : 0x0;
-    return countMap_[label][id];
+    return getCounter(getLabelSlot(label), getThreadSlot(perThread ? thread_self() : 0x0));
+}
+
+/**.......................................................................
+ * Return the counter for a label and thread slot, allocating its
+ * block if necessary.  A counter last used in an earlier epoch is
+ * cleared first, keeping any interval in progress
+ */
+ProfilerImpl::Counter& ProfilerImpl::getCounter(unsigned iLabel, unsigned iThread)
+{
+    unsigned iBlock = iLabel  / ARENA_BLOCK_LABELS;
+    unsigned jBlock = iThread / ARENA_BLOCK_THREADS;
+
+    if(blocks_.size() <= iBlock)
+        blocks_.resize(iBlock+1);
+
+    std::vector<CounterBlock*>& row = blocks_[iBlock];
+    if(row.size() <= jBlock)
+        row.resize(jBlock+1, 0);
+
+    if(row[jBlock] == 0)
+        row[jBlock] = new CounterBlock();
+
+    Counter*& counters = row[jBlock]->counters_[iThread % ARENA_BLOCK_THREADS];
+    if(counters == 0)
+        counters = new Counter[ARENA_BLOCK_LABELS];
+
+    Counter& counter = counters[iLabel % ARENA_BLOCK_LABELS];
+
+    if(counter.epoch_ != epoch_) {
+        counter.clearDeltas();
+        counter.errorCountUninitiated_  = 0;
+        counter.errorCountUnterminated_ = 0;
+        counter.epoch_ = epoch_;
+    }
+    
+    counter.used_ = true;
+    
+    return counter;
+}
+
+/**.......................................................................
+ * Return the storage slot of a label, assigning the next one if this
+ * is the first use of the label
+ */
+unsigned ProfilerImpl::getLabelSlot(std::string& label)
+{
+    std::map<std::string, unsigned>::iterator iter = labelSlots_.find(label);
+
+    if(iter != labelSlots_.end())
+        return iter->second;
+
+    // The overflow label itself doesn't count against the limit
+    
+    bool full = labels_.size() >= maxLabels_ + (labelSlots_.count(PROFILER_OVERFLOW_LABEL) ? 1 : 0);
+        
+    std::string slotLabel = label;
+    
+    if(full || label.size() > PROFILER_MAX_LABEL_LENGTH) {
+
+        ++rejectedLabels_;
+
+        std::string sample = label.substr(0, PROFILER_MAX_LABEL_LENGTH);
+        if(rejectedSamples_.size() < PROFILER_MAX_REJECTED_SAMPLES &&
+           std::find(rejectedSamples_.begin(), rejectedSamples_.end(), sample) == rejectedSamples_.end())
+            rejectedSamples_.push_back(sample);
+        
+        slotLabel = PROFILER_OVERFLOW_LABEL;
+        iter = labelSlots_.find(slotLabel);
+        if(iter != labelSlots_.end())
+            return iter->second;
+    }
+
+    labelSlots_[slotLabel] = labels_.size();
+    labels_.push_back(slotLabel);
+
+    return labels_.size() - 1;
+}
+
+/**.......................................................................
+ * Return the storage slot of a thread, assigning the next one if
+ * this is the first use of the thread.  Slots are not reused when
+ * threads exit
+ */
+unsigned ProfilerImpl::getThreadSlot(thread_id id)
+{
+    std::map<thread_id, unsigned>::iterator iter = threadSlots_.find(id);
+
+    if(iter != threadSlots_.end())
+        return iter->second;
+
+    // The shared thread doesn't count against the limit
+    
+    if(id != 0x0 && threadIds_.size() >= maxThreads_ + (threadSlots_.count(0x0) ? 1 : 0)) {
+        ++rejectedThreads_;
+        return getThreadSlot(0x0);
+    }
+
+    threadSlots_[id] = threadIds_.size();
+    threadIds_.push_back(id);
+
+    return threadIds_.size() - 1;
+}
+
+/**.......................................................................
+ * Return the counter for a label and thread slot, or NULL if it has
+ * never been used
+ */
+ProfilerImpl::Counter* ProfilerImpl::findCounter(unsigned iLabel, unsigned iThread)
+{
+    unsigned iBlock = iLabel  / ARENA_BLOCK_LABELS;
+    unsigned jBlock = iThread / ARENA_BLOCK_THREADS;
+
+    if(iBlock >= blocks_.size() || jBlock >= blocks_[iBlock].size() || blocks_[iBlock][jBlock] == 0)
+        return 0;
+
+    Counter* counters = blocks_[iBlock][jBlock]->counters_[iThread % ARENA_BLOCK_THREADS];
+    if(counters == 0)
+        return 0;
+
+    Counter* counter = counters + iLabel % ARENA_BLOCK_LABELS;
+
+    return counter->used_ ? counter : 0;
 }
 
 /**.......................................................................
@@ -218,10 +776,39 @@ unsigned ProfilerImpl::start(std::string& label, bool perThread)
 {
     unsigned count = 0;
 
+    if(!groups_.isEnabled(label))
+        return count;
+
+    if(!perThread && nOverlaps_ > 0) {
+        OverlapCounter* overlap = findOverlap(label);
+        if(overlap) {
+            overlap->start(getCurrentMicroSeconds());
+            return count;
+        }
+    }
+
+    // Resource usage is sampled outside the lock, since it may
+    // involve a system call.  The time is taken outside it too, so
+    // that waiting for the lock isn't part of the interval
+
+    ThreadUsage usage;
+    bool sampleUsage = cpuTime_ || perfCounters_ || allocTrack_;
+    if(sampleUsage)
+        getThreadUsage(usage);
+
+    int64_t usec = getCurrentMicroSeconds();
+    
     mutex_.Lock();
     Counter& counter = getCounter(label, perThread);
     count = ++counter_;
-    counter.start(getCurrentMicroSeconds(), count);
+
+    // Allocation counts are read last, so that any allocation made
+    // by getCounter() isn't attributed to this counter
+    
+    if(allocTrack_)
+        AllocTracker::read(usage.alloc_);
+    
+    counter.start(usec, count, epoch_, sampleUsage ? &usage : 0);
 
     mutex_.Unlock();
     
@@ -233,10 +820,51 @@ unsigned ProfilerImpl::start(std::string& label, bool perThread)
  */
 void ProfilerImpl::stop(std::string& label, bool perThread)
 {
+    if(!groups_.isEnabled(label))
+        return;
+
+    if(!perThread && nOverlaps_ > 0) {
+        OverlapCounter* overlap = findOverlap(label);
+        if(overlap) {
+            overlap->stop(getCurrentMicroSeconds());
+            return;
+        }
+    }
+
+    int64_t usec = getCurrentMicroSeconds();
+    
+    ThreadUsage usage;
+    bool sampleUsage = cpuTime_ || perfCounters_ || allocTrack_;
+    if(sampleUsage) {
+        if(allocTrack_)
+            AllocTracker::read(usage.alloc_);
+        getThreadUsage(usage);
+    }
+
     mutex_.Lock();
 
-    Counter& counter = getCounter(label, perThread);
-    counter.stop(getCurrentMicroSeconds(), counter_);
+    unsigned iLabel  = getLabelSlot(label);
+    unsigned iThread = getThreadSlot(perThread ? thread_self() : 0x0);
+
+    Counter& counter = getCounter(iLabel, iThread);
+    bool late = counter.state_ == STATE_TRIGGERED && counter.startEpoch_ != epoch_;
+    
+    counter.stop(usec, counter_, sampleUsage ? &usage : 0);
+
+    if(late)
+        foldLateStop(counter, iLabel, iThread);
+
+    if(shm_.isOpen())
+        publishCounter(counter, label, perThread ? thread_self() : 0x0);
+
+    if(usage.hasCpu_)
+        cpuSampled_ = true;
+
+    if(usage.perf_.valid_)
+        perfSampled_ = true;
+
+    if(usage.alloc_.valid_)
+        allocSampled_ = true;
 
     // counter_ now serves as both a unique incrementing counter,
     // and a count of the number of times the Profiler registers
@@ -247,165 +875,642 @@ void ProfilerImpl::stop(std::string& label, bool perThread)
     mutex_.Unlock();
 }
 
-std::vector<thread_id> ProfilerImpl::getThreadIds()
+/**.......................................................................
+ * Return the overlap counter for a label, or NULL if it has none
+ */
+OverlapCounter* ProfilerImpl::findOverlap(const std::string& label)
 {
-    std::map<thread_id, thread_id> tempMap;
-    std::vector<thread_id> threadVec;
-
-    // Iterate over all labeled counters and threads to construct a
-    // unique list of threads
-    
-    for(std::map<std::string, std::map<thread_id, ProfilerImpl::Counter> >::iterator iter = countMap_.begin();
-        iter != countMap_.end(); iter++) {
-        std::map<thread_id, ProfilerImpl::Counter>& threadMap = iter->second;
-        for(std::map<thread_id, ProfilerImpl::Counter>::iterator iter2 = threadMap.begin(); iter2 != threadMap.end(); iter2++) {
-            tempMap[iter2->first] = iter2->first;
-        }
-    }
+    unsigned nOverlaps = nOverlaps_;
 
-    // Now iterate over the map to construct the return vector
-    
-    for(std::map<thread_id, thread_id>::iterator iter = tempMap.begin(); iter != tempMap.end(); iter++)
-        threadVec.push_back(iter->first);
+    for(unsigned i=0; i < nOverlaps; i++)
+        if(overlaps_[i]->label_ == label)
+            return overlaps_[i];
 
-    return threadVec;
+    return 0;
 }
 
 /**.......................................................................
- * Dump out a text file with profiler stats
+ * Start and stop a counter given a label that the caller keeps, so
+ * that no copy of it is made.  Otherwise the same as profile()
  */
-void ProfilerImpl::dump(std::string fileName)
+unsigned ProfilerImpl::startCounter(std::string& label, bool perThread, bool always)
 {
-    COUT("Dumping to file: " << fileName);
-    std::fstream outfile;                                               
-    outfile.open(fileName.c_str(), std::fstream::out);
-    outfile << formatStats(false);
-    outfile.close();
+    if(noop_ && !always)
+        return 0;
+
+    return instance_.start(label, perThread);
 }
 
-std::string ProfilerImpl::formatStats(bool term)
+void ProfilerImpl::stopCounter(std::string& label, bool perThread, bool always)
 {
-    std::ostringstream os;
-    
-    mutex_.Lock();
+    if(noop_ && !always)
+        return;
 
-    //------------------------------------------------------------
-    // Write the total count at the top of the file
-    //------------------------------------------------------------
-    
-    OSTERM(os, term, true, false, "totalcount" << " " << counter_ << std::endl);
+    instance_.stop(label, perThread);
+}
 
-    //------------------------------------------------------------
-    // Write the list of labels
-    //------------------------------------------------------------
-    
-    OSTERM(os, term, true, false, "label" << " ");
-    
-    for(std::map<std::string, std::map<thread_id, ProfilerImpl::Counter> >::iterator iter = countMap_.begin();
-        iter != countMap_.end(); iter++) {
-        os << "'" << iter->first << "'" << " ";
-    }
-    
-    OSTERM(os, term, false, true, std::endl);
+/**.......................................................................
+ * Return the slot of a label, adding it if necessary.  A label
+ * beyond the limits gets the slot of PROFILER_OVERFLOW_LABEL
+ */
+unsigned ProfilerImpl::labelSlot(std::string label)
+{
+    MutexLock lock(instance_.mutex_);
+    return instance_.getLabelSlot(label);
+}
 
-    //------------------------------------------------------------
-    // Now iterate over all known threads, writing the count for each
-    // label
-    //------------------------------------------------------------
+/**.......................................................................
+ * Apply a batch of caller-timed start/stop events (see Profiler.h).
+ * Each event is treated like a start() or stop() made at its usec,
+ * except that the resource usage of the calling thread isn't sampled
+ */
+void ProfilerImpl::applyEvents(const int64_t* events, unsigned nEvent, bool perThread, bool always)
+{
+    if(noop_ && !always)
+        return;
 
-    std::vector<thread_id> threadVec = getThreadIds();
-    
-    for(unsigned iThread=0; iThread < threadVec.size(); iThread++) {
+    ProfilerImpl& prof = instance_;
+    MutexLock lock(prof.mutex_);
 
-        thread_id id = threadVec[iThread];
-        
-        OSTERM(os, term, true, false, "count" << " " << "0x" << std::hex << (int64_t)id << std::dec << " ");
-        
-        for(std::map<std::string, std::map<thread_id, ProfilerImpl::Counter> >::iterator iter = countMap_.begin();
-            iter != countMap_.end(); iter++) {
-            std::map<thread_id, ProfilerImpl::Counter>& threadCountMap = iter->second;
+    for(unsigned iEvent=0; iEvent < nEvent; iEvent++) {
+        const int64_t* event = events + 3*iEvent;
 
+        if(event[0] < 0 || (uint64_t)event[0] >= prof.labels_.size())
+            ThrowRuntimeError("Event " << iEvent << " has invalid label slot " << event[0]);
 
-            if(threadCountMap.find(id) == threadCountMap.end()) {
-                os << "0" << " ";
-            } else {
-                ProfilerImpl::Counter& counter = threadCountMap[id];
-                os << counter.deltaCounts_ << " ";
-            }
-        }
-        
-        OSTERM(os, term, false, true, std::endl);
+        if(event[1] != 0 && event[1] != 1)
+            ThrowRuntimeError("Event " << iEvent << " has invalid operation " << event[1] << " (0 to start, 1 to stop)");
     }
+
+    unsigned iThread = prof.getThreadSlot(perThread ? thread_self() : 0x0);
+    thread_id id = prof.threadIds_[iThread];
     
-    //------------------------------------------------------------
-    // Now iterate over all known threads, writing the elapsed usec
-    // for each label
-    //------------------------------------------------------------
-    
-    for(unsigned iThread=0; iThread < threadVec.size(); iThread++) {
+    for(unsigned iEvent=0; iEvent < nEvent; iEvent++) {
+        const int64_t* event = events + 3*iEvent;
 
-        thread_id id = threadVec[iThread];
-        
-        OSTERM(os, term, true, false, "usec" << " " << "0x" << std::hex << (int64_t)id << std::dec << " ");
-        
-        for(std::map<std::string, std::map<thread_id, ProfilerImpl::Counter> >::iterator iter = countMap_.begin();
-            iter != countMap_.end(); iter++) {
-            std::map<thread_id, ProfilerImpl::Counter>& threadCountMap = iter->second;
+        unsigned iLabel = (unsigned)event[0];
+        bool stop       = (event[1] == 1);
+        int64_t usec    = event[2];
 
-            if(threadCountMap.find(id) == threadCountMap.end()) {
-                os << "0" << " ";
-            } else {
-                ProfilerImpl::Counter& counter = threadCountMap[id];
-                os << counter.deltaUsec_ << " ";
+        const std::string& label = prof.labels_[iLabel];
+        
+        if(!prof.groups_.isEnabled(label))
+            continue;
+
+        if(!perThread && prof.nOverlaps_ > 0) {
+            OverlapCounter* overlap = prof.findOverlap(label);
+            if(overlap) {
+                if(stop)
+                    overlap->stop(usec);
+                else
+                    overlap->start(usec);
+                continue;
             }
         }
-        
-        OSTERM(os, term, false, true, std::endl);
-    }
-    
-    //------------------------------------------------------------
-    // Finally, write out any errors
-    //------------------------------------------------------------
 
-    for(unsigned iThread=0; iThread < threadVec.size(); iThread++) {
+        Counter& counter = prof.getCounter(iLabel, iThread);
 
-        thread_id id = threadVec[iThread];
-        
-        for(std::map<std::string, std::map<thread_id, ProfilerImpl::Counter> >::iterator iter = countMap_.begin();
-            iter != countMap_.end(); iter++) {
-            std::map<thread_id, ProfilerImpl::Counter>& threadCountMap = iter->second;
-            
-            if(threadCountMap.find(id) != threadCountMap.end()) {
-                ProfilerImpl::Counter& counter = threadCountMap[id];
-
-                if(counter.errorCountUninitiated_ > 0) {
-                    OSTERM(os, term, false, true, "WARNING:" 
-                           << " thread 0x" << std::hex << (int64_t)id
-                           << " attempted " << counter.errorCountUninitiated_ << (counter.errorCountUninitiated_ > 1 ? " terminations" : " termination")
-                           << " of counter '" << iter->first << "' without initiation" << std::endl);
-                }
+        if(!stop) {
+            counter.start(usec, ++prof.counter_, prof.epoch_);
+            continue;
+        }
 
-                if(counter.errorCountUnterminated_ > 0) {
-                    OSTERM(os, term, false, true, "WARNING: " 
-                           << "thread 0x" << std::hex << (int64_t)id
-                           << " attempted " << counter.errorCountUnterminated_ << (counter.errorCountUnterminated_ > 1 ? " initiations" : " initiation")
-                           << " of counter '" << iter->first << "' without termination" << std::endl);
-                }
+        bool late = counter.state_ == STATE_TRIGGERED && counter.startEpoch_ != prof.epoch_;
 
-                if(counter.state_ != STATE_DONE) {
-                    OSTERM(os, term, false, true, "WARNING: " 
-                           << "thread 0x" << std::hex << (int64_t)id
-                           << " left counter '" << iter->first << "' unterminated" << std::endl);
-                }
-            }
-        }
-        
-        OSTERM(os, term, false, true, std::endl);
-    }
+        counter.stop(usec, prof.counter_);
 
-    mutex_.Unlock();
+        if(late)
+            prof.foldLateStop(counter, iLabel, iThread);
 
-    return os.str();
+        if(prof.shm_.isOpen())
+            prof.publishCounter(counter, label, id);
+
+        ++prof.counter_;
+    }
+}
+
+/**.......................................................................
+ * Begin an async span, returning the token to end it with (from any
+ * thread), or 0 if profiling is off for this label or too many spans
+ * are open
+ */
+uint64_t ProfilerImpl::spanBegin(std::string label)
+{
+    if(noop_ || !instance_.groups_.isEnabled(label))
+        return 0;
+
+    ProfilerImpl& prof = instance_;
+    unsigned iLabel;
+    unsigned epoch;
+    unsigned count;
+    
+    {
+        MutexLock lock(prof.mutex_);
+
+        iLabel = prof.getLabelSlot(label);
+        prof.getCounter(iLabel, prof.getThreadSlot(0x0));
+        epoch = prof.epoch_;
+        count = ++prof.counter_;
+
+        if(prof.spans_ == 0)
+            prof.spans_ = new SpanPool(PROFILER_MAX_OPEN_SPANS);
+    }
+
+    uint64_t token = prof.spans_->acquire(iLabel, epoch, getCurrentMicroSeconds(), count);
+
+    if(token == 0) {
+        MutexLock lock(prof.mutex_);
+        ++prof.spanOverflows_;
+    }
+
+    return token;
+}
+
+/**.......................................................................
+ * End an async span.  A token of 0 is ignored; a token that has
+ * already been ended (or was never issued) is counted and ignored
+ */
+void ProfilerImpl::spanEnd(uint64_t token)
+{
+    if(token == 0)
+        return;
+
+    ProfilerImpl& prof = instance_;
+    
+    unsigned iLabel;
+    unsigned epoch;
+    int64_t startUsec;
+    unsigned count;
+
+    if(prof.spans_ == 0 || !prof.spans_->release(token, iLabel, epoch, startUsec, count)) {
+        MutexLock lock(prof.mutex_);
+        ++prof.spanInvalidEnds_;
+        return;
+    }
+
+    int64_t usec = getCurrentMicroSeconds();
+    
+    MutexLock lock(prof.mutex_);
+
+    unsigned iThread = prof.getThreadSlot(0x0);
+
+    // A span begun before a reset belongs to the epoch it began in,
+    // as an interval that stops late does
+
+    if(epoch != prof.epoch_ && prof.foldLateSpan(iLabel, iThread, epoch, usec - startUsec, prof.counter_ - count)) {
+        ++prof.counter_;
+        return;
+    }
+
+    Counter& counter = prof.getCounter(iLabel, iThread);
+    counter.addInterval(usec - startUsec, prof.counter_ - count);
+
+    if(prof.shm_.isOpen())
+        prof.publishCounter(counter, prof.labels_[iLabel], 0x0);
+    
+    ++prof.counter_;
+}
+
+/**.......................................................................
+ * Start exporting counters to the named shared-memory segment (or
+ * stop, if name is empty).  All existing counters are published
+ * immediately; thereafter each counter is republished when it stops,
+ * and atomic counters each time they are dumped
+ */
+void ProfilerImpl::exportToShm(std::string name)
+{
+    MutexLock lock(mutex_);
+
+    if(name.empty()) {
+        shm_.close();
+        return;
+    }
+
+    shm_.open(name, SHM_MAX_COUNTERS, SHM_MAX_ATOMIC_VALUES);
+
+    for(unsigned iLabel=0; iLabel < labels_.size(); iLabel++) {
+        for(unsigned iThread=0; iThread < threadIds_.size(); iThread++) {
+            Counter* counter = findCounter(iLabel, iThread);
+            if(counter && counter->epoch_ == epoch_) {
+                counter->shmIndex_ = -1;
+                publishCounter(*counter, labels_[iLabel], threadIds_[iThread]);
+            }
+        }
+    }
+}
+
+/**.......................................................................
+ * Copy a counter's accumulated values to its shared-memory slot,
+ * allocating one first if it doesn't have one.  Called with mutex_
+ * held, so there is only ever a single writer
+ */
+void ProfilerImpl::publishCounter(Counter& counter, const std::string& label, thread_id id)
+{
+    if(counter.shmIndex_ < 0)
+        counter.shmIndex_ = shm_.addCounter(label, (uint64_t)id);
+
+    shm_.publishCounter(counter.shmIndex_, counter.deltaCounts_, counter.deltaUsec_, counter.deltaCpuUsec_,
+                        counter.deltaAllocs_, counter.deltaAllocBytes_,
+                        counter.errorCountUninitiated_, counter.errorCountUnterminated_);
+}
+
+/**.......................................................................
+ * Dump out a file with profiler stats, in the current report format
+ */
+void ProfilerImpl::dump(std::string fileName)
+{
+    COUT("Dumping to file: " << fileName);
+    writeClosedEpoch();
+    writeReport(fileName);
+}
+
+/**.......................................................................
+ * Write the profiler stats to a file.  The counters are copied under
+ * the lock, and written from the copy to a temporary file, which is
+ * synced and then renamed over fileName.  A crash at any point
+ * leaves either the previous file or the new one, never a partial
+ * report
+ */
+void ProfilerImpl::writeReport(std::string fileName)
+{
+    ProfileSnapshot snap;
+    snapshot(snap);
+    writeReport(fileName, snap);
+}
+
+void ProfilerImpl::writeReport(std::string fileName, ProfileSnapshot& snap)
+{
+    ReportFormat::Format format;
+    {
+        MutexLock lock(mutex_);
+        format = reportFormat_;
+    }
+
+    // Unique per thread, in case a dump and a checkpoint of the same
+    // file overlap
+    
+    std::ostringstream os;
+    os << fileName << ".tmp" << thread_self();
+    std::string tmpName = os.str();
+    
+    FILE* file = fopen(tmpName.c_str(), "w");
+    if(file == 0)
+        ThrowRuntimeError("Unable to open file: " << tmpName);
+
+    try {
+        ReportWriter writer(file);
+        ReportFormat::write(snap, writer, format);
+        writer.flush();
+
+        if(fflush(file) != 0)
+            ThrowRuntimeError("Error writing file: " << tmpName);
+    } catch(...) {
+        fclose(file);
+        remove(tmpName.c_str());
+        throw;
+    }
+
+#ifdef _WIN32
+    _commit(_fileno(file));
+    fclose(file);
+
+    if(!MoveFileExA(tmpName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        remove(tmpName.c_str());
+        ThrowRuntimeError("Unable to replace file: " << fileName);
+    }
+#else
+    fsync(fileno(file));
+    fclose(file);
+
+    if(rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        int err = errno;
+        remove(tmpName.c_str());
+        ThrowRuntimeError("Unable to replace file: " << fileName << ": " << strerror(err));
+    }
+#endif
+}
+
+/**.......................................................................
+ * The name of a file written without an explicit name: at exit and
+ * by checkpoints (name = "profile"), and for closed epochs
+ */
+std::string ProfilerImpl::reportFileName(std::string name)
+{
+    MutexLock lock(mutex_);
+    
+    std::ostringstream os;
+#ifndef _WIN32
+    os << prefix_ << "/" << this << "_" << name << ReportFormat::extension(reportFormat_);
+#else
+    os << prefix_ << "\\" << this << "_" << name << ReportFormat::extension(reportFormat_);
+#endif
+
+    return os.str();
+}
+
+/**.......................................................................
+ * Return the profiler stats as a string, with carriage returns for
+ * display on a raw terminal if term is true
+ */
+std::string ProfilerImpl::formatStats(bool term)
+{
+    ProfileSnapshot snap;
+    snapshot(snap);
+
+    ReportWriter writer;
+    snap.writeText(writer, term);
+    
+    return writer.str();
+}
+
+/**.......................................................................
+ * Copy the used counters into a snapshot, in order of thread slot
+ * and then label slot.  This is the only part of a report made with
+ * mutex_ held
+ */
+void ProfilerImpl::snapshot(ProfileSnapshot& snap)
+{
+    MutexLock lock(mutex_);
+    snapshotLocked(snap);
+}
+
+/**.......................................................................
+ * Copy the counters of the current epoch into a snapshot.  Called
+ * with mutex_ held
+ */
+void ProfilerImpl::snapshotLocked(ProfileSnapshot& snap)
+{
+    snap.initialize(cpuSampled_, perfSampled_, allocSampled_, nOverlaps_ > 0);
+    
+    snap.epoch_           = epoch_;
+    snap.totalCount_      = counter_ - epochBaseCount_;
+    snap.rejectedLabels_  = rejectedLabels_;
+    snap.rejectedThreads_ = rejectedThreads_;
+    snap.labels_          = labels_;
+
+    snap.threadIds_.resize(threadIds_.size());
+    for(unsigned iThread=0; iThread < threadIds_.size(); iThread++)
+        snap.threadIds_[iThread] = (uint64_t)threadIds_[iThread];
+
+    ProfileSnapshot::Cell cell;
+    ProfileSnapshot::Warning warning;
+    unsigned nField = snap.fields_.size();
+    int64_t usec = getCurrentMicroSeconds();
+
+    // Walk the blocks rather than every (label, thread) pair, so
+    // that unallocated blocks are skipped whole
+    
+    for(unsigned iThread=0; iThread < threadIds_.size(); iThread++) {
+
+        unsigned jBlock = iThread / ARENA_BLOCK_THREADS;
+        
+        for(unsigned iBlock=0; iBlock < blocks_.size(); iBlock++) {
+
+            if(jBlock >= blocks_[iBlock].size() || blocks_[iBlock][jBlock] == 0)
+                continue;
+
+            Counter* counters = blocks_[iBlock][jBlock]->counters_[iThread % ARENA_BLOCK_THREADS];
+            if(counters == 0)
+                continue;
+
+            for(unsigned i=0; i < ARENA_BLOCK_LABELS; i++) {
+
+                Counter* counter = counters + i;
+                if(!counter->used_)
+                    continue;
+
+                cell.label_  = iBlock * ARENA_BLOCK_LABELS + i;
+                cell.thread_ = iThread;
+
+                // Overlap counters are read from their own state, and
+                // are split at a reset rather than cleared lazily
+
+                if(threadIds_[iThread] == 0x0 && cell.label_ < labelOverlaps_.size() &&
+                   labelOverlaps_[cell.label_] >= 0) {
+
+                    OverlapCounter::Values vals;
+                    overlaps_[labelOverlaps_[cell.label_]]->read(usec, vals);
+                    
+                    snap.cells_.push_back(cell);
+                    for(unsigned iField=0; iField < nField; iField++)
+                        snap.values_.push_back(vals.getField(snap.fields_[iField]));
+
+                    if(vals.unmatched_ > 0) {
+                        warning.label_                  = cell.label_;
+                        warning.thread_                 = iThread;
+                        warning.errorCountUninitiated_  = vals.unmatched_;
+                        warning.errorCountUnterminated_ = 0;
+                        warning.unterminated_           = false;
+                        snap.warnings_.push_back(warning);
+                    }
+                    
+                    continue;
+                }
+
+                // A counter not used since the last reset has nothing
+                // in this epoch, except perhaps an open interval
+
+                bool current = (counter->epoch_ == epoch_);
+
+                if(current) {
+                    snap.cells_.push_back(cell);
+                    for(unsigned iField=0; iField < nField; iField++)
+                        snap.values_.push_back(counter->getField(snap.fields_[iField]));
+                }
+
+                if((current && (counter->errorCountUninitiated_ > 0 || counter->errorCountUnterminated_ > 0)) ||
+                   counter->state_ != STATE_DONE) {
+                    warning.label_                  = cell.label_;
+                    warning.thread_                 = iThread;
+                    warning.errorCountUninitiated_  = current ? counter->errorCountUninitiated_  : 0;
+                    warning.errorCountUnterminated_ = current ? counter->errorCountUnterminated_ : 0;
+                    warning.unterminated_           = (counter->state_ != STATE_DONE);
+                    snap.warnings_.push_back(warning);
+                }
+            }
+        }
+    }
+}
+
+/**.......................................................................
+ * Add an interval that started in the closed epoch, and has just
+ * stopped, to closedEpoch_ instead of the current epoch.  Intervals
+ * that started before the closed epoch are left where they are.
+ * Called with mutex_ held, after the counter was cleared for the
+ * current epoch and stopped, so its values are this interval's
+ */
+void ProfilerImpl::foldLateStop(Counter& counter, unsigned iLabel, unsigned iThread)
+{
+    if(counter.startEpoch_ != closedEpoch_.epoch_ || closedEpoch_.epoch_ + 1 != epoch_)
+        return;
+
+    std::map<std::pair<unsigned, unsigned>, unsigned>::iterator iter =
+        closedCells_.find(std::make_pair(iLabel, iThread));
+
+    if(iter == closedCells_.end())
+        return;
+
+    unsigned nField = closedEpoch_.fields_.size();
+    for(unsigned iField=0; iField < nField; iField++)
+        closedEpoch_.values_[iter->second * nField + iField] += counter.getField(closedEpoch_.fields_[iField]);
+
+    for(unsigned iWarning=0; iWarning < closedEpoch_.warnings_.size(); iWarning++) {
+        ProfileSnapshot::Warning& warning = closedEpoch_.warnings_[iWarning];
+        if(warning.label_ == iLabel && warning.thread_ == iThread)
+            warning.unterminated_ = false;
+    }
+
+    counter.clearDeltas();
+    closedEpochDirty_ = true;
+}
+
+/**.......................................................................
+ * Add an async span that began in the closed epoch, and has just
+ * ended, to closedEpoch_ instead of the current epoch.  Returns false
+ * (leaving the span to the current epoch, as foldLateStop() does) if
+ * it began before the closed epoch.  Called with mutex_ held
+ */
+bool ProfilerImpl::foldLateSpan(unsigned iLabel, unsigned iThread, unsigned startEpoch, int64_t usec, unsigned count)
+{
+    if(startEpoch != closedEpoch_.epoch_ || closedEpoch_.epoch_ + 1 != epoch_)
+        return false;
+
+    // spanBegin() used the counter, so it has a cell.  Cells are in
+    // (thread, label) order
+
+    std::vector<ProfileSnapshot::Cell>& cells = closedEpoch_.cells_;
+    unsigned lo = 0, hi = cells.size();
+
+    while(lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if(cells[mid].thread_ < iThread || (cells[mid].thread_ == iThread && cells[mid].label_ < iLabel))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == cells.size() || cells[lo].thread_ != iThread || cells[lo].label_ != iLabel)
+        return false;
+
+    Counter span;
+    span.addInterval(usec, count);
+
+    unsigned nField = closedEpoch_.fields_.size();
+    for(unsigned iField=0; iField < nField; iField++)
+        closedEpoch_.values_[lo * nField + iField] += span.getField(closedEpoch_.fields_[iField]);
+
+    closedEpochDirty_ = true;
+    return true;
+}
+
+/**.......................................................................
+ * Start a new epoch.  The counters of the current epoch are copied
+ * into closedEpoch_, which is written to <prefix>/<this>_epoch<N>
+ * (with the report format's extension), and again by later dumps or
+ * checkpoints if intervals that were open at the reset close in the
+ * meantime.  Late stops folded into the previous closed epoch since
+ * it was last written are written out before it is replaced.
+ * Returns the new epoch number
+ */
+unsigned ProfilerImpl::reset()
+{
+    MutexLock resetLock(instance_.resetMutex_);
+    
+    unsigned epoch;
+    ProfileSnapshot previous;
+    bool writePrevious = false;
+    
+    {
+        MutexLock lock(instance_.mutex_);
+
+        if(instance_.closedEpochDirty_) {
+            previous = instance_.closedEpoch_;
+            writePrevious = true;
+        }
+        
+        instance_.snapshotLocked(instance_.closedEpoch_);
+
+        // Index the cells of open intervals, which are the only
+        // ones that can still change.  Cells and warnings are both
+        // in (thread, label) order, so one pass finds them
+
+        std::vector<ProfileSnapshot::Cell>& cells = instance_.closedEpoch_.cells_;
+        std::vector<ProfileSnapshot::Warning>& warnings = instance_.closedEpoch_.warnings_;
+        unsigned iCell = 0;
+
+        instance_.closedCells_.clear();
+        
+        for(unsigned iWarning=0; iWarning < warnings.size(); iWarning++) {
+            ProfileSnapshot::Warning& warning = warnings[iWarning];
+
+            while(iCell < cells.size() && (cells[iCell].thread_ < warning.thread_ ||
+                                           (cells[iCell].thread_ == warning.thread_ && cells[iCell].label_ < warning.label_)))
+                iCell++;
+
+            if(warning.unterminated_ && iCell < cells.size() &&
+               cells[iCell].thread_ == warning.thread_ && cells[iCell].label_ == warning.label_)
+                instance_.closedCells_[std::make_pair(warning.label_, warning.thread_)] = iCell;
+        }
+
+        instance_.closedEpochDirty_ = true;
+
+        int64_t usec = getCurrentMicroSeconds();
+        for(unsigned i=0; i < instance_.nOverlaps_; i++)
+            instance_.overlaps_[i]->rebase(usec);
+        
+        epoch = ++instance_.epoch_;
+        instance_.epochBaseCount_  = instance_.counter_;
+        instance_.rejectedLabels_  = 0;
+        instance_.rejectedThreads_ = 0;
+        instance_.rejectedSamples_.clear();
+    }
+
+    if(writePrevious)
+        instance_.writeEpoch(previous);
+    
+    instance_.writeClosedEpoch();
+
+    return epoch;
+}
+
+/**.......................................................................
+ * Write closedEpoch_, if it has changed since it was last written.
+ * If the write fails, closedEpoch_ is left dirty (unless a reset has
+ * replaced it meanwhile), so the next dump or checkpoint retries it
+ */
+void ProfilerImpl::writeClosedEpoch()
+{
+    ProfileSnapshot snap;
+
+    {
+        MutexLock lock(mutex_);
+
+        if(!closedEpochDirty_)
+            return;
+
+        snap = closedEpoch_;
+        closedEpochDirty_ = false;
+    }
+
+    try {
+        writeEpoch(snap);
+    } catch(...) {
+        MutexLock lock(mutex_);
+        if(closedEpoch_.epoch_ == snap.epoch_)
+            closedEpochDirty_ = true;
+        throw;
+    }
+}
+
+/**.......................................................................
+ * Write a closed epoch to <prefix>/<this>_epoch<N>
+ */
+void ProfilerImpl::writeEpoch(ProfileSnapshot& snap)
+{
+    std::ostringstream name;
+    name << "epoch" << snap.epoch_;
+    
+    writeReport(reportFileName(name.str()), snap);
 }
 
 int64_t ProfilerImpl::getCurrentMicroSeconds()
@@ -448,6 +1553,60 @@ int64_t ProfilerImpl::getCurrentMicroSeconds()
 #endif
 }
 
+/**.......................................................................
+ * Sample whichever of the CPU time/context switches or hardware
+ * counters of the calling thread are enabled.  Quantities that are
+ * not available on this platform are left at 0.  The wall time is
+ * taken immediately after the CPU time, for the time off the cpu
+ */
+void ProfilerImpl::getThreadUsage(ThreadUsage& usage)
+{
+    usage.threadId_ = thread_self();
+
+    if(perfCounters_)
+        PerfCounters::read(usage.perf_);
+    
+    if(!cpuTime_)
+        return;
+
+    usage.hasCpu_ = true;
+    
+#ifdef _WIN32
+
+    FILETIME createTime, exitTime, kernelTime, userTime;
+
+    if(GetThreadTimes(GetCurrentThread(), &createTime, &exitTime, &kernelTime, &userTime)) {
+        uint64_t kernel = ((uint64_t)kernelTime.dwHighDateTime << 32) + kernelTime.dwLowDateTime;
+        uint64_t user   = ((uint64_t)userTime.dwHighDateTime   << 32) + userTime.dwLowDateTime;
+
+        // FILETIME is in units of 100 nanoseconds
+        
+        usage.cpuUsec_ = (kernel + user) / 10;
+    }
+
+    usage.wallUsec_ = getCurrentMicroSeconds();
+    
+#else
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        usage.cpuUsec_ = static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec/1000;
+#endif
+
+    usage.wallUsec_ = getCurrentMicroSeconds();
+
+#ifdef RUSAGE_THREAD
+    struct rusage ru;
+    if(getrusage(RUSAGE_THREAD, &ru) == 0) {
+        usage.volCtxSwitches_   = ru.ru_nvcsw;
+        usage.involCtxSwitches_ = ru.ru_nivcsw;
+    }
+#endif
+
+#endif
+}
+
 /**.......................................................................
  * Return the static instance of this class
  */
@@ -483,6 +1642,386 @@ void ProfilerImpl::noop(bool makeNoop)
     noop_ = makeNoop;
 }
 
+/**.......................................................................
+ * Enable or disable counters whose labels match a pattern ("*", or a
+ * prefix with an optional trailing "*").  Unlike noop, this applies
+ * whether or not a call is made with always=true, and takes effect
+ * immediately for all threads (see LabelGroups.h)
+ */
+void ProfilerImpl::enableGroup(std::string pattern, bool enable)
+{
+    MutexLock lock(instance_.mutex_);
+    instance_.groups_.enable(pattern, enable);
+}
+
+/**.......................................................................
+ * Make the shared (0x0) counter of a label accept overlapping
+ * intervals (see OverlapCounter.h).  This can't be undone, and
+ * should be done before the label is first used: intervals already
+ * counted the ordinary way are no longer reported
+ */
+void ProfilerImpl::overlap(std::string label)
+{
+    MutexLock lock(instance_.mutex_);
+
+    if(instance_.findOverlap(label))
+        return;
+
+    if(instance_.nOverlaps_ == MAX_OVERLAP_COUNTERS)
+        ThrowRuntimeError("Too many overlap counters (max " << MAX_OVERLAP_COUNTERS << ")");
+
+    unsigned iLabel = instance_.getLabelSlot(label);
+
+    if(instance_.labels_[iLabel] != label)
+        ThrowRuntimeError("Unable to add overlap counter " << label << ": label limit reached");
+
+    // Mark the shared counter used, so that snapshots visit its cell
+    
+    instance_.getCounter(iLabel, instance_.getThreadSlot(0x0));
+
+    unsigned id = instance_.nOverlaps_;
+
+    OverlapCounter* overlap = new OverlapCounter();
+    overlap->label_     = label;
+    overlap->labelSlot_ = iLabel;
+    
+    instance_.overlaps_[id] = overlap;
+
+    if(instance_.labelOverlaps_.size() <= iLabel)
+        instance_.labelOverlaps_.resize(iLabel + 1, -1);
+    instance_.labelOverlaps_[iLabel] = id;
+
+    // Make sure the slot is visible before the count that covers it
+
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+    instance_.nOverlaps_ = id + 1;
+}
+
+/**.......................................................................
+ * Enabling CPU-time profiling causes each counter start/stop to also
+ * sample the per-thread CPU time and context-switch counts.  As with
+ * noop_, this flag is not mutex protected
+ */
+void ProfilerImpl::cpuTime(bool enable)
+{
+    cpuTime_ = enable;
+}
+
+/**.......................................................................
+ * Enabling hardware-counter profiling causes each counter start/stop
+ * to also read the per-thread cycles, instructions, LLC misses and
+ * branch misses.  If the counters can't be opened on this host, this
+ * degrades to a no-op after the first failed attempt
+ */
+void ProfilerImpl::perfCounters(bool enable)
+{
+    perfCounters_ = enable;
+}
+
+/**.......................................................................
+ * Enabling allocation profiling causes each counter start/stop to
+ * also read the per-thread allocation counts maintained by the
+ * interposed allocators (see AllocTracker.h).  If the allocators
+ * are not interposed, this is a no-op
+ */
+void ProfilerImpl::allocTrack(bool enable)
+{
+    allocTrack_ = enable;
+}
+
+/**.......................................................................
+ * Track the k heaviest partitions per tag in the atomic counter
+ * output (0 to disable).  If skipCold is true, bins are only written
+ * for partitions that are in the top k for at least one tag
+ */
+void ProfilerImpl::atomicTopK(unsigned k, bool skipCold)
+{
+    MutexLock lock(instance_.mutex_);
+
+    if(k != instance_.atomicTopK_)
+        instance_.cumulativeTopK_.clear();
+    
+    instance_.atomicTopK_     = k;
+    instance_.atomicSkipCold_ = k > 0 && skipCold;
+}
+
+/**.......................................................................
+ * Select the encoding of intervals in the atomic counter output:
+ * "dense" (every bin) or "sparse" (runs of non-zero bins only)
+ */
+void ProfilerImpl::atomicFormat(std::string format)
+{
+    if(format != "dense" && format != "sparse")
+        ThrowRuntimeError("Unrecognized atomic counter format: " << format << " (use dense or sparse)");
+
+    MutexLock lock(instance_.mutex_);
+    instance_.atomicSparse_ = (format == "sparse");
+}
+
+/**.......................................................................
+ * Set the maximum number of distinct labels and per-thread counter
+ * threads.  Lowering a limit doesn't discard existing counters; it
+ * only redirects new ones to the overflow bucket
+ */
+void ProfilerImpl::limits(unsigned maxLabels, unsigned maxThreads)
+{
+    if(maxLabels == 0 || maxThreads == 0)
+        ThrowRuntimeError("Label and thread limits must be greater than zero");
+
+    MutexLock lock(instance_.mutex_);
+    instance_.maxLabels_  = maxLabels;
+    instance_.maxThreads_ = maxThreads;
+}
+
+/**.......................................................................
+ * Select the format of dumped files: "text" (the default), "json",
+ * "csv" or "prometheus"
+ */
+void ProfilerImpl::reportFormat(std::string format)
+{
+    ReportFormat::Format reportFormat = ReportFormat::fromString(format);
+
+    MutexLock lock(instance_.mutex_);
+    instance_.reportFormat_ = reportFormat;
+}
+
+/**.......................................................................
+ * Serve snapshots on "unix:/path" or "tcp:port" (loopback only), or
+ * stop serving if address is empty.  Returns the bound TCP port (0
+ * for a Unix socket)
+ */
+unsigned ProfilerImpl::scrape(std::string address)
+{
+    MutexLock lock(instance_.scrapeMutex_);
+
+    if(address.empty()) {
+        instance_.scrape_.stop();
+        return 0;
+    }
+
+    instance_.scrape_.start(address, &scrapeSnapshot, &instance_);
+
+    return instance_.scrape_.port();
+}
+
+/**.......................................................................
+ * Checkpoint the report file every intervalMs (0 for none) and, if
+ * onSignal is true, on SIGTERM and SIGABRT.  With neither,
+ * checkpointing stops
+ */
+void ProfilerImpl::checkpoint(unsigned intervalMs, bool onSignal)
+{
+    MutexLock lock(instance_.checkpointMutex_);
+
+    if(intervalMs == 0 && !onSignal) {
+        instance_.checkpoints_.stop();
+        return;
+    }
+
+    instance_.checkpoints_.start((uint64_t)intervalMs * 1000, onSignal, &writeCheckpoint, &instance_);
+}
+
+/**.......................................................................
+ * Checkpoint callback.  This runs on the checkpoint thread, which
+ * the destructor joins, so a failed write is logged here rather than
+ * thrown
+ */
+void ProfilerImpl::writeCheckpoint(void* arg)
+{
+    ProfilerImpl* prof = (ProfilerImpl*)arg;
+
+    try {
+        prof->writeClosedEpoch();
+        prof->writeReport(prof->reportFileName("profile"));
+        prof->checkpointFailing_ = false;
+    } catch(std::exception& err) {
+        if(!prof->checkpointFailing_)
+            COUT("Unable to write checkpoint: " << err.what());
+        prof->checkpointFailing_ = true;
+    }
+}
+
+/**.......................................................................
+ * Start a timed profiling session: save the current settings, apply
+ * the session's, and take the baseline snapshot.  Only one session
+ * can run at a time
+ */
+void ProfilerImpl::sessionStart(std::string name, unsigned durationMs, Profiler::SessionOptions& opts)
+{
+    if(name.empty() || name.find_first_of("/\\") != std::string::npos)
+        ThrowRuntimeError("Invalid session name: '" << name << "'");
+
+    if(durationMs == 0)
+        ThrowRuntimeError("Session duration must be greater than 0");
+
+    MutexLock timerLock(instance_.sessionTimerMutex_);
+
+    {
+        MutexLock lock(instance_.sessionMutex_);
+        if(instance_.sessionActive_)
+            ThrowRuntimeError("Session '" << instance_.sessionName_ << "' is already running");
+    }
+
+    // Reap the timer of the last session, which has ended
+
+    instance_.sessionTimer_.cancel();
+
+    MutexLock lock(instance_.sessionMutex_);
+
+    //------------------------------------------------------------
+    // Groups first, since a bad pattern should leave everything as
+    // it was
+    //------------------------------------------------------------
+
+    {
+        MutexLock groupLock(instance_.mutex_);
+        instance_.savedGroups_     = instance_.groups_.enabledBits();
+        instance_.savedGroupCount_ = instance_.groups_.groupCount();
+
+        try {
+            for(unsigned i=0; i < opts.groups_.size(); i++)
+                instance_.groups_.enable(opts.groups_[i], true);
+        } catch(...) {
+            instance_.groups_.restoreEnabledBits(instance_.savedGroups_, instance_.savedGroupCount_);
+            throw;
+        }
+    }
+
+    instance_.savedNoop_         = noop_;
+    instance_.savedCpuTime_      = cpuTime_;
+    instance_.savedPerfCounters_ = perfCounters_;
+    instance_.savedAllocTrack_   = allocTrack_;
+
+    noop_         = false;
+    cpuTime_      = cpuTime_      || opts.cpuTime_;
+    perfCounters_ = perfCounters_ || opts.perfCounters_;
+    allocTrack_   = allocTrack_   || opts.allocTrack_;
+
+    instance_.snapshot(instance_.sessionBaseline_);
+
+    instance_.sessionName_   = name;
+    instance_.sessionEndUs_  = getCurrentMicroSeconds() + (int64_t)durationMs * 1000;
+    instance_.sessionActive_ = true;
+
+    try {
+        instance_.sessionTimer_.start((uint64_t)durationMs * 1000, &expireSession, &instance_);
+    } catch(...) {
+        instance_.sessionActive_ = false;
+        noop_         = instance_.savedNoop_;
+        cpuTime_      = instance_.savedCpuTime_;
+        perfCounters_ = instance_.savedPerfCounters_;
+        allocTrack_   = instance_.savedAllocTrack_;
+
+        MutexLock groupLock(instance_.mutex_);
+        instance_.groups_.restoreEnabledBits(instance_.savedGroups_, instance_.savedGroupCount_);
+        throw;
+    }
+}
+
+/**.......................................................................
+ * End the current session early, writing its result.  Does nothing
+ * if no session is running
+ */
+void ProfilerImpl::sessionStop()
+{
+    MutexLock timerLock(instance_.sessionTimerMutex_);
+
+    instance_.sessionTimer_.cancel();
+    instance_.endSession();
+}
+
+/**.......................................................................
+ * Session timer callback.  This runs on the timer thread, where an
+ * error would otherwise go unseen, so it is logged here
+ */
+void ProfilerImpl::expireSession(void* arg)
+{
+    ProfilerImpl* prof = (ProfilerImpl*)arg;
+
+    try {
+        prof->endSession();
+    } catch(std::exception& err) {
+        COUT("Unable to write the session report: " << err.what());
+    }
+}
+
+/**.......................................................................
+ * End the session: take the final snapshot, restore the settings
+ * saved when it started, and write the difference from the baseline
+ * to <prefix>/<name>_session, with the report format's extension
+ */
+void ProfilerImpl::endSession()
+{
+    ProfileSnapshot snap;
+    std::ostringstream os;
+    
+    {
+        MutexLock lock(sessionMutex_);
+
+        if(!sessionActive_)
+            return;
+
+        sessionActive_ = false;
+
+        // After a reset, the end snapshot already starts from zero
+
+        snapshot(snap);
+        if(snap.epoch_ == sessionBaseline_.epoch_)
+            snap.subtract(sessionBaseline_);
+        sessionBaseline_.clear();
+
+        noop_         = savedNoop_;
+        cpuTime_      = savedCpuTime_;
+        perfCounters_ = savedPerfCounters_;
+        allocTrack_   = savedAllocTrack_;
+
+        MutexLock groupLock(mutex_);
+        groups_.restoreEnabledBits(savedGroups_, savedGroupCount_);
+
+#ifndef _WIN32
+        os << prefix_ << "/" << sessionName_ << "_session" << ReportFormat::extension(reportFormat_);
+#else
+        os << prefix_ << "\\" << sessionName_ << "_session" << ReportFormat::extension(reportFormat_);
+#endif
+    }
+
+    writeReport(os.str(), snap);
+}
+
+/**.......................................................................
+ * Snapshot callback for the scrape server.  This runs on the server
+ * thread, and holds mutex_ only while copying the counters
+ */
+void ProfilerImpl::scrapeSnapshot(ProfileSnapshot& snap, void* arg)
+{
+    ProfilerImpl* prof = (ProfilerImpl*)arg;
+    prof->snapshot(snap);
+}
+
+/**.......................................................................
+ * Format the cardinality limits, and what they have rejected so far
+ */
+void ProfilerImpl::formatLimits(std::ostringstream& os)
+{
+    MutexLock lock(mutex_);
+
+    os << labels_.size() << "/" << maxLabels_ << " labels, "
+       << threadIds_.size() - threadSlots_.count(0x0) << "/" << maxThreads_ << " threads";
+
+    if(rejectedLabels_ > 0 || rejectedThreads_ > 0)
+        os << ", rejected " << rejectedLabels_ << " label and " << rejectedThreads_ << " thread lookups";
+
+    for(unsigned i=0; i < rejectedSamples_.size(); i++)
+        os << (i==0 ? " (e.g. '" : ", '") << rejectedSamples_[i] << "'"
+           << (i+1 == rejectedSamples_.size() ? ")" : "");
+}
+
 /**.......................................................................
  * Print debug information
  */
@@ -490,10 +2029,131 @@ void ProfilerImpl::debug()
 {
     COUT("Prefix is: "  << GREEN << "'" << instance_.prefix_ << "'" << std::endl << NORM);
     COUT("Noop is:   "  << GREEN << noop_ << std::endl << NORM);
+    {
+        MutexLock lock(instance_.mutex_);
+        std::ostringstream groups;
+        instance_.groups_.format(groups);
+        COUT("Groups:    "  << GREEN << groups.str() << std::endl << NORM);
+    }
+    {
+        MutexLock lock(instance_.mutex_);
+        std::ostringstream overlaps;
+        int64_t usec = getCurrentMicroSeconds();
+        for(unsigned i=0; i < instance_.nOverlaps_; i++) {
+            OverlapCounter::Values vals;
+            instance_.overlaps_[i]->read(usec, vals);
+            overlaps << (i == 0 ? "" : ", ") << instance_.overlaps_[i]->label_
+                     << " (" << vals.active_ << " active, peak " << vals.peakActive_ << ")";
+        }
+        COUT("Overlap:   "  << GREEN << (instance_.nOverlaps_ > 0 ? overlaps.str() : "none") << std::endl << NORM);
+    }
+    COUT("Shm export: " << GREEN << (instance_.shm_.isOpen() ? "on" : "off") << std::endl << NORM);
+    COUT("CPU time:  "  << GREEN << cpuTime_ << std::endl << NORM);
+    COUT("HW counters: " << GREEN << perfCounters_
+         << (PerfCounters::isAvailable() ? "" : " (unavailable)") << std::endl << NORM);
+    COUT("Alloc tracking: " << GREEN << allocTrack_
+         << (AllocTracker::isActive() ? "" : " (no allocator hooks active)") << std::endl << NORM);
+
+    std::ostringstream limits;
+    instance_.formatLimits(limits);
+    COUT("Limits:    "  << GREEN << limits.str() << std::endl << NORM);
+    {
+        std::ostringstream spans;
+        SpanPool* pool = instance_.spans_;
+        MutexLock lock(instance_.mutex_);
+        spans << (pool ? pool->nOpen() : 0) << "/" << PROFILER_MAX_OPEN_SPANS << " open";
+        if(instance_.spanOverflows_ > 0 || instance_.spanInvalidEnds_ > 0)
+            spans << ", " << instance_.spanOverflows_ << " not begun (pool full), "
+                  << instance_.spanInvalidEnds_ << " invalid ends";
+        COUT("Spans:     "  << GREEN << spans.str() << std::endl << NORM);
+    }
+    COUT("Format:    "  << GREEN << ReportFormat::toString(instance_.reportFormat_) << std::endl << NORM);
+    {
+        MutexLock lock(instance_.scrapeMutex_);
+        COUT("Scrape:    "  << GREEN << (instance_.scrape_.isRunning() ? instance_.scrape_.address() : "off")
+             << std::endl << NORM);
+    }
+    {
+        MutexLock lock(instance_.checkpointMutex_);
+        std::ostringstream cp;
+        uint64_t intervalUs = instance_.checkpoints_.intervalUs();
+        if(!instance_.checkpoints_.isRunning())
+            cp << "off";
+        if(intervalUs > 0)
+            cp << "every " << intervalUs/1000 << " ms";
+        if(instance_.checkpoints_.onSignal())
+            cp << (intervalUs > 0 ? " and " : "") << "on SIGTERM/SIGABRT";
+        COUT("Checkpoint: " << GREEN << cp.str() << std::endl << NORM);
+    }
+    {
+        MutexLock lock(instance_.sessionMutex_);
+        std::ostringstream session;
+        if(instance_.sessionActive_) {
+            int64_t remainUs = instance_.sessionEndUs_ - getCurrentMicroSeconds();
+            session << "'" << instance_.sessionName_ << "', " << (remainUs > 0 ? remainUs/1000 : 0) << " ms left";
+        } else {
+            session << "off";
+        }
+        COUT("Session:   "  << GREEN << session.str() << std::endl << NORM);
+    }
 
+    std::ostringstream os;
+    formatAtomicTopK(os);
+    if(!os.str().empty())
+        COUT("Atomic top-K: " << GREEN << std::endl << os.str() << NORM);
+    
     COUT("Stats: " << GREEN << std::endl << std::endl << formatStats(true) << NORM);
 }
 
+/**.......................................................................
+ * Format the running top-K partitions per tag, as count(+error)
+ */
+void ProfilerImpl::formatAtomicTopK(std::ostringstream& os)
+{
+    MutexLock lock(mutex_);
+
+    if(cumulativeTopK_.empty() || atomicCounterMap_.empty())
+        return;
+
+    // Tags are those of the first partition that has any, and only
+    // count and sum tags are ranked
+    
+    std::vector<std::string> tags;
+    std::vector<bool> additive;
+    
+    for(std::map<uint64_t, RingPartition>::iterator iter=atomicCounterMap_.begin();
+        iter != atomicCounterMap_.end(); iter++) {
+
+        if(!tags.empty())
+            break;
+        
+        for(std::map<std::string, BufferedAtomicCounter>::iterator tag=iter->second.counterMap_.begin();
+            tag != iter->second.counterMap_.end(); tag++) {
+            tags.push_back(tag->first);
+            additive.push_back(BufferedAtomicCounter::isAdditive(tag->second.kind()));
+        }
+    }
+
+    for(unsigned iTag=0; iTag < tags.size() && iTag < cumulativeTopK_.size(); iTag++) {
+
+        if(!additive[iTag])
+            continue;
+        
+        std::vector<TopK::Entry> entries;
+        cumulativeTopK_[iTag].getSorted(entries);
+
+        os << "  " << tags[iTag] << ":";
+        for(unsigned i=0; i < entries.size(); i++) {
+            std::map<uint64_t, RingPartition>::iterator part = atomicCounterMap_.find(entries[i].key_);
+            os << " " << (part != atomicCounterMap_.end() ? part->second.leveldbFile_ : "?")
+               << "=" << entries[i].count_;
+            if(entries[i].error_ > 0)
+                os << "(+" << entries[i].error_ << ")";
+        }
+        os << std::endl;
+    }
+}
+
 unsigned ProfilerImpl::profile(std::string command, bool perThread, bool always)
 {
     return profile(command, "", perThread, always);
@@ -512,6 +2172,8 @@ unsigned ProfilerImpl::profile(std::string command, std::string value, bool perT
         instance_.dump(value);
     else if(command == "debug")
         instance_.debug();
+    else if(command == "shm_export")
+        instance_.exportToShm(value);
     else if(command == "start") {
         retval = instance_.start(value, perThread);
     } else if(command == "stop") {
@@ -547,29 +2209,165 @@ void ProfilerImpl::initializeAtomicCounters(std::map<std::string, std::string>&
     
     if(instance_.atomicCounterTimerId_== 0) {
         
+        // The value is the kind of the counter; anything
+        // unrecognized (historically, the name again) means a plain
+        // count.  Counter tags are laid out in name order, as in
+        // each partition's counterMap_
+
+        for(std::map<std::string,std::string>::iterator iter = nameMap.begin(); iter != nameMap.end(); iter++) {
+            if(iter->second == "hist")
+                continue;
+            
+            BufferedAtomicCounter::Kind kind = BufferedAtomicCounter::KIND_COUNT;
+            BufferedAtomicCounter::kindFromString(iter->second, kind);
+            
+            instance_.atomicBinTags_.push_back(iter->first);
+            instance_.atomicBinKinds_.push_back(BufferedAtomicCounter::kindToString(kind));
+        }
+
+        uint64_t nPart     = instance_.atomicCounterMap_.size();
+        uint64_t nTag      = instance_.atomicBinTags_.size();
+        uint64_t partSize  = nTag * bufferSize;
+        uint64_t bufSize   = nPart * partSize;
+        
+        instance_.atomicBins_.resize(2 * bufSize);
+        
+        unsigned iPart = 0;
+        
         for(std::map<uint64_t, RingPartition>::iterator part = instance_.atomicCounterMap_.begin();
-            part != instance_.atomicCounterMap_.end(); part++) {
+            part != instance_.atomicCounterMap_.end(); part++, iPart++) {
+
+            unsigned iTag = 0;
             
             for(std::map<std::string,std::string>::iterator iter = nameMap.begin(); iter != nameMap.end(); iter++) {
-                part->second.counterMap_[iter->first].setTo(bufferSize, intervalUs);
+
+                if(iter->second == "hist" || bufSize == 0) {
+                    part->second.addTag(iter->first, iter->second, bufferSize, intervalUs);
+                    continue;
+                }
+
+                uint64_t offset = iPart * partSize + iTag * bufferSize;
+                
+                part->second.addTag(iter->first, iter->second, bufferSize, intervalUs,
+                                    &instance_.atomicBins_[offset], &instance_.atomicBins_[bufSize + offset]);
+                iTag++;
             }
+            
+            instance_.atomicBinPartitions_.push_back(part->first);
         }
         
         instance_.atomicCounterOutput_ = fileName;
-        instance_.majorIntervalUs_ = bufferSize * intervalUs;
+        instance_.majorIntervalUs_  = bufferSize * intervalUs;
+        instance_.minorIntervalUs_  = intervalUs;
+        instance_.atomicBufferSize_ = bufferSize;
         
         // And start the timer
         
         instance_.startAtomicCounterTimer();
     }
     
-    instance_.mutex_.Unlock();
+    instance_.mutex_.Unlock();
+}
+
+void ProfilerImpl::incrementAtomicCounter(uint64_t partPtr, std::string counterName)
+{
+    if(instance_.atomicCounterMap_.find(partPtr) != instance_.atomicCounterMap_.end())
+        instance_.atomicCounterMap_[partPtr].incrementCounter(counterName, getCurrentMicroSeconds());
+}
+
+/**.......................................................................
+ * Accumulate a value into an atomic counter, according to the kind
+ * the tag was initialized with (sum, min, max or gauge)
+ */
+void ProfilerImpl::addAtomicCounter(uint64_t partPtr, std::string counterName, uint64_t value)
+{
+    std::map<uint64_t, RingPartition>::iterator iter = instance_.atomicCounterMap_.find(partPtr);
+    if(iter != instance_.atomicCounterMap_.end())
+        iter->second.addToCounter(counterName, getCurrentMicroSeconds(), value);
+}
+
+/**.......................................................................
+ * Describe the matrix of live atomic counter bins
+ */
+bool ProfilerImpl::atomicBins(Profiler::AtomicBins& bins)
+{
+    MutexLock lock(instance_.mutex_);
+
+    if(instance_.atomicCounterTimerId_ == 0)
+        return false;
+
+    bins.bins_            = instance_.atomicBins_.empty() ? 0 :
+        (const volatile uint64_t*)&instance_.atomicBins_[0].counts_;
+    bins.nPartition_      = instance_.atomicBinPartitions_.size();
+    bins.nTag_            = instance_.atomicBinTags_.size();
+    bins.nBin_            = instance_.atomicBufferSize_;
+    bins.minorIntervalUs_ = instance_.minorIntervalUs_;
+    bins.majorIntervalUs_ = instance_.majorIntervalUs_;
+    bins.tags_            = instance_.atomicBinTags_;
+    bins.kinds_           = instance_.atomicBinKinds_;
+    bins.partitions_      = instance_.atomicBinPartitions_;
+
+    bins.partitionFiles_.clear();
+    for(unsigned iPart=0; iPart < bins.partitions_.size(); iPart++)
+        bins.partitionFiles_.push_back(instance_.atomicCounterMap_[bins.partitions_[iPart]].leveldbFile_);
+
+    return true;
+}
+
+/**.......................................................................
+ * Add a family of counters over dims, binned with the same buffer
+ * size and interval as the atomic counters and written to fileName
+ * at the end of each major interval.  Returns the family's id
+ */
+unsigned ProfilerImpl::addCounterFamily(std::string name, std::vector<CounterFamily::Dimension>& dims,
+                                        std::string fileName, BufferedAtomicCounter::Kind kind)
+{
+    MutexLock lock(instance_.mutex_);
+
+    if(instance_.atomicCounterTimerId_ == 0)
+        ThrowRuntimeError("Atomic counters must be initialized before adding counter family " << name);
+
+    if(instance_.nFamilies_ == MAX_COUNTER_FAMILIES)
+        ThrowRuntimeError("Too many counter families (max " << MAX_COUNTER_FAMILIES << ")");
+
+    for(unsigned i=0; i < instance_.nFamilies_; i++) {
+        if(instance_.families_[i]->name_ == name)
+            ThrowRuntimeError("Counter family " << name << " already exists");
+    }
+    
+    unsigned id = instance_.nFamilies_;
+    
+    instance_.families_[id] = new CounterFamily(name, dims, instance_.atomicBufferSize_,
+                                                instance_.minorIntervalUs_, fileName, kind);
+
+    // Make sure the slot is visible before the count that covers it
+
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+    instance_.nFamilies_ = id + 1;
+
+    return id;
 }
 
-void ProfilerImpl::incrementAtomicCounter(uint64_t partPtr, std::string counterName)
+/**.......................................................................
+ * Increment a family's cell.  Unknown ids and out-of-range indices
+ * are ignored, as are unknown partitions for atomic counters
+ */
+void ProfilerImpl::incrementCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex)
 {
-    if(instance_.atomicCounterMap_.find(partPtr) != instance_.atomicCounterMap_.end())
-        instance_.atomicCounterMap_[partPtr].incrementCounter(counterName, getCurrentMicroSeconds());
+    if(id < instance_.nFamilies_)
+        instance_.families_[id]->increment(indices, nIndex, getCurrentMicroSeconds());
+}
+
+void ProfilerImpl::addToCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex, uint64_t value)
+{
+    if(id < instance_.nFamilies_)
+        instance_.families_[id]->add(indices, nIndex, getCurrentMicroSeconds(), value);
 }
 
 void ProfilerImpl::startAtomicCounterTimer()
@@ -582,8 +2380,17 @@ void ProfilerImpl::startAtomicCounterTimer()
     FOUT("Creating timer thread with instance = " << &instance_ << " instance size = " << instance_.atomicCounterMap_.size());
 
 #ifndef _WIN32
-    if(pthread_create(&atomicCounterTimerId_, NULL, &runAtomicCounterTimer, &instance_) != 0)
+    if(pipe(atomicCounterWakeFds_) != 0)
+        ThrowRuntimeError("Unable to create timer wake pipe: " << strerror(errno));
+
+    if(pthread_create(&atomicCounterTimerId_, NULL, &runAtomicCounterTimer, &instance_) != 0) {
+        close(atomicCounterWakeFds_[0]);
+        close(atomicCounterWakeFds_[1]);
+        atomicCounterWakeFds_[0] = -1;
+        atomicCounterWakeFds_[1] = -1;
+        atomicCounterTimerId_ = 0;
         ThrowRuntimeError("Unable to create timer thread");
+    }
 #else
     if(CreateThread(NULL, 0, runAtomicCounterTimer, &instance_, 0, &atomicCounterTimerId_) == 0)
         ThrowRuntimeError("Unable to create timer thread");
@@ -591,6 +2398,31 @@ void ProfilerImpl::startAtomicCounterTimer()
 
 }
 
+/**.......................................................................
+ * Wake the timer thread and wait for it to exit, after finishing any
+ * dump in progress.  Called without mutex_ held, since the timer
+ * thread may need it
+ */
+void ProfilerImpl::stopAtomicCounterTimer()
+{
+#ifndef _WIN32
+    if(atomicCounterTimerId_ == 0)
+        return;
+
+    char c = 0;
+    while(write(atomicCounterWakeFds_[1], &c, 1) < 0 && errno == EINTR)
+        ;
+
+    pthread_join(atomicCounterTimerId_, NULL);
+
+    close(atomicCounterWakeFds_[0]);
+    close(atomicCounterWakeFds_[1]);
+    atomicCounterWakeFds_[0] = -1;
+    atomicCounterWakeFds_[1] = -1;
+    atomicCounterTimerId_ = 0;
+#endif
+}
+
 void ProfilerImpl::dumpAtomicCounters()
 {
     try {
@@ -605,6 +2437,19 @@ void ProfilerImpl::dumpAtomicCounters()
             outfile.open(atomicCounterOutput_.c_str(), std::fstream::out|std::fstream::app);
             FOUT("About to open output file: " << atomicCounterOutput_ << ".. success");
             uint64_t timestamp = (getCurrentMicroSeconds()/majorIntervalUs_ - 1) * majorIntervalUs_;
+
+            // Partitions added after the counters were initialized
+            // have no tags, so take the tags from the first partition
+            // that has them
+
+            RingPartition* tagged = &atomicCounterMap_.begin()->second;
+            for(std::map<uint64_t, RingPartition>::iterator iter=atomicCounterMap_.begin();
+                iter != atomicCounterMap_.end(); iter++) {
+                if(!iter->second.counterMap_.empty() || !iter->second.histMap_.empty()) {
+                    tagged = &iter->second;
+                    break;
+                }
+            }
             
             //------------------------------------------------------------
             // If this is the first time we've written to the output file,
@@ -619,22 +2464,134 @@ void ProfilerImpl::dumpAtomicCounters()
                     outfile << iter->second.leveldbFile_ << " ";
                 outfile << std::endl;
                 
-                outfile << "tags: " << atomicCounterMap_.begin()->second.listTags() << std::endl;
+                outfile << "tags: " << tagged->listTags() << std::endl;
+
+                // Only written if needed, so that files of plain
+                // counts are unchanged
+                
+                if(tagged->hasValueKinds())
+                    outfile << "kinds: " << tagged->listKinds() << std::endl;
+
+                std::vector<std::string> histTags;
+                tagged->getHistTags(histTags);
+                if(!histTags.empty()) {
+                    outfile << "hists: ";
+                    for(unsigned i=0; i < histTags.size(); i++)
+                        outfile << histTags[i] << " ";
+                    outfile << std::endl;
+                }
                 
                 firstDump_ = false;
             }
             
             //------------------------------------------------------------
-            // Now dump out all counters for this timestamp
+            // Now dump out all counters for this timestamp, recording
+            // where each partition's bins start and how many tags it
+            // has, since untagged partitions add no bins
             //------------------------------------------------------------
+
+            std::vector<uint64_t> bins;
+            std::vector<std::string> partitions;
+            std::vector<uint64_t> partKeys;
+            std::vector<unsigned> partOffsets;
+            std::vector<unsigned> partTags;
             
-            outfile << timestamp << ": ";
             for(std::map<uint64_t, RingPartition>::iterator iter=atomicCounterMap_.begin();
-                iter != atomicCounterMap_.end(); iter++)
-                outfile << iter->second.dumpCounters(timestamp);
+                iter != atomicCounterMap_.end(); iter++) {
+                partKeys.push_back(iter->first);
+                partOffsets.push_back(bins.size());
+                partTags.push_back(iter->second.counterMap_.size());
+                iter->second.drainCounters(timestamp, bins);
+                partitions.push_back(iter->second.leveldbFile_);
+            }
+
+            std::vector<std::string> tags;
+            tagged->getTags(tags);
+            unsigned nBins = tags.size() > 0 ? tagged->counterMap_.begin()->second.bufferSize() : 0;
+
+            unsigned topK;
+            bool skipCold, sparse;
+            {
+                MutexLock lock(mutex_);
+                topK     = atomicTopK_;
+                skipCold = atomicSkipCold_;
+                sparse   = atomicSparse_;
+            }
+            
+            //------------------------------------------------------------
+            // Rank partitions per tag, if requested.  hot[i] is true
+            // for any partition in some tag's top K
+            //------------------------------------------------------------
+
+            std::vector<bool> hot(partitions.size(), !skipCold);
+
+            if(topK > 0 && nBins > 0)
+                writeAtomicTopK(outfile, timestamp, bins, partKeys, partOffsets, partTags, *tagged, nBins, topK, hot);
+
+            if(skipCold) {
+                outfile << "hot " << timestamp << ": ";
+                for(unsigned iPart=0; iPart < hot.size(); iPart++)
+                    if(hot[iPart])
+                        outfile << iPart << " ";
+                outfile << std::endl;
+            }
+            
+            //------------------------------------------------------------
+            // Write the bins, either all of them or just the
+            // non-zero runs, as
+            //
+            //   timestamp: v v v ...
+            //   sparse timestamp nValues: gap:v,v gap:v ...
+            //------------------------------------------------------------
+
+            std::vector<uint64_t> hotBins;
+            std::vector<uint64_t>& outBins = skipCold ? hotBins : bins;
+
+            if(skipCold) {
+                for(unsigned iPart=0; iPart < partOffsets.size(); iPart++) {
+                    unsigned end = (iPart + 1 < partOffsets.size()) ? partOffsets[iPart + 1] : bins.size();
+                    if(hot[iPart])
+                        hotBins.insert(hotBins.end(), bins.begin() + partOffsets[iPart], bins.begin() + end);
+                }
+            }
+            
+            if(sparse) {
+                outfile << "sparse " << timestamp << " " << outBins.size() << ": ";
+                if(!outBins.empty())
+                    SparseFormat::write(outfile, &outBins[0], outBins.size());
+            } else {
+                outfile << timestamp << ": ";
+                for(unsigned i=0; i < outBins.size(); i++)
+                    outfile << outBins[i] << " ";
+            }
             outfile << std::endl;
+
+            writeAtomicHistograms(outfile, timestamp, *tagged);
             
             outfile.close();
+
+            //------------------------------------------------------------
+            // And publish them to shared memory, if exporting.  The
+            // segment holds tags.size() * nBins values per partition,
+            // so only partitions with the full tag set are published
+            //------------------------------------------------------------
+
+            MutexLock lock(mutex_);
+
+            if(shm_.isOpen()) {
+                std::vector<std::string> shmPartitions;
+                std::vector<uint64_t> shmBins;
+
+                for(unsigned iPart=0; iPart < partOffsets.size(); iPart++) {
+                    if(nBins == 0 || partTags[iPart] != tags.size())
+                        continue;
+                    shmPartitions.push_back(partitions[iPart]);
+                    shmBins.insert(shmBins.end(), bins.begin() + partOffsets[iPart],
+                                   bins.begin() + partOffsets[iPart] + tags.size() * nBins);
+                }
+                
+                shm_.publishAtomic(timestamp, majorIntervalUs_, shmPartitions, tags, nBins, shmBins);
+            }
         }
         
     } catch(...) {
@@ -642,6 +2599,164 @@ void ProfilerImpl::dumpAtomicCounters()
     }
 }
 
+/**.......................................................................
+ * Write the last complete interval of each histogram tag, as
+ *
+ *   hist timestamp tag nValues: gap:v,v gap:v ...
+ *
+ * where the values are ordered by partition, then bin, then bucket,
+ * and run-length encoded as in sparse mode (see SparseFormat.h).  The
+ * histogram tags are those of tagged
+ */
+void ProfilerImpl::writeAtomicHistograms(std::fstream& outfile, uint64_t timestamp, RingPartition& tagged)
+{
+    std::vector<std::string> histTags;
+    tagged.getHistTags(histTags);
+
+    for(unsigned iTag=0; iTag < histTags.size(); iTag++) {
+
+        std::vector<uint64_t> buckets;
+        for(std::map<uint64_t, RingPartition>::iterator iter=atomicCounterMap_.begin();
+            iter != atomicCounterMap_.end(); iter++)
+            iter->second.drainHistogram(histTags[iTag], timestamp, buckets);
+
+        outfile << "hist " << timestamp << " " << histTags[iTag] << " " << buckets.size() << ": ";
+        if(!buckets.empty())
+            SparseFormat::write(outfile, &buckets[0], buckets.size());
+        outfile << std::endl;
+    }
+}
+
+/**.......................................................................
+ * Write the last complete interval of each counter family to its
+ * file, using the same line formats as the atomic counters
+ */
+void ProfilerImpl::dumpCounterFamilies()
+{
+    unsigned nFamilies = nFamilies_;
+
+    if(nFamilies == 0)
+        return;
+    
+    bool sparse;
+    {
+        MutexLock lock(mutex_);
+        sparse = atomicSparse_;
+    }
+
+    uint64_t timestamp = (getCurrentMicroSeconds()/majorIntervalUs_ - 1) * majorIntervalUs_;
+
+    for(unsigned iFam=0; iFam < nFamilies; iFam++) {
+
+        CounterFamily* family = families_[iFam];
+        
+        try {
+            std::vector<uint64_t> bins;
+            family->drain(timestamp, bins);
+
+            std::fstream outfile;
+            outfile.open(family->outputFile_.c_str(), std::fstream::out|std::fstream::app);
+
+            if(family->firstDump_) {
+                outfile << family->header();
+                family->firstDump_ = false;
+            }
+            
+            if(sparse) {
+                outfile << "sparse " << timestamp << " " << bins.size() << ": ";
+                if(!bins.empty())
+                    SparseFormat::write(outfile, &bins[0], bins.size());
+            } else {
+                outfile << timestamp << ": ";
+                for(unsigned i=0; i < bins.size(); i++)
+                    outfile << bins[i] << " ";
+            }
+            outfile << std::endl;
+            
+        } catch(...) {
+            FOUT("Unable to dump counter family " << family->name_);
+        }
+    }
+}
+
+/**.......................................................................
+ * Write the topK heaviest partitions per tag for this interval, one
+ * line per tag:
+ *
+ *   top timestamp tag: partIndex:count partIndex:count ...
+ *
+ * and fold the interval totals into the running top K per tag, keyed
+ * by partKeys[iPart].  Partition iPart's bins start at bins[partOffsets[iPart]]; those
+ * without a full set of tags (those of tagged) aren't ranked.  Nor
+ * are min, max and gauge tags, whose bins don't add up to a total
+ */
+void ProfilerImpl::writeAtomicTopK(std::fstream& outfile, uint64_t timestamp, std::vector<uint64_t>& bins,
+                                   std::vector<uint64_t>& partKeys,
+                                   std::vector<unsigned>& partOffsets, std::vector<unsigned>& partTags,
+                                   RingPartition& tagged, unsigned nBins,
+                                   unsigned topK, std::vector<bool>& hot)
+{
+    std::vector<std::string> tags;
+    std::vector<bool> additive;
+    
+    for(std::map<std::string, BufferedAtomicCounter>::iterator iter=tagged.counterMap_.begin();
+        iter != tagged.counterMap_.end(); iter++) {
+        tags.push_back(iter->first);
+        additive.push_back(BufferedAtomicCounter::isAdditive(iter->second.kind()));
+    }
+    
+    unsigned nPart = partOffsets.size();
+    unsigned nTag  = tags.size();
+    std::vector<TopK> intervalTopK(nTag, TopK(topK));
+    std::vector<uint64_t> totals(nPart * nTag, 0);
+    
+    for(unsigned iPart=0; iPart < nPart; iPart++) {
+
+        if(partTags[iPart] != nTag)
+            continue;
+        
+        for(unsigned iTag=0; iTag < nTag; iTag++) {
+
+            if(!additive[iTag])
+                continue;
+            
+            uint64_t* binPtr = &bins[partOffsets[iPart] + iTag * nBins];
+            uint64_t total = 0;
+            for(unsigned iBin=0; iBin < nBins; iBin++)
+                total += binPtr[iBin];
+            totals[iPart * nTag + iTag] = total;
+            if(total > 0)
+                intervalTopK[iTag].offer(iPart, total);
+        }
+    }
+
+    for(unsigned iTag=0; iTag < nTag; iTag++) {
+
+        if(!additive[iTag])
+            continue;
+        
+        std::vector<TopK::Entry> entries;
+        intervalTopK[iTag].getSorted(entries);
+
+        outfile << "top " << timestamp << " " << tags[iTag] << ": ";
+        for(unsigned i=0; i < entries.size(); i++) {
+            outfile << entries[i].key_ << ":" << entries[i].count_ << " ";
+            hot[entries[i].key_] = true;
+        }
+        outfile << std::endl;
+    }
+
+    MutexLock lock(mutex_);
+
+    if(cumulativeTopK_.size() != nTag)
+        cumulativeTopK_.assign(nTag, TopK(topK));
+    
+    for(unsigned iPart=0; iPart < nPart; iPart++)
+        for(unsigned iTag=0; iTag < nTag; iTag++)
+            if(additive[iTag])
+                cumulativeTopK_[iTag].add(partKeys[iPart], totals[iPart * nTag + iTag]);
+}
+
 #ifndef _MSC_FULL_VER
 THREAD_START(ProfilerImpl::runAtomicCounterTimer)
 #else
@@ -651,13 +2766,16 @@ DWORD ProfilerImpl::runAtomicCounterTimer(LPVOID arg)
     ProfilerImpl* prof = (ProfilerImpl*)arg;
     bool first = true;
     struct timeval timeout;
+    int nReady = 0;
     
     do {
 
         // If this is not the first time through the loop, dump out the counters
         
-        if(!first)
+        if(!first) {
             prof->dumpAtomicCounters();
+            prof->dumpCounterFamilies();
+        }
     
         uint64_t currentMicroSeconds = prof->getCurrentMicroSeconds();
 
@@ -674,7 +2792,20 @@ DWORD ProfilerImpl::runAtomicCounterTimer(LPVOID arg)
 
         first = false;
 
-    } while(select(0, NULL, NULL, NULL, &timeout) == 0);
+        // Sleep, unless woken by stopAtomicCounterTimer()
+
+#ifndef _WIN32
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(prof->atomicCounterWakeFds_[0], &fds);
+
+        while((nReady = select(prof->atomicCounterWakeFds_[0]+1, &fds, NULL, NULL, &timeout)) < 0 && errno == EINTR)
+            ;
+#else
+        nReady = select(0, NULL, NULL, NULL, &timeout);
+#endif
+
+    } while(nReady == 0);
 
     return 0;
 }
@@ -694,15 +2825,39 @@ ProfilerImpl::Counter::Counter()
     state_ = STATE_DONE;
     errorCountUninitiated_  = 0;
     errorCountUnterminated_ = 0;
+
+    hasUsage_              = false;
+    deltaOffCpuUsec_       = 0;
+    deltaCpuUsec_          = 0;
+    deltaVolCtxSwitches_   = 0;
+    deltaInvolCtxSwitches_ = 0;
+
+    for(unsigned i=0; i < PerfCounters::N_EVENT; i++)
+        deltaPerf_[i] = 0;
+
+    deltaAllocs_     = 0;
+    deltaAllocBytes_ = 0;
+    deltaFrees_      = 0;
+
+    shmIndex_   = -1;
+    used_       = false;
+    epoch_      = 0;
+    startEpoch_ = 0;
 }
 
-void ProfilerImpl::Counter::start(int64_t usec, unsigned count)
+void ProfilerImpl::Counter::start(int64_t usec, unsigned count, unsigned epoch, ThreadUsage* usage)
 {
     // Only set the time if the last trigger is done
     
     if(state_ == STATE_DONE) {
         currentUsec_   = usec;
+        startEpoch_    = epoch;
         state_ = STATE_TRIGGERED;
+
+        hasUsage_ = (usage != 0);
+        if(hasUsage_)
+            currentUsage_ = *usage;
+        
     } else {
         errorCountUnterminated_++;
     }
@@ -710,7 +2865,7 @@ void ProfilerImpl::Counter::start(int64_t usec, unsigned count)
     currentCounts_ = count;
 }
 
-void ProfilerImpl::Counter::stop(int64_t usec, unsigned count)
+void ProfilerImpl::Counter::stop(int64_t usec, unsigned count, ThreadUsage* usage)
 {
     // Only increment this counter if it was in fact triggered prior
     // to this call
@@ -723,12 +2878,137 @@ void ProfilerImpl::Counter::stop(int64_t usec, unsigned count)
         
         deltaCounts_ += (count - currentCounts_);
 
+        // Per-thread CPU time is only meaningful if the interval
+        // started and stopped on the same thread
+        
+        if(hasUsage_ && usage && usage->threadId_ == currentUsage_.threadId_) {
+
+            // The usage carries its own wall time, sampled next to
+            // the CPU time, so the two only differ by time spent off
+            // the cpu.  What is left of the sampling jitter is
+            // clamped at 0
+            
+            if(usage->hasCpu_ && currentUsage_.hasCpu_) {
+                int64_t cpuUsec         = usage->cpuUsec_ - currentUsage_.cpuUsec_;
+                int64_t offCpuUsec      = (usage->wallUsec_ - currentUsage_.wallUsec_) - cpuUsec;
+                
+                deltaOffCpuUsec_       += (offCpuUsec > 0 ? offCpuUsec : 0);
+                deltaCpuUsec_          += cpuUsec;
+                deltaVolCtxSwitches_   += (usage->volCtxSwitches_   - currentUsage_.volCtxSwitches_);
+                deltaInvolCtxSwitches_ += (usage->involCtxSwitches_ - currentUsage_.involCtxSwitches_);
+            }
+
+            uint64_t perf[PerfCounters::N_EVENT];
+            if(PerfCounters::delta(currentUsage_.perf_, usage->perf_, perf)) {
+                for(unsigned i=0; i < PerfCounters::N_EVENT; i++)
+                    deltaPerf_[i] += perf[i];
+            }
+
+            if(usage->alloc_.valid_ && currentUsage_.alloc_.valid_) {
+                deltaAllocs_     += (usage->alloc_.allocs_ - currentUsage_.alloc_.allocs_);
+                deltaAllocBytes_ += (usage->alloc_.bytes_  - currentUsage_.alloc_.bytes_);
+                deltaFrees_      += (usage->alloc_.frees_  - currentUsage_.alloc_.frees_);
+            }
+        }
+
         state_ = STATE_DONE;
     } else {
         errorCountUninitiated_++;
     }
 }
 
+/**.......................................................................
+ * Add an interval timed outside the counter (an async span)
+ */
+void ProfilerImpl::Counter::addInterval(int64_t usec, unsigned count)
+{
+    deltaUsec_   += usec;
+    deltaCounts_ += count;
+}
+
+/**.......................................................................
+ * Zero the accumulated values, leaving the state of the current
+ * interval (and the error counts) alone
+ */
+void ProfilerImpl::Counter::clearDeltas()
+{
+    deltaCounts_           = 0;
+    deltaUsec_             = 0;
+    deltaOffCpuUsec_       = 0;
+    deltaCpuUsec_          = 0;
+    deltaVolCtxSwitches_   = 0;
+    deltaInvolCtxSwitches_ = 0;
+
+    for(unsigned i=0; i < PerfCounters::N_EVENT; i++)
+        deltaPerf_[i] = 0;
+
+    deltaAllocs_     = 0;
+    deltaAllocBytes_ = 0;
+    deltaFrees_      = 0;
+}
+
+int64_t ProfilerImpl::Counter::getField(ProfileSnapshot::Field field)
+{
+    switch (field) {
+    case ProfileSnapshot::FIELD_COUNTS:
+        return deltaCounts_;
+        break;
+    case ProfileSnapshot::FIELD_USEC:
+        return deltaUsec_;
+        break;
+    case ProfileSnapshot::FIELD_CPU_USEC:
+        return deltaCpuUsec_;
+        break;
+    case ProfileSnapshot::FIELD_OFFCPU_USEC:
+        return deltaOffCpuUsec_;
+        break;
+    case ProfileSnapshot::FIELD_VOL_CTX_SWITCHES:
+        return deltaVolCtxSwitches_;
+        break;
+    case ProfileSnapshot::FIELD_INVOL_CTX_SWITCHES:
+        return deltaInvolCtxSwitches_;
+        break;
+    case ProfileSnapshot::FIELD_CYCLES:
+        return deltaPerf_[PerfCounters::EVENT_CYCLES];
+        break;
+    case ProfileSnapshot::FIELD_INSTRUCTIONS:
+        return deltaPerf_[PerfCounters::EVENT_INSTRUCTIONS];
+        break;
+    case ProfileSnapshot::FIELD_LLC_MISSES:
+        return deltaPerf_[PerfCounters::EVENT_LLC_MISSES];
+        break;
+    case ProfileSnapshot::FIELD_BRANCH_MISSES:
+        return deltaPerf_[PerfCounters::EVENT_BRANCH_MISSES];
+        break;
+    case ProfileSnapshot::FIELD_ALLOCS:
+        return deltaAllocs_;
+        break;
+    case ProfileSnapshot::FIELD_ALLOC_BYTES:
+        return deltaAllocBytes_;
+        break;
+    case ProfileSnapshot::FIELD_FREES:
+        return deltaFrees_;
+        break;
+    default:
+        return 0;
+        break;
+    }
+}
+
+//=======================================================================
+// ProfilerImpl::ThreadUsage
+//=======================================================================
+
+ProfilerImpl::ThreadUsage::ThreadUsage()
+{
+    threadId_         = 0;
+    hasCpu_           = false;
+    cpuUsec_          = 0;
+    wallUsec_         = 0;
+    volCtxSwitches_   = 0;
+    involCtxSwitches_ = 0;
+}
+
 //=======================================================================
 // Profiler class definition
 //=======================================================================
@@ -753,6 +3033,144 @@ void Profiler::noop(bool makeNoop)
     return ProfilerImpl::noop(makeNoop);
 }
 
+void Profiler::overlap(std::string label)
+{
+    ProfilerImpl::overlap(label);
+}
+
+unsigned Profiler::start(std::string& label, bool perThread, bool always)
+{
+    return ProfilerImpl::startCounter(label, perThread, always);
+}
+
+void Profiler::stop(std::string& label, bool perThread, bool always)
+{
+    ProfilerImpl::stopCounter(label, perThread, always);
+}
+
+unsigned Profiler::labelSlot(std::string label)
+{
+    return ProfilerImpl::labelSlot(label);
+}
+
+void Profiler::applyEvents(const int64_t* events, unsigned nEvent, bool perThread, bool always)
+{
+    ProfilerImpl::applyEvents(events, nEvent, perThread, always);
+}
+
+uint64_t Profiler::spanBegin(std::string label)
+{
+    return ProfilerImpl::spanBegin(label);
+}
+
+void Profiler::spanEnd(uint64_t token)
+{
+    ProfilerImpl::spanEnd(token);
+}
+
+unsigned Profiler::reset()
+{
+    return ProfilerImpl::reset();
+}
+
+void Profiler::enableGroup(std::string pattern, bool enable)
+{
+    ProfilerImpl::enableGroup(pattern, enable);
+}
+
+Profiler::SessionOptions::SessionOptions()
+{
+    cpuTime_      = false;
+    perfCounters_ = false;
+    allocTrack_   = false;
+}
+
+Profiler::AtomicBins::AtomicBins()
+{
+    bins_            = 0;
+    nPartition_      = 0;
+    nTag_            = 0;
+    nBin_            = 0;
+    minorIntervalUs_ = 0;
+    majorIntervalUs_ = 0;
+}
+
+bool Profiler::atomicBins(AtomicBins& bins)
+{
+    return ProfilerImpl::atomicBins(bins);
+}
+
+void Profiler::sessionStart(std::string name, unsigned durationMs, SessionOptions& opts)
+{
+    ProfilerImpl::sessionStart(name, durationMs, opts);
+}
+
+void Profiler::sessionStop()
+{
+    ProfilerImpl::sessionStop();
+}
+
+void Profiler::cpuTime(bool enable)
+{
+    return ProfilerImpl::cpuTime(enable);
+}
+
+void Profiler::perfCounters(bool enable)
+{
+    return ProfilerImpl::perfCounters(enable);
+}
+
+void Profiler::allocTrack(bool enable)
+{
+    return ProfilerImpl::allocTrack(enable);
+}
+
+unsigned Profiler::addCounterFamily(std::string name, std::vector<CounterFamily::Dimension>& dims,
+                                    std::string fileName, BufferedAtomicCounter::Kind kind)
+{
+    return ProfilerImpl::addCounterFamily(name, dims, fileName, kind);
+}
+
+void Profiler::incrementCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex)
+{
+    return ProfilerImpl::incrementCounterFamily(id, indices, nIndex);
+}
+
+void Profiler::addToCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex, uint64_t value)
+{
+    return ProfilerImpl::addToCounterFamily(id, indices, nIndex, value);
+}
+
+void Profiler::atomicTopK(unsigned k, bool skipCold)
+{
+    return ProfilerImpl::atomicTopK(k, skipCold);
+}
+
+void Profiler::atomicFormat(std::string format)
+{
+    return ProfilerImpl::atomicFormat(format);
+}
+
+void Profiler::limits(unsigned maxLabels, unsigned maxThreads)
+{
+    return ProfilerImpl::limits(maxLabels, maxThreads);
+}
+
+void Profiler::reportFormat(std::string format)
+{
+    return ProfilerImpl::reportFormat(format);
+}
+
+unsigned Profiler::scrape(std::string address)
+{
+    return ProfilerImpl::scrape(address);
+}
+
+void Profiler::checkpoint(unsigned intervalMs, bool onSignal)
+{
+    ProfilerImpl::checkpoint(intervalMs, onSignal);
+}
+
 int64_t Profiler::getCurrentMicroSeconds()
 {
     return ProfilerImpl::getCurrentMicroSeconds();
@@ -776,6 +3194,11 @@ void Profiler::incrementAtomicCounter(uint64_t partPtr, std::string counterName)
     return ProfilerImpl::incrementAtomicCounter(partPtr, counterName);
 }
 
+void Profiler::addAtomicCounter(uint64_t partPtr, std::string counterName, uint64_t value)
+{
+    return ProfilerImpl::addAtomicCounter(partPtr, counterName, value);
+}
+
 void Profiler::printString(std::string str)
 {
     std::cout << "str 1 = " << str << std::endl;
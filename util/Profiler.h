@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#include "CounterFamily.h"
 #include "Mutex.h"
 #include "RingPartition.h"
 
@@ -37,13 +38,106 @@ namespace profiler {
     class Profiler {
     public:
 
+        //------------------------------------------------------------
+        // What a profiling session turns on for its duration
+        //------------------------------------------------------------
+
+        struct PROFILER_API SessionOptions {
+            bool cpuTime_;
+            bool perfCounters_;
+            bool allocTrack_;
+
+            // Label group patterns to enable (see enableGroup())
+
+            std::vector<std::string> groups_;
+
+            SessionOptions();
+        };
+
+        //------------------------------------------------------------
+        // The live bins of the atomic counters, as one matrix that
+        // can be read in place while the counters are incremented.
+        // bins_ holds [2][nPartition_][nTag_][nBin_] values: a buffer
+        // for each of the two major intervals the counters alternate
+        // between, (usec / majorIntervalUs_) % 2 being the one being
+        // incremented, and (usec % majorIntervalUs_) /
+        // minorIntervalUs_ its current bin.  The other buffer holds
+        // the previous interval until it is written out, and is
+        // then zeroed.  Histogram tags are not included, and empty
+        // bins of min tags hold ~0.  The matrix lives until exit
+        //------------------------------------------------------------
+
+        struct PROFILER_API AtomicBins {
+            const volatile uint64_t* bins_;
+            unsigned nPartition_;
+            unsigned nTag_;
+            unsigned nBin_;
+            uint64_t minorIntervalUs_;
+            uint64_t majorIntervalUs_;
+
+            std::vector<uint64_t> partitions_;
+            std::vector<std::string> partitionFiles_;
+            std::vector<std::string> tags_;
+            std::vector<std::string> kinds_;
+
+            AtomicBins();
+        };
+
         PROFILER_API static void noop(bool makeNoop);
+
+        // Start a new epoch of start/stop counters, and write out
+        // the old one (see README).  Returns the new epoch number
+
+        PROFILER_API static unsigned reset();
+
+        // Turn start/stop counters on or off at runtime by label
+        // prefix: "compaction.*" (nested groups such as
+        // "compaction.level0.*" can be set independently), or "*"
+        // for everything.  Disabled calls return before taking the
+        // profiler lock
+
+        PROFILER_API static void enableGroup(std::string pattern, bool enable);
+
+        // Let the shared (non-per-thread) counter of a label take
+        // overlapping intervals, reporting their concurrency and
+        // busy time (see OverlapCounter.h)
+
+        PROFILER_API static void overlap(std::string label);
+
+        PROFILER_API static void cpuTime(bool enable);
+        PROFILER_API static void perfCounters(bool enable);
+        PROFILER_API static void allocTrack(bool enable);
         PROFILER_API static int64_t getCurrentMicroSeconds();
 
         PROFILER_API static unsigned profile(std::string command, bool perThread, bool always);
         PROFILER_API static unsigned profile(std::string command, std::string value, bool perThread, bool always);
         PROFILER_API static unsigned profileChar(const char* command, const char* value, bool perThread=false, bool always=false);
 
+        // Start and stop a counter without copying its label, for
+        // bindings that keep their labels between calls
+
+        PROFILER_API static unsigned start(std::string& label, bool perThread=false, bool always=false);
+        PROFILER_API static void stop(std::string& label, bool perThread=false, bool always=false);
+
+        // Apply a batch of start/stop events, timed by the caller,
+        // in order and under one lock.  events holds nEvent (label
+        // slot, 0 to start or 1 to stop, usec) triples, where the
+        // slot is the one returned by labelSlot().  Throws, without
+        // applying any, if a slot or operation is invalid
+
+        PROFILER_API static unsigned labelSlot(std::string label);
+        PROFILER_API static void applyEvents(const int64_t* events, unsigned nEvent, bool perThread=false, bool always=false);
+
+        // Time an operation that may finish on a different thread
+        // from the one that began it: spanEnd() takes the token
+        // returned by spanBegin(), from any thread, and adds the
+        // elapsed time to the shared (0x0) counter of the label.
+        // spanBegin() returns 0 (which spanEnd() ignores) if the
+        // label is disabled or too many spans are open
+
+        PROFILER_API static uint64_t spanBegin(std::string label);
+        PROFILER_API static void spanEnd(uint64_t token);
+
         //------------------------------------------------------------
         // Time-resolved atomic counters
         //------------------------------------------------------------
@@ -57,6 +151,74 @@ namespace profiler {
 
         PROFILER_API static void incrementAtomicCounter(uint64_t partPtr, std::string counterName);
 
+        // Accumulate a value (bytes, a latency, a queue depth...)
+        // into the current bin, as a sum, min, max or gauge according
+        // to the kind of the tag.  The values of nameMap passed to
+        // initializeAtomicCounters are the tag kinds ("count", "sum",
+        // "min", "max" or "gauge"; anything else means "count")
+        
+        PROFILER_API static void addAtomicCounter(uint64_t partPtr, std::string counterName, uint64_t value);
+
+        // Describe the live bins (see AtomicBins).  Returns false if
+        // the atomic counters haven't been initialized
+        
+        PROFILER_API static bool atomicBins(AtomicBins& bins);
+
+        // Time-resolved counters over arbitrary dimensions, binned
+        // like the atomic counters (which must be initialized first).
+        // addCounterFamily returns the id to increment with
+        
+        PROFILER_API static unsigned addCounterFamily(std::string name,
+                                                      std::vector<CounterFamily::Dimension>& dims,
+                                                      std::string fileName,
+                                                      BufferedAtomicCounter::Kind kind=BufferedAtomicCounter::KIND_COUNT);
+        PROFILER_API static void incrementCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex);
+        PROFILER_API static void addToCounterFamily(unsigned id, const unsigned* indices, unsigned nIndex,
+                                                    uint64_t value);
+
+        // Report the k heaviest partitions per tag each interval (0
+        // to disable), optionally writing bins only for those
+        
+        PROFILER_API static void atomicTopK(unsigned k, bool skipCold);
+
+        // Write every bin ("dense", the default) or only runs of
+        // non-zero bins ("sparse")
+
+        PROFILER_API static void atomicFormat(std::string format);
+
+        // Cap the number of distinct start/stop labels and of
+        // threads with per-thread counters.  Anything beyond the caps
+        // is counted under the "(overflow)" label or the shared 0x0
+        // thread, and the number of rejections is reported
+
+        PROFILER_API static void limits(unsigned maxLabels, unsigned maxThreads);
+
+        // Write dumped files as "text" (the default), "json", "csv"
+        // or "prometheus"
+
+        PROFILER_API static void reportFormat(std::string format);
+
+        // Serve snapshots from a profiler thread on "unix:/path" or
+        // "tcp:port" (loopback only; port 0 picks one), or stop if
+        // address is empty.  Returns the bound TCP port
+
+        PROFILER_API static unsigned scrape(std::string address);
+
+        // Rewrite the report file (the one written at exit) every
+        // intervalMs, and on SIGTERM/SIGABRT if onSignal is true.
+        // Each write replaces the file atomically.  0 and false stop
+        // checkpointing
+
+        PROFILER_API static void checkpoint(unsigned intervalMs, bool onSignal);
+
+        // Profile for durationMs with the given options, then write
+        // what was counted in that time to <prefix>/<name>_session
+        // (with the report format's extension) and restore the
+        // previous settings.  sessionStop() ends the session early
+
+        PROFILER_API static void sessionStart(std::string name, unsigned durationMs, SessionOptions& opts);
+        PROFILER_API static void sessionStop();
+
         PROFILER_API static void printString(std::string str);
         PROFILER_API static void printStringRef(std::string& str);
         PROFILER_API static void printChar(const char* str);
@@ -0,0 +1,496 @@
+#include "stdafx.h"
+#include "ReportFormat.h"
+#include "ReportWriter.h"
+
+#include "exceptionutils.h"
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Return the warning (if any) for a cell.  Cells and warnings are
+ * both ordered by thread and then label, so callers walking the cells
+ * in order advance a single warning cursor
+ */
+static ProfileSnapshot::Warning* warningFor(ProfileSnapshot& snap, unsigned iCell, unsigned& iWarning)
+{
+    ProfileSnapshot::Cell& cell = snap.cells_[iCell];
+
+    while(iWarning < snap.warnings_.size()) {
+        ProfileSnapshot::Warning& warning = snap.warnings_[iWarning];
+
+        if(warning.thread_ > cell.thread_ || (warning.thread_ == cell.thread_ && warning.label_ > cell.label_))
+            return 0;
+
+        iWarning++;
+
+        if(warning.thread_ == cell.thread_ && warning.label_ == cell.label_)
+            return &warning;
+    }
+
+    return 0;
+}
+
+/**.......................................................................
+ * Write little-endian integers, independent of the host byte order
+ */
+static void writeLe32(ReportWriter& writer, uint32_t val)
+{
+    char bytes[4];
+    for(unsigned i=0; i < 4; i++)
+        bytes[i] = (char)(val >> (8*i));
+    writer.write(bytes, 4);
+}
+
+static void writeLe64(ReportWriter& writer, uint64_t val)
+{
+    char bytes[8];
+    for(unsigned i=0; i < 8; i++)
+        bytes[i] = (char)(val >> (8*i));
+    writer.write(bytes, 8);
+}
+
+/**.......................................................................
+ * Return the help text for a Prometheus metric
+ */
+static const char* fieldHelp(ProfileSnapshot::Field field)
+{
+    switch (field) {
+    case ProfileSnapshot::FIELD_COUNTS:
+        return "Profiler accesses while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_USEC:
+        return "Elapsed microseconds while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_CPU_USEC:
+        return "CPU microseconds while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_OFFCPU_USEC:
+        return "Off-CPU microseconds while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_VOL_CTX_SWITCHES:
+        return "Voluntary context switches while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_INVOL_CTX_SWITCHES:
+        return "Involuntary context switches while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_CYCLES:
+        return "CPU cycles while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_INSTRUCTIONS:
+        return "Instructions retired while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_LLC_MISSES:
+        return "Last-level cache misses while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_BRANCH_MISSES:
+        return "Branch misses while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_ALLOCS:
+        return "Allocations while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_ALLOC_BYTES:
+        return "Bytes allocated while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_FREES:
+        return "Frees while the counter was running";
+        break;
+    case ProfileSnapshot::FIELD_ACTIVE:
+        return "Overlapping intervals currently active";
+        break;
+    case ProfileSnapshot::FIELD_PEAK_ACTIVE:
+        return "Most overlapping intervals active at once";
+        break;
+    case ProfileSnapshot::FIELD_BUSY_USEC:
+        return "Wall-clock microseconds with at least one interval active, whether or not on a CPU";
+        break;
+    default:
+        return "";
+        break;
+    }
+}
+
+ReportFormat::Format ReportFormat::fromString(std::string name)
+{
+    if(name == "text")
+        return FORMAT_TEXT;
+    else if(name == "json")
+        return FORMAT_JSON;
+    else if(name == "csv")
+        return FORMAT_CSV;
+    else if(name == "prometheus")
+        return FORMAT_PROMETHEUS;
+    else if(name == "binary")
+        return FORMAT_BINARY;
+
+    ThrowRuntimeError("Unrecognized report format: " << name << " (use text, json, csv, prometheus or binary)");
+    return FORMAT_TEXT;
+}
+
+const char* ReportFormat::toString(Format format)
+{
+    switch (format) {
+    case FORMAT_JSON:
+        return "json";
+        break;
+    case FORMAT_CSV:
+        return "csv";
+        break;
+    case FORMAT_PROMETHEUS:
+        return "prometheus";
+        break;
+    case FORMAT_BINARY:
+        return "binary";
+        break;
+    default:
+        return "text";
+        break;
+    }
+}
+
+const char* ReportFormat::extension(Format format)
+{
+    switch (format) {
+    case FORMAT_JSON:
+        return ".json";
+        break;
+    case FORMAT_CSV:
+        return ".csv";
+        break;
+    case FORMAT_PROMETHEUS:
+        return ".prom";
+        break;
+    case FORMAT_BINARY:
+        return ".bin";
+        break;
+    default:
+        return ".txt";
+        break;
+    }
+}
+
+/**.......................................................................
+ * Write a snapshot in the requested format
+ */
+void ReportFormat::write(ProfileSnapshot& snap, ReportWriter& writer, Format format)
+{
+    switch (format) {
+    case FORMAT_JSON:
+        writeJson(snap, writer);
+        break;
+    case FORMAT_CSV:
+        writeCsv(snap, writer);
+        break;
+    case FORMAT_PROMETHEUS:
+        writePrometheus(snap, writer);
+        break;
+    case FORMAT_BINARY:
+        writeBinary(snap, writer);
+        break;
+    default:
+        snap.writeText(writer, false);
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------
+// JSON
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Write a JSON document with the totals, and an object per counter
+ * holding its label, thread id and the copied fields.  Counters with
+ * start/stop errors also have uninitiated, unterminated and open
+ * members
+ */
+void ReportFormat::writeJson(ProfileSnapshot& snap, ReportWriter& writer)
+{
+    writer.write("{\"totalcount\": ");
+    writer.writeUint(snap.totalCount_);
+
+    writer.write(",\n \"rejected\": {\"labels\": ");
+    writer.writeUint(snap.rejectedLabels_);
+    writer.write(", \"threads\": ");
+    writer.writeUint(snap.rejectedThreads_);
+    writer.write('}');
+
+    writer.write(",\n \"counters\": [");
+
+    unsigned iWarning = 0;
+
+    for(unsigned iCell=0; iCell < snap.cells_.size(); iCell++) {
+        ProfileSnapshot::Cell& cell = snap.cells_[iCell];
+
+        writer.write(iCell == 0 ? "\n  {\"label\": " : ",\n  {\"label\": ");
+        writeJsonString(writer, snap.labels_[cell.label_]);
+        writer.write(", \"thread\": \"0x");
+        writer.writeHex(snap.threadIds_[cell.thread_]);
+        writer.write('"');
+
+        for(unsigned iField=0; iField < snap.fields_.size(); iField++) {
+            writer.write(", \"");
+            writer.write(ProfileSnapshot::fieldName(snap.fields_[iField]));
+            writer.write("\": ");
+            writer.writeInt(snap.value(iCell, snap.fields_[iField]));
+        }
+
+        ProfileSnapshot::Warning* warning = warningFor(snap, iCell, iWarning);
+        if(warning) {
+            writer.write(", \"uninitiated\": ");
+            writer.writeUint(warning->errorCountUninitiated_);
+            writer.write(", \"unterminated\": ");
+            writer.writeUint(warning->errorCountUnterminated_);
+            writer.write(", \"open\": ");
+            writer.write(warning->unterminated_ ? "true" : "false");
+        }
+
+        writer.write('}');
+    }
+
+    writer.write("\n ]}\n");
+}
+
+/**.......................................................................
+ * Write a JSON string, escaping quotes, backslashes and control
+ * characters.  Other bytes are passed through, so labels are assumed
+ * to be UTF-8 (or ASCII, as atoms are)
+ */
+void ReportFormat::writeJsonString(ReportWriter& writer, const std::string& str)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    writer.write('"');
+
+    for(unsigned i=0; i < str.size(); i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        if(c == '"' || c == '\\') {
+            writer.write('\\');
+            writer.write((char)c);
+        } else if(c < 0x20) {
+            writer.write("\\u00", 4);
+            writer.write(hex[c >> 4]);
+            writer.write(hex[c & 0xf]);
+        } else {
+            writer.write((char)c);
+        }
+    }
+
+    writer.write('"');
+}
+
+//-----------------------------------------------------------------------
+// CSV
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Write a header line, then one line per counter: label, thread id,
+ * the copied fields and the start/stop error counts
+ */
+void ReportFormat::writeCsv(ProfileSnapshot& snap, ReportWriter& writer)
+{
+    writer.write("label,thread");
+    for(unsigned iField=0; iField < snap.fields_.size(); iField++) {
+        writer.write(',');
+        writer.write(ProfileSnapshot::fieldName(snap.fields_[iField]));
+    }
+    writer.write(",uninitiated,unterminated,open\n");
+
+    unsigned iWarning = 0;
+
+    for(unsigned iCell=0; iCell < snap.cells_.size(); iCell++) {
+        ProfileSnapshot::Cell& cell = snap.cells_[iCell];
+
+        writeCsvString(writer, snap.labels_[cell.label_]);
+        writer.write(",0x", 3);
+        writer.writeHex(snap.threadIds_[cell.thread_]);
+
+        for(unsigned iField=0; iField < snap.fields_.size(); iField++) {
+            writer.write(',');
+            writer.writeInt(snap.value(iCell, snap.fields_[iField]));
+        }
+
+        ProfileSnapshot::Warning* warning = warningFor(snap, iCell, iWarning);
+        if(warning) {
+            writer.write(',');
+            writer.writeUint(warning->errorCountUninitiated_);
+            writer.write(',');
+            writer.writeUint(warning->errorCountUnterminated_);
+            writer.write(warning->unterminated_ ? ",1\n" : ",0\n");
+        } else {
+            writer.write(",0,0,0\n");
+        }
+    }
+}
+
+/**.......................................................................
+ * Write a quoted CSV field, doubling any quotes in it
+ */
+void ReportFormat::writeCsvString(ReportWriter& writer, const std::string& str)
+{
+    writer.write('"');
+
+    for(unsigned i=0; i < str.size(); i++) {
+        if(str[i] == '"')
+            writer.write('"');
+        writer.write(str[i]);
+    }
+
+    writer.write('"');
+}
+
+//-----------------------------------------------------------------------
+// Prometheus
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Write the Prometheus text exposition format.  Each field is a
+ * metric family profiler_<field>_total with a series per counter,
+ * labelled by label and thread.  Off-CPU time is derived (elapsed
+ * minus CPU time) and can decrease, so it is a gauge, as are the
+ * active and peak counts of overlap counters
+ */
+void ReportFormat::writePrometheus(ProfileSnapshot& snap, ReportWriter& writer)
+{
+    writer.write("# HELP profiler_accesses_total Profiler start/stop calls\n"
+                 "# TYPE profiler_accesses_total counter\n"
+                 "profiler_accesses_total ");
+    writer.writeUint(snap.totalCount_);
+
+    writer.write("\n# HELP profiler_rejected_total Lookups redirected by the label and thread limits\n"
+                 "# TYPE profiler_rejected_total counter\n"
+                 "profiler_rejected_total{kind=\"label\"} ");
+    writer.writeUint(snap.rejectedLabels_);
+    writer.write("\nprofiler_rejected_total{kind=\"thread\"} ");
+    writer.writeUint(snap.rejectedThreads_);
+    writer.write('\n');
+
+    for(unsigned iField=0; iField < snap.fields_.size(); iField++) {
+
+        ProfileSnapshot::Field field = snap.fields_[iField];
+        bool gauge = (field == ProfileSnapshot::FIELD_OFFCPU_USEC || ProfileSnapshot::isGauge(field));
+        const char* name = ProfileSnapshot::fieldName(field);
+
+        writer.write("# HELP profiler_");
+        writer.write(name);
+        writer.write(gauge ? " " : "_total ");
+        writer.write(fieldHelp(field));
+        writer.write("\n# TYPE profiler_");
+        writer.write(name);
+        writer.write(gauge ? " gauge\n" : "_total counter\n");
+
+        for(unsigned iCell=0; iCell < snap.cells_.size(); iCell++) {
+            writer.write("profiler_");
+            writer.write(name);
+            if(!gauge)
+                writer.write("_total", 6);
+            writePrometheusLabels(snap, writer, iCell);
+            writer.write(' ');
+            writer.writeInt(snap.value(iCell, field));
+            writer.write('\n');
+        }
+    }
+
+    // Start/stop errors, only for the counters that have any
+
+    if(snap.warnings_.empty())
+        return;
+
+    writer.write("# HELP profiler_errors_total Unmatched counter starts and stops\n"
+                 "# TYPE profiler_errors_total counter\n");
+
+    unsigned iWarning = 0;
+
+    for(unsigned iCell=0; iCell < snap.cells_.size(); iCell++) {
+
+        ProfileSnapshot::Warning* warning = warningFor(snap, iCell, iWarning);
+        if(warning == 0)
+            continue;
+
+        writer.write("profiler_errors_total");
+        writePrometheusLabels(snap, writer, iCell, "uninitiated");
+        writer.write(' ');
+        writer.writeUint(warning->errorCountUninitiated_);
+
+        writer.write("\nprofiler_errors_total");
+        writePrometheusLabels(snap, writer, iCell, "unterminated");
+        writer.write(' ');
+        writer.writeUint(warning->errorCountUnterminated_);
+        writer.write('\n');
+    }
+}
+
+/**.......................................................................
+ * Write the {label="...",thread="0x..."} label set of a counter (plus
+ * type="...", if type is not NULL), escaping backslashes, quotes and
+ * newlines in the label
+ */
+void ReportFormat::writePrometheusLabels(ProfileSnapshot& snap, ReportWriter& writer, unsigned iCell,
+                                         const char* type)
+{
+    ProfileSnapshot::Cell& cell = snap.cells_[iCell];
+    const std::string& label = snap.labels_[cell.label_];
+
+    writer.write("{label=\"", 8);
+
+    for(unsigned i=0; i < label.size(); i++) {
+        if(label[i] == '\\' || label[i] == '"') {
+            writer.write('\\');
+            writer.write(label[i]);
+        } else if(label[i] == '\n') {
+            writer.write("\\n", 2);
+        } else {
+            writer.write(label[i]);
+        }
+    }
+
+    writer.write("\",thread=\"0x", 12);
+    writer.writeHex(snap.threadIds_[cell.thread_]);
+
+    if(type) {
+        writer.write("\",type=\"", 8);
+        writer.write(type);
+    }
+
+    writer.write("\"}", 2);
+}
+
+//-----------------------------------------------------------------------
+// Binary
+//-----------------------------------------------------------------------
+
+/**.......................................................................
+ * Write the binary encoding of a snapshot (see ReportFormat.h)
+ */
+void ReportFormat::writeBinary(ProfileSnapshot& snap, ReportWriter& writer)
+{
+    writer.write("PRFS", 4);
+    writeLe32(writer, REPORT_BINARY_VERSION);
+
+    writeLe64(writer, snap.totalCount_);
+    writeLe64(writer, snap.rejectedLabels_);
+    writeLe64(writer, snap.rejectedThreads_);
+
+    writeLe32(writer, snap.labels_.size());
+    for(unsigned iLabel=0; iLabel < snap.labels_.size(); iLabel++) {
+        writeLe32(writer, snap.labels_[iLabel].size());
+        writer.write(snap.labels_[iLabel]);
+    }
+
+    writeLe32(writer, snap.threadIds_.size());
+    for(unsigned iThread=0; iThread < snap.threadIds_.size(); iThread++)
+        writeLe64(writer, snap.threadIds_[iThread]);
+
+    writeLe32(writer, snap.fields_.size());
+    for(unsigned iField=0; iField < snap.fields_.size(); iField++)
+        writer.write((char)snap.fields_[iField]);
+
+    writeLe32(writer, snap.cells_.size());
+    for(unsigned iCell=0; iCell < snap.cells_.size(); iCell++) {
+        writeLe32(writer, snap.cells_[iCell].label_);
+        writeLe32(writer, snap.cells_[iCell].thread_);
+        for(unsigned iField=0; iField < snap.fields_.size(); iField++)
+            writeLe64(writer, (uint64_t)snap.value(iCell, snap.fields_[iField]));
+    }
+}
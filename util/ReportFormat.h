@@ -0,0 +1,90 @@
+// $Id: $
+
+#ifndef PROFILER_REPORTFORMAT_H
+#define PROFILER_REPORTFORMAT_H
+
+/**
+ * @file ReportFormat.h
+ *
+ * Tagged: Mon Oct 19 20:03:17 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+
+#include "export.h"
+#include "ProfileSnapshot.h"
+
+#define REPORT_BINARY_VERSION 1
+
+namespace profiler {
+
+    class ReportWriter;
+
+    //------------------------------------------------------------
+    // Formatters for a ProfileSnapshot.  Besides the original text
+    // layout, these write machine-readable output:
+    //
+    //   json        one object, with a "counters" array holding an
+    //               object per used (label, thread) counter
+    //   csv         a header line, then one line per counter
+    //   prometheus  the Prometheus text exposition format, one
+    //               series per counter and field
+    //   binary      a compact little-endian encoding of the
+    //               snapshot (below), for programs polling the
+    //               scrape endpoint
+    //
+    // The binary layout is: the magic bytes "PRFS", u32 version,
+    // u64 totalcount, u64 rejected labels, u64 rejected threads,
+    // u32 nLabels and that many (u32 length, bytes) labels, u32
+    // nThreads and that many u64 thread ids, u32 nFields and that
+    // many u8 ProfileSnapshot::Field ids, then u32 nCells and that
+    // many (u32 label, u32 thread, nFields x i64 values) cells
+    //
+    // All of them format straight into a ReportWriter
+    //------------------------------------------------------------
+
+    class ReportFormat {
+    public:
+
+        enum Format {
+            FORMAT_TEXT,
+            FORMAT_JSON,
+            FORMAT_CSV,
+            FORMAT_PROMETHEUS,
+            FORMAT_BINARY
+        };
+
+        // Convert to and from the names used in the {format, ...}
+        // command; fromString() throws if the name is not recognized
+
+        PROFILER_API static Format fromString(std::string name);
+        PROFILER_API static const char* toString(Format format);
+
+        // The file extension for a format, including the dot
+
+        PROFILER_API static const char* extension(Format format);
+
+        PROFILER_API static void write(ProfileSnapshot& snap, ReportWriter& writer, Format format);
+
+    private:
+
+        static void writeJson(ProfileSnapshot& snap, ReportWriter& writer);
+        static void writeCsv(ProfileSnapshot& snap, ReportWriter& writer);
+        static void writePrometheus(ProfileSnapshot& snap, ReportWriter& writer);
+        static void writeBinary(ProfileSnapshot& snap, ReportWriter& writer);
+
+        static void writeJsonString(ReportWriter& writer, const std::string& str);
+        static void writeCsvString(ReportWriter& writer, const std::string& str);
+        static void writePrometheusLabels(ProfileSnapshot& snap, ReportWriter& writer, unsigned iCell,
+                                          const char* type=0);
+
+    }; // End class ReportFormat
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_REPORTFORMAT_H
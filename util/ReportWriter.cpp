@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "ReportWriter.h"
+
+#include "exceptionutils.h"
+
+#include <string.h>
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.
+ */
+ReportWriter::ReportWriter(FILE* file)
+{
+    file_ = file;
+    size_ = 0;
+    buffer_.resize(REPORT_WRITER_BUFFER_SIZE);
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+ReportWriter::~ReportWriter()
+{
+    try {
+        flush();
+    } catch(...) {
+    }
+}
+
+void ReportWriter::write(const char* data, size_t size)
+{
+    if(size > buffer_.size()) {
+        flush();
+        output(data, size);
+        return;
+    }
+
+    reserve(size);
+    memcpy(&buffer_[size_], data, size);
+    size_ += size;
+}
+
+void ReportWriter::write(const std::string& str)
+{
+    write(str.data(), str.size());
+}
+
+void ReportWriter::write(const char* str)
+{
+    write(str, strlen(str));
+}
+
+void ReportWriter::write(char c)
+{
+    reserve(1);
+    buffer_[size_++] = c;
+}
+
+/**.......................................................................
+ * Write an unsigned integer in decimal.  Digits are generated two at
+ * a time from a lookup table, from the least significant end
+ */
+void ReportWriter::writeUint(uint64_t val)
+{
+    static const char digits[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    char tmp[20];
+    char* ptr = tmp + sizeof(tmp);
+
+    while(val >= 100) {
+        unsigned i = (unsigned)(val % 100) * 2;
+        val /= 100;
+        *--ptr = digits[i+1];
+        *--ptr = digits[i];
+    }
+
+    if(val >= 10) {
+        unsigned i = (unsigned)val * 2;
+        *--ptr = digits[i+1];
+        *--ptr = digits[i];
+    } else {
+        *--ptr = (char)('0' + val);
+    }
+
+    write(ptr, tmp + sizeof(tmp) - ptr);
+}
+
+void ReportWriter::writeInt(int64_t val)
+{
+    if(val < 0) {
+        write('-');
+        writeUint(0 - (uint64_t)val);
+    } else {
+        writeUint((uint64_t)val);
+    }
+}
+
+/**.......................................................................
+ * Write an unsigned integer in lower-case hex, without a prefix
+ */
+void ReportWriter::writeHex(uint64_t val)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char tmp[16];
+    char* ptr = tmp + sizeof(tmp);
+
+    do {
+        *--ptr = digits[val & 0xf];
+        val >>= 4;
+    } while(val != 0);
+
+    write(ptr, tmp + sizeof(tmp) - ptr);
+}
+
+/**.......................................................................
+ * Write a floating-point value with a fixed number of decimal
+ * places.  These are rare in reports (ratio rows only), so this just
+ * uses sprintf, with a buffer large enough for any double
+ */
+void ReportWriter::writeFixed(double val, unsigned precision)
+{
+    char tmp[512];
+
+    if(precision > 17)
+        precision = 17;
+    
+    int n = sprintf(tmp, "%.*f", (int)precision, val);
+
+    if(n > 0)
+        write(tmp, n);
+}
+
+/**.......................................................................
+ * Write out the buffered output
+ */
+void ReportWriter::flush()
+{
+    if(size_ == 0)
+        return;
+
+    // Empty the buffer first, so that it doesn't stay full if
+    // output() throws
+
+    size_t size = size_;
+    size_ = 0;
+    
+    output(&buffer_[0], size);
+}
+
+/**.......................................................................
+ * Write a chunk to the file, or append it to the in-memory output
+ */
+void ReportWriter::output(const char* data, size_t size)
+{
+    if(file_) {
+        if(fwrite(data, 1, size, file_) != size)
+            ThrowRuntimeError("Error writing report");
+    } else {
+        output_.append(data, size);
+    }
+}
+
+std::string ReportWriter::str()
+{
+    flush();
+    return output_;
+}
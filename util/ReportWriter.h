@@ -0,0 +1,90 @@
+// $Id: $
+
+#ifndef PROFILER_REPORTWRITER_H
+#define PROFILER_REPORTWRITER_H
+
+/**
+ * @file ReportWriter.h
+ *
+ * Tagged: Mon Oct 19 19:12:05 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "export.h"
+
+#define REPORT_WRITER_BUFFER_SIZE (64*1024)
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // A buffered writer for reports.  Text and numbers are formatted
+    // directly into a fixed buffer, which is written to the file in
+    // chunks as it fills, so a report of any size is streamed
+    // rather than built in memory.  Without a file, output is
+    // accumulated and returned by str().  Subclasses can send the
+    // chunks elsewhere by overriding output(), but must then call
+    // flush() in their own destructor
+    //------------------------------------------------------------
+
+    class ReportWriter {
+    public:
+
+        /**
+         * Constructor.  If file is NULL, output is kept in memory
+         */
+        PROFILER_API ReportWriter(FILE* file=0);
+
+        /**
+         * Destructor.  Flushes any buffered output
+         */
+        PROFILER_API virtual ~ReportWriter();
+
+        PROFILER_API void write(const char* data, size_t size);
+        PROFILER_API void write(const std::string& str);
+        PROFILER_API void write(const char* str);
+        PROFILER_API void write(char c);
+
+        PROFILER_API void writeUint(uint64_t val);
+        PROFILER_API void writeInt(int64_t val);
+        PROFILER_API void writeHex(uint64_t val);
+        PROFILER_API void writeFixed(double val, unsigned precision);
+
+        PROFILER_API void flush();
+
+        // The output so far, if not writing to a file
+
+        PROFILER_API std::string str();
+
+    protected:
+
+        // Write out a chunk of formatted output
+
+        PROFILER_API virtual void output(const char* data, size_t size);
+
+    private:
+
+        FILE* file_;
+        std::vector<char> buffer_;
+        size_t size_;
+        std::string output_;
+
+        inline void reserve(size_t size) {
+            if(size_ + size > buffer_.size())
+                flush();
+        }
+
+    }; // End class ReportWriter
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_REPORTWRITER_H
@@ -23,6 +23,48 @@ void RingPartition::incrementCounter(std::string name, uint64_t currentUs)
         counterMap_[name].increment(currentUs);
 }
 
+/**.......................................................................
+ * Accumulate value into a counter tag, or record it in a histogram
+ * tag
+ */
+void RingPartition::addToCounter(std::string name, uint64_t currentUs, uint64_t value)
+{
+    std::map<std::string, BufferedAtomicCounter>::iterator iter = counterMap_.find(name);
+    if(iter != counterMap_.end()) {
+        iter->second.add(currentUs, value);
+        return;
+    }
+
+    std::map<std::string, BufferedHistogram>::iterator hist = histMap_.find(name);
+    if(hist != histMap_.end())
+        hist->second.record(currentUs, value);
+}
+
+void RingPartition::addTag(std::string name, std::string kind, unsigned int bufferSize, uint64_t intervalUs)
+{
+    addTag(name, kind, bufferSize, intervalUs, 0, 0);
+}
+
+void RingPartition::addTag(std::string name, std::string kind, unsigned int bufferSize, uint64_t intervalUs,
+                           BufferedAtomicCounter::AtomicCounter* buffer0,
+                           BufferedAtomicCounter::AtomicCounter* buffer1)
+{
+    if(kind == "hist") {
+        histMap_[name].setTo(bufferSize, intervalUs);
+        return;
+    }
+        
+    // Anything unrecognized means a plain count
+    
+    BufferedAtomicCounter::Kind counterKind = BufferedAtomicCounter::KIND_COUNT;
+    BufferedAtomicCounter::kindFromString(kind, counterKind);
+    
+    if(buffer0 && buffer1)
+        counterMap_[name].setTo(bufferSize, intervalUs, counterKind, buffer0, buffer1);
+    else
+        counterMap_[name].setTo(bufferSize, intervalUs, counterKind);
+}
+
 std::string RingPartition::dumpCounters(uint64_t currentUs)
 {
     std::ostringstream os;
@@ -33,6 +75,50 @@ std::string RingPartition::dumpCounters(uint64_t currentUs)
     return os.str();
 }
 
+/**.......................................................................
+ * Append the bins of all counters, in tag order, to bins
+ */
+void RingPartition::drainCounters(uint64_t currentUs, std::vector<uint64_t>& bins)
+{
+    for(std::map<std::string, BufferedAtomicCounter>::iterator iter=counterMap_.begin(); iter != counterMap_.end(); iter++)
+        iter->second.drain(currentUs, bins);
+}
+
+void RingPartition::getTags(std::vector<std::string>& tags)
+{
+    for(std::map<std::string, BufferedAtomicCounter>::iterator iter=counterMap_.begin(); iter != counterMap_.end(); iter++)
+        tags.push_back(iter->first);
+}
+
+bool RingPartition::hasValueKinds()
+{
+    for(std::map<std::string, BufferedAtomicCounter>::iterator iter=counterMap_.begin(); iter != counterMap_.end(); iter++)
+        if(iter->second.kind() != BufferedAtomicCounter::KIND_COUNT)
+            return true;
+    return false;
+}
+
+std::string RingPartition::listKinds()
+{
+    std::ostringstream os;
+    for(std::map<std::string, BufferedAtomicCounter>::iterator iter=counterMap_.begin(); iter != counterMap_.end(); iter++)
+        os << BufferedAtomicCounter::kindToString(iter->second.kind()) << " ";
+    return os.str();
+}
+
+void RingPartition::getHistTags(std::vector<std::string>& tags)
+{
+    for(std::map<std::string, BufferedHistogram>::iterator iter=histMap_.begin(); iter != histMap_.end(); iter++)
+        tags.push_back(iter->first);
+}
+
+void RingPartition::drainHistogram(std::string name, uint64_t currentUs, std::vector<uint64_t>& buckets)
+{
+    std::map<std::string, BufferedHistogram>::iterator iter = histMap_.find(name);
+    if(iter != histMap_.end())
+        iter->second.drain(currentUs, buckets);
+}
+
 std::string RingPartition::listTags()
 {
     std::ostringstream os;
@@ -13,9 +13,11 @@
  * @author /bin/bash: username: command not found
  */
 #include "BufferedAtomicCounter.h"
+#include "BufferedHistogram.h"
 
 #include <map>
 #include <string>
+#include <vector>
 #include <inttypes.h>
 
 #include "export.h"
@@ -36,11 +38,38 @@ namespace profiler {
         PROFILER_API virtual ~RingPartition();
 
         PROFILER_API void incrementCounter(std::string name, uint64_t currentUs);
+        PROFILER_API void addToCounter(std::string name, uint64_t currentUs, uint64_t value);
+
+        // Add a tag of the given kind: "hist" for a histogram, else
+        // any of the BufferedAtomicCounter kinds
+        
+        PROFILER_API void addTag(std::string name, std::string kind, unsigned int bufferSize, uint64_t intervalUs);
+
+        // As above, keeping a counter's two buffers of bins in storage
+        // owned by the caller.  Histogram tags ignore the storage
+        
+        PROFILER_API void addTag(std::string name, std::string kind, unsigned int bufferSize, uint64_t intervalUs,
+                                 BufferedAtomicCounter::AtomicCounter* buffer0,
+                                 BufferedAtomicCounter::AtomicCounter* buffer1);
         PROFILER_API std::string dumpCounters(uint64_t currentUs);
+        PROFILER_API void drainCounters(uint64_t currentUs, std::vector<uint64_t>& bins);
         PROFILER_API std::string listTags();
+        PROFILER_API void getTags(std::vector<std::string>& tags);
+
+        // True if any tag is not a plain event count
+        
+        PROFILER_API bool hasValueKinds();
+        PROFILER_API std::string listKinds();
+
+        // Histogram tags are kept separately from counters, so that
+        // the layout of counter bins is unaffected by them
+        
+        PROFILER_API void getHistTags(std::vector<std::string>& tags);
+        PROFILER_API void drainHistogram(std::string name, uint64_t currentUs, std::vector<uint64_t>& buckets);
         
         std::string leveldbFile_;
         std::map<std::string, BufferedAtomicCounter> counterMap_;
+        std::map<std::string, BufferedHistogram> histMap_;
         
     }; // End class RingPartition
 
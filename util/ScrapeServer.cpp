@@ -0,0 +1,491 @@
+#include "stdafx.h"
+#include "ScrapeServer.h"
+#include "ReportWriter.h"
+
+#include "exceptionutils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Longest request read from a client, and the receive/send timeouts
+// for a connection
+
+#define SCRAPE_MAX_REQUEST  4096
+#define SCRAPE_RECV_TIMEOUT_S 1
+#define SCRAPE_SEND_TIMEOUT_S 5
+
+// A client closing its end early must not raise SIGPIPE in the
+// emulator
+
+#if defined(_WIN32) || defined(__APPLE__)
+#define SCRAPE_SEND_FLAGS 0
+#else
+#define SCRAPE_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+#ifndef _WIN32
+
+namespace {
+
+    //------------------------------------------------------------
+    // A ReportWriter that sends its chunks to a socket
+    //------------------------------------------------------------
+
+    class SocketWriter : public ReportWriter {
+    public:
+
+        SocketWriter(int fd) {
+            fd_ = fd;
+        }
+
+        virtual ~SocketWriter() {
+            try {
+                flush();
+            } catch(...) {
+            }
+        }
+
+    protected:
+
+        virtual void output(const char* data, size_t size) {
+            while(size > 0) {
+                ssize_t nSent = send(fd_, data, size, SCRAPE_SEND_FLAGS);
+
+                if(nSent < 0) {
+                    if(errno == EINTR)
+                        continue;
+                    ThrowRuntimeError("Error sending report: " << strerror(errno));
+                }
+
+                data += nSent;
+                size -= nSent;
+            }
+        }
+
+    private:
+
+        int fd_;
+    };
+
+    /**.......................................................................
+     * Don't leak profiler sockets into ports spawned by the emulator
+     */
+    void setCloseOnExec(int fd)
+    {
+        int flags = fcntl(fd, F_GETFD);
+        if(flags >= 0)
+            fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+}
+
+#endif
+
+/**.......................................................................
+ * Constructor.
+ */
+ScrapeServer::ScrapeServer()
+{
+    port_       = 0;
+    snapshotFn_ = 0;
+    arg_        = 0;
+    listenFd_   = -1;
+    wakeFds_[0] = -1;
+    wakeFds_[1] = -1;
+    running_    = false;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+ScrapeServer::~ScrapeServer()
+{
+    stop();
+}
+
+/**.......................................................................
+ * Start serving on the given address, stopping any previous server
+ * first
+ */
+void ScrapeServer::start(std::string address, SnapshotFn snapshotFn, void* arg)
+{
+#ifdef _WIN32
+    ThrowRuntimeError("The scrape endpoint is not supported on this platform");
+#else
+    stop();
+
+    snapshotFn_ = snapshotFn;
+    arg_        = arg;
+
+    listen(address);
+
+    if(pipe(wakeFds_) != 0) {
+        closeFds();
+        ThrowRuntimeError("Unable to create scrape wake pipe: " << strerror(errno));
+    }
+
+    setCloseOnExec(wakeFds_[0]);
+    setCloseOnExec(wakeFds_[1]);
+
+    if(pthread_create(&threadId_, NULL, &run, this) != 0) {
+        closeFds();
+        ThrowRuntimeError("Unable to create scrape thread");
+    }
+
+    address_ = address;
+    running_ = true;
+#endif
+}
+
+/**.......................................................................
+ * Stop the server: wake the thread, wait for it to finish the
+ * current connection, and close the listening socket
+ */
+void ScrapeServer::stop()
+{
+#ifndef _WIN32
+    if(!running_)
+        return;
+
+    char c = 0;
+    while(write(wakeFds_[1], &c, 1) < 0 && errno == EINTR)
+        ;
+
+    pthread_join(threadId_, NULL);
+
+    closeFds();
+
+    address_.clear();
+    port_    = 0;
+    running_ = false;
+#endif
+}
+
+bool ScrapeServer::isRunning()
+{
+    return running_;
+}
+
+std::string ScrapeServer::address()
+{
+    return address_;
+}
+
+unsigned ScrapeServer::port()
+{
+    return port_;
+}
+
+/**.......................................................................
+ * Open the listening socket for an address
+ */
+void ScrapeServer::listen(std::string address)
+{
+#ifndef _WIN32
+    if(address.find("unix:") == 0) {
+
+        std::string path = address.substr(5);
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if(path.empty() || path.size() >= sizeof(addr.sun_path))
+            ThrowRuntimeError("Invalid scrape socket path: '" << path << "'");
+
+        strcpy(addr.sun_path, path.c_str());
+
+        // Remove a socket left behind by a previous run, but nothing
+        // else
+
+        struct stat st;
+        if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path.c_str());
+
+        listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listenFd_ < 0)
+            ThrowRuntimeError("Unable to create scrape socket: " << strerror(errno));
+
+        // The socket file must be owner-only from the moment it
+        // exists: chmod() after bind() would leave it open at the
+        // default umask in between.  Linux creates the file with the
+        // mode of the socket's inode, which fchmod() sets; elsewhere,
+        // the umask is narrowed for the duration of the bind
+
+#ifdef __linux__
+        fchmod(listenFd_, 0600);
+        int ret = bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr));
+#else
+        mode_t savedMask = umask(0177);
+        int ret = bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr));
+        umask(savedMask);
+#endif
+
+        if(ret != 0) {
+            int err = errno;
+            closeFds();
+            ThrowRuntimeError("Unable to bind scrape socket " << path << ": " << strerror(err));
+        }
+
+        socketPath_ = path;
+        port_ = 0;
+
+    } else if(address.find("tcp:") == 0) {
+
+        char* end = 0;
+        unsigned long port = strtoul(address.c_str() + 4, &end, 10);
+
+        if(address.size() == 4 || *end != '\0' || port > 65535)
+            ThrowRuntimeError("Invalid scrape port: '" << address.substr(4) << "'");
+
+        // Loopback only: the endpoint has no authentication
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if(listenFd_ < 0)
+            ThrowRuntimeError("Unable to create scrape socket: " << strerror(errno));
+
+        int on = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if(bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            int err = errno;
+            closeFds();
+            ThrowRuntimeError("Unable to bind scrape port " << port << ": " << strerror(err));
+        }
+
+        socklen_t len = sizeof(addr);
+        getsockname(listenFd_, (struct sockaddr*)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+
+    } else {
+        ThrowRuntimeError("Unrecognized scrape address: '" << address << "' (use unix:/path or tcp:port)");
+    }
+
+    setCloseOnExec(listenFd_);
+
+    if(::listen(listenFd_, 16) != 0) {
+        int err = errno;
+        closeFds();
+        ThrowRuntimeError("Unable to listen on " << address << ": " << strerror(err));
+    }
+#endif
+}
+
+/**.......................................................................
+ * Close the listening socket and wake pipe, and remove the socket
+ * file
+ */
+void ScrapeServer::closeFds()
+{
+#ifndef _WIN32
+    if(listenFd_ >= 0)
+        close(listenFd_);
+
+    for(unsigned i=0; i < 2; i++)
+        if(wakeFds_[i] >= 0)
+            close(wakeFds_[i]);
+
+    if(!socketPath_.empty())
+        unlink(socketPath_.c_str());
+#endif
+
+    listenFd_   = -1;
+    wakeFds_[0] = -1;
+    wakeFds_[1] = -1;
+    socketPath_.clear();
+}
+
+#ifndef _WIN32
+
+/**.......................................................................
+ * The server thread: accept connections until woken by stop()
+ */
+void* ScrapeServer::run(void* arg)
+{
+    ScrapeServer* server = (ScrapeServer*)arg;
+
+    int maxFd = server->listenFd_ > server->wakeFds_[0] ? server->listenFd_ : server->wakeFds_[0];
+
+    while(true) {
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(server->listenFd_,  &fds);
+        FD_SET(server->wakeFds_[0], &fds);
+
+        if(select(maxFd+1, &fds, NULL, NULL, NULL) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(FD_ISSET(server->wakeFds_[0], &fds))
+            break;
+
+        if(!FD_ISSET(server->listenFd_, &fds))
+            continue;
+
+        int fd = accept(server->listenFd_, NULL, NULL);
+        if(fd < 0)
+            continue;
+
+        setCloseOnExec(fd);
+
+        try {
+            server->serve(fd);
+        } catch(...) {
+        }
+
+        close(fd);
+    }
+
+    return 0;
+}
+
+#endif
+
+/**.......................................................................
+ * Answer one connection
+ */
+void ScrapeServer::serve(int fd)
+{
+#ifndef _WIN32
+    struct timeval timeout;
+    timeout.tv_usec = 0;
+
+    timeout.tv_sec = SCRAPE_RECV_TIMEOUT_S;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    timeout.tv_sec = SCRAPE_SEND_TIMEOUT_S;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+#ifdef __APPLE__
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    //------------------------------------------------------------
+    // Read the request: an HTTP request up to the blank line after
+    // its headers, or otherwise a single line.  A client that sends
+    // nothing gets the text format once it closes its end (or the
+    // receive times out)
+    //------------------------------------------------------------
+
+    std::string request;
+    char buf[1024];
+
+    while(request.size() < SCRAPE_MAX_REQUEST) {
+
+        ssize_t nRead = recv(fd, buf, sizeof(buf), 0);
+
+        if(nRead < 0 && errno == EINTR)
+            continue;
+
+        if(nRead <= 0)
+            break;
+
+        request.append(buf, nRead);
+
+        bool http = request.compare(0, 4, "GET ") == 0;
+
+        if(http && (request.find("\r\n\r\n") != std::string::npos || request.find("\n\n") != std::string::npos))
+            break;
+
+        if(!http && request.find('\n') != std::string::npos)
+            break;
+    }
+
+    SocketWriter writer(fd);
+
+    //------------------------------------------------------------
+    // HTTP: the path selects the format
+    //------------------------------------------------------------
+
+    if(request.compare(0, 4, "GET ") == 0) {
+
+        std::string path = request.substr(4, request.find_first_of(" ?\r\n", 4) - 4);
+
+        ReportFormat::Format format = ReportFormat::FORMAT_TEXT;
+        const char* contentType = "text/plain; charset=utf-8";
+
+        if(path == "/" || path == "/text") {
+        } else if(path == "/json") {
+            format = ReportFormat::FORMAT_JSON;
+            contentType = "application/json";
+        } else if(path == "/csv") {
+            format = ReportFormat::FORMAT_CSV;
+            contentType = "text/csv";
+        } else if(path == "/metrics" || path == "/prometheus") {
+            format = ReportFormat::FORMAT_PROMETHEUS;
+            contentType = "text/plain; version=0.0.4";
+        } else if(path == "/binary") {
+            format = ReportFormat::FORMAT_BINARY;
+            contentType = "application/octet-stream";
+        } else {
+            writer.write("HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nNot found\n");
+            writer.flush();
+            return;
+        }
+
+        ProfileSnapshot snap;
+        snapshotFn_(snap, arg_);
+
+        writer.write("HTTP/1.0 200 OK\r\nContent-Type: ");
+        writer.write(contentType);
+        writer.write("\r\nConnection: close\r\n\r\n");
+
+        ReportFormat::write(snap, writer, format);
+        writer.flush();
+
+        return;
+    }
+
+    //------------------------------------------------------------
+    // Otherwise, the first line names the format
+    //------------------------------------------------------------
+
+    std::string name = request.substr(0, request.find_first_of("\r\n"));
+    if(name.empty())
+        name = "text";
+
+    ReportFormat::Format format;
+
+    try {
+        format = ReportFormat::fromString(name);
+    } catch(std::runtime_error& err) {
+        writer.write("error: ");
+        writer.write(err.what());
+        writer.write('\n');
+        writer.flush();
+        return;
+    }
+
+    ProfileSnapshot snap;
+    snapshotFn_(snap, arg_);
+
+    ReportFormat::write(snap, writer, format);
+    writer.flush();
+#endif
+}
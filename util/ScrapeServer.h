@@ -0,0 +1,102 @@
+// $Id: $
+
+#ifndef PROFILER_SCRAPESERVER_H
+#define PROFILER_SCRAPESERVER_H
+
+/**
+ * @file ScrapeServer.h
+ *
+ * Tagged: Mon Oct 19 20:47:52 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+
+#include "export.h"
+#include "ProfileSnapshot.h"
+#include "ReportFormat.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Serves profiler snapshots on a Unix domain socket or a
+    // loopback TCP port, from a thread of its own.  Addresses are
+    // "unix:/path/to/socket" or "tcp:port" (port 0 picks a free
+    // port; see port()).
+    //
+    // A connection is answered in one of two ways, and then closed:
+    //
+    //   - an HTTP GET of /, /text, /json, /csv, /metrics (Prometheus)
+    //     or /binary returns the snapshot in that format
+    //
+    //   - otherwise, the first line sent is taken as a format name
+    //     (text, json, csv, prometheus or binary; an empty line means
+    //     text), and the snapshot is returned with no header
+    //
+    // Each request takes a fresh snapshot through the callback,
+    // which is the only point at which the server touches profiler
+    // state.  Connections are served one at a time, with send and
+    // receive timeouts so a stalled client can't block the thread
+    //------------------------------------------------------------
+
+    class ScrapeServer {
+    public:
+
+        typedef void (*SnapshotFn)(ProfileSnapshot& snap, void* arg);
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API ScrapeServer();
+
+        /**
+         * Destructor.  Stops the server if it is running
+         */
+        PROFILER_API virtual ~ScrapeServer();
+
+        PROFILER_API void start(std::string address, SnapshotFn snapshotFn, void* arg);
+        PROFILER_API void stop();
+        PROFILER_API bool isRunning();
+
+        PROFILER_API std::string address();
+
+        // The bound TCP port, or 0 for a Unix socket
+
+        PROFILER_API unsigned port();
+
+    private:
+
+        std::string address_;
+        std::string socketPath_;
+        unsigned port_;
+
+        SnapshotFn snapshotFn_;
+        void* arg_;
+
+        int listenFd_;
+        int wakeFds_[2];
+        bool running_;
+
+#ifndef _WIN32
+        pthread_t threadId_;
+
+        static void* run(void* arg);
+#endif
+
+        void listen(std::string address);
+        void serve(int fd);
+        void closeFds();
+
+    }; // End class ScrapeServer
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_SCRAPESERVER_H
@@ -0,0 +1,266 @@
+#include "stdafx.h"
+#include "ShmExport.h"
+#include "exceptionutils.h"
+
+#include <string.h>
+
+#ifdef __APPLE__
+#include <libkern/OSAtomic.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+// Keep the names table, and each region, cache-line aligned
+
+#define SHM_MAX_NAMES 4096
+#define SHM_ALIGN(n) (((n) + 63) & ~((uint64_t)63))
+
+/**.......................................................................
+ * Constructor.
+ */
+ShmExport::ShmExport()
+{
+    size_     = 0;
+    base_     = 0;
+    header_   = 0;
+    counters_ = 0;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+ShmExport::~ShmExport()
+{
+    close();
+}
+
+bool ShmExport::isOpen()
+{
+    return base_ != 0;
+}
+
+/**.......................................................................
+ * Create (or re-create) the named segment and initialize its header
+ */
+void ShmExport::open(std::string name, unsigned maxCounters, uint64_t maxAtomicValues)
+{
+#ifdef _WIN32
+    ThrowRuntimeError("Shared-memory export is not supported on this platform");
+#else
+    close();
+
+    if(name.empty() || name[0] != '/')
+        name = "/" + name;
+
+    uint64_t countersOffset = SHM_ALIGN(sizeof(ShmHeader));
+    uint64_t namesOffset    = SHM_ALIGN(countersOffset + (uint64_t)maxCounters * sizeof(ShmCounter));
+    uint64_t atomicOffset   = SHM_ALIGN(namesOffset + (uint64_t)SHM_MAX_NAMES * PROFILER_SHM_NAME_LEN);
+    uint64_t size           = atomicOffset + maxAtomicValues * sizeof(uint64_t);
+
+    int fd = shm_open(name.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0600);
+
+    if(fd < 0)
+        ThrowSysError("Unable to create shared-memory segment " << name);
+
+    if(ftruncate(fd, size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        ThrowSysError("Unable to size shared-memory segment " << name << " to " << size << " bytes");
+    }
+
+    void* base = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(base == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        ThrowSysError("Unable to map shared-memory segment " << name);
+    }
+
+    name_     = name;
+    size_     = size;
+    base_     = (unsigned char*)base;
+    header_   = (ShmHeader*)base_;
+    counters_ = (ShmCounter*)(base_ + countersOffset);
+
+    // The segment is zero-filled by ftruncate(), so only the
+    // non-zero fields need setting.  The magic number is written
+    // last, so that a reader never sees a partially-initialized
+    // header as valid
+    
+    header_->version_         = PROFILER_SHM_VERSION;
+    header_->size_            = size;
+    header_->pid_             = getpid();
+    header_->maxCounters_     = maxCounters;
+    header_->countersOffset_  = countersOffset;
+    header_->maxNames_        = SHM_MAX_NAMES;
+    header_->namesOffset_     = namesOffset;
+    header_->maxAtomicValues_ = maxAtomicValues;
+    header_->atomicOffset_    = atomicOffset;
+
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+    header_->magic_ = PROFILER_SHM_MAGIC;
+#endif
+}
+
+/**.......................................................................
+ * Unmap and remove the segment
+ */
+void ShmExport::close()
+{
+#ifndef _WIN32
+    if(base_) {
+        munmap(base_, size_);
+        shm_unlink(name_.c_str());
+    }
+#endif
+    size_     = 0;
+    base_     = 0;
+    header_   = 0;
+    counters_ = 0;
+}
+
+void ShmExport::beginWrite(volatile uint32_t* seq)
+{
+    *seq = *seq + 1;
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+void ShmExport::endWrite(volatile uint32_t* seq)
+{
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+    *seq = *seq + 1;
+}
+
+void ShmExport::copyName(char* dest, const std::string& src)
+{
+    size_t len = src.size() < PROFILER_SHM_NAME_LEN-1 ? src.size() : PROFILER_SHM_NAME_LEN-1;
+    memcpy(dest, src.c_str(), len);
+    dest[len] = '\0';
+}
+
+int ShmExport::addCounter(const std::string& label, uint64_t threadId)
+{
+    if(!base_ || header_->nCounters_ >= header_->maxCounters_)
+        return -1;
+
+    int index = header_->nCounters_;
+    ShmCounter& counter = counters_[index];
+
+    copyName(counter.label_, label);
+    counter.threadId_ = threadId;
+
+#ifdef __APPLE__
+    OSMemoryBarrier();
+#elif defined _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+    header_->nCounters_ = index + 1;
+    
+    return index;
+}
+
+void ShmExport::publishCounter(int index, int64_t counts, int64_t usec, int64_t cpuUsec,
+                               uint64_t allocs, uint64_t allocBytes,
+                               unsigned errorCountUninitiated, unsigned errorCountUnterminated)
+{
+    if(!base_ || index < 0 || (unsigned)index >= header_->nCounters_)
+        return;
+
+    ShmCounter& counter = counters_[index];
+
+    beginWrite(&counter.seq_);
+    
+    counter.counts_                 = counts;
+    counter.usec_                   = usec;
+    counter.cpuUsec_                = cpuUsec;
+    counter.allocs_                 = allocs;
+    counter.allocBytes_             = allocBytes;
+    counter.errorCountUninitiated_  = errorCountUninitiated;
+    counter.errorCountUnterminated_ = errorCountUnterminated;
+
+    endWrite(&counter.seq_);
+}
+
+void ShmExport::publishAtomic(uint64_t timestampUs, uint64_t intervalUs,
+                              std::vector<std::string>& partitions,
+                              std::vector<std::string>& tags,
+                              unsigned nBins, std::vector<uint64_t>& values)
+{
+    if(!base_)
+        return;
+
+    char*     names = (char*)(base_ + header_->namesOffset_);
+    uint64_t* dest  = (uint64_t*)(base_ + header_->atomicOffset_);
+
+    // Truncate to whole partitions if we can't fit everything
+    
+    uint64_t partSize = (uint64_t)tags.size() * nBins;
+    uint64_t nPart    = partitions.size();
+
+    if(tags.size() > header_->maxNames_)
+        partSize = 0;
+    
+    if(partSize == 0)
+        nPart = 0;
+    else if(nPart + tags.size() > header_->maxNames_)
+        nPart = tags.size() < header_->maxNames_ ? header_->maxNames_ - tags.size() : 0;
+
+    if(nPart * partSize > header_->maxAtomicValues_)
+        nPart = header_->maxAtomicValues_ / partSize;
+
+    if(values.size() < nPart * partSize)
+        nPart = partSize > 0 ? values.size() / partSize : 0;
+    
+    beginWrite(&header_->atomicSeq_);
+
+    header_->timestampUs_ = timestampUs;
+    header_->intervalUs_  = intervalUs;
+    header_->nPartitions_ = nPart;
+    header_->nTags_       = partSize > 0 ? tags.size() : 0;
+    header_->nBins_       = nBins;
+    header_->truncated_   = (nPart < partitions.size());
+
+    for(unsigned i=0; i < nPart; i++)
+        copyName(names + i * PROFILER_SHM_NAME_LEN, partitions[i]);
+
+    for(unsigned i=0; i < header_->nTags_; i++)
+        copyName(names + (nPart + i) * PROFILER_SHM_NAME_LEN, tags[i]);
+
+    if(nPart * partSize > 0)
+        memcpy(dest, &values[0], nPart * partSize * sizeof(uint64_t));
+    
+    endWrite(&header_->atomicSeq_);
+}
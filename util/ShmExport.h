@@ -0,0 +1,87 @@
+// $Id: $
+
+#ifndef PROFILER_SHMEXPORT_H
+#define PROFILER_SHMEXPORT_H
+
+/**
+ * @file ShmExport.h
+ * 
+ * Tagged: Mon Oct 19 13:52:44 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "ShmLayout.h"
+#include "export.h"
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Publishes profiler counters into a named POSIX shared-memory
+    // segment, with the layout described in ShmLayout.h.  Once the
+    // segment is open, publishing is plain memory writes.
+    //
+    // This class does no locking of its own: the caller must ensure
+    // that publishCounter() is only called by one thread at a time,
+    // and likewise for publishAtomic()
+    //------------------------------------------------------------
+
+    class ShmExport {
+    public:
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API ShmExport();
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~ShmExport();
+
+        PROFILER_API void open(std::string name, unsigned maxCounters, uint64_t maxAtomicValues);
+        PROFILER_API void close();
+        PROFILER_API bool isOpen();
+
+        // Allocate a new counter slot, returning -1 if the table is
+        // full
+        
+        PROFILER_API int addCounter(const std::string& label, uint64_t threadId);
+
+        PROFILER_API void publishCounter(int index, int64_t counts, int64_t usec, int64_t cpuUsec,
+                                         uint64_t allocs, uint64_t allocBytes,
+                                         unsigned errorCountUninitiated, unsigned errorCountUnterminated);
+
+        // Publish one major interval of atomic counters.  values is
+        // ordered by partition, then tag, then bin, and every
+        // partition must have tags.size() * nBins values
+        
+        PROFILER_API void publishAtomic(uint64_t timestampUs, uint64_t intervalUs,
+                                        std::vector<std::string>& partitions,
+                                        std::vector<std::string>& tags,
+                                        unsigned nBins, std::vector<uint64_t>& values);
+
+    private:
+
+        void beginWrite(volatile uint32_t* seq);
+        void endWrite(volatile uint32_t* seq);
+        void copyName(char* dest, const std::string& src);
+        
+        std::string name_;
+        uint64_t size_;
+        unsigned char* base_;
+        ShmHeader* header_;
+        ShmCounter* counters_;
+        
+    }; // End class ShmExport
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_SHMEXPORT_H
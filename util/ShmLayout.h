@@ -0,0 +1,93 @@
+// $Id: $
+
+#ifndef PROFILER_SHMLAYOUT_H
+#define PROFILER_SHMLAYOUT_H
+
+/**
+ * @file ShmLayout.h
+ * 
+ * Tagged: Mon Oct 19 13:40:02 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <inttypes.h>
+
+//------------------------------------------------------------
+// Layout of the shared-memory segment exported by ShmExport, and read
+// by out-of-process tools (see tools/profshm.cpp).
+//
+// The segment consists of:
+//
+//   ShmHeader
+//   ShmCounter[maxCounters_]              at countersOffset_
+//   char[maxNames_][PROFILER_SHM_NAME_LEN] at namesOffset_
+//   uint64_t[maxAtomicValues_]            at atomicOffset_
+//
+// All offsets are from the start of the segment.  There is a single
+// writer (the profiler); readers never write.
+//
+// Each ShmCounter, and the atomic counter section as a whole, is
+// protected by a sequence lock: the writer increments seq_ to an odd
+// value before modifying the data, and back to an even value
+// afterwards.  A reader copies the data, and retries if seq_ was odd
+// or changed during the copy.
+//
+// Any change to these structs must increment PROFILER_SHM_VERSION
+//------------------------------------------------------------
+
+#define PROFILER_SHM_MAGIC    0x464f5250 // "PROF"
+#define PROFILER_SHM_VERSION  1
+#define PROFILER_SHM_NAME_LEN 64
+
+namespace profiler {
+
+    struct ShmHeader {
+        uint32_t magic_;
+        uint32_t version_;
+        uint64_t size_;
+        uint64_t pid_;
+
+        // Ordinary counters.  nCounters_ only ever increases, and is
+        // incremented after the new slot has been initialized
+
+        uint32_t maxCounters_;
+        volatile uint32_t nCounters_;
+        uint64_t countersOffset_;
+
+        // The most recently completed major interval of
+        // time-resolved atomic counters.  Partition names are stored
+        // first in the names table, followed by tag names.  Values
+        // are ordered by partition, then tag, then bin
+
+        volatile uint32_t atomicSeq_;
+        uint32_t maxNames_;
+        uint32_t nPartitions_;
+        uint32_t nTags_;
+        uint32_t nBins_;
+        uint32_t truncated_;
+        uint64_t namesOffset_;
+        uint64_t maxAtomicValues_;
+        uint64_t atomicOffset_;
+        uint64_t timestampUs_;
+        uint64_t intervalUs_;
+    };
+
+    struct ShmCounter {
+        volatile uint32_t seq_;
+        uint32_t pad_;
+        char label_[PROFILER_SHM_NAME_LEN];
+        uint64_t threadId_;
+        int64_t counts_;
+        int64_t usec_;
+        int64_t cpuUsec_;
+        uint64_t allocs_;
+        uint64_t allocBytes_;
+        uint32_t errorCountUninitiated_;
+        uint32_t errorCountUnterminated_;
+    };
+
+} // End namespace profiler
+
+#endif // End #ifndef PROFILER_SHMLAYOUT_H
@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "SpanPool.h"
+
+#include "exceptionutils.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.  All slots start out free, and on the stack in order
+ */
+SpanPool::SpanPool(unsigned capacity)
+{
+    if(capacity == 0)
+        ThrowRuntimeError("Span pool capacity must be greater than 0");
+
+    slots_.resize(capacity);
+
+    for(unsigned iSlot=0; iSlot < capacity; iSlot++) {
+        slots_[iSlot].gen_       = 0;
+        slots_[iSlot].next_      = (iSlot+1 < capacity) ? iSlot+2 : 0;
+        slots_[iSlot].label_     = 0;
+        slots_[iSlot].epoch_     = 0;
+        slots_[iSlot].count_     = 0;
+        slots_[iSlot].startUsec_ = 0;
+    }
+
+    head_ = 1;
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+SpanPool::~SpanPool() {}
+
+unsigned SpanPool::capacity()
+{
+    return slots_.size();
+}
+
+/**.......................................................................
+ * Claim a free slot
+ */
+uint64_t SpanPool::acquire(unsigned label, unsigned epoch, int64_t startUsec, unsigned count)
+{
+    uint32_t iSlot;
+    if(!pop(iSlot))
+        return 0;
+
+    Slot& slot = slots_[iSlot];
+
+    slot.label_     = label;
+    slot.epoch_     = epoch;
+    slot.count_     = count;
+    slot.startUsec_ = startUsec;
+
+    // Publish the contents with the generation.  Only this thread
+    // owns the slot now, so the increment can't race
+
+    uint32_t gen = slot.gen_ + 1;
+    cas32(&slot.gen_, gen - 1, gen);
+
+    return ((uint64_t)gen << 32) | iSlot;
+}
+
+/**.......................................................................
+ * Release a span's slot.  Only one caller can win the
+ * compare-and-swap for a given generation, so a span is ended at most
+ * once
+ */
+bool SpanPool::release(uint64_t token, unsigned& label, unsigned& epoch, int64_t& startUsec, unsigned& count)
+{
+    uint32_t gen   = (uint32_t)(token >> 32);
+    uint32_t iSlot = (uint32_t)(token & 0xFFFFFFFF);
+
+    if(iSlot >= slots_.size() || (gen & 1) == 0)
+        return false;
+
+    Slot& slot = slots_[iSlot];
+
+    label     = slot.label_;
+    epoch     = slot.epoch_;
+    count     = slot.count_;
+    startUsec = slot.startUsec_;
+
+    if(!cas32(&slot.gen_, gen, gen + 1))
+        return false;
+
+    push(iSlot);
+
+    return true;
+}
+
+unsigned SpanPool::nOpen()
+{
+    unsigned n = 0;
+    for(unsigned iSlot=0; iSlot < slots_.size(); iSlot++)
+        if(slots_[iSlot].gen_ & 1)
+            n++;
+    return n;
+}
+
+/**.......................................................................
+ * Pop the first free slot off the stack
+ */
+bool SpanPool::pop(uint32_t& iSlot)
+{
+    uint64_t head;
+    uint64_t newHead;
+
+    do {
+        head = head_;
+
+        uint32_t first = (uint32_t)(head & 0xFFFFFFFF);
+        if(first == 0)
+            return false;
+
+        iSlot   = first - 1;
+        newHead = (((head >> 32) + 1) << 32) | slots_[iSlot].next_;
+
+    } while(!cas64(&head_, head, newHead));
+
+    return true;
+}
+
+/**.......................................................................
+ * Push a slot back onto the stack
+ */
+void SpanPool::push(uint32_t iSlot)
+{
+    uint64_t head;
+    uint64_t newHead;
+
+    do {
+        head = head_;
+        slots_[iSlot].next_ = (uint32_t)(head & 0xFFFFFFFF);
+        newHead = (((head >> 32) + 1) << 32) | (iSlot + 1);
+    } while(!cas64(&head_, head, newHead));
+}
+
+bool SpanPool::cas32(volatile uint32_t* ptr, uint32_t oldVal, uint32_t newVal)
+{
+#ifdef __APPLE__
+    return OSAtomicCompareAndSwap32Barrier((int32_t)oldVal, (int32_t)newVal, (volatile int32_t*)ptr);
+#elif defined _WIN32
+    return InterlockedCompareExchange((volatile LONG*)ptr, (LONG)newVal, (LONG)oldVal) == (LONG)oldVal;
+#else
+    return __sync_bool_compare_and_swap(ptr, oldVal, newVal);
+#endif
+}
+
+bool SpanPool::cas64(volatile uint64_t* ptr, uint64_t oldVal, uint64_t newVal)
+{
+#ifdef __APPLE__
+    return OSAtomicCompareAndSwap64Barrier((int64_t)oldVal, (int64_t)newVal, (volatile int64_t*)ptr);
+#elif defined _WIN32
+    return InterlockedCompareExchange64((volatile LONGLONG*)ptr, (LONGLONG)newVal, (LONGLONG)oldVal) == (LONGLONG)oldVal;
+#else
+    return __sync_bool_compare_and_swap(ptr, oldVal, newVal);
+#endif
+}
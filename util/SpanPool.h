@@ -0,0 +1,105 @@
+// $Id: $
+
+#ifndef PROFILER_SPANPOOL_H
+#define PROFILER_SPANPOOL_H
+
+/**
+ * @file SpanPool.h
+ *
+ * Tagged: Mon Oct 19 23:40:12 PDT 2026
+ *
+ * @version: $Revision: $, $Date: $
+ *
+ * @author /bin/bash: username: command not found
+ */
+#ifdef __APPLE__
+#include <libkern/OSAtomic.h>
+#endif
+
+#include <vector>
+#include <inttypes.h>
+
+#include "export.h"
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // A fixed pool of open async spans, each begun on one thread and
+    // ended on any thread.
+    //
+    // acquire() returns a token of (generation << 32 | slot).  A
+    // slot's generation is incremented when it is acquired and again
+    // when it is released, so it is odd while in use, and a token is
+    // only honoured by release() while the generation still matches:
+    // a token ended twice, or ended after its slot was reused, is
+    // rejected rather than corrupting another span.  Tokens are never
+    // 0, so 0 can mean "no span".
+    //
+    // Free slots are kept on a lock-free (Treiber) stack, whose head
+    // carries a tag that changes with every update, so that a slot
+    // popped and pushed back between a thread's read of the head and
+    // its compare-and-swap can't be mistaken for an unchanged stack
+    //------------------------------------------------------------
+
+    class SpanPool {
+    public:
+
+        /**
+         * Constructor.
+         */
+        PROFILER_API SpanPool(unsigned capacity);
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~SpanPool();
+
+        // Claim a slot for a span, returning its token, or 0 if
+        // every slot is in use.  epoch is the profiler epoch the span
+        // began in, so that one ended after a reset can be credited
+        // to the epoch it belongs to
+
+        PROFILER_API uint64_t acquire(unsigned label, unsigned epoch, int64_t startUsec, unsigned count);
+
+        // Return a span's slot, and what was stored when it was
+        // acquired.  Returns false for a stale or invalid token
+
+        PROFILER_API bool release(uint64_t token, unsigned& label, unsigned& epoch, int64_t& startUsec, unsigned& count);
+
+        PROFILER_API unsigned capacity();
+
+        // The number of spans currently open (a scan, for display)
+
+        PROFILER_API unsigned nOpen();
+
+    private:
+
+        struct Slot {
+            volatile uint32_t gen_;
+            volatile uint32_t next_;
+            unsigned label_;
+            unsigned epoch_;
+            unsigned count_;
+            int64_t startUsec_;
+        };
+
+        std::vector<Slot> slots_;
+
+        // (tag << 32) | (index of the first free slot + 1), or a
+        // low word of 0 if none are free
+
+        volatile uint64_t head_;
+
+        bool pop(uint32_t& iSlot);
+        void push(uint32_t iSlot);
+
+        static bool cas32(volatile uint32_t* ptr, uint32_t oldVal, uint32_t newVal);
+        static bool cas64(volatile uint64_t* ptr, uint64_t oldVal, uint64_t newVal);
+
+    }; // End class SpanPool
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_SPANPOOL_H
@@ -0,0 +1,61 @@
+#include "stdafx.h"
+#include "SparseFormat.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PROFILER_HAVE_SSE2
+#endif
+
+using namespace std;
+
+using namespace profiler;
+
+size_t SparseFormat::nextNonZero(const uint64_t* vals, size_t start, size_t n)
+{
+    size_t i = start;
+
+#ifdef PROFILER_HAVE_SSE2
+
+    //------------------------------------------------------------
+    // OR four values together and compare against zero; the
+    // movemask is 0xffff only if all 16 bytes compared equal
+    //------------------------------------------------------------
+    
+    __m128i zero = _mm_setzero_si128();
+    
+    for(; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(vals + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(vals + i + 2));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), zero)) != 0xffff)
+            break;
+    }
+#endif
+
+    while(i < n && vals[i] == 0)
+        i++;
+
+    return i;
+}
+
+size_t SparseFormat::nextZero(const uint64_t* vals, size_t start, size_t n)
+{
+    size_t i = start;
+    while(i < n && vals[i] != 0)
+        i++;
+    return i;
+}
+
+void SparseFormat::write(std::ostream& os, const uint64_t* vals, size_t n)
+{
+    size_t end = 0;
+    
+    for(size_t start = nextNonZero(vals, 0, n); start < n; start = nextNonZero(vals, end, n)) {
+
+        os << (start - end) << ":";
+
+        end = nextZero(vals, start, n);
+        
+        for(size_t i=start; i < end; i++)
+            os << vals[i] << (i+1 < end ? "," : " ");
+    }
+}
@@ -0,0 +1,58 @@
+// $Id: $
+
+#ifndef PROFILER_SPARSEFORMAT_H
+#define PROFILER_SPARSEFORMAT_H
+
+/**
+ * @file SparseFormat.h
+ * 
+ * Tagged: Mon Oct 19 18:31:05 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <ostream>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "export.h"
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Run-length encoding of mostly-zero count vectors, as written to
+    // the atomic counter file in sparse mode.  Only runs of non-zero
+    // values are written, each prefixed by the number of zeros
+    // skipped since the end of the previous run:
+    //
+    //   gap:v,v,v gap:v ...
+    //
+    // so that {0,0,5,6,0,0,0,1} is written as "2:5,6 3:1"
+    //------------------------------------------------------------
+
+    class SparseFormat {
+    public:
+
+        // Return the index of the first non-zero value at or after
+        // start (n if none).  Uses SSE2 where available to skip
+        // zeros four values at a time
+        
+        PROFILER_API static size_t nextNonZero(const uint64_t* vals, size_t start, size_t n);
+
+        // Return the index of the first zero value at or after start
+        // (n if none)
+        
+        PROFILER_API static size_t nextZero(const uint64_t* vals, size_t start, size_t n);
+
+        // Write the runs of non-zero values in vals[0..n)
+        
+        PROFILER_API static void write(std::ostream& os, const uint64_t* vals, size_t n);
+        
+    }; // End class SparseFormat
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_SPARSEFORMAT_H
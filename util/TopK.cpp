@@ -0,0 +1,114 @@
+#include "stdafx.h"
+#include "TopK.h"
+
+#include <algorithm>
+
+using namespace std;
+
+using namespace profiler;
+
+/**.......................................................................
+ * Constructor.
+ */
+TopK::TopK(unsigned capacity)
+{
+    setCapacity(capacity);
+}
+
+/**.......................................................................
+ * Destructor.
+ */
+TopK::~TopK() {}
+
+/**.......................................................................
+ * Set the number of keys to track.  This discards any current entries
+ */
+void TopK::setCapacity(unsigned capacity)
+{
+    capacity_ = capacity;
+    entries_.clear();
+    entries_.reserve(capacity);
+}
+
+unsigned TopK::capacity()
+{
+    return capacity_;
+}
+
+void TopK::clear()
+{
+    entries_.clear();
+}
+
+/**.......................................................................
+ * Return the index of the lightest entry (entries_ must be non-empty)
+ */
+unsigned TopK::minIndex()
+{
+    unsigned iMin = 0;
+    for(unsigned i=1; i < entries_.size(); i++) {
+        if(entries_[i].count_ < entries_[iMin].count_)
+            iMin = i;
+    }
+    return iMin;
+}
+
+/**.......................................................................
+ * Space-saving update: add weight to key's count, evicting the
+ * lightest entry if key is not tracked and we are full
+ */
+void TopK::add(uint64_t key, uint64_t weight)
+{
+    if(capacity_ == 0 || weight == 0)
+        return;
+    
+    for(unsigned i=0; i < entries_.size(); i++) {
+        if(entries_[i].key_ == key) {
+            entries_[i].count_ += weight;
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.key_ = key;
+    
+    if(entries_.size() < capacity_) {
+        entry.count_ = weight;
+        entry.error_ = 0;
+        entries_.push_back(entry);
+    } else {
+        Entry& min = entries_[minIndex()];
+        entry.count_ = min.count_ + weight;
+        entry.error_ = min.count_;
+        min = entry;
+    }
+}
+
+/**.......................................................................
+ * Exact selection: keep key if count is among the capacity_ largest
+ * seen.  Each key must be offered at most once between clear()s
+ */
+void TopK::offer(uint64_t key, uint64_t count)
+{
+    if(capacity_ == 0)
+        return;
+
+    Entry entry;
+    entry.key_   = key;
+    entry.count_ = count;
+    entry.error_ = 0;
+    
+    if(entries_.size() < capacity_) {
+        entries_.push_back(entry);
+    } else {
+        unsigned iMin = minIndex();
+        if(count > entries_[iMin].count_)
+            entries_[iMin] = entry;
+    }
+}
+
+void TopK::getSorted(std::vector<Entry>& entries)
+{
+    entries = entries_;
+    std::stable_sort(entries.begin(), entries.end());
+}
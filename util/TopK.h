@@ -0,0 +1,88 @@
+// $Id: $
+
+#ifndef PROFILER_TOPK_H
+#define PROFILER_TOPK_H
+
+/**
+ * @file TopK.h
+ * 
+ * Tagged: Mon Oct 19 17:02:36 PDT 2026
+ * 
+ * @version: $Revision: $, $Date: $
+ * 
+ * @author /bin/bash: username: command not found
+ */
+#include <vector>
+#include <inttypes.h>
+
+#include "export.h"
+
+namespace profiler {
+
+    //------------------------------------------------------------
+    // Fixed-memory tracking of the K heaviest keys in a stream.
+    //
+    // add() implements the (weighted) space-saving algorithm: a key
+    // not already tracked replaces the lightest entry, inheriting its
+    // count as an error bound, so any key whose true total exceeds
+    // 1/K of the stream total is guaranteed to be present, and counts
+    // overestimate by at most error_.
+    //
+    // offer() is for streams in which each key appears at most once
+    // (e.g. one total per partition per interval), for which the K
+    // largest can be kept exactly.
+    //
+    // Entries are kept unsorted and searched linearly, which is
+    // cheaper than a heap + index for the small K this is used with
+    //------------------------------------------------------------
+
+    class TopK {
+    public:
+
+        struct Entry {
+            uint64_t key_;
+            uint64_t count_;
+            uint64_t error_;
+
+            // Sort in descending order of count
+            
+            bool operator<(const Entry& entry) const {
+                return count_ > entry.count_;
+            }
+        };
+        
+        /**
+         * Constructor.
+         */
+        PROFILER_API TopK(unsigned capacity=0);
+
+        /**
+         * Destructor.
+         */
+        PROFILER_API virtual ~TopK();
+
+        PROFILER_API void setCapacity(unsigned capacity);
+        PROFILER_API unsigned capacity();
+        PROFILER_API void clear();
+        
+        PROFILER_API void add(uint64_t key, uint64_t weight);
+        PROFILER_API void offer(uint64_t key, uint64_t count);
+
+        // Return the tracked entries, heaviest first
+        
+        PROFILER_API void getSorted(std::vector<Entry>& entries);
+
+    private:
+
+        unsigned capacity_;
+        std::vector<Entry> entries_;
+
+        unsigned minIndex();
+        
+    }; // End class TopK
+
+} // End namespace profiler
+
+
+
+#endif // End #ifndef PROFILER_TOPK_H